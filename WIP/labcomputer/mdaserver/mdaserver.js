@@ -104,6 +104,11 @@ http.createServer(function (REQ, RESP) {
 					send_text_response(txt);
 					return;
 				}
+				if (query.output=='binary') {
+					//saves the client a second round trip
+					serve_file(mdachunk_data_path+"/"+txt,RESP);
+					return;
+				}
 				var obj={
 					path:txt
 				};
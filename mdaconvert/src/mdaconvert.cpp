@@ -6,6 +6,8 @@
 
 #include "mdaconvert.h"
 #include "mdaio.h"
+#include "chunkedmda.h"
+#include "firingsstore.h"
 
 #include <QFile>
 #include <QFileInfo>
@@ -30,15 +32,28 @@ struct working_data {
     FILE* inf = 0;
     FILE* outf = 0;
     void* buf = 0;
+
+    //for chunked (compressed) mda input or output
+    bool use_chunked_in = false;
+    bool use_chunked_out = false;
+    ChunkedMdaReader chunked_in;
+    ChunkedMdaWriter chunked_out;
+    long position = 0;
 };
 
 bool copy_data(working_data& D, long N);
+bool copy_data_chunked(working_data& D, long N);
+bool convert_firings(const mdaconvert_opts& opts);
 int get_num_bytes_per_entry(int dtype);
 
 bool mdaconvert(const mdaconvert_opts& opts)
 {
     QList<long> opts_dims = opts.dims;
 
+    if ((opts.output_format == "firings") || (FiringsStore::isFiringsStore(opts.input_path))) {
+        return convert_firings(opts);
+    }
+
     //default inputs in case input format is mda or not
     if (opts.input_format == "mda") {
         if (!opts.input_dtype.isEmpty()) {
@@ -87,7 +102,15 @@ bool mdaconvert(const mdaconvert_opts& opts)
         return false;
     }
     // read header for format = mda
-    if (opts.input_format == "mda") {
+    if ((opts.input_format == "mda") && (ChunkedMdaReader::isChunkedMda(opts.input_path))) {
+        if (!D.chunked_in.open(opts.input_path)) {
+            qWarning() << "Error opening chunked mda input";
+            return false;
+        }
+        D.HH_in = D.chunked_in.header();
+        D.use_chunked_in = true;
+    }
+    else if (opts.input_format == "mda") {
         if (!mda_read_header(&D.HH_in, D.inf)) {
             qWarning() << "Error reading input header";
             return false;
@@ -144,8 +167,17 @@ bool mdaconvert(const mdaconvert_opts& opts)
     }
 
     //open output file, write header if mda
-    D.outf = fopen(opts.output_path.toLatin1().data(), "wb");
-    if (!D.outf) {
+    if (opts.output_format == "chunked") {
+        QList<long> dims;
+        for (int i = 0; i < D.HH_out.num_dims; i++)
+            dims << D.HH_out.dims[i];
+        if (!D.chunked_out.open(opts.output_path, D.HH_out.data_type, dims, opts.chunk_size, opts.compression_level))
+            return false;
+        D.use_chunked_out = true;
+    }
+    else
+        D.outf = fopen(opts.output_path.toLatin1().data(), "wb");
+    if ((!D.outf) && (!D.use_chunked_out)) {
         qWarning() << "Unable to open output file for writing: " + opts.output_path;
         return false;
     }
@@ -157,7 +189,7 @@ bool mdaconvert(const mdaconvert_opts& opts)
     }
 
     //check input file size
-    if (opts.check_input_file_size) {
+    if ((opts.check_input_file_size) && (!D.use_chunked_in)) {
         long expected_input_file_size = D.HH_in.num_bytes_per_entry * dim_prod + D.HH_in.header_size;
         long actual_input_file_size = QFileInfo(opts.input_path).size();
         if (actual_input_file_size != expected_input_file_size) {
@@ -177,14 +209,24 @@ bool mdaconvert(const mdaconvert_opts& opts)
             timer.restart();
         }
         long NN = qMin(chunk_size, dim_prod - ii);
-        if (!copy_data(D, NN)) {
+        bool ok;
+        if ((D.use_chunked_in) || (D.use_chunked_out))
+            ok = copy_data_chunked(D, NN);
+        else
+            ok = copy_data(D, NN);
+        if (!ok) {
             ret = false;
             break;
         }
     }
+    if (D.use_chunked_out) {
+        if (!D.chunked_out.close())
+            ret = false;
+    }
 
     if (!ret) {
-        fclose(D.outf);
+        if (D.outf)
+            fclose(D.outf);
         D.outf = 0;
         QFile::remove(opts.output_path);
     }
@@ -274,6 +316,66 @@ bool copy_data(working_data& D, long N)
     return true;
 }
 
+//goes through float64, which is exact for all of the supported types
+bool convert_firings(const mdaconvert_opts& opts)
+{
+    FiringsStore store;
+    if (!store.open(opts.input_path)) {
+        qWarning() << "Unable to read firings: " + opts.input_path;
+        return false;
+    }
+    if (opts.output_format == "firings") {
+        return store.write(opts.output_path);
+    }
+    if (opts.output_format != "mda") {
+        qWarning() << "Columnar firings can only be converted to mda";
+        return false;
+    }
+    return store.toMda().write64(opts.output_path);
+}
+
+bool copy_data_chunked(working_data& D, long N)
+{
+    if (!N)
+        return true;
+    if (D.buf) {
+        free(D.buf);
+        D.buf = 0;
+    }
+    D.buf = malloc(N * sizeof(double));
+    if (!D.buf) {
+        qWarning() << QString("Error in malloc of size %1 ").arg(N * sizeof(double));
+        return false;
+    }
+    double* buf = (double*)D.buf;
+
+    long num_read;
+    if (D.use_chunked_in)
+        num_read = D.chunked_in.read(buf, D.position, N);
+    else
+        num_read = mda_read_float64(buf, &D.HH_in, N, D.inf);
+    if (num_read != N) {
+        qWarning() << "Error reading data" << num_read << N;
+        return false;
+    }
+
+    if (D.use_chunked_out) {
+        if (!D.chunked_out.write(buf, N)) {
+            qWarning() << "Error writing chunked data";
+            return false;
+        }
+    }
+    else {
+        long num_written = mda_write_float64(buf, &D.HH_out, N, D.outf);
+        if (num_written != N) {
+            qWarning() << "Error writing data" << num_written << N;
+            return false;
+        }
+    }
+    D.position += N;
+    return true;
+}
+
 int get_mda_dtype(QString format)
 {
     if (format == "byte")
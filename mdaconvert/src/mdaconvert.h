@@ -16,11 +16,15 @@ struct mdaconvert_opts {
 
     QString output_path;
     QString output_dtype; // uint16, float32, ...
-    QString output_format; // mda, raw, ...
+    QString output_format; // mda, raw, chunked (compressed mda), ...
 
     QList<long> dims;
 
     bool check_input_file_size = true;
+
+    //for output_format = chunked
+    long chunk_size = 0; //number of columns (timepoints) per chunk, 0 for the default
+    int compression_level = 6;
 };
 bool mdaconvert(const mdaconvert_opts& opts);
 
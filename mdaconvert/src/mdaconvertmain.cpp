@@ -61,6 +61,9 @@ int main(int argc, char* argv[])
         opts.output_format = get_default_format(opts.output_path);
     }
 
+    opts.chunk_size = params.named_parameters.value("chunk-size", 0).toLongLong();
+    opts.compression_level = params.named_parameters.value("compression-level", 6).toInt();
+
     QStringList dims_strlist = params.named_parameters.value("dims", "").toString().split("x", QString::SkipEmptyParts);
     foreach (QString str, dims_strlist) {
         opts.dims << str.toLong();
@@ -101,6 +104,8 @@ void print_usage()
     printf("mdaconvert input.dat output.mda --dtype=uint16 --dims=32x100x44\n");
     printf("mdaconvert input.mda output.dat\n");
     printf("mdaconvert input.file output.file --input-format=dat --input-dtype=float64 --output-format=mda --output-dtype=float32\n");
+    printf("mdaconvert input.mda output.mda --output-format=chunked [--chunk-size=timepoints] [--compression-level=6]\n");
+    printf("mdaconvert firings.mda firings.firings --output-format=firings (columnar firings, see firingsstore.h -- and back with --output-format=mda)\n");
 }
 
 #define MDAIO_MAX_DIMS 50
@@ -0,0 +1,40 @@
+/******************************************************
+** See the accompanying README and LICENSE files
+*******************************************************/
+
+#ifndef CHECKSUMINDEX_H
+#define CHECKSUMINDEX_H
+
+#include <QString>
+#include <QStringList>
+
+/*
+ * A persistent on-disk index of the files within the local search paths, used to
+ * locate the file referred to by a .prv record without walking and hashing the
+ * whole tree on every lookup.
+ *
+ * For every indexed directory we record its modification time, its subdirectories,
+ * and for each file its (size, inode, mtime) together with checksum1000 and sha1,
+ * (or the sha1tree checksum), which are computed lazily the first time a file is a candidate for a lookup.
+ * When updating, only directories whose modification time has changed are relisted.
+ * Note that a file modified in place (without being replaced) does not change the
+ * modification time of its directory, so it is only noticed if it becomes a candidate.
+ */
+class ChecksumIndexPrivate;
+class ChecksumIndex {
+public:
+    friend class ChecksumIndexPrivate;
+    ChecksumIndex(const QString& index_path = ""); //by default the index lives in the mountainlab temporary path
+    virtual ~ChecksumIndex();
+
+    //returns an empty string if not found. Set update_index=false for a quick lookup of what is already indexed
+    //checksum_type is "sha1" or "sha1tree" (see sumit.h)
+    QString findFile(const QStringList& search_paths, qint64 size, const QString& checksum, const QString& checksum1000_optional, bool update_index = true, const QString& checksum_type = "sha1");
+    //rescan the directories that have changed since they were indexed
+    void update(const QStringList& search_paths);
+
+private:
+    ChecksumIndexPrivate* d;
+};
+
+#endif // CHECKSUMINDEX_H
@@ -0,0 +1,82 @@
+/******************************************************
+** See the accompanying README and LICENSE files
+*******************************************************/
+
+#ifndef CHUNKEDMDA_H
+#define CHUNKEDMDA_H
+
+#include "mdaio.h"
+#include <QString>
+#include <QList>
+
+/*
+ * A chunked, compressed variant of the .mda format with random access.
+ *
+ * The array is split into chunks of whole columns (time blocks for a timeseries),
+ * and each chunk is compressed independently, so that any range can be read by
+ * decompressing only the chunks it touches. Before zlib compression (qCompress),
+ * integer data are delta-encoded along the second dimension and the bytes of all
+ * data types are shuffled (all first bytes, then all second bytes, ...), which is
+ * what makes raw int16 recordings compress well.
+ *
+ * Layout (native byte order, as for .mda):
+ *   char[8] "MDACHUNK", int32 version
+ *   int32 data_type, int32 num_bytes_per_entry, int32 num_dims, int32 dims[num_dims]
+ *   int32 filters, int64 chunk_size (entries), int64 num_chunks, int64 index_offset
+ *   the compressed chunks
+ *   the index: int64 offsets[num_chunks+1] (the last one being the end of the final chunk)
+ *
+ * DiskReadMda and DiskReadMda32 read these files transparently, and mdaconvert writes them (--output-format=chunked).
+ */
+
+#define CHUNKED_MDA_FILTER_DELTA 1
+#define CHUNKED_MDA_FILTER_SHUFFLE 2
+
+class ChunkedMdaReaderPrivate;
+class ChunkedMdaReader {
+public:
+    friend class ChunkedMdaReaderPrivate;
+    ChunkedMdaReader();
+    virtual ~ChunkedMdaReader();
+
+    static bool isChunkedMda(const QString& path);
+
+    bool open(const QString& path);
+    void close();
+    bool isOpen() const;
+    MDAIO_HEADER header() const;
+    long totalSize() const;
+
+    //read num entries of the vectorized array starting at entry i, returns the number of entries read
+    long read(double* dst, long i, long num);
+    long read(float* dst, long i, long num);
+
+    void setMaxCacheBytes(long num_bytes);
+
+private:
+    ChunkedMdaReaderPrivate* d;
+    ChunkedMdaReader(const ChunkedMdaReader&);
+    void operator=(const ChunkedMdaReader&);
+};
+
+class ChunkedMdaWriterPrivate;
+class ChunkedMdaWriter {
+public:
+    friend class ChunkedMdaWriterPrivate;
+    ChunkedMdaWriter();
+    virtual ~ChunkedMdaWriter();
+
+    //chunk_size is the number of columns (e.g., timepoints) per chunk, or 0 for a default of around a million entries
+    bool open(const QString& path, int data_type, const QList<long>& dims, long chunk_size = 0, int compression_level = 6);
+    //the entries must be written in order, in any number of calls
+    bool write(const double* data, long num);
+    //writes the index -- must be called, and returns false if anything went wrong
+    bool close();
+
+private:
+    ChunkedMdaWriterPrivate* d;
+    ChunkedMdaWriter(const ChunkedMdaWriter&);
+    void operator=(const ChunkedMdaWriter&);
+};
+
+#endif // CHUNKEDMDA_H
@@ -21,10 +21,12 @@ public:
     friend class DiskReadMdaPrivate;
     DiskReadMda(const QString& path = ""); ///Constructor pointing to the .mda file specified by path (file name).
     DiskReadMda(const DiskReadMda& other); ///Copy constructor
+    DiskReadMda(DiskReadMda&& other); ///Move constructor (other is left empty)
     DiskReadMda(const Mda& X); ///Constructor based on an in-memory array. This enables passing an Mda into a function that expects a DiskReadMda.
     DiskReadMda(const QJsonObject& prv_object);
     virtual ~DiskReadMda();
     void operator=(const DiskReadMda& other);
+    void operator=(DiskReadMda&& other);
 
     ///Set the path (file name) of the .mda file to read.
     void setPath(const QString& file_path);
@@ -20,10 +20,12 @@ public:
     friend class DiskReadMda32Private;
     DiskReadMda32(const QString& path = ""); ///Constructor pointing to the .mda file specified by path (file name).
     DiskReadMda32(const DiskReadMda32& other); ///Copy constructor
+    DiskReadMda32(DiskReadMda32&& other); ///Move constructor (other is left empty)
     DiskReadMda32(const Mda32& X); ///Constructor based on an in-memory array. This enables passing an Mda32 into a function that expects a DiskReadMda32.
     DiskReadMda32(const QJsonObject& prv_object);
     virtual ~DiskReadMda32();
     void operator=(const DiskReadMda32& other);
+    void operator=(DiskReadMda32&& other);
 
     ///Set the path (file name) of the .mda file to read.
     void setPath(const QString& file_path);
@@ -55,6 +57,10 @@ public:
     ///Retrieve a chunk of the vectorized data of size N1xN2xN3 starting at position (i1,i2,i3)
     bool readChunk(Mda32& X, long i1, long i2, long i3, long size1, long size2, long size3) const;
 
+    ///Zero-copy access to the whole array as N1xN2x(N3*...*N6), by memory-mapping the file. Only possible for uncompressed local float32 files (and in-memory arrays) -- otherwise the view is empty.
+    ///The view remains valid for as long as this object is alive (and not assigned to)
+    Mda32View mappedView() const;
+
     ///A slow method to retrieve the value at location i of the vectorized array for example value(3+4*N1())==value(3,4). Consider using readChunk() instead
     dtype32 value(long i) const;
     ///A slow method to retrieve the value at location (i1,i2) of the array. Consider using readChunk() instead
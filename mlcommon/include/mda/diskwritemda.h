@@ -20,7 +20,16 @@ public:
     DiskWriteMda(int data_type, const QString& path, long N1, long N2, long N3 = 1, long N4 = 1, long N5 = 1, long N6 = 1);
     virtual ~DiskWriteMda();
     bool open(int data_type, const QString& path, long N1, long N2, long N3 = 1, long N4 = 1, long N5 = 1, long N6 = 1);
-    void close();
+    //returns false if anything could not be written, in which case the output file is removed rather than renamed into place
+    bool close();
+
+    //In asynchronous (write-behind) mode, writeChunk converts the data into an owned buffer and returns immediately,
+    //while a background thread writes the buffers to their positions in the file. Chunks may be submitted in any order
+    //and from several threads at once. At most max_queued_bytes are held in memory -- beyond that writeChunk waits.
+    //Must be called before open()
+    void setAsynchronous(bool val, long max_queued_bytes = 256 * 1024 * 1024);
+    //wait until everything submitted so far has been written, returns false if there was an error
+    bool flush();
 
     long N1();
     long N2();
@@ -0,0 +1,103 @@
+/******************************************************
+** See the accompanying README and LICENSE files
+*******************************************************/
+
+#ifndef FIRINGSSTORE_H
+#define FIRINGSSTORE_H
+
+#include "mda.h"
+#include "diskreadmda.h"
+#include <QString>
+#include <QVector>
+
+/*
+ * A columnar representation of a firings array.
+ *
+ * A firings .mda is a RxL array of doubles (channel, time, label, and optionally further rows such as peak amplitude),
+ * so pulling out the times or the labels means touching every entry. Here the channels, times and labels are kept
+ * as separate typed columns -- with the times as 64-bit integers -- together with an index of the events of each label,
+ * so that the events of a single cluster can be obtained without rescanning everything.
+ *
+ * FiringsStore::write() saves this representation to a file, which open() then memory-maps (no parsing is needed).
+ * open() also accepts an ordinary firings .mda (or .prv), which is read in a single pass and converted in memory.
+ *
+ * Layout (native byte order, as for .mda; every section starts on an 8-byte boundary):
+ *   char[8] "MLFIRING", int32 version, int32 num_extra_rows, int64 L, int32 K, int32 has_label_index
+ *   int64 times[L]
+ *   float64 extra_rows[num_extra_rows][L] (rows 3,4,... of the firings array)
+ *   int32 channels[L], int32 labels[L]
+ *   if has_label_index: int64 offsets[K+2], int64 event_indices[offsets[K+1]]
+ *     the events with label k (0<=k<=K) are event_indices[offsets[k]..offsets[k+1]), in increasing order
+ *
+ * Times are rounded to the nearest integer timepoint on conversion from .mda.
+ */
+
+//a read-only view into a column (or part of one) -- valid for as long as the FiringsStore is open
+template <typename T>
+class FiringsColumn {
+public:
+    FiringsColumn(const T* data = 0, long count = 0)
+        : m_data(data)
+        , m_count(count)
+    {
+    }
+    const T* data() const { return m_data; }
+    long count() const { return m_count; }
+    bool isEmpty() const { return (m_count == 0); }
+    const T* begin() const { return m_data; }
+    const T* end() const { return m_data + m_count; }
+    const T& operator[](long i) const { return m_data[i]; }
+    QVector<T> toVector() const
+    {
+        QVector<T> ret(m_count);
+        for (long i = 0; i < m_count; i++)
+            ret[i] = m_data[i];
+        return ret;
+    }
+
+private:
+    const T* m_data;
+    long m_count;
+};
+
+class FiringsStorePrivate;
+class FiringsStore {
+public:
+    friend class FiringsStorePrivate;
+    FiringsStore();
+    FiringsStore(const QString& path);
+    virtual ~FiringsStore();
+
+    static bool isFiringsStore(const QString& path);
+
+    //the columnar format is memory-mapped, anything else is read as a firings array
+    bool open(const QString& path);
+    bool load(const DiskReadMda& firings);
+    void load(const Mda& firings);
+    void close();
+
+    long eventCount() const;
+    int K() const; //the maximum label
+    int extraRowCount() const;
+
+    FiringsColumn<qint32> channels() const;
+    FiringsColumn<qint64> times() const;
+    FiringsColumn<qint32> labels() const;
+    FiringsColumn<double> extraRow(int r) const; //row 3+r of the firings array
+
+    //the indices of the events with label k, in increasing order (empty if k<0 or k>K)
+    FiringsColumn<qint64> eventIndicesForLabel(int k) const;
+    QVector<qint64> timesForLabel(int k) const;
+
+    Mda toMda() const;
+
+    bool write(const QString& path, bool include_label_index = true) const;
+    static bool write(const QString& path, const Mda& firings, bool include_label_index = true);
+
+private:
+    FiringsStorePrivate* d;
+    FiringsStore(const FiringsStore&);
+    void operator=(const FiringsStore&);
+};
+
+#endif // FIRINGSSTORE_H
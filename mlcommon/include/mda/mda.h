@@ -9,6 +9,7 @@
 #include <QString>
 #include <QDebug>
 #include <QSharedDataPointer>
+#include "mdaview.h"
 
 extern void* allocate(unsigned long nbytes);
 
@@ -17,6 +18,13 @@ class MdaData;
  * @brief The Mda class
  *
  * An object of type Mda is a multi-dimensional array, with up to 6 dimensions. All indexing is 0-based.
+ *
+ * The data are implicitly shared: copies are cheap, and the data are only copied when a shared array is modified
+ * (through a non-const method such as dataPtr() or set()). So call detach() or dataPtr() before writing to a
+ * copied array from several threads, and do not keep a pointer from dataPtr() across a copy.
+ *
+ * The data are aligned to 64 bytes. Within an MdaArenaScope they are recycled through a pool of the current thread
+ * (see mdaarena.h), which is what chunk loops should use for their temporaries.
  */
 class Mda {
 public:
@@ -25,10 +33,14 @@ public:
     Mda(long N1 = 1, long N2 = 1, long N3 = 1, long N4 = 1, long N5 = 1, long N6 = 1);
     ///Construct an array and read the .mda file
     Mda(const QString& mda_filename);
-    ///Copy constructor
+    ///Copy constructor (shares the data)
     Mda(const Mda& other);
-    ///Assignment operator
+    ///Move constructor (other is left as an empty array)
+    Mda(Mda&& other);
+    ///Assignment operator (shares the data)
     void operator=(const Mda& other);
+    ///Move assignment (other is left as an empty array)
+    void operator=(Mda&& other);
     ///Destructor
     virtual ~Mda();
     ///Allocate an array of size N1xN2x...xN6
@@ -147,6 +159,9 @@ public:
 
     void detach();
 
+    ///A view of the data as N1xN2x(N3*...*N6), for slicing without copying (see MdaViewT)
+    MdaView view() const;
+
 private:
     QSharedDataPointer<MdaData> d;
 };
@@ -10,28 +10,40 @@
 #include <QString>
 #include <QDebug>
 #endif
+#include <QSharedDataPointer>
+#include "mdaview.h"
 
 typedef float dtype32;
 
 extern void* allocate(const size_t nbytes);
 
-class Mda32Private;
+class Mda32Data;
 /** \class Mda32 - a multi-dimensional array corresponding to the .mda file format
  * @brief The Mda32 class
  *
  * An object of type Mda32 is a multi-dimensional array, with up to 6 dimensions. All indexing is 0-based.
+ *
+ * The data are implicitly shared: copies are cheap, and the data are only copied when a shared array is modified
+ * (through a non-const method such as dataPtr() or set()). So call detach() or dataPtr() before writing to a
+ * copied array from several threads, and do not keep a pointer from dataPtr() across a copy.
+ *
+ * The data are aligned to 64 bytes. Within an MdaArenaScope they are recycled through a pool of the current thread
+ * (see mdaarena.h), which is what chunk loops should use for their temporaries.
  */
 class Mda32 {
 public:
-    friend class Mda32Private;
     ///Construct an array of size N1xN2x...xN6
     Mda32(long N1 = 1, long N2 = 1, long N3 = 1, long N4 = 1, long N5 = 1, long N6 = 1);
     ///Construct an array and read the .mda file
     Mda32(const QString mda_filename);
-    ///Copy constructor
+    ///Copy constructor (shares the data)
     Mda32(const Mda32& other);
-    ///Assignment operator
+    ///Move constructor (other is left as an empty array)
+    Mda32(Mda32&& other);
+    ///Assignment operator (shares the data)
     void operator=(const Mda32& other);
+    ///Move assignment (other is left as an empty array)
+    void operator=(Mda32&& other);
     ///Destructor
     virtual ~Mda32();
     ///Allocate an array of size N1xN2x...xN6
@@ -145,8 +157,13 @@ public:
 
     bool reshape(int N1b, int N2b, int N3b = 1, int N4b = 1, int N5b = 1, int N6b = 1);
 
+    void detach();
+
+    ///A view of the data as N1xN2x(N3*...*N6), for slicing without copying (see MdaViewT)
+    Mda32View view() const;
+
 private:
-    Mda32Private* d;
+    QSharedDataPointer<Mda32Data> d;
 };
 
 #endif // MDA_H
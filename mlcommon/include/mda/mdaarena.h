@@ -0,0 +1,59 @@
+/******************************************************
+** See the accompanying README and LICENSE files
+*******************************************************/
+
+#ifndef MDAARENA_H
+#define MDAARENA_H
+
+/*
+ * A per-thread pool for the data of Mda and Mda32 (and other scratch buffers).
+ *
+ * Chunk loops allocate and free the same few arrays (the chunk, the output chunk, the FFT buffers...) on every
+ * iteration. Within an MdaArenaScope, blocks freed on the current thread are kept in a pool of size classes
+ * (four per power of two) belonging to that thread, and are handed back out by the next allocation of a similar size,
+ * so that in steady state no call to the system allocator -- and no contention on its locks -- remains.
+ *
+ * The pool is freed when the outermost scope of the thread ends.
+ *
+ * Outside of any scope, mda_arena_allocate() and mda_arena_free() simply go to the system allocator. A block may be
+ * freed on any thread, and after its scope has ended -- but only the thread that allocated it pools it again, others
+ * return it to the system. All blocks are aligned to 64 bytes.
+ *
+ * Typical use, around a parallel loop within the parallel region, so that the pool lasts for all the iterations of
+ * the thread:
+ *     #pragma omp parallel
+ *     {
+ *         MdaArenaScope arena_scope;
+ *         #pragma omp for
+ *         for (...) {
+ *             Mda chunk;
+ *             ...
+ */
+
+#define MDA_ARENA_ALIGNMENT 64
+
+//never returns 0 for nbytes>0 unless the system is out of memory; the contents are not initialized
+void* mda_arena_allocate(long nbytes);
+//for blocks from mda_arena_allocate() only
+void mda_arena_free(void* ptr);
+
+class MdaArenaScope {
+public:
+    MdaArenaScope();
+    virtual ~MdaArenaScope();
+
+    //whether a scope is active on the current thread
+    static bool isActive();
+    //the number of bytes held in the pool of the current thread
+    static long cachedBytes();
+    //frees the pool of the current thread (this happens anyway at the end of its outermost scope)
+    static void releaseCache();
+    //the largest pool a thread may hold, default 256 MB
+    static void setMaxCachedBytesPerThread(long num_bytes);
+
+private:
+    MdaArenaScope(const MdaArenaScope&);
+    void operator=(const MdaArenaScope&);
+};
+
+#endif // MDAARENA_H
@@ -81,6 +81,11 @@ long mda_write_uint16(uint16_t* data, struct MDAIO_HEADER* H, long n, FILE* outp
 long mda_write_float64(double* data, struct MDAIO_HEADER* H, long n, FILE* output_file);
 long mda_write_uint32(uint32_t* data, struct MDAIO_HEADER* H, long n, FILE* output_file);
 
+//convert n entries to the representation of the underlying data type (as they would be written to the file)
+//dst must have room for n*H->num_bytes_per_entry bytes. Returns n, or 0 if the data type is not handled
+long mda_convert_from_float32(void* dst, const struct MDAIO_HEADER* H, const float* data, long n);
+long mda_convert_from_float64(void* dst, const struct MDAIO_HEADER* H, const double* data, long n);
+
 //here's an example usage function. See top of file for more info.
 void transpose_array(char* infile_path, char* outfile_path);
 
@@ -0,0 +1,128 @@
+/******************************************************
+** See the accompanying README and LICENSE files
+*******************************************************/
+
+#ifndef MDAVIEW_H
+#define MDAVIEW_H
+
+/*
+ * A read-only, non-owning view into a 3D array (N1xN2xN3) with arbitrary strides.
+ *
+ * Taking a template, a clip, a range of clips or a single channel out of an Mda/Mda32 with getChunk() allocates and
+ * copies. A view is just a pointer, the dimensions and the strides (in entries), so slicing costs nothing.
+ * Views come from Mda::view(), Mda32::view(), DiskReadMda32::mappedView() or any buffer.
+ *
+ * A view does not keep the data alive: it is only valid for as long as the array it came from is neither destroyed
+ * nor modified (a non-const access to a shared Mda may move its data, see Mda).
+ */
+
+template <typename T>
+class MdaViewT {
+public:
+    MdaViewT()
+    {
+        set(0, 0, 1, 1, 1, 0, 0);
+    }
+    //a contiguous array, as in an Mda
+    MdaViewT(const T* data, long N1, long N2 = 1, long N3 = 1)
+    {
+        set(data, N1, N2, N3, 1, N1, N1 * N2);
+    }
+    MdaViewT(const T* data, long N1, long N2, long N3, long stride1, long stride2, long stride3)
+    {
+        set(data, N1, N2, N3, stride1, stride2, stride3);
+    }
+
+    long N1() const { return m_dims[0]; }
+    long N2() const { return m_dims[1]; }
+    long N3() const { return m_dims[2]; }
+    long totalSize() const { return m_dims[0] * m_dims[1] * m_dims[2]; }
+    long stride(int dimension_index) const { return m_strides[dimension_index]; } //zero-based
+    bool isEmpty() const { return (totalSize() == 0); }
+    bool isContiguous() const
+    {
+        return ((m_strides[0] == 1) || (m_dims[0] <= 1))
+            && ((m_strides[1] == m_dims[0]) || (m_dims[1] <= 1))
+            && ((m_strides[2] == m_dims[0] * m_dims[1]) || (m_dims[2] <= 1));
+    }
+
+    const T* constDataPtr() const { return m_data; }
+    const T* constDataPtr(long i1, long i2, long i3 = 0) const { return m_data + i1 * m_strides[0] + i2 * m_strides[1] + i3 * m_strides[2]; }
+
+    T get(long i1, long i2) const { return m_data[i1 * m_strides[0] + i2 * m_strides[1]]; }
+    T get(long i1, long i2, long i3) const { return m_data[i1 * m_strides[0] + i2 * m_strides[1] + i3 * m_strides[2]]; }
+    //returns 0 when out of bounds
+    T value(long i1, long i2, long i3 = 0) const
+    {
+        if ((i1 < 0) || (i1 >= m_dims[0]) || (i2 < 0) || (i2 >= m_dims[1]) || (i3 < 0) || (i3 >= m_dims[2]))
+            return 0;
+        return get(i1, i2, i3);
+    }
+
+    //the size1xsize2xsize3 block starting at (i1,i2,i3), which must lie within the view
+    MdaViewT subView(long i1, long i2, long i3, long size1, long size2, long size3) const
+    {
+        return MdaViewT(constDataPtr(i1, i2, i3), size1, size2, size3, m_strides[0], m_strides[1], m_strides[2]);
+    }
+    //the N1xN2 plane at i3 -- for example a template out of MxTxK templates, or a clip out of MxTxL clips
+    MdaViewT slice(long i3) const
+    {
+        return subView(0, 0, i3, m_dims[0], m_dims[1], 1);
+    }
+    //the N1x1 column at (i2,i3)
+    MdaViewT column(long i2, long i3 = 0) const
+    {
+        return subView(0, i2, i3, m_dims[0], 1, 1);
+    }
+    //the 1xN2xN3 row at i1 -- for example a single channel of a timeseries or of a set of clips
+    MdaViewT row(long i1) const
+    {
+        return subView(i1, 0, 0, 1, m_dims[1], m_dims[2]);
+    }
+    //the same entries with different dimensions -- only possible for a contiguous view, otherwise the result is empty
+    MdaViewT reshaped(long N1b, long N2b, long N3b = 1) const
+    {
+        if ((!isContiguous()) || (N1b * N2b * N3b != totalSize()))
+            return MdaViewT();
+        return MdaViewT(m_data, N1b, N2b, N3b);
+    }
+
+    //copies the entries into X (an Mda or Mda32), which is allocated as N1xN2xN3
+    template <class MdaType>
+    void copyTo(MdaType& X) const
+    {
+        X.allocate(m_dims[0], m_dims[1], m_dims[2]);
+        auto* ptr = X.dataPtr();
+        long ii = 0;
+        for (long i3 = 0; i3 < m_dims[2]; i3++) {
+            for (long i2 = 0; i2 < m_dims[1]; i2++) {
+                const T* src = constDataPtr(0, i2, i3);
+                for (long i1 = 0; i1 < m_dims[0]; i1++) {
+                    ptr[ii] = src[i1 * m_strides[0]];
+                    ii++;
+                }
+            }
+        }
+    }
+
+private:
+    const T* m_data;
+    long m_dims[3];
+    long m_strides[3];
+
+    void set(const T* data, long N1, long N2, long N3, long stride1, long stride2, long stride3)
+    {
+        m_data = data;
+        m_dims[0] = N1;
+        m_dims[1] = N2;
+        m_dims[2] = N3;
+        m_strides[0] = stride1;
+        m_strides[1] = stride2;
+        m_strides[2] = stride3;
+    }
+};
+
+typedef MdaViewT<double> MdaView;
+typedef MdaViewT<float> Mda32View; //float is dtype32 (see mda32.h)
+
+#endif // MDAVIEW_H
@@ -26,6 +26,9 @@ public:
     void setRemoteDataType(QString dtype);
     void setDownloadChunkSize(long size);
     long downloadChunkSize();
+    //the chunks needed for a read are requested concurrently, and a few more are prefetched in the direction of access
+    void setMaxRequestsInFlight(int num);
+    void setNumPrefetchChunks(int num);
 
     void setPath(const QString& path);
     QString makePath() const; //not capturing the reshaping
@@ -28,6 +28,7 @@ QString resolvePath(const QString& basepath, const QString& path);
 void mkdirIfNeeded(const QString& path);
 QString computeSha1SumOfFile(const QString& path);
 QString computeSha1SumOfFileHead(const QString& path, long num_bytes);
+QString computeChecksumOfFile(const QString& path, const QString& checksum_type); //see sumit.h for the checksum types
 QString computeSha1SumOfString(const QString& str);
 QList<int> stringListToIntList(const QStringList& list);
 QStringList intListToStringList(const QList<int>& list);
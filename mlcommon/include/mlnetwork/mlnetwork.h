@@ -8,7 +8,9 @@
 #define MLNETWORK_H
 
 #include <QFile>
+#include <QMap>
 #include <QMutex>
+#include <QPair>
 #include <QNetworkReply>
 #include <QString>
 #include <QThread>
@@ -74,6 +76,45 @@ private:
     QFile* m_file = 0;
 };
 
+//Downloads a byte range of a prv url, writing it at the same position in an open file. Used by PrvParallelDownloader
+class PrvRangeDownloader : public Runner {
+    Q_OBJECT
+public:
+    virtual ~PrvRangeDownloader();
+
+    //input
+    QString source_url; //must be prv protocol
+    int destination_fd = -1;
+    long start_byte = 0;
+    long end_byte = 0; //inclusive -- may be lowered while running, to hand the rest of the range to somebody else
+
+    //output
+    bool success = false;
+    QString error;
+
+    void start();
+    long num_bytes_downloaded(); //contiguous, from start_byte
+    long num_bytes_remaining();
+signals:
+    void progress();
+private slots:
+    void slot_reply_error();
+    void slot_reply_ready_read();
+    void slot_reply_finished();
+
+private:
+    long m_num_bytes_downloaded = 0;
+    QNetworkReply* m_reply = 0;
+
+    void finish(bool success0, const QString& error0 = "");
+};
+
+/*
+ * The byte ranges are written directly into a preallocated destination_file_name + ".part", and the ranges
+ * completed so far are recorded in destination_file_name + ".part.ranges". A download that is interrupted (or fails)
+ * can therefore be resumed by starting again with the same source_url, destination_file_name and size.
+ * Whenever a connection is idle, the largest outstanding range (that is, the slowest) is split in two.
+ */
 class PrvParallelDownloader : public Runner {
     Q_OBJECT
 public:
@@ -95,7 +136,6 @@ public:
 private slots:
     void slot_downloader_progress();
     void slot_downloader_finished();
-    void slot_concatenate_finished();
 
 private:
     QMutex m_mutex;
@@ -103,7 +143,17 @@ private:
     long m_num_bytes_downloaded = 0;
 
     TaskProgress m_task;
-    QList<Downloader*> m_downloaders;
+    QFile m_file;
+    QList<QPair<long, long> > m_completed_ranges; //inclusive, sorted and merged
+    QList<QPair<long, long> > m_pending_ranges;
+    QMap<long, int> m_num_attempts; //by start byte of a range that failed
+    QList<PrvRangeDownloader*> m_downloaders;
+
+    bool load_completed_ranges();
+    void save_completed_ranges();
+    void add_completed_range(long start_byte, long end_byte);
+    void start_more_downloaders();
+    void finish(bool success0, const QString& error0 = "");
 };
 
 class Uploader : public Runner {
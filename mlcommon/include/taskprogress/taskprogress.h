@@ -13,6 +13,9 @@
 #include <QDebug>
 #include <QAbstractItemModel>
 #include <QReadWriteLock>
+#include <QElapsedTimer>
+#include <QStringList>
+#include <QVector>
 
 struct TaskProgressLogMessage {
     enum Type {
@@ -135,6 +138,24 @@ signals:
 
 class TaskProgressModel;
 
+//the distribution of the durations of an operation, in power-of-two buckets of microseconds:
+//bucket 0 counts durations below 1 us, and bucket b>0 those in [2^(b-1),2^b) us
+struct TaskProgressLatencyHistogram {
+    enum {
+        NumBuckets = 32
+    };
+    long count = 0;
+    double total_msec = 0;
+    double max_msec = 0;
+    QVector<long> bucket_counts = QVector<long>(NumBuckets, 0);
+
+    double meanMsec() const { return count ? total_msec / count : 0; }
+    //an upper bound for the duration within which a fraction p (0<=p<=1) of the operations completed
+    double percentileMsec(double p) const;
+    static double bucketUpperBoundMsec(int b);
+    static int bucketForMsec(double msec);
+};
+
 class TaskProgressMonitor : public QObject {
     Q_OBJECT
 public:
@@ -143,14 +164,41 @@ public:
     virtual int indexOf(TaskProgressAgent*) const = 0;
     static TaskProgressMonitor* globalInstance();
 
+    //The quantities and latencies are accumulated in per-thread counters without any locking, so these may be
+    //called from inside parallel loops. The getters sum over the threads. quantitiesChanged() is emitted at most
+    //a few times per second (from the thread of the monitor), rather than on every increment.
     virtual void incrementQuantity(QString name, double val) = 0;
     virtual double getQuantity(QString name) const = 0;
 
+    virtual void recordLatency(QString name, double msec) = 0;
+    virtual TaskProgressLatencyHistogram getLatencyHistogram(QString name) const = 0;
+    virtual QStringList latencyNames() const = 0;
+
     virtual TaskProgressModel* model() const = 0;
 signals:
     void quantitiesChanged();
 };
 
+//records the time from construction to destruction as a latency of the given operation
+class TaskProgressLatencyTimer {
+public:
+    TaskProgressLatencyTimer(const QString& name)
+        : m_name(name)
+    {
+        m_timer.start();
+    }
+    ~TaskProgressLatencyTimer()
+    {
+        TaskProgressMonitor::globalInstance()->recordLatency(m_name, m_timer.nsecsElapsed() * 1e-6);
+    }
+
+private:
+    QString m_name;
+    QElapsedTimer m_timer;
+    TaskProgressLatencyTimer(const TaskProgressLatencyTimer&);
+    void operator=(const TaskProgressLatencyTimer&);
+};
+
 class TaskProgressAgentPrivate;
 
 class TaskProgressModel : public QAbstractItemModel {
@@ -0,0 +1,310 @@
+/******************************************************
+** See the accompanying README and LICENSE files
+*******************************************************/
+
+#include "checksumindex.h"
+#include "mlcommon.h"
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QMap>
+#include <QSet>
+#include <sys/stat.h>
+#include <stdio.h>
+
+#define CHECKSUM_INDEX_MAGIC 0x6d6c6369
+#define CHECKSUM_INDEX_VERSION 2
+
+struct ChecksumIndexFile {
+    QString name;
+    qint64 size = 0;
+    qint64 inode = 0;
+    qint64 mtime = 0;
+    QString checksum1000; //computed lazily
+    QString sha1; //computed lazily
+    QString sha1tree; //computed lazily, only for lookups by that checksum type
+};
+
+struct ChecksumIndexDirectory {
+    qint64 mtime = 0; //zero means it must be relisted on the next update
+    QList<ChecksumIndexFile> files;
+    QStringList subdirs;
+};
+
+QDataStream& operator<<(QDataStream& out, const ChecksumIndexFile& F)
+{
+    out << F.name << F.size << F.inode << F.mtime << F.checksum1000 << F.sha1 << F.sha1tree;
+    return out;
+}
+
+QDataStream& operator>>(QDataStream& in, ChecksumIndexFile& F)
+{
+    in >> F.name >> F.size >> F.inode >> F.mtime >> F.checksum1000 >> F.sha1 >> F.sha1tree;
+    return in;
+}
+
+QDataStream& operator<<(QDataStream& out, const ChecksumIndexDirectory& D)
+{
+    out << D.mtime << D.files << D.subdirs;
+    return out;
+}
+
+QDataStream& operator>>(QDataStream& in, ChecksumIndexDirectory& D)
+{
+    in >> D.mtime >> D.files >> D.subdirs;
+    return in;
+}
+
+class ChecksumIndexPrivate {
+public:
+    ChecksumIndex* q;
+    QString m_index_path;
+    QMap<QString, ChecksumIndexDirectory> m_directories; //by absolute path
+    bool m_loaded = false;
+    bool m_modified = false;
+
+    void load();
+    void save();
+    void refresh_directory(const QString& path, QSet<QString>& visited);
+    void remove_directory(const QString& path);
+    QString find_in_index(const QString& root, qint64 size, const QString& checksum, const QString& checksum1000_optional, const QString& checksum_type);
+    bool file_matches(const QString& dirpath, ChecksumIndexFile& F, qint64 size, const QString& checksum, const QString& checksum1000_optional, const QString& checksum_type);
+    static bool stat_file(const QString& path, ChecksumIndexFile& F);
+};
+
+ChecksumIndex::ChecksumIndex(const QString& index_path)
+{
+    d = new ChecksumIndexPrivate;
+    d->q = this;
+    d->m_index_path = index_path;
+    if (d->m_index_path.isEmpty()) {
+        //kept in its own subdirectory, because the temporary path is itself usually a search path
+        QString dirpath = MLUtil::tempPath() + "/checksum_index";
+        MLUtil::mkdirIfNeeded(dirpath);
+        d->m_index_path = dirpath + "/checksum_index.dat";
+    }
+}
+
+ChecksumIndex::~ChecksumIndex()
+{
+    delete d;
+}
+
+QString ChecksumIndex::findFile(const QStringList& search_paths, qint64 size, const QString& checksum, const QString& checksum1000_optional, bool update_index, const QString& checksum_type)
+{
+    d->load();
+    QString ret;
+    foreach (QString search_path, search_paths) {
+        ret = d->find_in_index(QDir(search_path).absolutePath(), size, checksum, checksum1000_optional, checksum_type);
+        if (!ret.isEmpty())
+            break;
+    }
+    if ((ret.isEmpty()) && (update_index)) {
+        update(search_paths);
+        foreach (QString search_path, search_paths) {
+            ret = d->find_in_index(QDir(search_path).absolutePath(), size, checksum, checksum1000_optional, checksum_type);
+            if (!ret.isEmpty())
+                break;
+        }
+    }
+    d->save(); //the lazily computed checksums are worth keeping even if we did not find it
+    return ret;
+}
+
+void ChecksumIndex::update(const QStringList& search_paths)
+{
+    d->load();
+    QSet<QString> visited;
+    foreach (QString search_path, search_paths) {
+        d->refresh_directory(QDir(search_path).absolutePath(), visited);
+    }
+    d->save();
+}
+
+void ChecksumIndexPrivate::load()
+{
+    if (m_loaded)
+        return;
+    m_loaded = true;
+    m_directories.clear();
+    QFile ff(m_index_path);
+    if (!ff.open(QFile::ReadOnly))
+        return;
+    QDataStream in(&ff);
+    quint32 magic;
+    qint32 version;
+    in >> magic >> version;
+    if ((magic != CHECKSUM_INDEX_MAGIC) || (version != CHECKSUM_INDEX_VERSION)) {
+        qWarning() << "Ignoring checksum index with unexpected format: " + m_index_path;
+        return;
+    }
+    in >> m_directories;
+    if (in.status() != QDataStream::Ok) {
+        qWarning() << "Problem reading checksum index: " + m_index_path;
+        m_directories.clear();
+    }
+}
+
+void ChecksumIndexPrivate::save()
+{
+    if (!m_modified)
+        return;
+    //other processes may be updating the index at the same time -- the last one wins, which only costs us some rescanning
+    QString tmp_path = m_index_path + ".tmp." + MLUtil::makeRandomId();
+    {
+        QFile ff(tmp_path);
+        if (!ff.open(QFile::WriteOnly)) {
+            qWarning() << "Unable to write checksum index: " + tmp_path;
+            return;
+        }
+        QDataStream out(&ff);
+        out << (quint32)CHECKSUM_INDEX_MAGIC << (qint32)CHECKSUM_INDEX_VERSION;
+        out << m_directories;
+    }
+    if (::rename(tmp_path.toUtf8().data(), m_index_path.toUtf8().data()) != 0) {
+        QFile::remove(tmp_path);
+        return;
+    }
+    m_modified = false;
+}
+
+void ChecksumIndexPrivate::refresh_directory(const QString& path, QSet<QString>& visited)
+{
+    struct stat SS;
+    if ((stat(path.toUtf8().data(), &SS) != 0) || (!S_ISDIR(SS.st_mode))) {
+        remove_directory(path);
+        return;
+    }
+    //guard against cycles through symbolic links
+    QString id = QString("%1:%2").arg(SS.st_dev).arg(SS.st_ino);
+    if (visited.contains(id))
+        return;
+    visited.insert(id);
+
+    qint64 mtime = SS.st_mtime;
+    if ((m_directories.contains(path)) && (m_directories[path].mtime == mtime)) {
+        QStringList subdirs = m_directories[path].subdirs;
+        foreach (QString subdir, subdirs) {
+            refresh_directory(path + "/" + subdir, visited);
+        }
+        return;
+    }
+
+    ChecksumIndexDirectory old = m_directories.value(path);
+    QMap<QString, ChecksumIndexFile> old_files;
+    foreach (ChecksumIndexFile F, old.files) {
+        old_files[F.name] = F;
+    }
+
+    ChecksumIndexDirectory D;
+    //the mtime has a resolution of one second, so a directory that changed very recently may change again unnoticed
+    if (QDateTime::currentDateTime().toTime_t() - mtime > 1)
+        D.mtime = mtime;
+    QStringList fnames = QDir(path).entryList(QStringList("*"), QDir::Files);
+    foreach (QString fname, fnames) {
+        ChecksumIndexFile F;
+        F.name = fname;
+        if (!stat_file(path + "/" + fname, F))
+            continue;
+        if (old_files.contains(fname)) {
+            ChecksumIndexFile F0 = old_files[fname];
+            if ((F0.size == F.size) && (F0.inode == F.inode) && (F0.mtime == F.mtime)) {
+                F.checksum1000 = F0.checksum1000;
+                F.sha1 = F0.sha1;
+                F.sha1tree = F0.sha1tree;
+            }
+        }
+        D.files << F;
+    }
+    D.subdirs = QDir(path).entryList(QStringList("*"), QDir::Dirs | QDir::NoDotAndDotDot);
+    foreach (QString subdir, old.subdirs) {
+        if (!D.subdirs.contains(subdir))
+            remove_directory(path + "/" + subdir);
+    }
+    m_directories[path] = D;
+    m_modified = true;
+
+    foreach (QString subdir, D.subdirs) {
+        refresh_directory(path + "/" + subdir, visited);
+    }
+}
+
+void ChecksumIndexPrivate::remove_directory(const QString& path)
+{
+    if (!m_directories.contains(path))
+        return;
+    QStringList subdirs = m_directories[path].subdirs;
+    m_directories.remove(path);
+    m_modified = true;
+    foreach (QString subdir, subdirs) {
+        remove_directory(path + "/" + subdir);
+    }
+}
+
+QString ChecksumIndexPrivate::find_in_index(const QString& root, qint64 size, const QString& checksum, const QString& checksum1000_optional, const QString& checksum_type)
+{
+    //the map is sorted by path, so the directories within root are contiguous (apart from siblings like root2, which we skip)
+    QMap<QString, ChecksumIndexDirectory>::iterator it = m_directories.lowerBound(root);
+    while ((it != m_directories.end()) && (it.key().startsWith(root))) {
+        if ((it.key() == root) || (it.key().startsWith(root + "/"))) {
+            QList<ChecksumIndexFile>& files = it.value().files;
+            for (int i = 0; i < files.count(); i++) {
+                if (files[i].size == size) {
+                    if (file_matches(it.key(), files[i], size, checksum, checksum1000_optional, checksum_type))
+                        return it.key() + "/" + files[i].name;
+                }
+            }
+        }
+        ++it;
+    }
+    return "";
+}
+
+bool ChecksumIndexPrivate::file_matches(const QString& dirpath, ChecksumIndexFile& F, qint64 size, const QString& checksum, const QString& checksum1000_optional, const QString& checksum_type)
+{
+    QString path = dirpath + "/" + F.name;
+    ChecksumIndexFile F1;
+    F1.name = F.name;
+    if (!stat_file(path, F1))
+        return false;
+    if ((F1.size != F.size) || (F1.inode != F.inode) || (F1.mtime != F.mtime)) {
+        //the file has changed since it was indexed
+        F = F1;
+        m_modified = true;
+        if (F.size != size)
+            return false;
+    }
+    if (!checksum1000_optional.isEmpty()) {
+        if (F.checksum1000.isEmpty()) {
+            F.checksum1000 = MLUtil::computeSha1SumOfFileHead(path, 1000);
+            m_modified = true;
+        }
+        if (F.checksum1000 != checksum1000_optional)
+            return false;
+    }
+    if (checksum_type == "sha1tree") {
+        if (F.sha1tree.isEmpty()) {
+            F.sha1tree = MLUtil::computeChecksumOfFile(path, checksum_type);
+            m_modified = true;
+        }
+        return (F.sha1tree == checksum);
+    }
+    if (F.sha1.isEmpty()) {
+        F.sha1 = MLUtil::computeSha1SumOfFile(path);
+        m_modified = true;
+    }
+    return (F.sha1 == checksum);
+}
+
+bool ChecksumIndexPrivate::stat_file(const QString& path, ChecksumIndexFile& F)
+{
+    struct stat SS;
+    if (stat(path.toUtf8().data(), &SS) != 0)
+        return false;
+    F.size = SS.st_size;
+    F.inode = SS.st_ino;
+    F.mtime = SS.st_mtime;
+    return true;
+}
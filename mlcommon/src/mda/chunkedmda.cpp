@@ -0,0 +1,696 @@
+/******************************************************
+** See the accompanying README and LICENSE files
+*******************************************************/
+
+#include "chunkedmda.h"
+
+#include <QAtomicInt>
+#include <QDebug>
+#include <QMap>
+#include <QThread>
+#include <QVector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#define CHUNKED_MDA_MAGIC "MDACHUNK"
+#define CHUNKED_MDA_MAGIC_SIZE 8
+#define CHUNKED_MDA_VERSION 1
+#define CHUNKED_MDA_DEFAULT_CHUNK_ENTRIES (1024 * 1024)
+#define CHUNKED_MDA_DEFAULT_MAX_CACHE_BYTES (64 * 1024 * 1024)
+
+namespace {
+
+int num_bytes_per_entry_for_type(int data_type)
+{
+    switch (data_type) {
+    case MDAIO_TYPE_BYTE:
+        return 1;
+    case MDAIO_TYPE_INT16:
+    case MDAIO_TYPE_UINT16:
+        return 2;
+    case MDAIO_TYPE_INT32:
+    case MDAIO_TYPE_UINT32:
+    case MDAIO_TYPE_FLOAT32:
+        return 4;
+    case MDAIO_TYPE_FLOAT64:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+bool is_integer_type(int data_type)
+{
+    return ((data_type == MDAIO_TYPE_BYTE) || (data_type == MDAIO_TYPE_INT16) || (data_type == MDAIO_TYPE_UINT16) || (data_type == MDAIO_TYPE_INT32) || (data_type == MDAIO_TYPE_UINT32));
+}
+
+bool pread_all(int fd, void* buf, qint64 num, qint64 offset)
+{
+    qint64 total = 0;
+    while (total < num) {
+        ssize_t num0 = ::pread(fd, (char*)buf + total, num - total, offset + total);
+        if (num0 < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        if (num0 == 0)
+            return false;
+        total += num0;
+    }
+    return true;
+}
+
+//unsigned arithmetic, so that the wrap-around is well defined and the decoding exact
+template <typename T>
+void delta_encode(T* X, long N, long stride)
+{
+    for (long i = N - 1; i >= stride; i--) {
+        X[i] = (T)(X[i] - X[i - stride]);
+    }
+}
+
+template <typename T>
+void delta_decode(T* X, long N, long stride)
+{
+    for (long i = stride; i < N; i++) {
+        X[i] = (T)(X[i] + X[i - stride]);
+    }
+}
+
+void apply_delta(char* data, long N, int num_bytes_per_entry, long stride, bool encode)
+{
+    if (num_bytes_per_entry == 1) {
+        if (encode)
+            delta_encode((quint8*)data, N, stride);
+        else
+            delta_decode((quint8*)data, N, stride);
+    }
+    else if (num_bytes_per_entry == 2) {
+        if (encode)
+            delta_encode((quint16*)data, N, stride);
+        else
+            delta_decode((quint16*)data, N, stride);
+    }
+    else if (num_bytes_per_entry == 4) {
+        if (encode)
+            delta_encode((quint32*)data, N, stride);
+        else
+            delta_decode((quint32*)data, N, stride);
+    }
+}
+
+QByteArray shuffle_bytes(const QByteArray& X, int num_bytes_per_entry, bool forward)
+{
+    long N = X.count() / num_bytes_per_entry;
+    QByteArray ret(X.count(), 0);
+    const char* src = X.data();
+    char* dst = ret.data();
+    for (int b = 0; b < num_bytes_per_entry; b++) {
+        for (long i = 0; i < N; i++) {
+            if (forward)
+                dst[b * N + i] = src[i * num_bytes_per_entry + b];
+            else
+                dst[i * num_bytes_per_entry + b] = src[b * N + i];
+        }
+    }
+    return ret;
+}
+
+struct ChunkCodec {
+    int num_bytes_per_entry = 0;
+    long stride = 1;
+    int filters = 0;
+    int compression_level = 6;
+
+    QByteArray encode(QByteArray raw) const
+    {
+        if (filters & CHUNKED_MDA_FILTER_DELTA)
+            apply_delta(raw.data(), raw.count() / num_bytes_per_entry, num_bytes_per_entry, stride, true);
+        if (filters & CHUNKED_MDA_FILTER_SHUFFLE)
+            raw = shuffle_bytes(raw, num_bytes_per_entry, true);
+        return qCompress(raw, compression_level);
+    }
+    QByteArray decode(const QByteArray& compressed) const
+    {
+        QByteArray raw = qUncompress(compressed);
+        if (filters & CHUNKED_MDA_FILTER_SHUFFLE)
+            raw = shuffle_bytes(raw, num_bytes_per_entry, false);
+        if (filters & CHUNKED_MDA_FILTER_DELTA)
+            apply_delta(raw.data(), raw.count() / num_bytes_per_entry, num_bytes_per_entry, stride, false);
+        return raw;
+    }
+};
+
+class ChunkCodecThread : public QThread {
+public:
+    //input
+    ChunkCodec codec;
+    bool encode = false;
+    const QByteArray* inputs = 0;
+    int num = 0;
+    QAtomicInt* next_index = 0;
+
+    //output
+    QByteArray* outputs = 0;
+
+    void run()
+    {
+        while (true) {
+            int ii = next_index->fetchAndAddOrdered(1);
+            if (ii >= num)
+                break;
+            if (encode)
+                outputs[ii] = codec.encode(inputs[ii]);
+            else
+                outputs[ii] = codec.decode(inputs[ii]);
+        }
+    }
+};
+
+//encode or decode a batch of chunks in parallel
+QVector<QByteArray> run_codec(const ChunkCodec& codec, bool encode, const QVector<QByteArray>& inputs)
+{
+    QVector<QByteArray> outputs(inputs.count());
+    QAtomicInt next_index(0);
+    int num_threads = qMin(QThread::idealThreadCount(), inputs.count());
+    if (num_threads <= 1) {
+        for (int i = 0; i < inputs.count(); i++) {
+            outputs[i] = encode ? codec.encode(inputs[i]) : codec.decode(inputs[i]);
+        }
+        return outputs;
+    }
+    QList<ChunkCodecThread*> threads;
+    for (int i = 0; i < num_threads; i++) {
+        ChunkCodecThread* T = new ChunkCodecThread;
+        T->codec = codec;
+        T->encode = encode;
+        T->inputs = inputs.data();
+        T->num = inputs.count();
+        T->next_index = &next_index;
+        T->outputs = outputs.data();
+        T->start();
+        threads << T;
+    }
+    foreach (ChunkCodecThread* T, threads) {
+        T->wait();
+        delete T;
+    }
+    return outputs;
+}
+
+template <typename T, typename Out>
+void convert_entries(const char* src, Out* dst, long N)
+{
+    const T* X = (const T*)src;
+    for (long i = 0; i < N; i++) {
+        dst[i] = (Out)X[i];
+    }
+}
+
+template <typename Out>
+void convert_from_type(int data_type, const char* src, Out* dst, long N)
+{
+    switch (data_type) {
+    case MDAIO_TYPE_BYTE:
+        convert_entries<quint8>(src, dst, N);
+        break;
+    case MDAIO_TYPE_INT16:
+        convert_entries<qint16>(src, dst, N);
+        break;
+    case MDAIO_TYPE_UINT16:
+        convert_entries<quint16>(src, dst, N);
+        break;
+    case MDAIO_TYPE_INT32:
+        convert_entries<qint32>(src, dst, N);
+        break;
+    case MDAIO_TYPE_UINT32:
+        convert_entries<quint32>(src, dst, N);
+        break;
+    case MDAIO_TYPE_FLOAT32:
+        convert_entries<float>(src, dst, N);
+        break;
+    case MDAIO_TYPE_FLOAT64:
+        convert_entries<double>(src, dst, N);
+        break;
+    }
+}
+
+template <typename T>
+void convert_double_entries(const double* src, char* dst, long N)
+{
+    T* X = (T*)dst;
+    for (long i = 0; i < N; i++) {
+        X[i] = (T)src[i];
+    }
+}
+
+void convert_to_type(int data_type, const double* src, char* dst, long N)
+{
+    switch (data_type) {
+    case MDAIO_TYPE_BYTE:
+        convert_double_entries<quint8>(src, dst, N);
+        break;
+    case MDAIO_TYPE_INT16:
+        convert_double_entries<qint16>(src, dst, N);
+        break;
+    case MDAIO_TYPE_UINT16:
+        convert_double_entries<quint16>(src, dst, N);
+        break;
+    case MDAIO_TYPE_INT32:
+        convert_double_entries<qint32>(src, dst, N);
+        break;
+    case MDAIO_TYPE_UINT32:
+        convert_double_entries<quint32>(src, dst, N);
+        break;
+    case MDAIO_TYPE_FLOAT32:
+        convert_double_entries<float>(src, dst, N);
+        break;
+    case MDAIO_TYPE_FLOAT64:
+        convert_double_entries<double>(src, dst, N);
+        break;
+    }
+}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// ChunkedMdaReader
+
+class ChunkedMdaReaderPrivate {
+public:
+    ChunkedMdaReader* q;
+    int m_fd = -1;
+    MDAIO_HEADER m_header;
+    ChunkCodec m_codec;
+    long m_chunk_size = 0;
+    long m_total_size = 0;
+    QVector<qint64> m_offsets; //num_chunks+1
+
+    //the decoded chunks, least recently used first
+    QMap<long, QByteArray> m_cache;
+    QList<long> m_cache_order;
+    long m_cache_bytes = 0;
+    long m_max_cache_bytes = CHUNKED_MDA_DEFAULT_MAX_CACHE_BYTES;
+
+    bool read_header();
+    bool load_chunks(const QList<long>& chunk_indices, QMap<long, QByteArray>& decoded);
+    void add_to_cache(long chunk_index, const QByteArray& X);
+    template <typename Out>
+    long read(Out* dst, long i, long num);
+};
+
+ChunkedMdaReader::ChunkedMdaReader()
+{
+    d = new ChunkedMdaReaderPrivate;
+    d->q = this;
+}
+
+ChunkedMdaReader::~ChunkedMdaReader()
+{
+    close();
+    delete d;
+}
+
+bool ChunkedMdaReader::isChunkedMda(const QString& path)
+{
+    FILE* inf = fopen(path.toUtf8().data(), "rb");
+    if (!inf)
+        return false;
+    char magic[CHUNKED_MDA_MAGIC_SIZE];
+    bool ret = ((fread(magic, 1, CHUNKED_MDA_MAGIC_SIZE, inf) == CHUNKED_MDA_MAGIC_SIZE) && (memcmp(magic, CHUNKED_MDA_MAGIC, CHUNKED_MDA_MAGIC_SIZE) == 0));
+    fclose(inf);
+    return ret;
+}
+
+bool ChunkedMdaReader::open(const QString& path)
+{
+    close();
+    d->m_fd = ::open(path.toUtf8().data(), O_RDONLY);
+    if (d->m_fd < 0)
+        return false;
+    if (!d->read_header()) {
+        qWarning() << "Problem reading header of chunked mda: " + path;
+        close();
+        return false;
+    }
+    return true;
+}
+
+void ChunkedMdaReader::close()
+{
+    if (d->m_fd >= 0)
+        ::close(d->m_fd);
+    d->m_fd = -1;
+    d->m_offsets.clear();
+    d->m_cache.clear();
+    d->m_cache_order.clear();
+    d->m_cache_bytes = 0;
+}
+
+bool ChunkedMdaReader::isOpen() const
+{
+    return (d->m_fd >= 0);
+}
+
+MDAIO_HEADER ChunkedMdaReader::header() const
+{
+    return d->m_header;
+}
+
+long ChunkedMdaReader::totalSize() const
+{
+    return d->m_total_size;
+}
+
+long ChunkedMdaReader::read(double* dst, long i, long num)
+{
+    return d->read(dst, i, num);
+}
+
+long ChunkedMdaReader::read(float* dst, long i, long num)
+{
+    return d->read(dst, i, num);
+}
+
+void ChunkedMdaReader::setMaxCacheBytes(long num_bytes)
+{
+    d->m_max_cache_bytes = num_bytes;
+}
+
+bool ChunkedMdaReaderPrivate::read_header()
+{
+    qint64 pos = 0;
+    char magic[CHUNKED_MDA_MAGIC_SIZE];
+    if (!pread_all(m_fd, magic, CHUNKED_MDA_MAGIC_SIZE, pos))
+        return false;
+    if (memcmp(magic, CHUNKED_MDA_MAGIC, CHUNKED_MDA_MAGIC_SIZE) != 0)
+        return false;
+    pos += CHUNKED_MDA_MAGIC_SIZE;
+    qint32 version;
+    qint32 hdr[3];
+    if (!pread_all(m_fd, &version, 4, pos))
+        return false;
+    pos += 4;
+    if (version != CHUNKED_MDA_VERSION) {
+        qWarning() << "Unsupported chunked mda version" << version;
+        return false;
+    }
+    if (!pread_all(m_fd, hdr, 12, pos))
+        return false;
+    pos += 12;
+    for (int i = 0; i < MDAIO_MAX_DIMS; i++)
+        m_header.dims[i] = 1;
+    m_header.data_type = hdr[0];
+    m_header.num_bytes_per_entry = hdr[1];
+    m_header.num_dims = hdr[2];
+    if ((m_header.num_bytes_per_entry != num_bytes_per_entry_for_type(m_header.data_type)) || (m_header.num_bytes_per_entry == 0))
+        return false;
+    if ((m_header.num_dims <= 0) || (m_header.num_dims > MDAIO_MAX_DIMS))
+        return false;
+    if (!pread_all(m_fd, m_header.dims, 4 * m_header.num_dims, pos))
+        return false;
+    pos += 4 * m_header.num_dims;
+    m_total_size = 1;
+    for (int i = 0; i < m_header.num_dims; i++)
+        m_total_size *= m_header.dims[i];
+
+    qint32 filters;
+    qint64 vals[3]; //chunk_size, num_chunks, index_offset
+    if (!pread_all(m_fd, &filters, 4, pos))
+        return false;
+    pos += 4;
+    if (!pread_all(m_fd, vals, 24, pos))
+        return false;
+    pos += 24;
+    m_header.header_size = pos;
+    m_chunk_size = vals[0];
+    long num_chunks = vals[1];
+    if ((m_chunk_size <= 0) || (num_chunks != (m_total_size + m_chunk_size - 1) / m_chunk_size))
+        return false;
+    m_offsets.resize(num_chunks + 1);
+    if (!pread_all(m_fd, m_offsets.data(), 8 * (num_chunks + 1), vals[2]))
+        return false;
+
+    m_codec.num_bytes_per_entry = m_header.num_bytes_per_entry;
+    m_codec.stride = m_header.dims[0];
+    m_codec.filters = filters;
+    return true;
+}
+
+bool ChunkedMdaReaderPrivate::load_chunks(const QList<long>& chunk_indices, QMap<long, QByteArray>& decoded)
+{
+    //read sequentially (that is what the file system likes), then decompress in parallel
+    QVector<QByteArray> compressed;
+    foreach (long ind, chunk_indices) {
+        qint64 num_bytes = m_offsets[ind + 1] - m_offsets[ind];
+        QByteArray X(num_bytes, 0);
+        if (!pread_all(m_fd, X.data(), num_bytes, m_offsets[ind])) {
+            qWarning() << "Problem reading chunk of chunked mda" << ind;
+            return false;
+        }
+        compressed << X;
+    }
+    QVector<QByteArray> raw = run_codec(m_codec, false, compressed);
+    for (int i = 0; i < chunk_indices.count(); i++) {
+        long ind = chunk_indices[i];
+        long expected_size = qMin(m_chunk_size, m_total_size - ind * m_chunk_size) * m_header.num_bytes_per_entry;
+        if (raw[i].count() != expected_size) {
+            qWarning() << "Problem decompressing chunk of chunked mda" << ind << raw[i].count() << expected_size;
+            return false;
+        }
+        decoded[ind] = raw[i];
+    }
+    return true;
+}
+
+void ChunkedMdaReaderPrivate::add_to_cache(long chunk_index, const QByteArray& X)
+{
+    if (m_cache.contains(chunk_index)) {
+        m_cache_order.removeOne(chunk_index);
+        m_cache_order << chunk_index;
+        return;
+    }
+    m_cache[chunk_index] = X;
+    m_cache_order << chunk_index;
+    m_cache_bytes += X.count();
+    while ((m_cache_bytes > m_max_cache_bytes) && (m_cache_order.count() > 1)) {
+        long ind = m_cache_order.takeFirst();
+        m_cache_bytes -= m_cache[ind].count();
+        m_cache.remove(ind);
+    }
+}
+
+template <typename Out>
+long ChunkedMdaReaderPrivate::read(Out* dst, long i, long num)
+{
+    if ((m_fd < 0) || (i < 0) || (i + num > m_total_size))
+        return 0;
+    if (num <= 0)
+        return 0;
+    long c1 = i / m_chunk_size;
+    long c2 = (i + num - 1) / m_chunk_size;
+    //a batch of chunks at a time, so that a huge read does not need all of them in memory
+    long batch_size = qMax(1, QThread::idealThreadCount());
+    for (long cA = c1; cA <= c2; cA += batch_size) {
+        long cB = qMin(cA + batch_size - 1, c2);
+        QMap<long, QByteArray> chunks;
+        QList<long> to_load;
+        for (long c = cA; c <= cB; c++) {
+            if (m_cache.contains(c))
+                chunks[c] = m_cache[c];
+            else
+                to_load << c;
+        }
+        if (!to_load.isEmpty()) {
+            if (!load_chunks(to_load, chunks))
+                return 0;
+        }
+        for (long c = cA; c <= cB; c++) {
+            long jA = qMax(i, c * m_chunk_size);
+            long jB = qMin(i + num, (c + 1) * m_chunk_size);
+            const char* src = chunks[c].data() + (jA - c * m_chunk_size) * m_header.num_bytes_per_entry;
+            convert_from_type(m_header.data_type, src, dst + (jA - i), jB - jA);
+            add_to_cache(c, chunks[c]);
+        }
+    }
+    return num;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// ChunkedMdaWriter
+
+class ChunkedMdaWriterPrivate {
+public:
+    ChunkedMdaWriter* q;
+    FILE* m_file = 0;
+    int m_data_type = 0;
+    ChunkCodec m_codec;
+    long m_chunk_size = 0;
+    long m_total_size = 0;
+    long m_num_entries_written = 0;
+    qint64 m_index_offset_position = 0;
+    qint64 m_position = 0;
+    QVector<qint64> m_offsets;
+    QByteArray m_current_chunk;
+    QVector<QByteArray> m_pending_chunks;
+    bool m_error = false;
+
+    bool write_bytes(const void* data, qint64 num);
+    bool flush_pending_chunks();
+};
+
+ChunkedMdaWriter::ChunkedMdaWriter()
+{
+    d = new ChunkedMdaWriterPrivate;
+    d->q = this;
+}
+
+ChunkedMdaWriter::~ChunkedMdaWriter()
+{
+    if (d->m_file) {
+        qWarning() << "ChunkedMdaWriter was not closed. The file is incomplete.";
+        fclose(d->m_file);
+    }
+    delete d;
+}
+
+bool ChunkedMdaWriter::open(const QString& path, int data_type, const QList<long>& dims, long chunk_size, int compression_level)
+{
+    int num_bytes_per_entry = num_bytes_per_entry_for_type(data_type);
+    if (!num_bytes_per_entry) {
+        qWarning() << "Unsupported data type for chunked mda" << data_type;
+        return false;
+    }
+    if ((dims.isEmpty()) || (dims.count() > MDAIO_MAX_DIMS)) {
+        qWarning() << "Unexpected number of dimensions for chunked mda" << dims.count();
+        return false;
+    }
+    d->m_file = fopen(path.toUtf8().data(), "wb");
+    if (!d->m_file) {
+        qWarning() << "Unable to open chunked mda for writing: " + path;
+        return false;
+    }
+    d->m_data_type = data_type;
+    d->m_total_size = 1;
+    foreach (long N, dims) {
+        d->m_total_size *= N;
+    }
+    long N1 = dims[0];
+    if (chunk_size <= 0)
+        chunk_size = qMax(1L, CHUNKED_MDA_DEFAULT_CHUNK_ENTRIES / qMax(1L, N1));
+    d->m_chunk_size = qMax(1L, chunk_size * N1); //whole columns, so that the delta encoding lines up
+    d->m_codec.num_bytes_per_entry = num_bytes_per_entry;
+    d->m_codec.stride = N1;
+    d->m_codec.compression_level = compression_level;
+    d->m_codec.filters = 0;
+    if (is_integer_type(data_type))
+        d->m_codec.filters |= CHUNKED_MDA_FILTER_DELTA;
+    if (num_bytes_per_entry > 1)
+        d->m_codec.filters |= CHUNKED_MDA_FILTER_SHUFFLE;
+    d->m_num_entries_written = 0;
+    d->m_position = 0;
+    d->m_offsets.clear();
+    d->m_current_chunk.clear();
+    d->m_pending_chunks.clear();
+    d->m_error = false;
+
+    qint32 version = CHUNKED_MDA_VERSION;
+    qint32 hdr[3] = { data_type, num_bytes_per_entry, dims.count() };
+    d->write_bytes(CHUNKED_MDA_MAGIC, CHUNKED_MDA_MAGIC_SIZE);
+    d->write_bytes(&version, 4);
+    d->write_bytes(hdr, 12);
+    foreach (long N, dims) {
+        qint32 N0 = N;
+        d->write_bytes(&N0, 4);
+    }
+    qint32 filters = d->m_codec.filters;
+    d->write_bytes(&filters, 4);
+    qint64 vals[3] = { d->m_chunk_size, (d->m_total_size + d->m_chunk_size - 1) / d->m_chunk_size, 0 };
+    d->m_index_offset_position = d->m_position + 16;
+    d->write_bytes(vals, 24);
+    return !d->m_error;
+}
+
+bool ChunkedMdaWriter::write(const double* data, long num)
+{
+    if (!d->m_file)
+        return false;
+    if (d->m_num_entries_written + num > d->m_total_size) {
+        qWarning() << "Too many entries written to chunked mda";
+        d->m_error = true;
+        return false;
+    }
+    int bpe = d->m_codec.num_bytes_per_entry;
+    long batch_size = qMax(1, QThread::idealThreadCount());
+    long i = 0;
+    while (i < num) {
+        long num0 = qMin(num - i, d->m_chunk_size - d->m_current_chunk.count() / bpe);
+        long old_size = d->m_current_chunk.count();
+        d->m_current_chunk.resize(old_size + num0 * bpe);
+        convert_to_type(d->m_data_type, data + i, d->m_current_chunk.data() + old_size, num0);
+        i += num0;
+        d->m_num_entries_written += num0;
+        if (d->m_current_chunk.count() / bpe == d->m_chunk_size) {
+            d->m_pending_chunks << d->m_current_chunk;
+            d->m_current_chunk.clear();
+            if (d->m_pending_chunks.count() >= batch_size) {
+                if (!d->flush_pending_chunks())
+                    return false;
+            }
+        }
+    }
+    return !d->m_error;
+}
+
+bool ChunkedMdaWriter::close()
+{
+    if (!d->m_file)
+        return false;
+    if (d->m_num_entries_written != d->m_total_size) {
+        qWarning() << "Unexpected number of entries written to chunked mda" << d->m_num_entries_written << d->m_total_size;
+        d->m_error = true;
+    }
+    if (!d->m_current_chunk.isEmpty()) {
+        d->m_pending_chunks << d->m_current_chunk;
+        d->m_current_chunk.clear();
+    }
+    d->flush_pending_chunks();
+    qint64 index_offset = d->m_position;
+    d->m_offsets << d->m_position; //the end of the final chunk
+    d->write_bytes(d->m_offsets.data(), 8 * d->m_offsets.count());
+    if (fseek(d->m_file, d->m_index_offset_position, SEEK_SET) != 0)
+        d->m_error = true;
+    d->write_bytes(&index_offset, 8);
+    if (fclose(d->m_file) != 0)
+        d->m_error = true;
+    d->m_file = 0;
+    return !d->m_error;
+}
+
+bool ChunkedMdaWriterPrivate::write_bytes(const void* data, qint64 num)
+{
+    if (m_error)
+        return false;
+    if ((qint64)fwrite(data, 1, num, m_file) != num) {
+        qWarning() << "Problem writing to chunked mda";
+        m_error = true;
+        return false;
+    }
+    m_position += num;
+    return true;
+}
+
+bool ChunkedMdaWriterPrivate::flush_pending_chunks()
+{
+    if (m_pending_chunks.isEmpty())
+        return !m_error;
+    QVector<QByteArray> compressed = run_codec(m_codec, true, m_pending_chunks);
+    m_pending_chunks.clear();
+    foreach (QByteArray X, compressed) {
+        m_offsets << m_position;
+        write_bytes(X.data(), X.count());
+    }
+    return !m_error;
+}
@@ -1,6 +1,7 @@
 #include "diskreadmda.h"
 #include <stdio.h>
 #include "mdaio.h"
+#include "chunkedmda.h"
 #include <math.h>
 #include <QFile>
 #include <QCryptographicHash>
@@ -32,6 +33,7 @@ public:
     long m_current_internal_chunk_index;
     Mda m_memory_mda;
     bool m_use_memory_mda;
+    ChunkedMdaReader m_chunked; //open when the file is a chunked (compressed) mda
 
 #ifdef USE_REMOTE_READ_MDA
     bool m_use_remote_mda;
@@ -43,6 +45,7 @@ public:
     void construct_and_clear();
     bool read_header_if_needed();
     bool open_file_if_needed();
+    long read_entries(double* dst, long i, long num);
     void copy_from(const DiskReadMda& other);
     long total_size();
 };
@@ -65,6 +68,16 @@ DiskReadMda::DiskReadMda(const DiskReadMda& other)
     d->copy_from(other);
 }
 
+DiskReadMda::DiskReadMda(DiskReadMda&& other)
+{
+    //take over the open file and any cached chunk, leaving other empty
+    d = other.d;
+    d->q = this;
+    other.d = new DiskReadMdaPrivate;
+    other.d->q = &other;
+    other.d->construct_and_clear();
+}
+
 DiskReadMda::DiskReadMda(const Mda& X)
 {
     d = new DiskReadMdaPrivate;
@@ -107,6 +120,22 @@ void DiskReadMda::operator=(const DiskReadMda& other)
     d->copy_from(other);
 }
 
+void DiskReadMda::operator=(DiskReadMda&& other)
+{
+    if (&other == this)
+        return;
+    qSwap(d, other.d);
+    d->q = this;
+    other.d->q = &other;
+    //release what we held before
+    if (other.d->m_file) {
+        fclose(other.d->m_file);
+        other.d->m_file = 0;
+    }
+    other.d->construct_and_clear();
+    other.d->m_prv_object = QJsonObject();
+}
+
 void DiskReadMda::setPath(const QString& file_path)
 {
     if (d->m_file) {
@@ -405,8 +434,8 @@ bool DiskReadMda::readChunk(Mda& X, long i, long size) const
     long jB = qMin(i + size - 1, d->total_size() - 1);
     long size_to_read = jB - jA + 1;
     if (size_to_read > 0) {
-        fseek(d->m_file, d->m_header.header_size + d->m_header.num_bytes_per_entry * (jA), SEEK_SET);
-        long bytes_read = mda_read_float64(&X.dataPtr()[jA - i], &d->m_header, size_to_read, d->m_file);
+        TaskManager::TaskProgressLatencyTimer latency_timer("DiskReadMda::readChunk");
+        long bytes_read = d->read_entries(&X.dataPtr()[jA - i], jA, size_to_read);
         TaskManager::TaskProgressMonitor::globalInstance()->incrementQuantity("bytes_read", bytes_read);
         if (bytes_read != size_to_read) {
             printf("Warning problem reading chunk in diskreadmda: %ld<>%ld\n", bytes_read, size_to_read);
@@ -452,8 +481,8 @@ bool DiskReadMda::readChunk(Mda& X, long i1, long i2, long size1, long size2) co
         long jB = qMin(i2 + size2 - 1, N2() - 1);
         long size2_to_read = jB - jA + 1;
         if (size2_to_read > 0) {
-            fseek(d->m_file, d->m_header.header_size + d->m_header.num_bytes_per_entry * (i1 + N1() * jA), SEEK_SET);
-            long bytes_read = mda_read_float64(&X.dataPtr()[(jA - i2) * size1], &d->m_header, size1 * size2_to_read, d->m_file);
+            TaskManager::TaskProgressLatencyTimer latency_timer("DiskReadMda::readChunk");
+            long bytes_read = d->read_entries(&X.dataPtr()[(jA - i2) * size1], i1 + N1() * jA, size1 * size2_to_read);
             TaskManager::TaskProgressMonitor::globalInstance()->incrementQuantity("bytes_read", bytes_read);
             if (bytes_read != size1 * size2_to_read) {
                 printf("Warning problem reading 2d chunk in diskreadmda: %ld<>%ld\n", bytes_read, size1 * size2);
@@ -510,8 +539,8 @@ bool DiskReadMda::readChunk(Mda& X, long i1, long i2, long i3, long size1, long
         long jB = qMin(i3 + size3 - 1, N3() - 1);
         long size3_to_read = jB - jA + 1;
         if (size3_to_read > 0) {
-            fseek(d->m_file, d->m_header.header_size + d->m_header.num_bytes_per_entry * (i1 + N1() * i2 + N1() * N2() * jA), SEEK_SET);
-            long bytes_read = mda_read_float64(&X.dataPtr()[(jA - i3) * size1 * size2], &d->m_header, size1 * size2 * size3_to_read, d->m_file);
+            TaskManager::TaskProgressLatencyTimer latency_timer("DiskReadMda::readChunk");
+            long bytes_read = d->read_entries(&X.dataPtr()[(jA - i3) * size1 * size2], i1 + N1() * i2 + N1() * N2() * jA, size1 * size2 * size3_to_read);
             TaskManager::TaskProgressMonitor::globalInstance()->incrementQuantity("bytes_read", bytes_read);
             if (bytes_read != size1 * size2 * size3_to_read) {
                 printf("Warning problem reading 3d chunk in diskreadmda: %ld<>%ld\n", bytes_read, size1 * size2 * size3_to_read);
@@ -576,6 +605,7 @@ void DiskReadMdaPrivate::construct_and_clear()
     m_file = 0;
     m_current_internal_chunk_index = -1;
     m_use_memory_mda = false;
+    m_chunked.close();
     m_header_read = false;
     m_reshaped = false;
 #ifdef USE_REMOTE_READ_MDA
@@ -612,6 +642,7 @@ bool DiskReadMdaPrivate::read_header_if_needed()
     if (!file_was_open) {
         fclose(m_file);
         m_file = 0;
+        m_chunked.close();
     }
     return true;
 }
@@ -632,9 +663,20 @@ bool DiskReadMdaPrivate::open_file_if_needed()
         return false;
     m_file = fopen(m_path.toUtf8().data(), "rb");
     if (m_file) {
+        if (ChunkedMdaReader::isChunkedMda(m_path)) {
+            if (!m_chunked.open(m_path)) {
+                fclose(m_file);
+                m_file = 0;
+                m_file_open_failed = true;
+                return false;
+            }
+        }
         if (!m_header_read) {
             //important not to read it again in case we have reshaped the array
-            mda_read_header(&m_header, m_file);
+            if (m_chunked.isOpen())
+                m_header = m_chunked.header();
+            else
+                mda_read_header(&m_header, m_file);
             m_mda_header_total_size = 1;
             for (int i = 0; i < MDAIO_MAX_DIMS; i++)
                 m_mda_header_total_size *= m_header.dims[i];
@@ -695,6 +737,14 @@ long DiskReadMdaPrivate::total_size()
     return m_mda_header_total_size;
 }
 
+long DiskReadMdaPrivate::read_entries(double* dst, long i, long num)
+{
+    if (m_chunked.isOpen())
+        return m_chunked.read(dst, i, num);
+    fseek(m_file, m_header.header_size + m_header.num_bytes_per_entry * i, SEEK_SET);
+    return mda_read_float64(dst, &m_header, num, m_file);
+}
+
 void diskreadmda_unit_test()
 {
     printf("diskreadmda_unit_test...\n");
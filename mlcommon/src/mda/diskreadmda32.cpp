@@ -1,8 +1,10 @@
 #include "diskreadmda32.h"
 #include <stdio.h>
 #include "mdaio.h"
+#include "chunkedmda.h"
 #include <math.h>
 #include <QFile>
+#include <QSharedPointer>
 #include <QCryptographicHash>
 #include <QDir>
 #include <QJsonObject>
@@ -32,6 +34,7 @@ public:
     long m_current_internal_chunk_index;
     Mda32 m_memory_mda;
     bool m_use_memory_mda;
+    ChunkedMdaReader m_chunked; //open when the file is a chunked (compressed) mda
 
 #ifdef USE_REMOTE_READ_MDA
     bool m_use_remote_mda;
@@ -40,9 +43,12 @@ public:
 
     QString m_path;
     QJsonObject m_prv_object;
+    QSharedPointer<QFile> m_mapped_file; //the mapping is released when the file is destroyed
+    const float* m_mapped_data;
     void construct_and_clear();
     bool read_header_if_needed();
     bool open_file_if_needed();
+    long read_entries(float* dst, long i, long num);
     void copy_from(const DiskReadMda32& other);
     long total_size();
 };
@@ -65,6 +71,16 @@ DiskReadMda32::DiskReadMda32(const DiskReadMda32& other)
     d->copy_from(other);
 }
 
+DiskReadMda32::DiskReadMda32(DiskReadMda32&& other)
+{
+    //take over the open file and any cached chunk, leaving other empty
+    d = other.d;
+    d->q = this;
+    other.d = new DiskReadMda32Private;
+    other.d->q = &other;
+    other.d->construct_and_clear();
+}
+
 DiskReadMda32::DiskReadMda32(const Mda32& X)
 {
     d = new DiskReadMda32Private;
@@ -107,6 +123,22 @@ void DiskReadMda32::operator=(const DiskReadMda32& other)
     d->copy_from(other);
 }
 
+void DiskReadMda32::operator=(DiskReadMda32&& other)
+{
+    if (&other == this)
+        return;
+    qSwap(d, other.d);
+    d->q = this;
+    other.d->q = &other;
+    //release what we held before
+    if (other.d->m_file) {
+        fclose(other.d->m_file);
+        other.d->m_file = 0;
+    }
+    other.d->construct_and_clear();
+    other.d->m_prv_object = QJsonObject();
+}
+
 void DiskReadMda32::setPath(const QString& file_path)
 {
     if (d->m_file) {
@@ -399,8 +431,8 @@ bool DiskReadMda32::readChunk(Mda32& X, long i, long size) const
     long jB = qMin(i + size - 1, d->total_size() - 1);
     long size_to_read = jB - jA + 1;
     if (size_to_read > 0) {
-        fseek(d->m_file, d->m_header.header_size + d->m_header.num_bytes_per_entry * (jA), SEEK_SET);
-        long bytes_read = mda_read_float32(&X.dataPtr()[jA - i], &d->m_header, size_to_read, d->m_file);
+        TaskManager::TaskProgressLatencyTimer latency_timer("DiskReadMda32::readChunk");
+        long bytes_read = d->read_entries(&X.dataPtr()[jA - i], jA, size_to_read);
         TaskManager::TaskProgressMonitor::globalInstance()->incrementQuantity("bytes_read", bytes_read);
         if (bytes_read != size_to_read) {
             printf("Warning problem reading chunk in diskreadmda: %ld<>%ld\n", bytes_read, size_to_read);
@@ -446,8 +478,8 @@ bool DiskReadMda32::readChunk(Mda32& X, long i1, long i2, long size1, long size2
         long jB = qMin(i2 + size2 - 1, N2() - 1);
         long size2_to_read = jB - jA + 1;
         if (size2_to_read > 0) {
-            fseek(d->m_file, d->m_header.header_size + d->m_header.num_bytes_per_entry * (i1 + N1() * jA), SEEK_SET);
-            long bytes_read = mda_read_float32(&X.dataPtr()[(jA - i2) * size1], &d->m_header, size1 * size2_to_read, d->m_file);
+            TaskManager::TaskProgressLatencyTimer latency_timer("DiskReadMda32::readChunk");
+            long bytes_read = d->read_entries(&X.dataPtr()[(jA - i2) * size1], i1 + N1() * jA, size1 * size2_to_read);
             TaskManager::TaskProgressMonitor::globalInstance()->incrementQuantity("bytes_read", bytes_read);
             if (bytes_read != size1 * size2_to_read) {
                 printf("Warning problem reading 2d chunk in diskreadmda: %ld<>%ld\n", bytes_read, size1 * size2);
@@ -504,8 +536,8 @@ bool DiskReadMda32::readChunk(Mda32& X, long i1, long i2, long i3, long size1, l
         long jB = qMin(i3 + size3 - 1, N3() - 1);
         long size3_to_read = jB - jA + 1;
         if (size3_to_read > 0) {
-            fseek(d->m_file, d->m_header.header_size + d->m_header.num_bytes_per_entry * (i1 + N1() * i2 + N1() * N2() * jA), SEEK_SET);
-            long bytes_read = mda_read_float32(&X.dataPtr()[(jA - i3) * size1 * size2], &d->m_header, size1 * size2 * size3_to_read, d->m_file);
+            TaskManager::TaskProgressLatencyTimer latency_timer("DiskReadMda32::readChunk");
+            long bytes_read = d->read_entries(&X.dataPtr()[(jA - i3) * size1 * size2], i1 + N1() * i2 + N1() * N2() * jA, size1 * size2 * size3_to_read);
             TaskManager::TaskProgressMonitor::globalInstance()->incrementQuantity("bytes_read", bytes_read);
             if (bytes_read != size1 * size2 * size3_to_read) {
                 printf("Warning problem reading 3d chunk in diskreadmda: %ld<>%ld\n", bytes_read, size1 * size2 * size3_to_read);
@@ -520,6 +552,32 @@ bool DiskReadMda32::readChunk(Mda32& X, long i1, long i2, long i3, long size1, l
     }
 }
 
+Mda32View DiskReadMda32::mappedView() const
+{
+    if (d->m_use_memory_mda)
+        return d->m_memory_mda.view();
+#ifdef USE_REMOTE_READ_MDA
+    if (d->m_use_remote_mda)
+        return Mda32View();
+#endif
+    if (!d->m_mapped_data) {
+        if (!d->open_file_if_needed())
+            return Mda32View();
+        if ((d->m_chunked.isOpen()) || (d->m_header.data_type != MDAIO_TYPE_FLOAT32))
+            return Mda32View();
+        QSharedPointer<QFile> file(new QFile(d->m_path));
+        if (!file->open(QFile::ReadOnly))
+            return Mda32View();
+        qint64 num_bytes = d->m_header.header_size + d->m_mda_header_total_size * sizeof(float);
+        uchar* ptr = file->map(0, num_bytes);
+        if (!ptr)
+            return Mda32View();
+        d->m_mapped_file = file;
+        d->m_mapped_data = (const float*)(ptr + d->m_header.header_size);
+    }
+    return Mda32View(d->m_mapped_data, N1(), N2(), N3() * N4() * N5() * N6());
+}
+
 dtype32 DiskReadMda32::value(long i) const
 {
     if (d->m_use_memory_mda)
@@ -570,6 +628,7 @@ void DiskReadMda32Private::construct_and_clear()
     m_file = 0;
     m_current_internal_chunk_index = -1;
     m_use_memory_mda = false;
+    m_chunked.close();
     m_header_read = false;
     m_reshaped = false;
 #ifdef USE_REMOTE_READ_MDA
@@ -579,6 +638,8 @@ void DiskReadMda32Private::construct_and_clear()
     this->m_mda_header_total_size = 0;
     this->m_memory_mda = Mda32();
     this->m_path = "";
+    this->m_mapped_file.clear();
+    this->m_mapped_data = 0;
 #ifdef USE_REMOTE_READ_MDA
     this->m_remote_mda = RemoteReadMda();
 #endif
@@ -606,6 +667,7 @@ bool DiskReadMda32Private::read_header_if_needed()
     if (!file_was_open) {
         fclose(m_file);
         m_file = 0;
+        m_chunked.close();
     }
     return true;
 }
@@ -626,9 +688,20 @@ bool DiskReadMda32Private::open_file_if_needed()
         return false;
     m_file = fopen(m_path.toLatin1().data(), "rb");
     if (m_file) {
+        if (ChunkedMdaReader::isChunkedMda(m_path)) {
+            if (!m_chunked.open(m_path)) {
+                fclose(m_file);
+                m_file = 0;
+                m_file_open_failed = true;
+                return false;
+            }
+        }
         if (!m_header_read) {
             //important not to read it again in case we have reshaped the array
-            mda_read_header(&m_header, m_file);
+            if (m_chunked.isOpen())
+                m_header = m_chunked.header();
+            else
+                mda_read_header(&m_header, m_file);
             m_mda_header_total_size = 1;
             for (int i = 0; i < MDAIO_MAX_DIMS; i++)
                 m_mda_header_total_size *= m_header.dims[i];
@@ -682,3 +755,11 @@ long DiskReadMda32Private::total_size()
         return 0;
     return m_mda_header_total_size;
 }
+
+long DiskReadMda32Private::read_entries(float* dst, long i, long num)
+{
+    if (m_chunked.isOpen())
+        return m_chunked.read(dst, i, num);
+    fseek(m_file, m_header.header_size + m_header.num_bytes_per_entry * i, SEEK_SET);
+    return mda_read_float32(dst, &m_header, num, m_file);
+}
@@ -2,10 +2,29 @@
 #include "mdaio.h"
 
 #include <QFile>
+#include <QMutex>
 #include <QString>
+#include <QThread>
+#include <QWaitCondition>
 #include <mda32.h>
 #include "mda.h"
+#include "taskprogress.h"
 #include <QDebug>
+#include <unistd.h>
+
+struct DiskWriteMdaBlock {
+    long offset = 0; //in bytes, from the start of the file
+    QByteArray data; //already converted to the data type of the file
+};
+
+class DiskWriteMdaPrivate;
+class DiskWriteMdaIOThread : public QThread {
+public:
+    //input
+    DiskWriteMdaPrivate* d;
+
+    void run();
+};
 
 class DiskWriteMdaPrivate {
 public:
@@ -13,8 +32,25 @@ public:
     QString m_path;
     MDAIO_HEADER m_header;
     FILE* m_file;
+    bool m_error = false;
+
+    //asynchronous mode
+    bool m_asynchronous = false;
+    long m_max_queued_bytes = 0;
+    DiskWriteMdaIOThread* m_io_thread = 0;
+    QMutex m_mutex;
+    QWaitCondition m_queue_not_empty;
+    QWaitCondition m_queue_not_full;
+    QWaitCondition m_all_written;
+    QList<DiskWriteMdaBlock> m_queue;
+    long m_queued_bytes = 0; //including the block currently being written
+    bool m_stopping = false;
 
     int determine_ndims(long N1, long N2, long N3, long N4, long N5, long N6);
+    long clip_size(long i, long size);
+    void enqueue(const DiskWriteMdaBlock& B);
+    bool write_block(const DiskWriteMdaBlock& B);
+    void stop_io_thread();
 };
 
 DiskWriteMda::DiskWriteMda()
@@ -89,20 +125,67 @@ bool DiskWriteMda::open(int data_type, const QString& path, long N1, long N2, lo
     */
     fseek(d->m_file, d->m_header.header_size + d->m_header.num_bytes_per_entry * NN - 1, SEEK_SET);
     unsigned char zero = 0;
-    fwrite(&zero, 1, 1, d->m_file);
+    d->m_error = false;
+    if (fwrite(&zero, 1, 1, d->m_file) != 1)
+        d->m_error = true;
+
+    if (d->m_asynchronous) {
+        //from now on the data are written by position on the file descriptor, so the stdio buffer must be empty
+        if (fflush(d->m_file) != 0)
+            d->m_error = true;
+        d->m_stopping = false;
+        d->m_io_thread = new DiskWriteMdaIOThread;
+        d->m_io_thread->d = d;
+        d->m_io_thread->start();
+    }
 
     return true;
 }
 
-void DiskWriteMda::close()
+bool DiskWriteMda::close()
+{
+    if (!d->m_file)
+        return true;
+    bool ret = flush();
+    d->stop_io_thread();
+    if (fclose(d->m_file) != 0)
+        ret = false;
+    d->m_file = 0;
+    if (!ret) {
+        qWarning() << "Error writing file in diskwritemda::close" << d->m_path + ".tmp";
+        QFile::remove(d->m_path + ".tmp");
+        return false;
+    }
+    if (!QFile::rename(d->m_path + ".tmp", d->m_path)) {
+        qWarning() << "Unable to rename file in diskwritemda::close" << d->m_path + ".tmp" << d->m_path;
+        return false;
+    }
+    return true;
+}
+
+void DiskWriteMda::setAsynchronous(bool val, long max_queued_bytes)
 {
     if (d->m_file) {
-        fclose(d->m_file);
-        if (!QFile::rename(d->m_path + ".tmp", d->m_path)) {
-            qWarning() << "Unable to rename file in diskwritemda::open" << d->m_path + ".tmp" << d->m_path;
-        }
-        d->m_file = 0;
+        qWarning() << "DiskWriteMda::setAsynchronous must be called before open()";
+        return;
+    }
+    d->m_asynchronous = val;
+    d->m_max_queued_bytes = max_queued_bytes;
+}
+
+bool DiskWriteMda::flush()
+{
+    if (!d->m_file)
+        return !d->m_error;
+    if (!d->m_asynchronous) {
+        if (fflush(d->m_file) != 0)
+            d->m_error = true;
+        return !d->m_error;
     }
+    QMutexLocker locker(&d->m_mutex);
+    while (d->m_queued_bytes > 0)
+        d->m_all_written.wait(&d->m_mutex);
+    return !d->m_error;
 }
 
 long DiskWriteMda::N1()
@@ -156,13 +239,23 @@ void DiskWriteMda::writeChunk(Mda& X, long i)
 {
     if (!d->m_file)
         return;
-    fseek(d->m_file, d->m_header.header_size + d->m_header.num_bytes_per_entry * i, SEEK_SET);
-    long size = X.totalSize();
-    if (i + size > this->totalSize())
-        size = this->totalSize() - i;
-    if (size > 0) {
-        mda_write_float64(X.dataPtr(), &d->m_header, size, d->m_file);
+    long size = d->clip_size(i, X.totalSize());
+    if (size <= 0)
+        return;
+    //in asynchronous mode this is the time to queue the block (including any wait for the queue to drain)
+    TaskManager::TaskProgressLatencyTimer latency_timer("DiskWriteMda::writeChunk");
+    if (d->m_asynchronous) {
+        DiskWriteMdaBlock B;
+        B.offset = d->m_header.header_size + d->m_header.num_bytes_per_entry * i;
+        B.data.resize(size * d->m_header.num_bytes_per_entry);
+        mda_convert_from_float64(B.data.data(), &d->m_header, X.constDataPtr(), size);
+        d->enqueue(B);
+        return;
     }
+    fseek(d->m_file, d->m_header.header_size + d->m_header.num_bytes_per_entry * i, SEEK_SET);
+    //constDataPtr(), so that an implicitly shared array is not detached (mda_write_float64 does not modify the data)
+    if (mda_write_float64((double*)X.constDataPtr(), &d->m_header, size, d->m_file) != size)
+        d->m_error = true;
 }
 
 void DiskWriteMda::writeChunk(Mda& X, long i1, long i2)
@@ -189,13 +282,22 @@ void DiskWriteMda::writeChunk(Mda32& X, long i)
 {
     if (!d->m_file)
         return;
-    fseek(d->m_file, d->m_header.header_size + d->m_header.num_bytes_per_entry * i, SEEK_SET);
-    long size = X.totalSize();
-    if (i + size > this->totalSize())
-        size = this->totalSize() - i;
-    if (size > 0) {
-        mda_write_float32(X.dataPtr(), &d->m_header, size, d->m_file);
+    long size = d->clip_size(i, X.totalSize());
+    if (size <= 0)
+        return;
+    TaskManager::TaskProgressLatencyTimer latency_timer("DiskWriteMda::writeChunk");
+    if (d->m_asynchronous) {
+        DiskWriteMdaBlock B;
+        B.offset = d->m_header.header_size + d->m_header.num_bytes_per_entry * i;
+        B.data.resize(size * d->m_header.num_bytes_per_entry);
+        mda_convert_from_float32(B.data.data(), &d->m_header, X.constDataPtr(), size);
+        d->enqueue(B);
+        return;
     }
+    fseek(d->m_file, d->m_header.header_size + d->m_header.num_bytes_per_entry * i, SEEK_SET);
+    //as for Mda, without detaching X
+    if (mda_write_float32((float*)X.constDataPtr(), &d->m_header, size, d->m_file) != size)
+        d->m_error = true;
 }
 
 void DiskWriteMda::writeChunk(Mda32& X, long i1, long i2)
@@ -234,3 +336,79 @@ int DiskWriteMdaPrivate::determine_ndims(long N1, long N2, long N3, long N4, lon
         return 3;
     return 2;
 }
+
+long DiskWriteMdaPrivate::clip_size(long i, long size)
+{
+    long total_size = q->totalSize();
+    if (i + size > total_size)
+        size = total_size - i;
+    return size;
+}
+
+void DiskWriteMdaPrivate::enqueue(const DiskWriteMdaBlock& B)
+{
+    QMutexLocker locker(&m_mutex);
+    //a single block larger than the limit is still accepted once the queue is empty
+    while ((m_queued_bytes > 0) && (m_queued_bytes + B.data.count() > m_max_queued_bytes))
+        m_queue_not_full.wait(&m_mutex);
+    m_queue << B;
+    m_queued_bytes += B.data.count();
+    m_queue_not_empty.wakeOne();
+}
+
+bool DiskWriteMdaPrivate::write_block(const DiskWriteMdaBlock& B)
+{
+    int fd = fileno(m_file);
+    const char* ptr = B.data.constData();
+    long num_bytes = B.data.count();
+    long offset = B.offset;
+    while (num_bytes > 0) {
+        ssize_t n = pwrite(fd, ptr, num_bytes, offset);
+        if (n <= 0)
+            return false;
+        ptr += n;
+        offset += n;
+        num_bytes -= n;
+    }
+    return true;
+}
+
+void DiskWriteMdaPrivate::stop_io_thread()
+{
+    if (!m_io_thread)
+        return;
+    {
+        QMutexLocker locker(&m_mutex);
+        m_stopping = true;
+        m_queue_not_empty.wakeAll();
+    }
+    m_io_thread->wait();
+    delete m_io_thread;
+    m_io_thread = 0;
+}
+
+void DiskWriteMdaIOThread::run()
+{
+    while (true) {
+        DiskWriteMdaBlock B;
+        {
+            QMutexLocker locker(&d->m_mutex);
+            while ((d->m_queue.isEmpty()) && (!d->m_stopping))
+                d->m_queue_not_empty.wait(&d->m_mutex);
+            if (d->m_queue.isEmpty())
+                return;
+            B = d->m_queue.takeFirst();
+        }
+        //positional writes, so the order in which the blocks arrive does not matter
+        bool ok = d->write_block(B);
+        {
+            QMutexLocker locker(&d->m_mutex);
+            if (!ok)
+                d->m_error = true;
+            d->m_queued_bytes -= B.data.count();
+            d->m_queue_not_full.wakeAll();
+            if (d->m_queued_bytes == 0)
+                d->m_all_written.wakeAll();
+        }
+    }
+}
@@ -0,0 +1,390 @@
+/******************************************************
+** See the accompanying README and LICENSE files
+*******************************************************/
+
+#include "firingsstore.h"
+
+#include <QDebug>
+#include <QFile>
+#include <math.h>
+#include <string.h>
+
+#define FIRINGS_STORE_MAGIC "MLFIRING"
+#define FIRINGS_STORE_VERSION 1
+#define FIRINGS_STORE_HEADER_SIZE 32
+
+struct FiringsStoreHeader {
+    char magic[8];
+    qint32 version;
+    qint32 num_extra_rows;
+    qint64 L;
+    qint32 K;
+    qint32 has_label_index;
+};
+
+class FiringsStorePrivate {
+public:
+    FiringsStore* q;
+
+    //when memory-mapped
+    QFile m_file;
+    uchar* m_map = 0;
+
+    //when converted (or for an index that was not stored in the file)
+    QVector<qint64> m_owned_times;
+    QVector<double> m_owned_extra_rows;
+    QVector<qint32> m_owned_channels;
+    QVector<qint32> m_owned_labels;
+    QVector<qint64> m_owned_offsets;
+    QVector<qint64> m_owned_event_indices;
+
+    long m_L = 0;
+    int m_K = 0;
+    int m_num_extra_rows = 0;
+    const qint64* m_times = 0;
+    const double* m_extra_rows = 0;
+    const qint32* m_channels = 0;
+    const qint32* m_labels = 0;
+    const qint64* m_offsets = 0;
+    const qint64* m_event_indices = 0;
+
+    void clear();
+    bool map_file(const QString& path);
+    void build_label_index();
+    static bool write_columns(const QString& path, long L, int K, int num_extra_rows, const qint64* times, const double* extra_rows, const qint32* channels, const qint32* labels, const qint64* offsets, const qint64* event_indices);
+};
+
+FiringsStore::FiringsStore()
+{
+    d = new FiringsStorePrivate;
+    d->q = this;
+}
+
+FiringsStore::FiringsStore(const QString& path)
+{
+    d = new FiringsStorePrivate;
+    d->q = this;
+    open(path);
+}
+
+FiringsStore::~FiringsStore()
+{
+    close();
+    delete d;
+}
+
+bool FiringsStore::isFiringsStore(const QString& path)
+{
+    QFile ff(path);
+    if (!ff.open(QFile::ReadOnly))
+        return false;
+    QByteArray magic = ff.read(8);
+    return (magic == QByteArray(FIRINGS_STORE_MAGIC));
+}
+
+bool FiringsStore::open(const QString& path)
+{
+    close();
+    if (isFiringsStore(path)) {
+        if (!d->map_file(path)) {
+            close();
+            return false;
+        }
+        return true;
+    }
+    DiskReadMda X(path);
+    return load(X);
+}
+
+bool FiringsStore::load(const DiskReadMda& firings)
+{
+    close();
+    if (firings.N1() <= 0)
+        return false;
+    Mda F;
+    if (!firings.readChunk(F, 0, 0, firings.N1(), firings.N2()))
+        return false;
+    load(F);
+    return true;
+}
+
+void FiringsStore::load(const Mda& firings)
+{
+    close();
+    long R = firings.N1();
+    long L = firings.N2();
+    const double* ptr = firings.constDataPtr();
+    d->m_L = L;
+    d->m_num_extra_rows = qMax(0L, R - 3);
+    d->m_owned_channels.resize(L);
+    d->m_owned_times.resize(L);
+    d->m_owned_labels.resize(L);
+    d->m_owned_extra_rows.resize(d->m_num_extra_rows * L);
+    int K = 0;
+    for (long i = 0; i < L; i++) {
+        const double* col = &ptr[R * i];
+        d->m_owned_channels[i] = (R > 0) ? (qint32)col[0] : 0;
+        d->m_owned_times[i] = (R > 1) ? (qint64)floor(col[1] + 0.5) : 0;
+        qint32 label = (R > 2) ? (qint32)col[2] : 0;
+        d->m_owned_labels[i] = label;
+        if (label > K)
+            K = label;
+        for (int r = 0; r < d->m_num_extra_rows; r++) {
+            d->m_owned_extra_rows[r * L + i] = col[3 + r];
+        }
+    }
+    d->m_K = K;
+    d->m_channels = d->m_owned_channels.constData();
+    d->m_times = d->m_owned_times.constData();
+    d->m_labels = d->m_owned_labels.constData();
+    d->m_extra_rows = d->m_owned_extra_rows.constData();
+    d->build_label_index();
+}
+
+void FiringsStore::close()
+{
+    d->clear();
+}
+
+long FiringsStore::eventCount() const
+{
+    return d->m_L;
+}
+
+int FiringsStore::K() const
+{
+    return d->m_K;
+}
+
+int FiringsStore::extraRowCount() const
+{
+    return d->m_num_extra_rows;
+}
+
+FiringsColumn<qint32> FiringsStore::channels() const
+{
+    return FiringsColumn<qint32>(d->m_channels, d->m_L);
+}
+
+FiringsColumn<qint64> FiringsStore::times() const
+{
+    return FiringsColumn<qint64>(d->m_times, d->m_L);
+}
+
+FiringsColumn<qint32> FiringsStore::labels() const
+{
+    return FiringsColumn<qint32>(d->m_labels, d->m_L);
+}
+
+FiringsColumn<double> FiringsStore::extraRow(int r) const
+{
+    if ((r < 0) || (r >= d->m_num_extra_rows))
+        return FiringsColumn<double>();
+    return FiringsColumn<double>(d->m_extra_rows + r * d->m_L, d->m_L);
+}
+
+FiringsColumn<qint64> FiringsStore::eventIndicesForLabel(int k) const
+{
+    if ((k < 0) || (k > d->m_K) || (!d->m_offsets))
+        return FiringsColumn<qint64>();
+    return FiringsColumn<qint64>(d->m_event_indices + d->m_offsets[k], d->m_offsets[k + 1] - d->m_offsets[k]);
+}
+
+QVector<qint64> FiringsStore::timesForLabel(int k) const
+{
+    FiringsColumn<qint64> inds = eventIndicesForLabel(k);
+    QVector<qint64> ret(inds.count());
+    for (long i = 0; i < inds.count(); i++) {
+        ret[i] = d->m_times[inds[i]];
+    }
+    return ret;
+}
+
+Mda FiringsStore::toMda() const
+{
+    long R = 3 + d->m_num_extra_rows;
+    long L = d->m_L;
+    Mda ret(R, L);
+    double* ptr = ret.dataPtr();
+    for (long i = 0; i < L; i++) {
+        double* col = &ptr[R * i];
+        col[0] = d->m_channels[i];
+        col[1] = d->m_times[i];
+        col[2] = d->m_labels[i];
+        for (int r = 0; r < d->m_num_extra_rows; r++) {
+            col[3 + r] = d->m_extra_rows[r * L + i];
+        }
+    }
+    return ret;
+}
+
+bool FiringsStore::write(const QString& path, bool include_label_index) const
+{
+    return FiringsStorePrivate::write_columns(path, d->m_L, d->m_K, d->m_num_extra_rows, d->m_times, d->m_extra_rows, d->m_channels, d->m_labels,
+        include_label_index ? d->m_offsets : 0, include_label_index ? d->m_event_indices : 0);
+}
+
+bool FiringsStore::write(const QString& path, const Mda& firings, bool include_label_index)
+{
+    FiringsStore store;
+    store.load(firings);
+    return store.write(path, include_label_index);
+}
+
+void FiringsStorePrivate::clear()
+{
+    if (m_map) {
+        m_file.unmap(m_map);
+        m_map = 0;
+    }
+    if (m_file.isOpen())
+        m_file.close();
+    m_owned_times.clear();
+    m_owned_extra_rows.clear();
+    m_owned_channels.clear();
+    m_owned_labels.clear();
+    m_owned_offsets.clear();
+    m_owned_event_indices.clear();
+    m_L = 0;
+    m_K = 0;
+    m_num_extra_rows = 0;
+    m_times = 0;
+    m_extra_rows = 0;
+    m_channels = 0;
+    m_labels = 0;
+    m_offsets = 0;
+    m_event_indices = 0;
+}
+
+bool FiringsStorePrivate::map_file(const QString& path)
+{
+    m_file.setFileName(path);
+    if (!m_file.open(QFile::ReadOnly)) {
+        qWarning() << "Unable to open firings file: " + path;
+        return false;
+    }
+    qint64 file_size = m_file.size();
+    if (file_size < FIRINGS_STORE_HEADER_SIZE) {
+        qWarning() << "Firings file is too small: " + path;
+        return false;
+    }
+    m_map = m_file.map(0, file_size);
+    if (!m_map) {
+        qWarning() << "Unable to map firings file: " + path;
+        return false;
+    }
+    FiringsStoreHeader H;
+    memcpy(&H, m_map, sizeof(H));
+    if ((H.version != FIRINGS_STORE_VERSION) || (H.L < 0) || (H.K < 0) || (H.num_extra_rows < 0)) {
+        qWarning() << "Unexpected header in firings file: " + path;
+        return false;
+    }
+    long L = H.L;
+    long pos = FIRINGS_STORE_HEADER_SIZE;
+    long expected_size = pos + 8 * L + 8 * H.num_extra_rows * L + 8 * L;
+    if (H.has_label_index)
+        expected_size += 8 * (H.K + 2); //and the event indices, checked below
+    if (file_size < expected_size) {
+        qWarning() << "Firings file is truncated: " + path;
+        return false;
+    }
+    m_L = L;
+    m_K = H.K;
+    m_num_extra_rows = H.num_extra_rows;
+    m_times = (const qint64*)(m_map + pos);
+    pos += 8 * L;
+    m_extra_rows = (const double*)(m_map + pos);
+    pos += 8 * m_num_extra_rows * L;
+    m_channels = (const qint32*)(m_map + pos);
+    m_labels = (const qint32*)(m_map + pos + 4 * L);
+    pos += 8 * L;
+    if (H.has_label_index) {
+        m_offsets = (const qint64*)(m_map + pos);
+        pos += 8 * (m_K + 2);
+        if ((m_offsets[m_K + 1] < 0) || (m_offsets[m_K + 1] > L) || (file_size < pos + 8 * m_offsets[m_K + 1])) {
+            qWarning() << "Firings file has an invalid label index: " + path;
+            return false;
+        }
+        //a corrupt index would otherwise give columns and times outside the mapped file
+        for (int k = 0; k <= m_K; k++) {
+            if ((m_offsets[k] < 0) || (m_offsets[k] > m_offsets[k + 1])) {
+                qWarning() << "Firings file has an invalid label index: " + path;
+                return false;
+            }
+        }
+        m_event_indices = (const qint64*)(m_map + pos);
+        for (qint64 i = 0; i < m_offsets[m_K + 1]; i++) {
+            if ((m_event_indices[i] < 0) || (m_event_indices[i] >= L)) {
+                qWarning() << "Firings file has an invalid label index: " + path;
+                return false;
+            }
+        }
+    }
+    else {
+        build_label_index();
+    }
+    return true;
+}
+
+void FiringsStorePrivate::build_label_index()
+{
+    //a counting sort, so the indices for each label come out in increasing order
+    m_owned_offsets.fill(0, m_K + 2);
+    for (long i = 0; i < m_L; i++) {
+        qint32 k = m_labels[i];
+        if ((k >= 0) && (k <= m_K))
+            m_owned_offsets[k + 1]++;
+    }
+    for (int k = 0; k <= m_K; k++) {
+        m_owned_offsets[k + 1] += m_owned_offsets[k];
+    }
+    m_owned_event_indices.resize(m_owned_offsets[m_K + 1]);
+    QVector<qint64> positions = m_owned_offsets;
+    for (long i = 0; i < m_L; i++) {
+        qint32 k = m_labels[i];
+        if ((k >= 0) && (k <= m_K))
+            m_owned_event_indices[positions[k]++] = i;
+    }
+    m_offsets = m_owned_offsets.constData();
+    m_event_indices = m_owned_event_indices.constData();
+}
+
+bool FiringsStorePrivate::write_columns(const QString& path, long L, int K, int num_extra_rows, const qint64* times, const double* extra_rows, const qint32* channels, const qint32* labels, const qint64* offsets, const qint64* event_indices)
+{
+    QString tmp_path = path + ".tmp";
+    QFile ff(tmp_path);
+    if (!ff.open(QFile::WriteOnly)) {
+        qWarning() << "Unable to open file for writing: " + tmp_path;
+        return false;
+    }
+    FiringsStoreHeader H;
+    memcpy(H.magic, FIRINGS_STORE_MAGIC, 8);
+    H.version = FIRINGS_STORE_VERSION;
+    H.num_extra_rows = num_extra_rows;
+    H.L = L;
+    H.K = K;
+    H.has_label_index = (offsets ? 1 : 0);
+    bool ok = true;
+    ok = ok && (ff.write((const char*)&H, sizeof(H)) == sizeof(H));
+    ok = ok && (ff.write((const char*)times, 8 * L) == 8 * L);
+    ok = ok && (ff.write((const char*)extra_rows, 8 * num_extra_rows * L) == 8 * num_extra_rows * L);
+    ok = ok && (ff.write((const char*)channels, 4 * L) == 4 * L);
+    ok = ok && (ff.write((const char*)labels, 4 * L) == 4 * L);
+    if (offsets) {
+        ok = ok && (ff.write((const char*)offsets, 8 * (K + 2)) == 8 * (K + 2));
+        ok = ok && (ff.write((const char*)event_indices, 8 * offsets[K + 1]) == 8 * offsets[K + 1]);
+    }
+    ff.close();
+    if (!ok) {
+        qWarning() << "Problem writing firings file: " + tmp_path;
+        QFile::remove(tmp_path);
+        return false;
+    }
+    if (QFile::exists(path))
+        QFile::remove(path);
+    if (!QFile::rename(tmp_path, path)) {
+        qWarning() << "Unable to rename file: " + tmp_path + " -> " + path;
+        return false;
+    }
+    return true;
+}
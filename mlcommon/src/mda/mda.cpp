@@ -1,5 +1,7 @@
 #include "mda.h"
 #include "mdaio.h"
+#include "chunkedmda.h"
+#include "mdaarena.h"
 #include <cachemanager.h>
 #include <stdio.h>
 #include "mlcommon.h"
@@ -85,27 +87,58 @@ Mda::Mda(const QString& mda_filename)
     this->read(mda_filename);
 }
 
+//what a moved-from array is left holding (an empty 0x1 array), shared so that moves never allocate
+static MdaData* new_empty_mda_data()
+{
+    MdaData* ret = new MdaData;
+    ret->allocate(0, 0, 1);
+    return ret;
+}
+
+static QSharedDataPointer<MdaData> empty_mda_data()
+{
+    static QSharedDataPointer<MdaData> empty_data(new_empty_mda_data());
+    return empty_data;
+}
+
 Mda::Mda(const Mda& other)
 {
     d = other.d;
 }
 
+Mda::Mda(Mda&& other)
+    : d(empty_mda_data())
+{
+    d.swap(other.d);
+}
+
 void Mda::operator=(const Mda& other)
 {
     d = other.d;
 }
 
+void Mda::operator=(Mda&& other)
+{
+    d.swap(other.d);
+    other.d = empty_mda_data();
+}
+
 Mda::~Mda()
 {
 }
 
 bool Mda::allocate(long N1, long N2, long N3, long N4, long N5, long N6)
 {
+    //no point in detaching (copying) the old contents when they are about to be replaced
+    if (d.constData()->ref.load() != 1)
+        d = new MdaData;
     return d->allocate(0, N1, N2, N3, N4, N5, N6);
 }
 
 bool Mda::allocateFill(double value, long N1, long N2, long N3, long N4, long N5, long N6)
 {
+    if (d.constData()->ref.load() != 1)
+        d = new MdaData;
     return d->allocate(value, N1, N2, N3, N4, N5, N6);
 }
 
@@ -222,6 +255,19 @@ bool Mda::read(const char* path)
     if ((QString(path).endsWith(".txt")) || (QString(path).endsWith(".csv"))) {
         return d->read_from_text_file(path);
     }
+    if (ChunkedMdaReader::isChunkedMda(path)) {
+        ChunkedMdaReader R;
+        if (!R.open(path))
+            return false;
+        MDAIO_HEADER H = R.header();
+        this->allocate(H.dims[0], H.dims[1], H.dims[2], H.dims[3], H.dims[4], H.dims[5]);
+        if (R.read(d->data(), 0, d->totalSize()) != d->totalSize()) {
+            qWarning() << "Problem reading chunked mda file: " + QString(path);
+            return false;
+        }
+        TaskManager::TaskProgressMonitor::globalInstance()->incrementQuantity("bytes_read", d->totalSize() * H.num_bytes_per_entry);
+        return true;
+    }
     FILE* input_file = fopen(path, "rb");
     if (!input_file) {
         printf("Warning: Unable to open mda file for reading: %s\n", path);
@@ -812,6 +858,11 @@ void Mda::detach()
     d.detach();
 }
 
+MdaView Mda::view() const
+{
+    return MdaView(constDataPtr(), N1(), N2(), N3() * N4() * N5() * N6());
+}
+
 void Mda::set(double val, long i)
 {
     d->data()[i] = val;
@@ -887,7 +938,7 @@ long MdaData::N2() const { return dim(1); }
 
 void MdaData::allocate(long size)
 {
-    m_data = (double*)::allocate(size * sizeof(double));
+    m_data = (double*)mda_arena_allocate(size * sizeof(double));
     if (!m_data)
         return;
     TaskManager::TaskProgressMonitor::globalInstance()->incrementQuantity("bytes_allocated", totalSize());
@@ -897,7 +948,7 @@ void MdaData::deallocate()
 {
     if (!m_data)
         return;
-    free(m_data);
+    mda_arena_free(m_data);
     TaskManager::TaskProgressMonitor::globalInstance()->incrementQuantity("bytes_freed", totalSize());
     m_data = 0;
 }
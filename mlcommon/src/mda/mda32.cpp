@@ -1,97 +1,99 @@
 #include "mda32.h"
 #include "mdaio.h"
+#include "chunkedmda.h"
+#include "mdaarena.h"
 #include <cachemanager.h>
 #include <stdio.h>
 #include "mlcommon.h"
 #include "taskprogress.h"
+#include <QSharedData>
+#include <cstring>
 
 #define MDA_MAX_DIMS 6
 
-class Mda32Private {
+class Mda32Data : public QSharedData {
 public:
-    Mda32* q;
+    Mda32Data();
+    Mda32Data(const Mda32Data& other);
+    ~Mda32Data();
+
     dtype32* m_data;
     long m_dims[MDA_MAX_DIMS];
     long m_total_size;
 
-    void do_construct();
-    void copy_from(const Mda32& other);
-    int determine_num_dims(long N1, long N2, long N3, long N4, long N5, long N6);
-    bool safe_index(long i);
-    bool safe_index(long i1, long i2);
-    bool safe_index(long i1, long i2, long i3);
-    bool safe_index(long i1, long i2, long i3, long i4, long i5, long i6);
+    bool allocate(long N1, long N2, long N3 = 1, long N4 = 1, long N5 = 1, long N6 = 1);
+    void deallocate();
+    int determine_num_dims(long N1, long N2, long N3, long N4, long N5, long N6) const;
+    bool safe_index(long i) const;
+    bool safe_index(long i1, long i2) const;
+    bool safe_index(long i1, long i2, long i3) const;
+    bool safe_index(long i1, long i2, long i3, long i4, long i5, long i6) const;
 
     bool read_from_text_file(const QString& path);
-    bool write_to_text_file(const QString& path);
+    bool write_to_text_file(const QString& path) const;
 };
 
+//what a moved-from array is left holding (an empty 0x1 array), shared so that moves never allocate
+static QSharedDataPointer<Mda32Data> empty_mda32_data()
+{
+    static QSharedDataPointer<Mda32Data> empty_data(new Mda32Data);
+    return empty_data;
+}
+
 Mda32::Mda32(long N1, long N2, long N3, long N4, long N5, long N6)
 {
-    d = new Mda32Private;
-    d->q = this;
-    d->do_construct();
+    d = new Mda32Data;
     this->allocate(N1, N2, N3, N4, N5, N6);
 }
 
 Mda32::Mda32(const QString mda_filename)
 {
-    d = new Mda32Private;
-    d->q = this;
-    d->do_construct();
+    d = new Mda32Data;
     this->read(mda_filename);
 }
 
 Mda32::Mda32(const Mda32& other)
+    : d(other.d)
+{
+}
+
+Mda32::Mda32(Mda32&& other)
+    : d(empty_mda32_data())
 {
-    d = new Mda32Private;
-    d->q = this;
-    d->do_construct();
-    d->copy_from(other);
+    d.swap(other.d);
 }
 
 void Mda32::operator=(const Mda32& other)
 {
-    d->copy_from(other);
+    d = other.d;
+}
+
+void Mda32::operator=(Mda32&& other)
+{
+    d.swap(other.d);
+    other.d = empty_mda32_data();
 }
 
 Mda32::~Mda32()
 {
-    if (d->m_data) {
-        free(d->m_data);
-        TaskManager::TaskProgressMonitor::globalInstance()->incrementQuantity("bytes_freed", d->m_total_size);
-    }
-    delete d;
 }
 
 bool Mda32::allocate(long N1, long N2, long N3, long N4, long N5, long N6)
 {
-    if (d->m_data) {
-        free(d->m_data);
-        TaskManager::TaskProgressMonitor::globalInstance()->incrementQuantity("bytes_freed", d->m_total_size);
-    }
-
-    d->m_dims[0] = N1;
-    d->m_dims[1] = N2;
-    d->m_dims[2] = N3;
-    d->m_dims[3] = N4;
-    d->m_dims[4] = N5;
-    d->m_dims[5] = N6;
-    d->m_total_size = N1 * N2 * N3 * N4 * N5 * N6;
+    //no point in detaching (copying) the old contents when they are about to be replaced
+    if (d.constData()->ref.load() != 1)
+        d = new Mda32Data;
+    return d->allocate(N1, N2, N3, N4, N5, N6);
+}
 
-    d->m_data = 0;
-    if (d->m_total_size > 0) {
-        d->m_data = (dtype32*)::allocate(sizeof(dtype32) * d->m_total_size);
-        if (!d->m_data) {
-            qCritical() << QString("Unable to allocate Mda32 of size %1x%2x%3x%4x%5x%6 (total=%7)").arg(N1).arg(N2).arg(N3).arg(N4).arg(N5).arg(N6).arg(d->m_total_size);
-            exit(-1);
-        }
-        TaskManager::TaskProgressMonitor::globalInstance()->incrementQuantity("bytes_allocated", d->m_total_size);
-        for (long i = 0; i < d->m_total_size; i++)
-            d->m_data[i] = 0;
-    }
+void Mda32::detach()
+{
+    d.detach();
+}
 
-    return true;
+Mda32View Mda32::view() const
+{
+    return Mda32View(constDataPtr(), N1(), N2(), N3() * N4() * N5() * N6());
 }
 
 bool Mda32::read(const QString& path)
@@ -119,6 +121,19 @@ bool Mda32::read(const char* path)
     if ((QString(path).endsWith(".txt")) || (QString(path).endsWith(".csv"))) {
         return d->read_from_text_file(path);
     }
+    if (ChunkedMdaReader::isChunkedMda(path)) {
+        ChunkedMdaReader R;
+        if (!R.open(path))
+            return false;
+        MDAIO_HEADER H = R.header();
+        this->allocate(H.dims[0], H.dims[1], H.dims[2], H.dims[3], H.dims[4], H.dims[5]);
+        if (R.read(d->m_data, 0, d->m_total_size) != d->m_total_size) {
+            qWarning() << "Problem reading chunked mda file: " + QString(path);
+            return false;
+        }
+        TaskManager::TaskProgressMonitor::globalInstance()->incrementQuantity("bytes_read", d->m_total_size * H.num_bytes_per_entry);
+        return true;
+    }
     FILE* input_file = fopen(path, "rb");
     if (!input_file) {
         printf("Warning: Unable to open mda file for reading: %s\n", path);
@@ -730,36 +745,68 @@ void Mda32::set(dtype32 val, long i1, long i2, long i3, long i4, long i5, long i
         = val;
 }
 
-void Mda32Private::do_construct()
+Mda32Data::Mda32Data()
+    : QSharedData()
+    , m_data(0)
+    , m_total_size(0)
 {
-    m_data = (dtype32*)::allocate(sizeof(dtype32) * 1);
-    TaskManager::TaskProgressMonitor::globalInstance()->incrementQuantity("bytes_allocated", 1);
-    for (int i = 0; i < MDA_MAX_DIMS; i++) {
+    m_dims[0] = 0;
+    for (int i = 1; i < MDA_MAX_DIMS; i++) {
         m_dims[i] = 1;
     }
-    m_total_size = 1;
 }
 
-void Mda32Private::copy_from(const Mda32& other)
+Mda32Data::Mda32Data(const Mda32Data& other)
+    : QSharedData(other)
+    , m_data(0)
+    , m_total_size(0)
 {
-    const bool needResize = m_total_size != other.d->m_total_size;
-    if (needResize && m_data) {
-        free(m_data);
-        TaskManager::TaskProgressMonitor::globalInstance()->incrementQuantity("bytes_freed", m_total_size);
-        m_data = 0;
-    }
-    m_total_size = other.d->m_total_size;
-    memcpy(m_dims, other.d->m_dims, MDA_MAX_DIMS * sizeof(m_dims[0]));
+    //this is the detach (copy-on-write)
+    allocate(other.m_dims[0], other.m_dims[1], other.m_dims[2], other.m_dims[3], other.m_dims[4], other.m_dims[5]);
+    if (m_total_size > 0)
+        memcpy(m_data, other.m_data, sizeof(dtype32) * m_total_size);
+}
+
+Mda32Data::~Mda32Data()
+{
+    deallocate();
+}
+
+bool Mda32Data::allocate(long N1, long N2, long N3, long N4, long N5, long N6)
+{
+    deallocate();
+
+    m_dims[0] = N1;
+    m_dims[1] = N2;
+    m_dims[2] = N3;
+    m_dims[3] = N4;
+    m_dims[4] = N5;
+    m_dims[5] = N6;
+    m_total_size = N1 * N2 * N3 * N4 * N5 * N6;
+
     if (m_total_size > 0) {
-        if (needResize) {
-            m_data = (dtype32*)::allocate(sizeof(dtype32) * m_total_size);
-            TaskManager::TaskProgressMonitor::globalInstance()->incrementQuantity("bytes_allocated", m_total_size);
+        m_data = (dtype32*)mda_arena_allocate(sizeof(dtype32) * m_total_size);
+        if (!m_data) {
+            qCritical() << QString("Unable to allocate Mda32 of size %1x%2x%3x%4x%5x%6 (total=%7)").arg(N1).arg(N2).arg(N3).arg(N4).arg(N5).arg(N6).arg(m_total_size);
+            exit(-1);
         }
-        memcpy(m_data, other.d->m_data, sizeof(dtype32) * m_total_size);
+        TaskManager::TaskProgressMonitor::globalInstance()->incrementQuantity("bytes_allocated", m_total_size);
+        memset(m_data, 0, sizeof(dtype32) * m_total_size);
     }
+
+    return true;
+}
+
+void Mda32Data::deallocate()
+{
+    if (!m_data)
+        return;
+    mda_arena_free(m_data);
+    TaskManager::TaskProgressMonitor::globalInstance()->incrementQuantity("bytes_freed", m_total_size);
+    m_data = 0;
 }
 
-int Mda32Private::determine_num_dims(long N1, long N2, long N3, long N4, long N5, long N6)
+int Mda32Data::determine_num_dims(long N1, long N2, long N3, long N4, long N5, long N6) const
 {
 #ifdef QT_CORE_LIB
     Q_UNUSED(N1)
@@ -776,28 +823,28 @@ int Mda32Private::determine_num_dims(long N1, long N2, long N3, long N4, long N5
     return 2;
 }
 
-bool Mda32Private::safe_index(long i)
+bool Mda32Data::safe_index(long i) const
 {
     return ((0 <= i) && (i < m_total_size));
 }
 
-bool Mda32Private::safe_index(long i1, long i2)
+bool Mda32Data::safe_index(long i1, long i2) const
 {
     return ((0 <= i1) && (i1 < m_dims[0]) && (0 <= i2) && (i2 < m_dims[1]));
 }
 
-bool Mda32Private::safe_index(long i1, long i2, long i3)
+bool Mda32Data::safe_index(long i1, long i2, long i3) const
 {
     return ((0 <= i1) && (i1 < m_dims[0]) && (0 <= i2) && (i2 < m_dims[1]) && (0 <= i3) && (i3 < m_dims[2]));
 }
 
-bool Mda32Private::safe_index(long i1, long i2, long i3, long i4, long i5, long i6)
+bool Mda32Data::safe_index(long i1, long i2, long i3, long i4, long i5, long i6) const
 {
     return (
         (0 <= i1) && (i1 < m_dims[0]) && (0 <= i2) && (i2 < m_dims[1]) && (0 <= i3) && (i3 < m_dims[2]) && (0 <= i4) && (i4 < m_dims[3]) && (0 <= i5) && (i5 < m_dims[4]) && (0 <= i6) && (i6 < m_dims[5]));
 }
 
-bool Mda32Private::read_from_text_file(const QString& path)
+bool Mda32Data::read_from_text_file(const QString& path)
 {
     QString txt = TextFile::read(path);
     QStringList lines = txt.split("\n", QString::SkipEmptyParts);
@@ -825,30 +872,31 @@ bool Mda32Private::read_from_text_file(const QString& path)
         line = line.split(",", QString::SkipEmptyParts).join(" ");
         QList<QString> vals = line.split(QRegExp("\\s+"), QString::SkipEmptyParts);
         if (i == 0) {
-            q->allocate(vals.count(), lines2.count());
+            allocate(vals.count(), lines2.count());
         }
         for (int j = 0; j < vals.count(); j++) {
-            q->setValue(vals[j].toDouble(), j, i);
+            if (safe_index(j, i))
+                m_data[j + m_dims[0] * i] = vals[j].toDouble();
         }
     }
     return true;
 }
 
-bool Mda32Private::write_to_text_file(const QString& path)
+bool Mda32Data::write_to_text_file(const QString& path) const
 {
     char sep = ' ';
     if (path.endsWith(".csv"))
         sep = ',';
     long max_num_entries = 1e6;
-    if (q->N1() * q->N2() == max_num_entries) {
+    if (m_dims[0] * m_dims[1] == max_num_entries) {
         qWarning() << "mda is too large to write text file";
         return false;
     }
     QList<QString> lines;
-    for (long i = 0; i < q->N2(); i++) {
+    for (long i = 0; i < m_dims[1]; i++) {
         QStringList vals;
-        for (long j = 0; j < q->N1(); j++) {
-            vals << QString("%1").arg(q->value(j, i));
+        for (long j = 0; j < m_dims[0]; j++) {
+            vals << QString("%1").arg(m_data[j + m_dims[0] * i]);
         }
         QString line = vals.join(sep);
         lines << line;
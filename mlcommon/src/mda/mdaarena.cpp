@@ -0,0 +1,210 @@
+/******************************************************
+** See the accompanying README and LICENSE files
+*******************************************************/
+
+#include "mdaarena.h"
+#include <stdlib.h>
+#include <atomic>
+#ifdef __WIN32
+#include <malloc.h>
+#endif
+
+//size class 0 holds blocks of 64 bytes, then there are four classes per power of two up to 2^MDA_ARENA_MAX_LOG bytes
+//larger blocks are never pooled
+#define MDA_ARENA_MIN_LOG 6
+#define MDA_ARENA_MAX_LOG 28
+#define MDA_ARENA_NUM_SIZE_CLASSES (1 + 4 * (MDA_ARENA_MAX_LOG - MDA_ARENA_MIN_LOG))
+
+//sits in front of every block, padded to the alignment so that the data stay aligned
+struct MdaArenaThreadCache;
+struct MdaArenaBlockHeader {
+    MdaArenaBlockHeader* next; //in the free list of a pool
+    MdaArenaThreadCache* owner; //the pool of the thread that allocated it
+    long capacity;
+    int size_class; //-1 if the block is not to be pooled
+};
+static_assert(sizeof(MdaArenaBlockHeader) <= MDA_ARENA_ALIGNMENT, "MdaArenaBlockHeader does not fit in the alignment");
+
+struct MdaArenaThreadCache {
+    MdaArenaBlockHeader* free_lists[MDA_ARENA_NUM_SIZE_CLASSES];
+    long cached_bytes;
+    int scope_depth;
+};
+
+static std::atomic<long> s_max_cached_bytes_per_thread(256L * 1024 * 1024);
+
+//a plain pointer, so that it can be safely looked at from anywhere (including during thread exit) -- 0 if this thread has no pool
+static thread_local MdaArenaThreadCache* t_arena_cache = 0;
+
+static void* system_allocate_aligned(long nbytes)
+{
+    void* result = 0;
+#ifdef __WIN32
+    result = _aligned_malloc(nbytes, MDA_ARENA_ALIGNMENT);
+#else
+    if (posix_memalign(&result, MDA_ARENA_ALIGNMENT, nbytes) != 0)
+        result = 0;
+#endif
+    return result;
+}
+
+static void system_free_aligned(void* ptr)
+{
+#ifdef __WIN32
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+static int size_class_for(long nbytes)
+{
+    if (nbytes <= (1L << MDA_ARENA_MIN_LOG))
+        return 0;
+    if (nbytes > (1L << MDA_ARENA_MAX_LOG))
+        return -1;
+    //find k such that 2^k < nbytes <= 2^(k+1), then split that range in four
+    int k = MDA_ARENA_MIN_LOG;
+    while ((2L << k) < nbytes)
+        k++;
+    long step = (1L << k) / 4;
+    long j = (nbytes - (1L << k) + step - 1) / step; //1..4
+    return 1 + 4 * (k - MDA_ARENA_MIN_LOG) + (int)(j - 1);
+}
+
+static long capacity_for(int size_class)
+{
+    if (size_class == 0)
+        return (1L << MDA_ARENA_MIN_LOG);
+    int k = MDA_ARENA_MIN_LOG + (size_class - 1) / 4;
+    long j = (size_class - 1) % 4 + 1;
+    return (1L << k) + j * ((1L << k) / 4);
+}
+
+static void release_cache(MdaArenaThreadCache* cache)
+{
+    for (int i = 0; i < MDA_ARENA_NUM_SIZE_CLASSES; i++) {
+        MdaArenaBlockHeader* H = cache->free_lists[i];
+        while (H) {
+            MdaArenaBlockHeader* next = H->next;
+            system_free_aligned(H);
+            H = next;
+        }
+        cache->free_lists[i] = 0;
+    }
+    cache->cached_bytes = 0;
+}
+
+class MdaArenaThreadCacheHolder {
+public:
+    MdaArenaThreadCacheHolder()
+    {
+        for (int i = 0; i < MDA_ARENA_NUM_SIZE_CLASSES; i++)
+            cache.free_lists[i] = 0;
+        cache.cached_bytes = 0;
+        cache.scope_depth = 0;
+        t_arena_cache = &cache;
+    }
+    ~MdaArenaThreadCacheHolder()
+    {
+        t_arena_cache = 0;
+        release_cache(&cache);
+    }
+
+    MdaArenaThreadCache cache;
+};
+
+//creates the pool of the current thread if needed
+static MdaArenaThreadCache* thread_cache()
+{
+    static thread_local MdaArenaThreadCacheHolder holder;
+    return &holder.cache;
+}
+
+void* mda_arena_allocate(long nbytes)
+{
+    if (nbytes <= 0)
+        return 0;
+    MdaArenaThreadCache* cache = t_arena_cache;
+    bool in_scope = ((cache) && (cache->scope_depth > 0));
+    int size_class = -1;
+    if (in_scope) {
+        size_class = size_class_for(nbytes);
+        if (size_class >= 0) {
+            MdaArenaBlockHeader* H = cache->free_lists[size_class];
+            if (H) {
+                cache->free_lists[size_class] = H->next;
+                cache->cached_bytes -= H->capacity;
+                H->next = 0;
+                return ((char*)H) + MDA_ARENA_ALIGNMENT;
+            }
+        }
+    }
+
+    //outside of a scope the block gets exactly the requested size (and will not be pooled)
+    long capacity = (size_class >= 0) ? capacity_for(size_class) : nbytes;
+    MdaArenaBlockHeader* H = (MdaArenaBlockHeader*)system_allocate_aligned(MDA_ARENA_ALIGNMENT + capacity);
+    if (!H)
+        return 0;
+    H->next = 0;
+    H->owner = cache;
+    H->capacity = capacity;
+    H->size_class = size_class;
+    return ((char*)H) + MDA_ARENA_ALIGNMENT;
+}
+
+void mda_arena_free(void* ptr)
+{
+    if (!ptr)
+        return;
+    MdaArenaBlockHeader* H = (MdaArenaBlockHeader*)(((char*)ptr) - MDA_ARENA_ALIGNMENT);
+    MdaArenaThreadCache* cache = t_arena_cache;
+    //a block freed on another thread goes back to the system, so that no pool grows at the expense of another
+    if ((H->size_class >= 0) && (cache) && (cache->scope_depth > 0) && (H->owner == cache)) {
+        if (cache->cached_bytes + H->capacity <= s_max_cached_bytes_per_thread.load(std::memory_order_relaxed)) {
+            H->next = cache->free_lists[H->size_class];
+            cache->free_lists[H->size_class] = H;
+            cache->cached_bytes += H->capacity;
+            return;
+        }
+    }
+    system_free_aligned(H);
+}
+
+MdaArenaScope::MdaArenaScope()
+{
+    thread_cache()->scope_depth++;
+}
+
+MdaArenaScope::~MdaArenaScope()
+{
+    MdaArenaThreadCache* cache = thread_cache();
+    cache->scope_depth--;
+    //the outermost scope gives the pool back, so that idle threads do not hold on to it
+    if (cache->scope_depth == 0)
+        release_cache(cache);
+}
+
+bool MdaArenaScope::isActive()
+{
+    return ((t_arena_cache) && (t_arena_cache->scope_depth > 0));
+}
+
+long MdaArenaScope::cachedBytes()
+{
+    if (!t_arena_cache)
+        return 0;
+    return t_arena_cache->cached_bytes;
+}
+
+void MdaArenaScope::releaseCache()
+{
+    if (!t_arena_cache)
+        return;
+    release_cache(t_arena_cache);
+}
+
+void MdaArenaScope::setMaxCachedBytesPerThread(long num_bytes)
+{
+    s_max_cached_bytes_per_thread.store(num_bytes, std::memory_order_relaxed);
+}
@@ -1,7 +1,12 @@
 #include "mdaio.h"
 #include "usagetracking.h"
-#include <vector>
 #include <cstring>
+#include <QtGlobal>
+
+#if defined(USE_SSE2) || defined(__SSE2__)
+#define MDAIO_USE_SSE2
+#include <emmintrin.h>
+#endif
 
 //can be replaced by std::is_same when C++11 is enabled
 template <class T, class U>
@@ -138,16 +143,152 @@ long mda_write_header(struct MDAIO_HEADER* X, FILE* output_file)
     return 1;
 }
 
+//the conversions go through a small fixed-size buffer (on the stack, so it is also thread safe) rather than a temporary of the full size
+#define MDAIO_STAGING_BUFFER_BYTES (64 * 1024)
+
+template <typename SourceType, typename TargetType>
+struct mdaConvert {
+    static void run(const SourceType* src, TargetType* dst, long n)
+    {
+        for (long i = 0; i < n; i++)
+            dst[i] = (TargetType)src[i];
+    }
+};
+
+//float or double to int16 on every path: truncate, and saturate rather than wrap (a plain cast of an out-of-range
+//value is undefined), NaN becomes -32768
+template <typename SourceType>
+inline int16_t mdaSaturateInt16(SourceType val)
+{
+    if (val > -32768)
+        return (val < 32767) ? (int16_t)val : 32767;
+    return -32768;
+}
+
+template <>
+struct mdaConvert<double, int16_t> {
+    static void run(const double* src, int16_t* dst, long n)
+    {
+        for (long i = 0; i < n; i++)
+            dst[i] = mdaSaturateInt16(src[i]);
+    }
+};
+
+#ifndef MDAIO_USE_SSE2
+template <>
+struct mdaConvert<float, int16_t> {
+    static void run(const float* src, int16_t* dst, long n)
+    {
+        for (long i = 0; i < n; i++)
+            dst[i] = mdaSaturateInt16(src[i]);
+    }
+};
+#endif
+
+#ifdef MDAIO_USE_SSE2
+//the common cases get vectorized kernels: int16 raw data read as float32, and float32 <-> float64
+template <>
+struct mdaConvert<int16_t, float> {
+    static void run(const int16_t* src, float* dst, long n)
+    {
+        long i = 0;
+        for (; i + 8 <= n; i += 8) {
+            __m128i x = _mm_loadu_si128((const __m128i*)(src + i));
+            __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16); //sign extend
+            __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+            _mm_storeu_ps(dst + i, _mm_cvtepi32_ps(lo));
+            _mm_storeu_ps(dst + i + 4, _mm_cvtepi32_ps(hi));
+        }
+        for (; i < n; i++)
+            dst[i] = src[i];
+    }
+};
+
+template <>
+struct mdaConvert<float, int16_t> {
+    static void run(const float* src, int16_t* dst, long n)
+    {
+        const __m128 min_val = _mm_set1_ps(-32768);
+        const __m128 max_val = _mm_set1_ps(32767);
+        long i = 0;
+        for (; i + 8 <= n; i += 8) {
+            //clamp first, since _mm_cvttps_epi32 gives INT_MIN for anything beyond the int32 range, large positive
+            //values included (the max comes first so that NaN becomes -32768, as in mdaSaturateInt16)
+            __m128 x_lo = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i), min_val), max_val);
+            __m128 x_hi = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i + 4), min_val), max_val);
+            __m128i lo = _mm_cvttps_epi32(x_lo);
+            __m128i hi = _mm_cvttps_epi32(x_hi);
+            _mm_storeu_si128((__m128i*)(dst + i), _mm_packs_epi32(lo, hi));
+        }
+        for (; i < n; i++)
+            dst[i] = mdaSaturateInt16(src[i]);
+    }
+};
+
+template <>
+struct mdaConvert<double, float> {
+    static void run(const double* src, float* dst, long n)
+    {
+        long i = 0;
+        for (; i + 4 <= n; i += 4) {
+            __m128 lo = _mm_cvtpd_ps(_mm_loadu_pd(src + i));
+            __m128 hi = _mm_cvtpd_ps(_mm_loadu_pd(src + i + 2));
+            _mm_storeu_ps(dst + i, _mm_movelh_ps(lo, hi));
+        }
+        for (; i < n; i++)
+            dst[i] = (float)src[i];
+    }
+};
+
+template <>
+struct mdaConvert<float, double> {
+    static void run(const float* src, double* dst, long n)
+    {
+        long i = 0;
+        for (; i + 4 <= n; i += 4) {
+            __m128 x = _mm_loadu_ps(src + i);
+            _mm_storeu_pd(dst + i, _mm_cvtps_pd(x));
+            _mm_storeu_pd(dst + i + 2, _mm_cvtps_pd(_mm_movehl_ps(x, x)));
+        }
+        for (; i < n; i++)
+            dst[i] = src[i];
+    }
+};
+#endif
+
 template <typename SourceType, typename TargetType>
 long mdaReadData_impl(TargetType* data, const long size, FILE* inputFile)
 {
     if (is_same<TargetType, SourceType>::value) {
         return jfread(data, sizeof(SourceType), size, inputFile);
     }
+    const long block_size = MDAIO_STAGING_BUFFER_BYTES / sizeof(SourceType);
+    SourceType staging[MDAIO_STAGING_BUFFER_BYTES / sizeof(SourceType)];
+    if (sizeof(SourceType) <= sizeof(TargetType)) {
+        //read the raw data straight into the destination and widen it in place, from the end backwards,
+        //so that each block is moved aside before anything is written over it
+        const long ret = jfread(data, sizeof(SourceType), size, inputFile);
+        const SourceType* raw = (const SourceType*)data;
+        for (long i = ret - (ret % block_size); i >= 0; i -= block_size) {
+            long n = qMin(block_size, ret - i);
+            if (n <= 0)
+                continue;
+            std::memcpy(staging, raw + i, n * sizeof(SourceType));
+            mdaConvert<SourceType, TargetType>::run(staging, data + i, n);
+        }
+        return ret;
+    }
     else {
-        std::vector<SourceType> tmp(size);
-        const long ret = jfread(&tmp[0], sizeof(SourceType), size, inputFile);
-        std::copy(tmp.begin(), tmp.end(), data);
+        //narrowing, so read through the staging buffer
+        long ret = 0;
+        while (ret < size) {
+            long n = qMin(block_size, size - ret);
+            long n_read = jfread(staging, sizeof(SourceType), n, inputFile);
+            mdaConvert<SourceType, TargetType>::run(staging, data + ret, n_read);
+            ret += n_read;
+            if (n_read < n)
+                break;
+        }
         return ret;
     }
 }
@@ -186,11 +327,18 @@ long mdaWriteData_impl(DataType* data, const long size, FILE* outputFile)
     if (is_same<DataType, TargetType>::value) {
         return fwrite(data, sizeof(DataType), size, outputFile);
     }
-    else {
-        std::vector<TargetType> tmp(size);
-        std::copy(data, data + size, tmp.begin());
-        return fwrite(&tmp[0], sizeof(TargetType), size, outputFile);
+    const long block_size = MDAIO_STAGING_BUFFER_BYTES / sizeof(TargetType);
+    TargetType staging[MDAIO_STAGING_BUFFER_BYTES / sizeof(TargetType)];
+    long ret = 0;
+    while (ret < size) {
+        long n = qMin(block_size, size - ret);
+        mdaConvert<DataType, TargetType>::run(data + ret, staging, n);
+        long n_written = fwrite(staging, sizeof(TargetType), n, outputFile);
+        ret += n_written;
+        if (n_written < n)
+            break;
     }
+    return ret;
 }
 
 template <typename DataType>
@@ -221,6 +369,44 @@ long mdaWriteData(DataType* data, const long size, const struct MDAIO_HEADER* he
         return 0;
 }
 
+template <typename TargetType, typename DataType>
+long mdaConvertData_impl(void* dst, const DataType* src, const long size)
+{
+    if (is_same<DataType, TargetType>::value)
+        std::memcpy(dst, src, size * sizeof(DataType));
+    else
+        mdaConvert<DataType, TargetType>::run(src, (TargetType*)dst, size);
+    return size;
+}
+
+template <typename DataType>
+long mdaConvertData(void* dst, const struct MDAIO_HEADER* header, const DataType* src, const long size)
+{
+    if (header->data_type == MDAIO_TYPE_BYTE) {
+        return mdaConvertData_impl<unsigned char>(dst, src, size);
+    }
+    else if (header->data_type == MDAIO_TYPE_FLOAT32) {
+        return mdaConvertData_impl<float>(dst, src, size);
+    }
+    else if (header->data_type == MDAIO_TYPE_INT16) {
+        return mdaConvertData_impl<int16_t>(dst, src, size);
+    }
+    else if (header->data_type == MDAIO_TYPE_INT32) {
+        return mdaConvertData_impl<int32_t>(dst, src, size);
+    }
+    else if (header->data_type == MDAIO_TYPE_UINT16) {
+        return mdaConvertData_impl<uint16_t>(dst, src, size);
+    }
+    else if (header->data_type == MDAIO_TYPE_FLOAT64) {
+        return mdaConvertData_impl<double>(dst, src, size);
+    }
+    else if (header->data_type == MDAIO_TYPE_UINT32) {
+        return mdaConvertData_impl<uint32_t>(dst, src, size);
+    }
+    else
+        return 0;
+}
+
 long mda_read_byte(unsigned char* data, struct MDAIO_HEADER* H, long n, FILE* input_file)
 {
     return mdaReadData(data, H, n, input_file);
@@ -291,6 +477,16 @@ long mda_write_uint32(uint32_t* data, struct MDAIO_HEADER* H, long n, FILE* outp
     return mdaWriteData(data, n, H, output_file);
 }
 
+long mda_convert_from_float32(void* dst, const struct MDAIO_HEADER* H, const float* data, long n)
+{
+    return mdaConvertData(dst, H, data, n);
+}
+
+long mda_convert_from_float64(void* dst, const struct MDAIO_HEADER* H, const double* data, long n)
+{
+    return mdaConvertData(dst, H, data, n);
+}
+
 void mda_copy_header(struct MDAIO_HEADER* ret, const struct MDAIO_HEADER* X)
 {
     std::memcpy(ret, X, sizeof(*ret));
@@ -15,8 +15,12 @@
 #include <diskreadmda32.h>
 #include "cachemanager.h"
 #include "mlcommon.h"
+#include "mdaio.h"
+#include <QEventLoop>
 
 #define REMOTE_READ_MDA_CHUNK_SIZE 5e5
+#define REMOTE_READ_MDA_MAX_IN_FLIGHT 4
+#define REMOTE_READ_MDA_NUM_PREFETCH_CHUNKS 2
 
 struct RemoteReadMdaInfo {
     RemoteReadMdaInfo()
@@ -29,6 +33,30 @@ struct RemoteReadMdaInfo {
     QDateTime file_last_modified;
 };
 
+//a chunk on its way into the cache. It takes one request if the server can send the chunk directly,
+//otherwise one for the url of the chunk and one for the chunk itself (and one more for the range of a quantized chunk)
+struct RemoteReadMdaFetch {
+    enum Stage {
+        Combined,
+        BinaryUrl,
+        Binary,
+        DynamicRange
+    };
+    ~RemoteReadMdaFetch()
+    {
+        delete downloader;
+    }
+
+    long index = 0;
+    long size = 0;
+    Stage stage = Combined;
+    MLNetwork::Downloader* downloader = 0;
+    QString binary_url;
+    QString tmp_mda_fname;
+    bool finished = false;
+    bool success = false;
+};
+
 class RemoteReadMdaPrivate {
 public:
     RemoteReadMda* q;
@@ -41,10 +69,32 @@ public:
     long m_download_chunk_size;
     bool m_download_failed; //don't make excessive calls. Once we failed, that's it.
 
+    int m_max_in_flight;
+    int m_num_prefetch_chunks;
+    bool m_combined_request_supported;
+    long m_last_chunk_index;
+    QMap<long, RemoteReadMdaFetch*> m_fetches; //by chunk index, including prefetches that nobody is waiting for yet
+
     void construct_and_clear();
     void copy_from(const RemoteReadMda& other);
     void download_info_if_needed();
-    QString download_chunk_at_index(long ii);
+
+    template <typename T>
+    bool read_entries(T* dst, long i, long size, TaskProgress& task);
+    long num_chunks();
+    QString chunk_file_name(long ii);
+    bool fetch_chunks(const QList<long>& indices);
+    void prefetch(const QList<long>& indices);
+    int num_active_fetches();
+    void start_fetch(long ii);
+    void start_download(RemoteReadMdaFetch* F, const QString& url);
+    void wait_for_fetches();
+    void advance_fetch(RemoteReadMdaFetch* F);
+    bool check_chunk_file(RemoteReadMdaFetch* F, const QString& fname);
+    bool move_into_cache(RemoteReadMdaFetch* F, const QString& fname);
+    void finish_fetch(RemoteReadMdaFetch* F, bool success);
+    void remove_finished_fetches();
+    void cancel_fetches();
 };
 
 RemoteReadMda::RemoteReadMda(const QString& path)
@@ -59,8 +109,7 @@ RemoteReadMda::RemoteReadMda(const RemoteReadMda& other)
 {
     d = new RemoteReadMdaPrivate;
     d->q = this;
-    d = new RemoteReadMdaPrivate;
-    d->q = this;
+    d->construct_and_clear();
     d->copy_from(other);
 }
 
@@ -71,6 +120,7 @@ void RemoteReadMda::operator=(const RemoteReadMda& other)
 
 RemoteReadMda::~RemoteReadMda()
 {
+    d->cancel_fetches();
     delete d;
 }
 
@@ -89,8 +139,19 @@ long RemoteReadMda::downloadChunkSize()
     return d->m_download_chunk_size;
 }
 
+void RemoteReadMda::setMaxRequestsInFlight(int num)
+{
+    d->m_max_in_flight = qMax(1, num);
+}
+
+void RemoteReadMda::setNumPrefetchChunks(int num)
+{
+    d->m_num_prefetch_chunks = qMax(0, num);
+}
+
 void RemoteReadMda::setPath(const QString& file_path)
 {
+    d->cancel_fetches();
     d->construct_and_clear();
 
     d->m_path = file_path;
@@ -154,105 +215,12 @@ bool RemoteReadMda::readChunk(Mda& X, long i, long size) const
         //don't make excessive calls... once we fail, that's it.
         return false;
     }
-    //double size_mb = size * datatype_size * 1.0 / 1e6;
-    //TaskProgress task(TaskProgress::Download, "Downloading array chunk");
-    //if (size_mb > 0.5) {
-    //    task.setLabel(QString("Downloading array chunk: %1 MB").arg(size_mb));
-    //}
     //read a chunk of the remote array considered as a 1D array
-
     TaskProgress task(TaskProgress::Download, QString("Downloading %1 numbers - %2 (%3x%4x%5)").arg(format_num(size)).arg(d->m_remote_datatype).arg(N1()).arg(N2()).arg(N3()));
     task.log() << "Reading chunk:" << this->makePath() << i << size;
 
     X.allocate(size, 1); //allocate the output array
-    double* Xptr = X.dataPtr(); //pointer to the output data
-    long ii1 = i; //start index of the remote array
-    long ii2 = i + size - 1; //end index of the remote array
-    long jj1 = ii1 / d->m_download_chunk_size; //start chunk index of the remote array
-    long jj2 = ii2 / d->m_download_chunk_size; //end chunk index of the remote array
-    if (jj1 == jj2) { //in this case there is only one chunk we need to worry about
-        task.setProgress(0.2);
-        QString fname = d->download_chunk_at_index(jj1); //download the single chunk
-        if (fname.isEmpty()) {
-            //task.error("fname is empty");
-            if (!MLUtil::threadInterruptRequested()) {
-                TaskProgress errtask("Download chunk at index");
-                errtask.log() << QString("m_remote_data_type = %1, download chunk size = %2").arg(d->m_remote_datatype).arg(d->m_download_chunk_size);
-                errtask.log() << d->m_path;
-                errtask.error() << QString("Failed to download chunk at index %1 *").arg(jj1);
-                d->m_download_failed = true;
-            }
-            return false;
-        }
-        DiskReadMda A(fname);
-        A.readChunk(X, ii1 - jj1 * d->m_download_chunk_size, size); //starting reading at the offset of ii1 relative to the start index of the chunk
-        return true;
-    }
-    else {
-        for (long jj = jj1; jj <= jj2; jj++) { //otherwise we need to step through the chunks
-            task.setProgress((jj - jj1 + 0.5) / (jj2 - jj1 + 1));
-            if (MLUtil::threadInterruptRequested()) {
-                //X = Mda(); //maybe it's better to return the right size.
-                //task.error("Halted");
-                return false;
-            }
-            QString fname = d->download_chunk_at_index(jj); //download the chunk at index jj
-            if (fname.isEmpty()) {
-                //task.error("fname is empty *");
-                return false;
-            }
-            DiskReadMda A(fname);
-            if (jj == jj1) { //case 1/3, this is the first chunk
-                Mda tmp;
-                long size0 = (jj1 + 1) * d->m_download_chunk_size - ii1; //the size is going to be the difference between ii1 and the start index of the next chunk
-                A.readChunk(tmp, ii1 - jj1 * d->m_download_chunk_size, size0); //again we start reading at the offset of ii1 relative to the start index of the chunk
-                double* tmp_ptr = tmp.dataPtr(); //copy the data directly from tmp_ptr to Xptr
-                long b = 0;
-                for (long a = 0; a < size0; a++) {
-                    Xptr[b] = tmp_ptr[a];
-                    b++;
-                }
-            }
-            else if (jj == jj2) { //case 2/3, this is the last chunk
-                Mda tmp;
-                long size0 = ii2 + 1 - jj2 * d->m_download_chunk_size; //the size is going to be the difference between the start index of the last chunk and ii2+1
-                A.readChunk(tmp, 0, size0); //we start reading at position zero
-                double* tmp_ptr = tmp.dataPtr();
-                //copy the data to the last part of X
-                long b = size - size0;
-                for (long a = 0; a < size0; a++) {
-                    Xptr[b] = tmp_ptr[a];
-                    b++;
-                }
-            }
-
-            /*
-             ///this was the old code, which was wrong!!!!!!!!! -- fixed on 5/16/2016
-            else if (jj == jj2) {
-                Mda tmp;
-                long size0 = ii2 + 1 - jj2 * d->m_download_chunk_size;
-                A.readChunk(tmp, d->m_download_chunk_size - size0, size0);
-                double* tmp_ptr = tmp.dataPtr();
-                long b = jj2 * d->m_download_chunk_size - ii1;
-                for (long a = 0; a < size0; a++) {
-                    Xptr[b] = tmp_ptr[a];
-                    b++;
-                }
-            }
-            */
-            else { //case 3/3, this is a middle chunk
-                Mda tmp;
-                A.readChunk(tmp, 0, d->m_download_chunk_size); //read the entire chunk, because we'll use it all
-                double* tmp_ptr = tmp.dataPtr();
-                long b = jj * d->m_download_chunk_size - ii1; //we start writing at the offset between the start index of the chunk and the start index
-                for (long a = 0; a < d->m_download_chunk_size; a++) {
-                    Xptr[b] = tmp_ptr[a];
-                    b++;
-                }
-            }
-        }
-        return true;
-    }
+    return d->read_entries(X.dataPtr(), i, size, task);
 }
 
 bool RemoteReadMda::readChunk32(Mda32& X, long i, long size) const
@@ -261,105 +229,94 @@ bool RemoteReadMda::readChunk32(Mda32& X, long i, long size) const
         //don't make excessive calls... once we fail, that's it.
         return false;
     }
-    //double size_mb = size * datatype_size * 1.0 / 1e6;
-    //TaskProgress task(TaskProgress::Download, "Downloading array chunk");
-    //if (size_mb > 0.5) {
-    //    task.setLabel(QString("Downloading array chunk: %1 MB").arg(size_mb));
-    //}
     //read a chunk of the remote array considered as a 1D array
-
     TaskProgress task(TaskProgress::Download, QString("Downloading %1 numbers -- %2 (%3x%4x%5)").arg(format_num(size)).arg(d->m_remote_datatype).arg(N1()).arg(N2()).arg(N3()));
     task.log(this->makePath());
 
     X.allocate(size, 1); //allocate the output array
-    dtype32* Xptr = X.dataPtr(); //pointer to the output data
+    return d->read_entries(X.dataPtr(), i, size, task);
+}
+
+namespace {
+long read_mda_entries(double* dst, MDAIO_HEADER* H, long n, FILE* f)
+{
+    return mda_read_float64(dst, H, n, f);
+}
+
+long read_mda_entries(float* dst, MDAIO_HEADER* H, long n, FILE* f)
+{
+    return mda_read_float32(dst, H, n, f);
+}
+
+//read num entries starting at offset directly into dst (no intermediate array)
+template <typename T>
+bool read_cached_chunk(const QString& fname, long offset, long num, T* dst)
+{
+    FILE* f = fopen(fname.toUtf8().data(), "rb");
+    if (!f)
+        return false;
+    MDAIO_HEADER H;
+    bool ok = (mda_read_header(&H, f) != 0);
+    if (ok)
+        ok = (fseek(f, H.header_size + H.num_bytes_per_entry * offset, SEEK_SET) == 0);
+    if (ok)
+        ok = (read_mda_entries(dst, &H, num, f) == num);
+    fclose(f);
+    return ok;
+}
+}
+
+template <typename T>
+bool RemoteReadMdaPrivate::read_entries(T* dst, long i, long size, TaskProgress& task)
+{
+    if (size <= 0)
+        return true;
     long ii1 = i; //start index of the remote array
     long ii2 = i + size - 1; //end index of the remote array
-    long jj1 = ii1 / d->m_download_chunk_size; //start chunk index of the remote array
-    long jj2 = ii2 / d->m_download_chunk_size; //end chunk index of the remote array
-    if (jj1 == jj2) { //in this case there is only one chunk we need to worry about
-        task.setProgress(0.2);
-        QString fname = d->download_chunk_at_index(jj1); //download the single chunk
-        if (fname.isEmpty()) {
-            //task.error("fname is empty");
-            if (!MLUtil::threadInterruptRequested()) {
-                TaskProgress errtask("Download chunk at index");
-                errtask.log(QString("m_remote_data_type = %1, download chunk size = %2").arg(d->m_remote_datatype).arg(d->m_download_chunk_size));
-                errtask.log(d->m_path);
-                errtask.error(QString("Failed to download chunk at index %1 -").arg(jj1));
-                d->m_download_failed = true;
-            }
+    long jj1 = ii1 / m_download_chunk_size; //start chunk index of the remote array
+    long jj2 = ii2 / m_download_chunk_size; //end chunk index of the remote array
+
+    //all the chunks we need are requested at once, and kept in flight together
+    QList<long> indices;
+    for (long jj = jj1; jj <= jj2; jj++)
+        indices << jj;
+    task.setProgress(0.2);
+    if (!fetch_chunks(indices)) {
+        if (!MLUtil::threadInterruptRequested()) {
+            TaskProgress errtask("Download chunk at index");
+            errtask.log() << QString("m_remote_data_type = %1, download chunk size = %2").arg(m_remote_datatype).arg(m_download_chunk_size);
+            errtask.log() << m_path;
+            errtask.error() << QString("Failed to download chunks %1-%2").arg(jj1).arg(jj2);
+            m_download_failed = true;
+        }
+        return false;
+    }
+    task.setProgress(0.8);
+
+    for (long jj = jj1; jj <= jj2; jj++) {
+        long chunk_start = jj * m_download_chunk_size;
+        long a1 = qMax(ii1, chunk_start); //the range of the remote array covered by this chunk
+        long a2 = qMin(ii2, chunk_start + m_download_chunk_size - 1);
+        if (!read_cached_chunk(chunk_file_name(jj), a1 - chunk_start, a2 - a1 + 1, dst + (a1 - ii1))) {
+            task.error() << "Problem reading downloaded chunk: " + chunk_file_name(jj);
             return false;
         }
-        DiskReadMda32 A(fname);
-        A.readChunk(X, ii1 - jj1 * d->m_download_chunk_size, size); //starting reading at the offset of ii1 relative to the start index of the chunk
-        return true;
     }
-    else {
-        for (long jj = jj1; jj <= jj2; jj++) { //otherwise we need to step through the chunks
-            task.setProgress((jj - jj1 + 0.5) / (jj2 - jj1 + 1));
-            if (MLUtil::threadInterruptRequested()) {
-                //X = Mda32(); //maybe it's better to return the right size.
-                //task.error("Halted");
-                return false;
-            }
-            QString fname = d->download_chunk_at_index(jj); //download the chunk at index jj
-            if (fname.isEmpty()) {
-                //task.error("fname is empty *");
-                return false;
-            }
-            DiskReadMda32 A(fname);
-            if (jj == jj1) { //case 1/3, this is the first chunk
-                Mda32 tmp;
-                long size0 = (jj1 + 1) * d->m_download_chunk_size - ii1; //the size is going to be the difference between ii1 and the start index of the next chunk
-                A.readChunk(tmp, ii1 - jj1 * d->m_download_chunk_size, size0); //again we start reading at the offset of ii1 relative to the start index of the chunk
-                dtype32* tmp_ptr = tmp.dataPtr(); //copy the data directly from tmp_ptr to Xptr
-                long b = 0;
-                for (long a = 0; a < size0; a++) {
-                    Xptr[b] = tmp_ptr[a];
-                    b++;
-                }
-            }
-            else if (jj == jj2) { //case 2/3, this is the last chunk
-                Mda32 tmp;
-                long size0 = ii2 + 1 - jj2 * d->m_download_chunk_size; //the size is going to be the difference between the start index of the last chunk and ii2+1
-                A.readChunk(tmp, 0, size0); //we start reading at position zero
-                dtype32* tmp_ptr = tmp.dataPtr();
-                //copy the data to the last part of X
-                long b = size - size0;
-                for (long a = 0; a < size0; a++) {
-                    Xptr[b] = tmp_ptr[a];
-                    b++;
-                }
-            }
 
-            /*
-             ///this was the old code, which was wrong!!!!!!!!! -- fixed on 5/16/2016
-            else if (jj == jj2) {
-                Mda32 tmp;
-                long size0 = ii2 + 1 - jj2 * d->m_download_chunk_size;
-                A.readChunk(tmp, d->m_download_chunk_size - size0, size0);
-                dtype32* tmp_ptr = tmp.dataPtr();
-                long b = jj2 * d->m_download_chunk_size - ii1;
-                for (long a = 0; a < size0; a++) {
-                    Xptr[b] = tmp_ptr[a];
-                    b++;
-                }
-            }
-            */
-            else { //case 3/3, this is a middle chunk
-                Mda32 tmp;
-                A.readChunk(tmp, 0, d->m_download_chunk_size); //read the entire chunk, because we'll use it all
-                dtype32* tmp_ptr = tmp.dataPtr();
-                long b = jj * d->m_download_chunk_size - ii1; //we start writing at the offset between the start index of the chunk and the start index
-                for (long a = 0; a < d->m_download_chunk_size; a++) {
-                    Xptr[b] = tmp_ptr[a];
-                    b++;
-                }
-            }
-        }
-        return true;
+    //read ahead in the direction we are moving
+    bool forward = true;
+    if ((m_last_chunk_index >= 0) && (jj1 < m_last_chunk_index))
+        forward = false;
+    m_last_chunk_index = jj1;
+    QList<long> prefetch_indices;
+    for (long k = 1; k <= m_num_prefetch_chunks; k++) {
+        long jj = forward ? jj2 + k : jj1 - k;
+        if ((jj >= 0) && (jj < num_chunks()))
+            prefetch_indices << jj;
     }
+    prefetch(prefetch_indices);
+
+    return true;
 }
 
 void RemoteReadMdaPrivate::construct_and_clear()
@@ -372,10 +329,16 @@ void RemoteReadMdaPrivate::construct_and_clear()
     /// TODO (LOW) use enum instead of string "float64", "float32", etc
     this->m_remote_datatype = "float64";
     this->m_reshaped = false;
+    this->m_max_in_flight = REMOTE_READ_MDA_MAX_IN_FLIGHT;
+    this->m_num_prefetch_chunks = REMOTE_READ_MDA_NUM_PREFETCH_CHUNKS;
+    this->m_combined_request_supported = true;
+    this->m_last_chunk_index = -1;
 }
 
 void RemoteReadMdaPrivate::copy_from(const RemoteReadMda& other)
 {
+    //the fetches in flight are not copied -- their chunks end up in the cache either way
+    this->cancel_fetches();
     this->m_download_chunk_size = other.d->m_download_chunk_size;
     this->m_download_failed = other.d->m_download_failed;
     this->m_info = other.d->m_info;
@@ -383,6 +346,10 @@ void RemoteReadMdaPrivate::copy_from(const RemoteReadMda& other)
     this->m_path = other.d->m_path;
     this->m_remote_datatype = other.d->m_remote_datatype;
     this->m_reshaped = other.d->m_reshaped;
+    this->m_max_in_flight = other.d->m_max_in_flight;
+    this->m_num_prefetch_chunks = other.d->m_num_prefetch_chunks;
+    this->m_combined_request_supported = other.d->m_combined_request_supported;
+    this->m_last_chunk_index = other.d->m_last_chunk_index;
 }
 
 void RemoteReadMdaPrivate::download_info_if_needed()
@@ -408,83 +375,282 @@ void RemoteReadMdaPrivate::download_info_if_needed()
 }
 
 void unquantize8(Mda& X, double minval, double maxval);
-QString RemoteReadMdaPrivate::download_chunk_at_index(long ii)
+
+long RemoteReadMdaPrivate::num_chunks()
 {
-    TaskProgress task(QString("Download chunk at index %1 ---").arg(ii));
     download_info_if_needed();
     long Ntot = m_info.N1 * m_info.N2 * m_info.N3;
-    long size = m_download_chunk_size;
-    if (ii * m_download_chunk_size + size > Ntot) {
-        size = Ntot - ii * m_download_chunk_size;
+    return (Ntot + m_download_chunk_size - 1) / m_download_chunk_size;
+}
+
+QString RemoteReadMdaPrivate::chunk_file_name(long ii)
+{
+    QString file_name = m_info.checksum + "-" + QString("%1-%2").arg(m_download_chunk_size).arg(ii);
+    return CacheManager::globalInstance()->makeLocalFile(file_name, CacheManager::ShortTerm);
+}
+
+bool RemoteReadMdaPrivate::fetch_chunks(const QList<long>& indices)
+{
+    download_info_if_needed();
+    if (m_info.checksum.isEmpty()) {
+        TaskProgress task("Download chunks");
+        task.error() << "Info checksum is empty";
+        return false;
+    }
+    QList<long> to_start;
+    foreach (long ii, indices) {
+        if ((!m_fetches.contains(ii)) && (!QFile::exists(chunk_file_name(ii))))
+            to_start << ii;
     }
-    if (size <= 0) {
+    while (true) {
+        if (MLUtil::threadInterruptRequested())
+            return false;
+        //keep up to m_max_in_flight requests going (prefetches already in flight count too)
+        while ((!to_start.isEmpty()) && (num_active_fetches() < m_max_in_flight)) {
+            start_fetch(to_start.takeFirst());
+        }
+        bool all_done = to_start.isEmpty();
+        foreach (long ii, indices) {
+            RemoteReadMdaFetch* F = m_fetches.value(ii);
+            if (F) {
+                if (!F->finished)
+                    all_done = false;
+                else if (!F->success) {
+                    remove_finished_fetches();
+                    return false;
+                }
+            }
+        }
+        if (all_done)
+            break;
+        wait_for_fetches();
+    }
+    remove_finished_fetches();
+    return true;
+}
+
+void RemoteReadMdaPrivate::prefetch(const QList<long>& indices)
+{
+    //these are started but not waited for -- they continue in the background and are picked up by a later read
+    remove_finished_fetches();
+    foreach (long ii, indices) {
+        if (num_active_fetches() >= m_max_in_flight)
+            break;
+        if ((!m_fetches.contains(ii)) && (!QFile::exists(chunk_file_name(ii))))
+            start_fetch(ii);
+    }
+}
+
+int RemoteReadMdaPrivate::num_active_fetches()
+{
+    int ret = 0;
+    foreach (RemoteReadMdaFetch* F, m_fetches) {
+        if (!F->finished)
+            ret++;
+    }
+    return ret;
+}
+
+void RemoteReadMdaPrivate::start_fetch(long ii)
+{
+    RemoteReadMdaFetch* F = new RemoteReadMdaFetch;
+    F->index = ii;
+    long Ntot = m_info.N1 * m_info.N2 * m_info.N3;
+    F->size = qMin(m_download_chunk_size, Ntot - ii * m_download_chunk_size);
+    m_fetches[ii] = F;
+    if (F->size <= 0) {
+        TaskProgress task(QString("Download chunk at index %1 ---").arg(ii));
         task.log() << m_info.N1 << m_info.N2 << m_info.N3 << Ntot << m_download_chunk_size << ii;
-        task.error() << "Size is:" << size;
-        return "";
+        task.error() << "Size is:" << F->size;
+        finish_fetch(F, false);
+        return;
     }
-    if (m_info.checksum.isEmpty()) {
-        task.error() << "Info checksum is empty";
-        return "";
+    QString url0 = m_path + QString("?a=readChunk&index=%1&size=%2&datatype=%3").arg((long)(ii * m_download_chunk_size)).arg(F->size).arg(m_remote_datatype);
+    if ((m_combined_request_supported) && (m_remote_datatype != "float32_q8")) {
+        //a single round trip: the server sends the chunk itself rather than the url where it can be found
+        F->stage = RemoteReadMdaFetch::Combined;
+        start_download(F, url0 + "&output=binary");
     }
-    QString file_name = m_info.checksum + "-" + QString("%1-%2").arg(m_download_chunk_size).arg(ii);
-    QString fname = CacheManager::globalInstance()->makeLocalFile(file_name, CacheManager::ShortTerm);
-    if (QFile::exists(fname))
-        return fname;
-    QString url = m_path;
-    QString url0 = url + QString("?a=readChunk&output=text&index=%1&size=%2&datatype=%3").arg((long)(ii * m_download_chunk_size)).arg(size).arg(m_remote_datatype);
-    QString binary_url = MLNetwork::httpGetTextSync(url0).trimmed();
-    if (binary_url.isEmpty())
-        return "";
-
-    //the following is ugly
-    int ind = m_path.indexOf("/mdaserver");
-    if (ind > 0) {
-        binary_url = m_path.mid(0, ind) + "/mdaserver/" + binary_url;
+    else {
+        F->stage = RemoteReadMdaFetch::BinaryUrl;
+        start_download(F, url0 + "&output=text");
     }
+}
+
+void RemoteReadMdaPrivate::start_download(RemoteReadMdaFetch* F, const QString& url)
+{
+    delete F->downloader;
+    F->downloader = new MLNetwork::Downloader;
+    F->downloader->source_url = url;
+    F->downloader->destination_file_name = CacheManager::globalInstance()->makeLocalFile() + ".RemoteReadMda";
+    F->downloader->start();
+}
 
-    task.log() << "binary_url:" << binary_url;
-    QString tmp_mda_fname = MLNetwork::httpGetBinaryFileSync(binary_url);
-    if (tmp_mda_fname.isEmpty())
-        return "";
-    DiskReadMda tmp(tmp_mda_fname);
-    if (tmp.totalSize() != size) {
-        task.error() << "Unexpected total size problem: " << tmp.totalSize() << size;
-        qWarning() << "Unexpected total size problem: " << tmp.totalSize() << size;
-        QFile::remove(tmp_mda_fname);
-        return "";
+void RemoteReadMdaPrivate::wait_for_fetches()
+{
+    QList<RemoteReadMdaFetch*> active;
+    foreach (RemoteReadMdaFetch* F, m_fetches) {
+        if ((!F->finished) && (F->downloader))
+            active << F;
+    }
+    if (active.isEmpty())
+        return;
+    bool any_finished = false;
+    QEventLoop loop;
+    foreach (RemoteReadMdaFetch* F, active) {
+        QObject::connect(F->downloader, SIGNAL(finished()), &loop, SLOT(quit()));
+        if (F->downloader->isFinished())
+            any_finished = true;
     }
-    if (m_remote_datatype == "float32_q8") {
-        QString dynamic_range_fname = MLNetwork::httpGetBinaryFileSync(binary_url + ".q8");
-        if (dynamic_range_fname.isEmpty()) {
-            qWarning() << "problem downloading .q8 file: " + binary_url + ".q8";
-            task.error() << "problem downloading .q8 file: " + binary_url + ".q8";
-            return "";
+    if (!any_finished)
+        loop.exec();
+    foreach (RemoteReadMdaFetch* F, active) {
+        if (F->downloader->isFinished())
+            advance_fetch(F);
+    }
+}
+
+void RemoteReadMdaPrivate::advance_fetch(RemoteReadMdaFetch* F)
+{
+    MLNetwork::Downloader* D = F->downloader;
+    QString fname = D->destination_file_name;
+    bool ok = D->success;
+    if (F->stage == RemoteReadMdaFetch::Combined) {
+        if ((ok) && (check_chunk_file(F, fname))) {
+            finish_fetch(F, move_into_cache(F, fname));
+            return;
+        }
+        //the server does not support this, so from now on we use two requests
+        QFile::remove(fname);
+        m_combined_request_supported = false;
+        F->stage = RemoteReadMdaFetch::BinaryUrl;
+        start_download(F, m_path + QString("?a=readChunk&output=text&index=%1&size=%2&datatype=%3").arg((long)(F->index * m_download_chunk_size)).arg(F->size).arg(m_remote_datatype));
+    }
+    else if (F->stage == RemoteReadMdaFetch::BinaryUrl) {
+        QString binary_url;
+        if (ok)
+            binary_url = TextFile::read(fname).trimmed();
+        QFile::remove(fname);
+        if (binary_url.isEmpty()) {
+            finish_fetch(F, false);
+            return;
+        }
+        //the following is ugly
+        int ind = m_path.indexOf("/mdaserver");
+        if (ind > 0) {
+            binary_url = m_path.mid(0, ind) + "/mdaserver/" + binary_url;
         }
-        Mda dynamic_range(dynamic_range_fname);
-        if (dynamic_range.totalSize() != 2) {
-            qWarning() << QString("Problem in .q8 file. Unexpected size %1: ").arg(dynamic_range.totalSize()) + binary_url + ".q8";
-            task.error() << QString("Problem in .q8 file. Unexpected size %1: ").arg(dynamic_range.totalSize()) + binary_url + ".q8";
-            return "";
+        F->binary_url = binary_url;
+        F->stage = RemoteReadMdaFetch::Binary;
+        start_download(F, binary_url);
+    }
+    else if (F->stage == RemoteReadMdaFetch::Binary) {
+        if ((!ok) || (!check_chunk_file(F, fname))) {
+            QFile::remove(fname);
+            finish_fetch(F, false);
+            return;
         }
-        Mda chunk(tmp_mda_fname);
-        unquantize8(chunk, dynamic_range.value(0), dynamic_range.value(1));
-        if (!chunk.write32(fname)) {
-            QFile::remove(tmp_mda_fname);
-            qWarning() << "Unable to write file: " + fname;
-            task.error() << "Unable to write file: " + fname;
-            return "";
+        if (m_remote_datatype == "float32_q8") {
+            F->tmp_mda_fname = fname;
+            F->stage = RemoteReadMdaFetch::DynamicRange;
+            start_download(F, F->binary_url + ".q8");
+            return;
         }
-        QFile::remove(tmp_mda_fname);
+        finish_fetch(F, move_into_cache(F, fname));
     }
-    else {
-        if (!QFile::rename(tmp_mda_fname, fname)) {
-            QFile::remove(tmp_mda_fname);
-            qWarning() << "Unable to rename file: " << tmp_mda_fname << fname;
-            task.error() << "Unable to rename file: " << tmp_mda_fname << fname;
-            return "";
+    else if (F->stage == RemoteReadMdaFetch::DynamicRange) {
+        TaskProgress task(QString("Download chunk at index %1 ---").arg(F->index));
+        bool ret = false;
+        if (!ok) {
+            task.error() << "problem downloading .q8 file: " + F->binary_url + ".q8";
+        }
+        else {
+            Mda dynamic_range(fname);
+            if (dynamic_range.totalSize() != 2) {
+                task.error() << QString("Problem in .q8 file. Unexpected size %1: ").arg(dynamic_range.totalSize()) + F->binary_url + ".q8";
+            }
+            else {
+                Mda chunk(F->tmp_mda_fname);
+                unquantize8(chunk, dynamic_range.value(0), dynamic_range.value(1));
+                ret = chunk.write32(chunk_file_name(F->index));
+                if (!ret)
+                    task.error() << "Unable to write file: " + chunk_file_name(F->index);
+            }
+        }
+        QFile::remove(fname);
+        QFile::remove(F->tmp_mda_fname);
+        finish_fetch(F, ret);
+    }
+}
+
+bool RemoteReadMdaPrivate::check_chunk_file(RemoteReadMdaFetch* F, const QString& fname)
+{
+    FILE* f = fopen(fname.toUtf8().data(), "rb");
+    if (!f)
+        return false;
+    MDAIO_HEADER H;
+    bool ok = (mda_read_header(&H, f) != 0);
+    fclose(f);
+    if (!ok)
+        return false;
+    long total_size = 1;
+    for (int i = 0; i < H.num_dims; i++)
+        total_size *= H.dims[i];
+    if (total_size != F->size) {
+        //in the combined case this is how we notice that the server sent something else
+        if (F->stage != RemoteReadMdaFetch::Combined)
+            qWarning() << "Unexpected total size problem: " << total_size << F->size;
+        return false;
+    }
+    return true;
+}
+
+bool RemoteReadMdaPrivate::move_into_cache(RemoteReadMdaFetch* F, const QString& fname)
+{
+    QString dst = chunk_file_name(F->index);
+    if (QFile::exists(dst)) {
+        //somebody else got it first
+        QFile::remove(fname);
+        return true;
+    }
+    if (!QFile::rename(fname, dst)) {
+        QFile::remove(fname);
+        qWarning() << "Unable to rename file: " << fname << dst;
+        return false;
+    }
+    return true;
+}
+
+void RemoteReadMdaPrivate::finish_fetch(RemoteReadMdaFetch* F, bool success)
+{
+    F->finished = true;
+    F->success = success;
+    delete F->downloader;
+    F->downloader = 0;
+}
+
+void RemoteReadMdaPrivate::remove_finished_fetches()
+{
+    QList<long> keys = m_fetches.keys();
+    foreach (long ii, keys) {
+        RemoteReadMdaFetch* F = m_fetches[ii];
+        if (F->finished) {
+            m_fetches.remove(ii);
+            delete F;
         }
     }
-    return fname;
+}
+
+void RemoteReadMdaPrivate::cancel_fetches()
+{
+    foreach (RemoteReadMdaFetch* F, m_fetches) {
+        if (F->downloader)
+            QFile::remove(F->downloader->destination_file_name);
+        if (!F->tmp_mda_fname.isEmpty())
+            QFile::remove(F->tmp_mda_fname);
+        delete F;
+    }
+    m_fetches.clear();
 }
 
 void unit_test_remote_read_mda()
@@ -5,6 +5,7 @@
 *******************************************************/
 
 #include "mlcommon.h"
+#include "checksumindex.h"
 #include "cachemanager/cachemanager.h"
 #include "taskprogress/taskprogress.h"
 
@@ -16,6 +17,7 @@
 #include <QUrl>
 #include <QDir>
 #include <QCryptographicHash>
+#include <QLockFile>
 #include <math.h>
 #include <QDataStream>
 #include <QJsonDocument>
@@ -205,6 +207,10 @@ QString MLUtil::computeSha1SumOfFileHead(const QString& path, long num_bytes)
 {
     return sumit(path, num_bytes);
 }
+QString MLUtil::computeChecksumOfFile(const QString& path, const QString& checksum_type)
+{
+    return sumit_of_type(path, checksum_type);
+}
 
 static QString s_temp_path = "";
 QString MLUtil::tempPath()
@@ -698,11 +704,13 @@ QString system_call_return_output(QString cmd)
     return process.readAllStandardOutput().trimmed();
 }
 
-QString locate_file_with_checksum(QString checksum, QString checksum1000, long size, bool allow_downloads)
+QString locate_file_with_checksum(QString checksum, QString checksum1000, long size, bool allow_downloads, QString checksum_type = "sha1")
 {
     QString extra_args = "";
     if (!allow_downloads)
         extra_args += "--local-only";
+    if ((!checksum_type.isEmpty()) && (checksum_type != "sha1"))
+        extra_args += " --checksum-type=" + checksum_type;
     QString cmd = QString("prv locate --checksum=%1 --checksum1000=%2 --size=%3 %4").arg(checksum).arg(checksum1000).arg(size).arg(extra_args);
     qDebug() << cmd;
     return system_call_return_output(cmd);
@@ -773,7 +781,16 @@ QString concatenate_files_to_temporary_file(QStringList file_paths)
 QString parallel_download_file_from_prvfileserver_to_temp_dir(QString url, long size, int num_downloads)
 {
 
-    QString tmp_fname = CacheManager::globalInstance()->makeLocalFile() + ".parallel_download";
+    //named after the source, so that an interrupted download is resumed by the next attempt
+    QString code = QString(QCryptographicHash::hash(QString("%1:%2").arg(url).arg(size).toUtf8(), QCryptographicHash::Sha1).toHex());
+    QString tmp_fname = CacheManager::globalInstance()->makeLocalFile(code + ".parallel_download");
+    //but only one process at a time may work on it -- held until we return (0: the lock is only stale if its process is gone)
+    QLockFile lock(tmp_fname + ".lock");
+    lock.setStaleLockTime(0);
+    if (!lock.tryLock(0)) {
+        //another process is downloading the same file, so this one gets a name of its own (and is not resumable)
+        tmp_fname = CacheManager::globalInstance()->makeLocalFile(QString("%1.%2.%3.parallel_download").arg(code).arg(QCoreApplication::applicationPid()).arg(make_random_id_22(5)));
+    }
     MLNetwork::PrvParallelDownloader downloader;
     downloader.destination_file_name = tmp_fname;
     downloader.size = size;
@@ -1069,5 +1086,15 @@ QString locate_prv(const QJsonObject& obj)
     QString checksum0 = obj["original_checksum"].toString();
     QString checksum0_1000 = obj["original_checksum_1000"].toString();
     long size0 = obj["original_size"].toVariant().toLongLong();
-    return locate_file_with_checksum(checksum0, checksum0_1000, size0, false);
+    QString checksum_type = obj["original_checksum_type"].toString("sha1");
+    {
+        //first a quick lookup in the checksum index, without spawning a process or rescanning
+        QStringList search_paths = MLUtil::configResolvedPathList("prv", "local_search_paths");
+        if (!MLUtil::tempPath().isEmpty())
+            search_paths << MLUtil::tempPath();
+        QString path1 = ChecksumIndex().findFile(search_paths, size0, checksum0, checksum0_1000, false, checksum_type);
+        if (!path1.isEmpty())
+            return path1;
+    }
+    return locate_file_with_checksum(checksum0, checksum0_1000, size0, false, checksum_type);
 }
@@ -15,20 +15,22 @@ TEMPLATE = lib
 INCLUDEPATH += ../include
 VPATH += ../include
 HEADERS += mlcommon.h sumit.h \
+    ../include/checksumindex.h \
     ../include/mda/mda32.h \
     ../include/mda/diskreadmda32.h \
     ../include/mliterator.h
 
 SOURCES += \
     mlcommon.cpp sumit.cpp \
+    checksumindex.cpp \
     mda/mda32.cpp \
     mda/diskreadmda32.cpp
 
 INCLUDEPATH += ../include/mda
 VPATH += ../include/mda
 VPATH += mda
-HEADERS += diskreadmda.h diskwritemda.h mda.h mdaio.h remotereadmda.h usagetracking.h
-SOURCES += diskreadmda.cpp diskwritemda.cpp mda.cpp mdaio.cpp remotereadmda.cpp usagetracking.cpp
+HEADERS += diskreadmda.h diskwritemda.h mda.h mdaio.h remotereadmda.h usagetracking.h chunkedmda.h firingsstore.h mdaview.h mdaarena.h
+SOURCES += diskreadmda.cpp diskwritemda.cpp mda.cpp mdaio.cpp remotereadmda.cpp usagetracking.cpp chunkedmda.cpp firingsstore.cpp mdaarena.cpp
 
 INCLUDEPATH += ../include/cachemanager
 VPATH += ../include/cachemanager
@@ -9,8 +9,12 @@
 #include <taskprogress.h>
 #include "mlcommon.h"
 #include <QCoreApplication>
+#include <QJsonArray>
 #include <QJsonDocument>
 #include <QJsonObject>
+#include <stdio.h>
+#include <unistd.h>
+#include <algorithm>
 
 namespace MLNetwork {
 
@@ -24,9 +28,17 @@ QNetworkAccessManager* manager()
 
 Downloader::~Downloader()
 {
+    if (m_reply) {
+        //we may be destroyed before the download has finished (for example a prefetch that is no longer needed)
+        QObject::disconnect(m_reply, 0, this, 0);
+        if (!m_reply->isFinished())
+            m_reply->abort();
+        m_reply->deleteLater();
+    }
     if (m_file) {
         m_file->close();
         delete m_file;
+        QFile::remove(m_tmp_fname);
     }
 }
 
@@ -377,63 +389,107 @@ void Downloader::slot_reply_finished()
     this->setFinished();
 }
 
-bool concatenate_files(QStringList file_paths, QString dest_path)
-{
-    qDebug() << "concatenating files" << file_paths << dest_path;
+#define PRV_PARALLEL_DOWNLOAD_MIN_SPLIT_BYTES (4 * 1024 * 1024)
+#define PRV_PARALLEL_DOWNLOAD_MAX_ATTEMPTS 3
 
-    /// Witold, this function should be improved by streaming the read/writes
-    foreach (QString str, file_paths) {
-        if (str.isEmpty())
-            return false;
+PrvRangeDownloader::~PrvRangeDownloader()
+{
+    if (m_reply) {
+        QObject::disconnect(m_reply, 0, this, 0);
+        if (!m_reply->isFinished())
+            m_reply->abort();
+        m_reply->deleteLater();
     }
+}
 
-    QFile f(dest_path);
-    if (!f.open(QIODevice::WriteOnly)) {
-        qWarning() << __FUNCTION__ << "Unable to open file for writing: " + dest_path;
-        return false;
-    }
-    foreach (QString str, file_paths) {
-        QFile g(str);
-        if (!g.open(QIODevice::ReadOnly)) {
-            qWarning() << __FUNCTION__ << "Unable to open file for reading: " + str;
-            f.close();
-            return false;
-        }
-        long chunk_size = 1e5;
-        QTime timer;
-        timer.start();
-        while (!g.atEnd()) {
-            QByteArray data0 = g.read(chunk_size);
-            f.write(data0);
-        }
-        g.close();
+void PrvRangeDownloader::start()
+{
+    m_num_bytes_downloaded = 0;
+    QString url = source_url;
+    if (!url.contains("?"))
+        url += "?";
+    else
+        url += "&";
+    url += QString("bytes=%1-%2&").arg(start_byte).arg(end_byte);
+
+    m_reply = manager()->get(QNetworkRequest(QUrl(url)));
+    QObject::connect(m_reply, SIGNAL(error(QNetworkReply::NetworkError)), this, SLOT(slot_reply_error()));
+    QObject::connect(m_reply, SIGNAL(readyRead()), this, SLOT(slot_reply_ready_read()));
+    QObject::connect(m_reply, SIGNAL(finished()), this, SLOT(slot_reply_finished()));
+
+    if (m_reply->error() != QNetworkReply::NoError) {
+        finish(false, QString("Error in network request (%1): %2").arg(url).arg(m_reply->errorString()));
     }
+}
 
-    f.close();
-    return true;
+long PrvRangeDownloader::num_bytes_downloaded()
+{
+    return m_num_bytes_downloaded;
 }
 
-class ConcatenateThread : public QThread {
-public:
-    QStringList file_names;
-    QString dest_file_name;
+long PrvRangeDownloader::num_bytes_remaining()
+{
+    return end_byte + 1 - (start_byte + m_num_bytes_downloaded);
+}
 
-    void run()
-    {
-        TaskProgress task("Concatenating files");
-        task.log() << file_names;
-        task.log() << dest_file_name;
-        if (!concatenate_files(file_names, dest_file_name)) {
-            task.error() << "Problem concatenating files";
+void PrvRangeDownloader::slot_reply_error()
+{
+    if (isFinished())
+        return;
+    finish(false, QString("Error in reply (%1): %2").arg(source_url).arg(m_reply->errorString()));
+}
+
+void PrvRangeDownloader::slot_reply_ready_read()
+{
+    if (isFinished())
+        return;
+    if (stopRequested()) {
+        finish(false, "Stop requested.");
+        return;
+    }
+    QByteArray X = m_reply->readAll();
+    long pos = start_byte + m_num_bytes_downloaded;
+    long num = qMin((long)X.count(), end_byte + 1 - pos); //the end may have been lowered since the request was made
+    const char* ptr = X.constData();
+    while (num > 0) {
+        ssize_t n = pwrite(destination_fd, ptr, num, pos);
+        if (n <= 0) {
+            finish(false, "Error writing to destination file");
             return;
         }
-        foreach (QString file, file_names) {
-            if (!QFile::remove(file)) {
-                qWarning() << "Problem removing file: " + file;
-            }
-        }
+        ptr += n;
+        pos += n;
+        num -= n;
+        m_num_bytes_downloaded += n;
     }
-};
+    emit progress();
+    if (num_bytes_remaining() <= 0)
+        finish(true);
+}
+
+void PrvRangeDownloader::slot_reply_finished()
+{
+    if (isFinished())
+        return;
+    slot_reply_ready_read();
+    if (isFinished())
+        return;
+    finish(false, QString("Unexpected number of bytes downloaded %1 <> %2").arg(m_num_bytes_downloaded).arg(end_byte + 1 - start_byte));
+}
+
+void PrvRangeDownloader::finish(bool success0, const QString& error0)
+{
+    success = success0;
+    error = error0;
+    if (m_reply) {
+        QObject::disconnect(m_reply, 0, this, 0);
+        if (!m_reply->isFinished())
+            m_reply->abort();
+        m_reply->deleteLater();
+        m_reply = 0;
+    }
+    this->setFinished();
+}
 
 void PrvParallelDownloader::start()
 {
@@ -441,121 +497,67 @@ void PrvParallelDownloader::start()
 
     m_timer.start();
     m_num_bytes_downloaded = 0;
-
-    //append the url so it can take some (more) query parameters
-    QString url = source_url;
-    if (!url.contains("?"))
-        url += "?";
-    else
-        url += "&";
+    success = true;
 
     m_task.log() << "size:" << size << "num_threads:" << num_threads;
 
-    //get the start and end bytes
-    QList<long> start_bytes;
-    QList<long> end_bytes;
-    long incr = (long)(1 + size * 1.0 / num_threads);
-    if (incr < 1000)
-        incr = 1000; //let's be a bit reasonable
-    long sum = 0;
-    for (int i = 0; i < num_threads; i++) {
-        if (sum < size) {
-            long val = qMin(incr, size - sum);
-            start_bytes << sum;
-            end_bytes << sum + val - 1;
-            sum += val;
-        }
+    bool resuming = load_completed_ranges();
+    m_file.setFileName(destination_file_name + ".part");
+    if (!m_file.open(QIODevice::ReadWrite | QIODevice::Unbuffered)) {
+        finish(false, "Unable to open file for writing: " + m_file.fileName());
+        return;
     }
-
-    m_task.log() << "start_bytes:" << start_bytes;
-    m_task.log() << "end_bytes:" << end_bytes;
-
-    for (int i = 0; i < start_bytes.count(); i++) {
-        QString url2 = url + QString("bytes=%1-%2&").arg(start_bytes[i]).arg(end_bytes[i]);
-        m_task.log() << "Starting downloader: " + url2;
-        Downloader* DD = new Downloader;
-        DD->source_url = url2;
-        DD->destination_file_name = CacheManager::globalInstance()->makeLocalFile() + ".PrvParallelDownloader";
-        DD->size = end_bytes[i] - start_bytes[i] + 1;
-        m_downloaders << DD;
-        connect(DD, SIGNAL(progress()), this, SLOT(slot_downloader_progress()));
-        connect(DD, SIGNAL(finished()), this, SLOT(slot_downloader_finished()));
-        m_task.log() << "Starting " + url2;
-        m_task.log() << "";
-        DD->start();
+    if (!resuming) {
+        m_completed_ranges.clear();
+        m_file.resize(0);
     }
-
-    /*
-    printf("Using %d downloaders\n", downloaders.count());
-    bool done = false;
-    success = true;
-    while ((!done) && (success)) {
-        done = true;
-        if (MLUtil::threadInterruptRequested()) {
-            task.error("Thread interrupt requested");
-            for (int j = 0; j < downloaders.count(); j++) {
-                downloaders[j]->requestInterruption();
-            }
-            success = false;
-            error = "Thread interrupted";
-        }
-        for (int i = 0; i < downloaders.count(); i++) {
-            if (downloaders[i]->wait(100)) {
-                if (downloaders[i]->success) {
-                    task.log() << "Thread finished: " + downloaders[i]->source_url;
-                }
-                else {
-                    task.error() << "Error in download thread: " + downloaders[i]->source_url + ": " + downloaders[i]->error;
-                    for (int j = 0; j < downloaders.count(); j++) {
-                        downloaders[j]->requestInterruption();
-                    }
-                    success = false;
-                    error = "Error in download thread: " + downloaders[i]->source_url + ": " + downloaders[i]->error;
-                }
-            }
-            else {
-                done = false;
-            }
-        }
-        long num_bytes = 0;
-        for (int i = 0; i < downloaders.count(); i++) {
-            num_bytes += downloaders[i]->num_bytes_downloaded();
-        }
-        if (size)
-            task.setProgress(num_bytes * 1.0 / size);
-        {
-            QMutexLocker locker(&m_mutex);
-            m_num_bytes_downloaded = num_bytes;
-        }
-    }
-    if (!success) {
-        for (int i = 0; i < downloaders.count(); i++) {
-            QFile::remove(downloaders[i]->destination_file_name);
-        }
-        qDeleteAll(downloaders);
+    //preallocate, so that every range can be written in place
+    if (!m_file.resize(size)) {
+        finish(false, "Unable to allocate file: " + m_file.fileName());
         return;
     }
 
-    QStringList paths;
-    for (int i = 0; i < downloaders.count(); i++) {
-        paths << downloaders[i]->destination_file_name;
-    }
-    qDeleteAll(downloaders);
-
-    if (!concatenate_files(paths, destination_file_name)) {
-        success = false;
-        error = "Problem concatenating files.";
+    //split what is missing into ranges for the connections
+    long incr = (long)(1 + size * 1.0 / qMax(1, num_threads));
+    if (incr < 1000)
+        incr = 1000; //let's be a bit reasonable
+    long pos = 0;
+    long num_bytes_present = 0;
+    for (int i = 0; i <= m_completed_ranges.count(); i++) {
+        long gap_end = (i < m_completed_ranges.count()) ? m_completed_ranges[i].first - 1 : size - 1;
+        while (pos <= gap_end) {
+            long end = qMin(pos + incr - 1, gap_end);
+            m_pending_ranges << qMakePair(pos, end);
+            pos = end + 1;
+        }
+        if (i < m_completed_ranges.count()) {
+            num_bytes_present += m_completed_ranges[i].second - m_completed_ranges[i].first + 1;
+            pos = m_completed_ranges[i].second + 1;
+        }
     }
+    if (resuming)
+        m_task.log() << QString("Resuming download: %1 of %2 bytes already present").arg(num_bytes_present).arg(size);
+    m_num_bytes_downloaded = num_bytes_present;
+    save_completed_ranges();
 
-    //clean up
-    foreach (QString fname, paths) {
-        QFile::remove(fname);
+    start_more_downloaders();
+    if (m_downloaders.isEmpty()) {
+        //nothing left to do (everything was already there)
+        slot_downloader_finished();
     }
-    */
 }
 
 PrvParallelDownloader::~PrvParallelDownloader()
 {
+    if (!isFinished()) {
+        //destroyed in the middle of the download, so keep what we have for next time
+        foreach (PrvRangeDownloader* DD, m_downloaders) {
+            if (DD->num_bytes_downloaded() > 0)
+                add_completed_range(DD->start_byte, DD->start_byte + DD->num_bytes_downloaded() - 1);
+        }
+        if (m_file.isOpen())
+            save_completed_ranges();
+    }
     qDeleteAll(m_downloaders);
 }
 
@@ -572,6 +574,9 @@ long PrvParallelDownloader::num_bytes_downloaded()
 void PrvParallelDownloader::slot_downloader_progress()
 {
     long num_bytes = 0;
+    for (int i = 0; i < m_completed_ranges.count(); i++) {
+        num_bytes += m_completed_ranges[i].second - m_completed_ranges[i].first + 1;
+    }
     for (int i = 0; i < m_downloaders.count(); i++) {
         num_bytes += m_downloaders[i]->num_bytes_downloaded();
     }
@@ -586,48 +591,154 @@ void PrvParallelDownloader::slot_downloader_finished()
 {
     if (this->isFinished())
         return;
-    bool all_finished = true;
-    for (int i = 0; i < m_downloaders.count(); i++) {
-        if (m_downloaders[i]->isFinished()) {
-            if (!m_downloaders[i]->success) {
-                if (success) {
-                    //record the error on only the first non-success
-                    success = false;
-                    error = m_downloaders[i]->error;
-                }
-                for (int j = 0; j < m_downloaders.count(); j++) {
-                    m_downloaders[j]->requestStop();
+    QString error0;
+    QList<PrvRangeDownloader*> downloaders = m_downloaders;
+    foreach (PrvRangeDownloader* DD, downloaders) {
+        if (!DD->isFinished())
+            continue;
+        m_downloaders.removeAll(DD);
+        long num = DD->num_bytes_downloaded();
+        if (num > 0)
+            add_completed_range(DD->start_byte, DD->start_byte + num - 1);
+        if (!DD->success) {
+            //retry the rest of the range (not the whole thing), unless it keeps failing without progress
+            long retry_start = DD->start_byte + num;
+            if (retry_start <= DD->end_byte) {
+                m_num_attempts[retry_start]++;
+                if (m_num_attempts[retry_start] >= PRV_PARALLEL_DOWNLOAD_MAX_ATTEMPTS)
+                    error0 = DD->error;
+                else {
+                    m_task.log() << "Retrying range after error: " + DD->error;
+                    m_pending_ranges.prepend(qMakePair(retry_start, DD->end_byte));
                 }
             }
         }
-        else {
-            all_finished = false;
-        }
+        DD->deleteLater();
     }
-    if (all_finished) {
-        //for the response text, either use the one where concatentated=true, or the one where success!=true
-        QStringList file_names;
-        for (int i = 0; i < m_downloaders.count(); i++) {
-            file_names << m_downloaders[i]->destination_file_name;
+    save_completed_ranges();
+    if (!error0.isEmpty()) {
+        finish(false, error0);
+        return;
+    }
+    if (stopRequested()) {
+        finish(false, "Stop requested.");
+        return;
+    }
+
+    start_more_downloaders();
+
+    if ((m_downloaders.isEmpty()) && (m_pending_ranges.isEmpty())) {
+        m_file.close();
+        //replaces an earlier download of the same file in one step, in case another process is reading it
+        if (::rename(m_file.fileName().toUtf8().data(), destination_file_name.toUtf8().data()) != 0) {
+            finish(false, "Unable to rename file: " + m_file.fileName() + " " + destination_file_name);
+            return;
         }
-        m_task.log() << "Concatenating files" << file_names << this->destination_file_name;
+        QFile::remove(destination_file_name + ".part.ranges");
+        m_task.log() << QString("Downloaded %1 MB in %2 sec").arg(size * 1.0 / 1e6).arg(m_timer.elapsed() * 1.0 / 1000);
+        finish(true);
+    }
+}
+
+bool PrvParallelDownloader::load_completed_ranges()
+{
+    m_completed_ranges.clear();
+    QString part_path = destination_file_name + ".part";
+    if ((!QFile::exists(part_path)) || (QFileInfo(part_path).size() != size))
+        return false;
+    QJsonObject obj = QJsonDocument::fromJson(TextFile::read(part_path + ".ranges").toUtf8()).object();
+    if ((obj["source_url"].toString() != source_url) || (obj["size"].toVariant().toLongLong() != size))
+        return false;
+    QJsonArray completed = obj["completed"].toArray();
+    for (int i = 0; i < completed.count(); i++) {
+        QJsonArray range = completed[i].toArray();
+        long start_byte = range[0].toVariant().toLongLong();
+        long end_byte = range[1].toVariant().toLongLong();
+        if ((0 <= start_byte) && (start_byte <= end_byte) && (end_byte < size))
+            add_completed_range(start_byte, end_byte);
+    }
+    return true;
+}
 
-        ConcatenateThread* T = new ConcatenateThread;
-        T->file_names = file_names;
-        T->dest_file_name = this->destination_file_name;
-        QObject::connect(T, SIGNAL(finished()), this, SLOT(slot_concatenate_finished()));
-        QObject::connect(T, SIGNAL(finished()), T, SLOT(deleteLater()));
-        T->start();
+void PrvParallelDownloader::save_completed_ranges()
+{
+    QJsonArray completed;
+    for (int i = 0; i < m_completed_ranges.count(); i++) {
+        QJsonArray range;
+        range << (double)m_completed_ranges[i].first << (double)m_completed_ranges[i].second;
+        completed << range;
     }
+    QJsonObject obj;
+    obj["source_url"] = source_url;
+    obj["size"] = (double)size;
+    obj["completed"] = completed;
+    TextFile::write(destination_file_name + ".part.ranges", QJsonDocument(obj).toJson(QJsonDocument::Compact));
 }
 
-void PrvParallelDownloader::slot_concatenate_finished()
+void PrvParallelDownloader::add_completed_range(long start_byte, long end_byte)
 {
-    if (!QFile::exists(this->destination_file_name)) {
-        m_task.error() << "Problem concatenating files. File does not exist: " + this->destination_file_name;
-        this->setFinished();
-        return;
+    m_completed_ranges << qMakePair(start_byte, end_byte);
+    std::sort(m_completed_ranges.begin(), m_completed_ranges.end());
+    QList<QPair<long, long> > merged;
+    for (int i = 0; i < m_completed_ranges.count(); i++) {
+        if ((!merged.isEmpty()) && (m_completed_ranges[i].first <= merged.last().second + 1))
+            merged.last().second = qMax(merged.last().second, m_completed_ranges[i].second);
+        else
+            merged << m_completed_ranges[i];
+    }
+    m_completed_ranges = merged;
+}
+
+void PrvParallelDownloader::start_more_downloaders()
+{
+    while (m_downloaders.count() < num_threads) {
+        if (m_pending_ranges.isEmpty()) {
+            //split the range with the most left to do -- usually the slowest connection
+            PrvRangeDownloader* slowest = 0;
+            foreach (PrvRangeDownloader* DD, m_downloaders) {
+                if ((!slowest) || (DD->num_bytes_remaining() > slowest->num_bytes_remaining()))
+                    slowest = DD;
+            }
+            if ((!slowest) || (slowest->num_bytes_remaining() < 2 * PRV_PARALLEL_DOWNLOAD_MIN_SPLIT_BYTES))
+                break;
+            long pos = slowest->start_byte + slowest->num_bytes_downloaded();
+            long mid = pos + slowest->num_bytes_remaining() / 2;
+            m_pending_ranges << qMakePair(mid, slowest->end_byte);
+            slowest->end_byte = mid - 1;
+        }
+        QPair<long, long> range = m_pending_ranges.takeFirst();
+        PrvRangeDownloader* DD = new PrvRangeDownloader;
+        DD->source_url = source_url;
+        DD->destination_fd = m_file.handle();
+        DD->start_byte = range.first;
+        DD->end_byte = range.second;
+        m_downloaders << DD;
+        connect(DD, SIGNAL(progress()), this, SLOT(slot_downloader_progress()));
+        connect(DD, SIGNAL(finished()), this, SLOT(slot_downloader_finished()), Qt::QueuedConnection);
+        m_task.log() << QString("Starting range %1-%2").arg(range.first).arg(range.second);
+        DD->start();
     }
+}
+
+void PrvParallelDownloader::finish(bool success0, const QString& error0)
+{
+    if (!success0) {
+        //keep what we have, so that the download can be resumed
+        foreach (PrvRangeDownloader* DD, m_downloaders) {
+            QObject::disconnect(DD, 0, this, 0);
+            if (DD->num_bytes_downloaded() > 0)
+                add_completed_range(DD->start_byte, DD->start_byte + DD->num_bytes_downloaded() - 1);
+            DD->deleteLater();
+        }
+        m_downloaders.clear();
+        if (m_file.isOpen())
+            save_completed_ranges();
+        m_task.error() << error0;
+    }
+    if (m_file.isOpen())
+        m_file.close();
+    success = success0;
+    error = error0;
     this->setFinished();
 }
 
@@ -14,32 +14,261 @@
 #include <QStringList>
 #include <QTime>
 #include <QDataStream>
+#include <QSemaphore>
+#include <QThread>
+#include <QAtomicInt>
+#include <QVector>
+#include <QTextStream>
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+
+#define SUMIT_READ_BLOCK_SIZE (4 * 1024 * 1024)
+#define SUMIT_READ_ALIGNMENT 4096
+#define SUMIT_NUM_READ_BUFFERS 3
+#define SUMIT_TREE_LEAF_SIZE (64 * 1024 * 1024)
+
+namespace {
+
+//like pread, but keeps reading until num bytes or the end of the file
+qint64 read_fully(int fd, char* buf, qint64 num, qint64 offset)
+{
+    qint64 total = 0;
+    while (total < num) {
+        ssize_t num0 = ::pread(fd, buf + total, num - total, offset + total);
+        if (num0 < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (num0 == 0)
+            break;
+        total += num0;
+    }
+    return total;
+}
+
+/*
+ * Reads a range of a file in large aligned blocks on a background thread, so that
+ * the reading of the next blocks overlaps with the hashing of the current one.
+ */
+class BlockReader : public QThread {
+public:
+    //input
+    int fd = -1;
+    qint64 offset = 0;
+    qint64 length = -1; //-1 means until the end of the file
+
+    BlockReader()
+        : m_free_buffers(SUMIT_NUM_READ_BUFFERS)
+    {
+        for (int i = 0; i < SUMIT_NUM_READ_BUFFERS; i++) {
+            void* ptr = 0;
+            if (posix_memalign(&ptr, SUMIT_READ_ALIGNMENT, SUMIT_READ_BLOCK_SIZE) != 0)
+                ptr = 0;
+            m_buffers[i] = (char*)ptr;
+        }
+    }
+    virtual ~BlockReader()
+    {
+        for (int i = 0; i < SUMIT_NUM_READ_BUFFERS; i++) {
+            free(m_buffers[i]);
+        }
+    }
+    bool buffersAllocated() const
+    {
+        for (int i = 0; i < SUMIT_NUM_READ_BUFFERS; i++) {
+            if (!m_buffers[i])
+                return false;
+        }
+        return true;
+    }
+
+    //call these from the consuming thread: nextBlock() returns false once the last block has been released (or on error)
+    bool nextBlock(const char*& data, qint64& num)
+    {
+        if (m_done)
+            return false;
+        m_filled_buffers.acquire();
+        int ii = m_consume_index % SUMIT_NUM_READ_BUFFERS;
+        if (m_counts[ii] < 0) {
+            m_error = true;
+            m_done = true;
+            return false;
+        }
+        data = m_buffers[ii];
+        num = m_counts[ii];
+        if (m_last[ii])
+            m_done = true;
+        return true;
+    }
+    void releaseBlock()
+    {
+        m_consume_index++;
+        m_free_buffers.release();
+    }
+    bool error() const { return m_error; }
+
+    void run()
+    {
+        qint64 pos = offset;
+        for (int index = 0;; index++) {
+            int ii = index % SUMIT_NUM_READ_BUFFERS;
+            qint64 num = SUMIT_READ_BLOCK_SIZE;
+            if (length >= 0)
+                num = qMin(num, offset + length - pos);
+            m_free_buffers.acquire();
+            m_counts[ii] = (num > 0) ? read_fully(fd, m_buffers[ii], num, pos) : 0;
+            m_last[ii] = ((m_counts[ii] < num) || ((length >= 0) && (pos + m_counts[ii] >= offset + length)));
+            bool stop = ((m_counts[ii] < 0) || (m_last[ii]));
+            pos += m_counts[ii];
+            m_filled_buffers.release();
+            if (stop)
+                break;
+        }
+    }
+
+private:
+    char* m_buffers[SUMIT_NUM_READ_BUFFERS];
+    qint64 m_counts[SUMIT_NUM_READ_BUFFERS];
+    bool m_last[SUMIT_NUM_READ_BUFFERS];
+    QSemaphore m_free_buffers;
+    QSemaphore m_filled_buffers;
+    int m_consume_index = 0;
+    bool m_done = false;
+    bool m_error = false;
+};
+
+//hash length bytes starting at offset (length=-1 for the rest of the file). Returns false on a read error
+bool hash_file_range(int fd, qint64 offset, qint64 length, QCryptographicHash& hash)
+{
+    BlockReader reader;
+    if (!reader.buffersAllocated())
+        return false;
+    reader.fd = fd;
+    reader.offset = offset;
+    reader.length = length;
+    reader.start();
+    const char* data;
+    qint64 num;
+    while (reader.nextBlock(data, num)) {
+        hash.addData(data, num);
+        reader.releaseBlock();
+    }
+    reader.wait();
+    return !reader.error();
+}
+
+int open_for_hashing(const QString& path)
+{
+    int fd = ::open(path.toUtf8().data(), O_RDONLY);
+    if (fd < 0)
+        return fd;
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    return fd;
+}
+
+class TreeHashWorker : public QThread {
+public:
+    //input
+    int fd = -1;
+    qint64 file_size = 0;
+    qint64 num_leaves = 0;
+    QAtomicInt* next_leaf = 0;
+
+    //output
+    QByteArray* leaf_hashes = 0; //preallocated, one per leaf
+    bool error = false;
+
+    void run()
+    {
+        while (true) {
+            qint64 leaf = next_leaf->fetchAndAddOrdered(1);
+            if (leaf >= num_leaves)
+                break;
+            qint64 offset = leaf * SUMIT_TREE_LEAF_SIZE;
+            QCryptographicHash hash(QCryptographicHash::Sha1);
+            if (!hash_file_range(fd, offset, qMin((qint64)SUMIT_TREE_LEAF_SIZE, file_size - offset), hash)) {
+                error = true;
+                break;
+            }
+            leaf_hashes[leaf] = hash.result().toHex();
+        }
+    }
+};
+}
 
 QString compute_the_file_hash(const QString& path, long num_bytes)
 {
+    if (num_bytes != 0) {
+        //For compatibility with existing .prv records we must reproduce the head checksum
+        //exactly as it was historically computed -- and owing to the loop condition in the
+        //original implementation, that never consumed any bytes of the file.
+        QFile FF(path);
+        if (!FF.open(QFile::ReadOnly))
+            return "";
+        return QString(QCryptographicHash::hash(QByteArray(), QCryptographicHash::Sha1).toHex());
+    }
+
+    int fd = open_for_hashing(path);
+    if (fd < 0)
+        return "";
     QCryptographicHash hash(QCryptographicHash::Sha1);
-    QFile FF(path);
-    if (!FF.open(QFile::ReadOnly))
+    bool ok = hash_file_range(fd, 0, -1, hash);
+    ::close(fd);
+    if (!ok) {
+        qWarning() << "Error reading file while computing checksum: " + path;
+        return "";
+    }
+    return QString(hash.result().toHex());
+}
+
+QString compute_the_file_tree_hash(const QString& path)
+{
+    int fd = open_for_hashing(path);
+    if (fd < 0)
+        return "";
+    qint64 file_size = QFileInfo(path).size();
+    qint64 num_leaves = qMax(1LL, (file_size + SUMIT_TREE_LEAF_SIZE - 1) / SUMIT_TREE_LEAF_SIZE);
+    QVector<QByteArray> leaf_hashes(num_leaves);
+
+    QAtomicInt next_leaf(0);
+    int num_threads = qMax(1, (int)qMin((qint64)QThread::idealThreadCount(), num_leaves));
+    QList<TreeHashWorker*> workers;
+    for (int i = 0; i < num_threads; i++) {
+        TreeHashWorker* W = new TreeHashWorker;
+        W->fd = fd;
+        W->file_size = file_size;
+        W->num_leaves = num_leaves;
+        W->next_leaf = &next_leaf;
+        W->leaf_hashes = leaf_hashes.data();
+        W->start();
+        workers << W;
+    }
+    bool ok = true;
+    foreach (TreeHashWorker* W, workers) {
+        W->wait();
+        if (W->error)
+            ok = false;
+        delete W;
+    }
+    ::close(fd);
+    if (!ok) {
+        qWarning() << "Error reading file while computing tree checksum: " + path;
         return "";
-    QTime timer;
-    timer.start();
-    //printf("Computing checksum for file %s\n", path.toLatin1().data());
-    long num_bytes_processed = 0;
-    while ((!FF.atEnd()) && ((num_bytes == 0) || (num_bytes_processed == num_bytes))) {
-        QByteArray tmp = FF.read(10000);
-        if (num_bytes != 0) {
-            if (num_bytes_processed + tmp.count() > num_bytes) {
-                tmp = tmp.mid(0, num_bytes - num_bytes_processed);
-            }
-        }
-        hash.addData(tmp);
-        num_bytes_processed += tmp.count();
     }
 
-    QString ret = QString(hash.result().toHex());
-    //printf("%s -- Elapsed: %g sec\n", ret.toLatin1().data(), timer.elapsed() * 1.0 / 1000);
-    return ret;
+    //the root is the sha1 of a header line followed by the hex sha1 of each leaf on its own line
+    QCryptographicHash root(QCryptographicHash::Sha1);
+    root.addData(QString("sha1tree %1 %2\n").arg(SUMIT_TREE_LEAF_SIZE).arg(file_size).toLatin1());
+    foreach (QByteArray leaf_hash, leaf_hashes) {
+        root.addData(leaf_hash + "\n");
+    }
+    return QString(root.result().toHex());
 }
 
 QString compute_the_string_hash(const QString& str)
@@ -79,17 +308,18 @@ void write_text_file(const QString& path, const QString& txt)
     out << txt;
 }
 
-void create_hash_file(const QString& path, const QString& hash_path)
+void create_hash_file(const QString& path, const QString& hash_path, const QString& checksum_type)
 {
-    QString the_hash = compute_the_file_hash(path, 0);
+    QString the_hash;
+    if (checksum_type == "sha1tree")
+        the_hash = compute_the_file_tree_hash(path);
+    else
+        the_hash = compute_the_file_hash(path, 0);
     write_text_file(hash_path, the_hash);
 }
 
-QString sumit(const QString& path, long num_bytes)
+QString sumit_cached(const QString& path, const QString& checksum_type)
 {
-    if (num_bytes != 0) {
-        return compute_the_file_hash(path, num_bytes);
-    }
     //the file id is a hashed function of device,inode,size, and modification time (in seconds)
     //note that it is not dependent on the file name
     struct stat SS;
@@ -103,22 +333,45 @@ QString sumit(const QString& path, long num_bytes)
     //QString id_string = QString("%1:%2:%3:%4").arg(SS.st_dev).arg(SS.st_ino).arg(SS.st_size).arg(SS.st_mtim.tv_sec);
     QString file_id = compute_the_string_hash(id_string);
 
-    QString dirname = QString("/tmp/sumit/sha1/%1").arg(file_id.mid(0, 4));
+    QString dirname = QString("/tmp/sumit/%1/%2").arg(checksum_type).arg(file_id.mid(0, 4));
     create_directory_if_doesnt_exist(dirname);
     QString hash_path = QString("%1/%2").arg(dirname).arg(file_id);
 
     QString hash_sum = read_text_file(hash_path);
     if (hash_sum.isEmpty()) {
-        create_hash_file(path, hash_path);
+        create_hash_file(path, hash_path, checksum_type);
         hash_sum = read_text_file(hash_path);
     }
     if (hash_sum.count() != 40) {
-        create_hash_file(path, hash_path);
+        create_hash_file(path, hash_path, checksum_type);
         hash_sum = read_text_file(hash_path);
     }
     return hash_sum;
 }
 
+QString sumit(const QString& path, long num_bytes)
+{
+    if (num_bytes != 0) {
+        return compute_the_file_hash(path, num_bytes);
+    }
+    return sumit_cached(path, "sha1");
+}
+
+QString sumit_tree(const QString& path)
+{
+    return sumit_cached(path, "sha1tree");
+}
+
+QString sumit_of_type(const QString& path, const QString& checksum_type)
+{
+    if ((checksum_type.isEmpty()) || (checksum_type == "sha1"))
+        return sumit(path);
+    if (checksum_type == "sha1tree")
+        return sumit_tree(path);
+    qWarning() << "Unknown checksum type: " + checksum_type;
+    return "";
+}
+
 QString sumit_dir(const QString& path)
 {
     QStringList files = QDir(path).entryList(QStringList("*"), QDir::Files, QDir::Name);
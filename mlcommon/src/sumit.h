@@ -18,6 +18,13 @@ In the case of directories, outputs a unique sha1 checksum that depends only on
 */
 
 QString sumit(const QString& path, long num_bytes = 0);
+/*
+The "sha1tree" checksum type: the file is split into 64 MB leaves which are hashed in parallel, and the result is the sha1 of
+"sha1tree [leaf size] [file size]\n" followed by the hex sha1 of each leaf on its own line. Much faster than sha1 for huge files
+on fast storage, but of course not interchangeable with it -- so .prv files record which type they use (see original_checksum_type).
+*/
+QString sumit_tree(const QString& path);
+QString sumit_of_type(const QString& path, const QString& checksum_type); //"sha1" (or empty) or "sha1tree"
 QString sumit_dir(const QString& path);
 
 #endif // SUMIT_H
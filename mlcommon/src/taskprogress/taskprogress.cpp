@@ -14,6 +14,8 @@
 #include <QSortFilterProxyModel>
 
 #include <QAtomicInt>
+#include <atomic>
+#include <math.h>
 
 Q_DECLARE_METATYPE(QSet<QString>)
 namespace TaskManager {
@@ -484,12 +486,185 @@ private:
     QVariant m_value;
 };
 
+/*
+ * Sharded counters for the quantities and latencies.
+ *
+ * Each thread accumulates into its own slots, which only that thread ever writes (so relaxed loads and stores
+ * suffice, and no read-modify-write is needed). A thread only takes the registry mutex the first time it uses a name.
+ * Readers take the mutex and sum over the shards. When a thread exits, its totals are folded into the retired values.
+ */
+struct TaskProgressCounterSlot {
+    std::atomic<double> value;
+    TaskProgressCounterSlot()
+        : value(0)
+    {
+    }
+};
+
+struct TaskProgressLatencySlot {
+    std::atomic<long> count;
+    std::atomic<double> total_msec;
+    std::atomic<double> max_msec;
+    std::atomic<long> bucket_counts[TaskProgressLatencyHistogram::NumBuckets];
+    TaskProgressLatencySlot()
+        : count(0)
+        , total_msec(0)
+        , max_msec(0)
+    {
+        for (int b = 0; b < TaskProgressLatencyHistogram::NumBuckets; b++)
+            bucket_counts[b].store(0, std::memory_order_relaxed);
+    }
+    void record(double msec)
+    {
+        count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        total_msec.store(total_msec.load(std::memory_order_relaxed) + msec, std::memory_order_relaxed);
+        if (msec > max_msec.load(std::memory_order_relaxed))
+            max_msec.store(msec, std::memory_order_relaxed);
+        std::atomic<long>& bc = bucket_counts[TaskProgressLatencyHistogram::bucketForMsec(msec)];
+        bc.store(bc.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+    void addTo(TaskProgressLatencyHistogram& H) const
+    {
+        H.count += count.load(std::memory_order_relaxed);
+        H.total_msec += total_msec.load(std::memory_order_relaxed);
+        H.max_msec = qMax(H.max_msec, max_msec.load(std::memory_order_relaxed));
+        for (int b = 0; b < TaskProgressLatencyHistogram::NumBuckets; b++)
+            H.bucket_counts[b] += bucket_counts[b].load(std::memory_order_relaxed);
+    }
+};
+
+struct TaskProgressCounterShard {
+    TaskProgressCounterShard();
+    ~TaskProgressCounterShard();
+    //these are only modified by the owning thread, with the registry mutex held
+    QHash<QString, TaskProgressCounterSlot*> counters;
+    QHash<QString, TaskProgressLatencySlot*> latencies;
+
+    TaskProgressCounterSlot* counter(const QString& name);
+    TaskProgressLatencySlot* latency(const QString& name);
+};
+
+class TaskProgressCounterRegistry {
+public:
+    QMutex mutex;
+    QList<TaskProgressCounterShard*> shards;
+    QMap<QString, double> retired_quantities;
+    QMap<QString, TaskProgressLatencyHistogram> retired_latencies;
+
+    double quantity(const QString& name)
+    {
+        QMutexLocker locker(&mutex);
+        double ret = retired_quantities.value(name, 0);
+        foreach (TaskProgressCounterShard* shard, shards) {
+            TaskProgressCounterSlot* slot = shard->counters.value(name);
+            if (slot)
+                ret += slot->value.load(std::memory_order_relaxed);
+        }
+        return ret;
+    }
+    TaskProgressLatencyHistogram latencyHistogram(const QString& name)
+    {
+        QMutexLocker locker(&mutex);
+        TaskProgressLatencyHistogram ret = retired_latencies.value(name);
+        foreach (TaskProgressCounterShard* shard, shards) {
+            TaskProgressLatencySlot* slot = shard->latencies.value(name);
+            if (slot)
+                slot->addTo(ret);
+        }
+        return ret;
+    }
+    QStringList latencyNames()
+    {
+        QMutexLocker locker(&mutex);
+        QSet<QString> names = retired_latencies.keys().toSet();
+        foreach (TaskProgressCounterShard* shard, shards) {
+            names.unite(shard->latencies.keys().toSet());
+        }
+        QStringList ret = names.toList();
+        qSort(ret);
+        return ret;
+    }
+    void retire(TaskProgressCounterShard* shard)
+    {
+        QMutexLocker locker(&mutex);
+        shards.removeAll(shard);
+        for (QHash<QString, TaskProgressCounterSlot*>::const_iterator it = shard->counters.constBegin(); it != shard->counters.constEnd(); ++it) {
+            retired_quantities[it.key()] += it.value()->value.load(std::memory_order_relaxed);
+        }
+        for (QHash<QString, TaskProgressLatencySlot*>::const_iterator it = shard->latencies.constBegin(); it != shard->latencies.constEnd(); ++it) {
+            it.value()->addTo(retired_latencies[it.key()]);
+        }
+    }
+};
+
+Q_GLOBAL_STATIC(TaskProgressCounterRegistry, _q_tp_counter_registry)
+
+TaskProgressCounterShard::TaskProgressCounterShard()
+{
+    TaskProgressCounterRegistry* registry = _q_tp_counter_registry;
+    QMutexLocker locker(&registry->mutex);
+    registry->shards << this;
+}
+
+TaskProgressCounterShard::~TaskProgressCounterShard()
+{
+    //the registry may already be gone if this is the main thread at exit
+    if (!_q_tp_counter_registry.isDestroyed())
+        _q_tp_counter_registry->retire(this);
+    qDeleteAll(counters);
+    qDeleteAll(latencies);
+}
+
+TaskProgressCounterSlot* TaskProgressCounterShard::counter(const QString& name)
+{
+    TaskProgressCounterSlot* slot = counters.value(name);
+    if (!slot) {
+        QMutexLocker locker(&_q_tp_counter_registry->mutex);
+        slot = new TaskProgressCounterSlot;
+        counters[name] = slot;
+    }
+    return slot;
+}
+
+TaskProgressLatencySlot* TaskProgressCounterShard::latency(const QString& name)
+{
+    TaskProgressLatencySlot* slot = latencies.value(name);
+    if (!slot) {
+        QMutexLocker locker(&_q_tp_counter_registry->mutex);
+        slot = new TaskProgressLatencySlot;
+        latencies[name] = slot;
+    }
+    return slot;
+}
+
+static TaskProgressCounterShard* this_thread_counter_shard()
+{
+    static thread_local TaskProgressCounterShard shard;
+    return &shard;
+}
+
+class TaskProgressQuantitiesEvent : public QEvent {
+public:
+    static QEvent::Type type()
+    {
+        static QEvent::Type typeVal = static_cast<QEvent::Type>(registerEventType());
+        return typeVal;
+    }
+    TaskProgressQuantitiesEvent()
+        : QEvent(TaskProgressQuantitiesEvent::type())
+    {
+    }
+};
+
 class TaskProgressMonitorPrivate : public TaskProgressMonitor {
 public:
     TaskProgressMonitorPrivate()
     {
         m_model = new TaskProgressModelPrivate(this);
         qRegisterMetaType<TaskInfo>();
+        //the global instance may first be needed in a worker thread, but the events must be handled by the main event loop
+        if (QCoreApplication::instance())
+            moveToThread(QCoreApplication::instance()->thread());
     }
 
     ~TaskProgressMonitorPrivate()
@@ -522,15 +697,26 @@ public:
 
     void incrementQuantity(QString name, double val) override
     {
-        QWriteLocker locker(&m_quantitiesMutex);
-        m_quantities.insert(name, m_quantities.value(name, 0) + val);
-        locker.unlock();
-        emit quantitiesChanged();
+        TaskProgressCounterSlot* slot = this_thread_counter_shard()->counter(name);
+        slot->value.store(slot->value.load(std::memory_order_relaxed) + val, std::memory_order_relaxed);
+        scheduleQuantitiesChanged();
     }
     double getQuantity(QString name) const override
     {
-        QReadLocker locker(&m_quantitiesMutex);
-        return m_quantities.value(name, 0);
+        return _q_tp_counter_registry->quantity(name);
+    }
+
+    void recordLatency(QString name, double msec) override
+    {
+        this_thread_counter_shard()->latency(name)->record(msec);
+    }
+    TaskProgressLatencyHistogram getLatencyHistogram(QString name) const override
+    {
+        return _q_tp_counter_registry->latencyHistogram(name);
+    }
+    QStringList latencyNames() const override
+    {
+        return _q_tp_counter_registry->latencyNames();
     }
 
     TaskProgressModel* model() const override
@@ -560,8 +746,26 @@ protected:
         m_timerId = 0;
     }
 
+    void scheduleQuantitiesChanged()
+    {
+        //only the first increment after an emission posts an event, the rest are coalesced by the timer
+        if (!m_quantitiesPending.testAndSetOrdered(0, 1))
+            return;
+        if (QCoreApplication::instance())
+            QCoreApplication::postEvent(this, new TaskProgressQuantitiesEvent);
+        else {
+            m_quantitiesPending.store(0);
+            emit quantitiesChanged();
+        }
+    }
+
     void customEvent(QEvent* event)
     {
+        if (event->type() == TaskProgressQuantitiesEvent::type()) {
+            if (!m_quantitiesTimerId)
+                m_quantitiesTimerId = startTimer(200);
+            return;
+        }
         if (event->type() != TaskProgressEvent::type()) {
             event->ignore();
             return;
@@ -611,12 +815,18 @@ protected:
             m_changeManager.exec(m_model);
             stop();
         }
+        else if (event->timerId() == m_quantitiesTimerId) {
+            killTimer(m_quantitiesTimerId);
+            m_quantitiesTimerId = 0;
+            m_quantitiesPending.store(0);
+            emit quantitiesChanged();
+        }
     }
 
 private:
     TaskProgressModelPrivate* m_model;
-    mutable QReadWriteLock m_quantitiesMutex;
-    QMap<QString, double> m_quantities;
+    QAtomicInt m_quantitiesPending;
+    int m_quantitiesTimerId = 0;
     ChangeLog::Manager m_changeManager;
     int m_timerId = 0;
 };
@@ -633,6 +843,35 @@ TaskProgressMonitorPrivate* TaskProgressMonitorPrivate::privateInstance()
     return _q_tpm_instance;
 }
 
+double TaskProgressLatencyHistogram::percentileMsec(double p) const
+{
+    if (!count)
+        return 0;
+    double target = p * count;
+    long cumulative = 0;
+    for (int b = 0; b < bucket_counts.count(); b++) {
+        cumulative += bucket_counts[b];
+        if ((cumulative >= target) && (cumulative > 0))
+            return qMin(bucketUpperBoundMsec(b), max_msec);
+    }
+    return max_msec;
+}
+
+double TaskProgressLatencyHistogram::bucketUpperBoundMsec(int b)
+{
+    return ldexp(1.0, b) * 1e-3;
+}
+
+int TaskProgressLatencyHistogram::bucketForMsec(double msec)
+{
+    double usec = msec * 1e3;
+    if (!(usec >= 1))
+        return 0;
+    int exponent;
+    frexp(usec, &exponent); //usec = m*2^exponent with 0.5<=m<1, so 2^(exponent-1)<=usec<2^exponent
+    return qMin(exponent, (int)NumBuckets - 1);
+}
+
 class TagsFilterProxyModel : public QSortFilterProxyModel {
 public:
     TagsFilterProxyModel(QObject* parent = 0)
@@ -8,6 +8,7 @@ CONFIG += c++11
 
 include(../../mlcommon/mlcommon.pri)
 include(../../mlcommon/mda.pri)
+include(../../mlcommon/taskprogress.pri)
 
 DESTDIR = ../bin
 OBJECTS_DIR = ../build
@@ -22,19 +23,29 @@ INCLUDEPATH += utils core mda unit_tests 3rdparty
 HEADERS += \
     mpdaemon.h \
     mpdaemoninterface.h \
-    localserver.h
+    localserver.h \
+    mpresourcehistory.h
 SOURCES += \
     mpdaemon.cpp \
     mpdaemoninterface.cpp \
-    localserver.cpp
+    localserver.cpp \
+    mpresourcehistory.cpp
 
 HEADERS += \
     processmanager.h \
+    processmonitor.h \
+    mpbenchmark.h \
+    mpprofiles.h \
+    resultcache.h \
     scriptcontroller2.h \
     unit_tests/unit_tests.h
 
 SOURCES += \
     processmanager.cpp \
+    processmonitor.cpp \
+    mpbenchmark.cpp \
+    mpprofiles.cpp \
+    resultcache.cpp \
     scriptcontroller2.cpp \
     unit_tests/unit_tests.cpp
 
@@ -46,9 +57,11 @@ test {
     DEPENDPATH += unit_tests
     SOURCES += unit_tests/testMda.cpp	\
 	unit_tests/testMain.cpp	\
-	unit_tests/testMdaIO.cpp
+	unit_tests/testMdaIO.cpp \
+	unit_tests/testMPProfiles.cpp
     HEADERS += unit_tests/testMda.h \
-	unit_tests/testMdaIO.h
+	unit_tests/testMdaIO.h \
+	unit_tests/testMPProfiles.h
 } else {
     SOURCES += mountainprocessmain.cpp
 }
@@ -61,6 +61,8 @@ If anything crashes along the way, every involved QProcess is killed.
 #include "cachemanager.h"
 #include "mlcommon.h"
 #include "scriptcontroller2.h"
+#include "mpbenchmark.h"
+#include "mpprofiles.h"
 #include <unistd.h>
 
 #ifndef Q_OS_LINUX
@@ -103,12 +105,11 @@ struct run_script_opts {
     //QStringList server_urls;
     //QString server_base_path;
     bool force_run;
+    int priority = 0;
     QString working_path;
+    QString pipeline_run; //passed on to the processes, which tag their profiles with it
 };
 
-QJsonArray monitor_stats_to_json_array(const QList<MonitorStats>& stats);
-long compute_peak_mem_bytes(const QList<MonitorStats>& stats);
-double compute_peak_cpu_pct(const QList<MonitorStats>& stats);
 //void log_begin(int argc,char* argv[]);
 //void //log_end();
 
@@ -263,10 +264,11 @@ int main(int argc, char* argv[])
             printf("PROCESS COMPLETED: %s\n", info.processor_name.toLatin1().data());
             if (!error_message.isEmpty())
                 printf("ERROR: %s\n", error_message.toLatin1().data());
-            long mb = compute_peak_mem_bytes(info.monitor_stats) / 1000000;
-            double cpu = compute_peak_cpu_pct(info.monitor_stats);
+            long mb = info.peak_stats.mem_bytes / 1000000;
+            double cpu = info.peak_stats.cpu_pct;
             if (cpu) {
                 printf("Peak usage: %ld MB RAM / %g%% CPU\n", mb, cpu);
+                printf("Total: %g sec CPU / %ld MB read / %ld MB written\n", info.peak_stats.cpu_time_sec, (long)(info.peak_stats.read_bytes / 1000000), (long)(info.peak_stats.write_bytes / 1000000));
             }
             printf("---------------------------------------------------------------\n");
         }
@@ -284,9 +286,19 @@ int main(int argc, char* argv[])
         obj["standard_error"] = QString(info.standard_error);
         obj["success"] = error_message.isEmpty();
         obj["error"] = error_message;
-        obj["peak_mem_bytes"] = (long long)compute_peak_mem_bytes(info.monitor_stats);
-        obj["peak_cpu_pct"] = compute_peak_cpu_pct(info.monitor_stats);
+        obj["peak_mem_bytes"] = (long long)info.peak_stats.mem_bytes;
+        obj["peak_cpu_pct"] = info.peak_stats.cpu_pct;
+        obj["resource_usage"] = monitor_stats_to_json_object(info.peak_stats); //peak memory/cpu and the total cpu time, io and page faults
         //obj["monitor_stats"]=monitor_stats_to_json_array(info.monitor_stats); -- at some point we can include this in the file. For now we only worry about the computed peak values
+        if (!info.profile.isEmpty()) {
+            QJsonObject profile = info.profile;
+            profile["timestamp"] = QDateTime::currentDateTime().toString(Qt::ISODate);
+            profile["pipeline_run"] = CLP.named_parameters.value("_pipeline_run").toString(); //set by run-script
+            profile["resource_usage"] = obj["resource_usage"];
+            obj["profile"] = profile;
+            remove_old_process_profiles(log_path + "/profiles", MLUtil::configValue("mountainprocess", "profile_max_age_days").toDouble());
+            write_process_profile(log_path + "/profiles", profile);
+        }
         if (!output_fname.isEmpty()) { //The user wants the results to go in this file
             QFile::remove(output_fname); //important -- added 9/9/16
             QString obj_json = QJsonDocument(obj).toJson();
@@ -356,7 +368,9 @@ int main(int argc, char* argv[])
         //opts.server_urls = server_urls;
         //opts.server_base_path = server_base_path;
         opts.force_run = CLP.named_parameters.contains("_force_run");
+        opts.priority = CLP.named_parameters.value("_priority", 0).toInt();
         opts.working_path = QDir::currentPath();
+        opts.pipeline_run = CLP.named_parameters.value("_pipeline_run", MLUtil::makeRandomId(8)).toString();
         QJsonObject results;
         if (!run_script(script_fnames, params, opts, error_message, results)) { //actually run the script
             ret = -1;
@@ -368,6 +382,7 @@ int main(int argc, char* argv[])
         obj["success"] = (ret == 0);
         obj["results"] = results;
         obj["error"] = error_message;
+        obj["pipeline_run"] = opts.pipeline_run;
         if (!output_fname.isEmpty()) { //The user wants the results to go in this file
             QFile::remove(output_fname); //important -- added 9/9/16
             QString obj_json = QJsonDocument(obj).toJson();
@@ -376,6 +391,10 @@ int main(int argc, char* argv[])
             }
         }
 
+        if (opts.nodaemon) {
+            printf("Profile summary: mountainprocess profile-summary --pipeline_run=%s\n", opts.pipeline_run.toLatin1().data());
+        }
+
         //log_end();
         return ret;
     }
@@ -423,10 +442,9 @@ int main(int argc, char* argv[])
         MPDaemon X;
         X.setLogPath(log_path);
         ProcessResources RR;
-        //RR.num_threads = qMax(0.0, MLUtil::configValue("mountainprocess", "max_num_simultaneous_threads").toDouble());
-        //RR.memory_gb = qMax(0.0, MLUtil::configValue("mountainprocess", "max_total_memory_gb").toDouble());
-        RR.num_threads = 0;
-        RR.memory_gb = 0;
+        //zero means the resource is not limited
+        RR.num_threads = qMax(0.0, MLUtil::configValue("mountainprocess", "max_num_simultaneous_threads").toDouble());
+        RR.memory_gb = qMax(0.0, MLUtil::configValue("mountainprocess", "max_total_memory_gb").toDouble());
         RR.num_processes = MLUtil::configValue("mountainprocess", "max_num_simultaneous_processes").toDouble();
         X.setTotalResourcesAvailable(RR);
         if (!X.run()) {
@@ -516,6 +534,76 @@ int main(int argc, char* argv[])
     else if (arg1 == "cleanup-cache") {
         CacheManager::globalInstance()->cleanUp();
     }
+    else if (arg1 == "profile-summary") { //Summarize the profiles written by processors, for example those of a pipeline run
+        QStringList paths = CLP.unnamed_parameters.mid(1);
+        if (paths.isEmpty())
+            paths << log_path + "/profiles";
+        QString pipeline_run = CLP.named_parameters.value("pipeline_run").toString();
+        QDateTime since;
+        if (CLP.named_parameters.contains("since")) {
+            since = QDateTime::fromString(CLP.named_parameters["since"].toString(), Qt::ISODate);
+            if (!since.isValid()) {
+                qWarning() << "Unable to parse time: " + CLP.named_parameters["since"].toString();
+                return -1;
+            }
+        }
+        QList<QJsonObject> profiles = load_process_profiles(paths, pipeline_run, since);
+        QJsonObject summary = summarize_process_profiles(profiles);
+        print_profile_summary(summary);
+        QString output_fname = CLP.named_parameters.value("output").toString();
+        if (!output_fname.isEmpty()) {
+            if (!TextFile::write(output_fname, QJsonDocument(summary).toJson())) {
+                qCritical() << "Unable to write summary to: " + output_fname;
+                return -1;
+            }
+        }
+    }
+    else if (arg1 == "benchmark") { //Run the sorting pipeline on a synthetic dataset and report the time and resources of each stage
+        MPBenchmarkOpts opts;
+        opts.outpath = CLP.named_parameters.value("outpath", "benchmark").toString();
+        opts.M = CLP.named_parameters.value("M", opts.M).toInt();
+        opts.duration_sec = CLP.named_parameters.value("duration", opts.duration_sec).toDouble();
+        opts.K = CLP.named_parameters.value("K", opts.K).toInt();
+        opts.samplerate = CLP.named_parameters.value("samplerate", opts.samplerate).toDouble();
+        opts.firing_rate_min = CLP.named_parameters.value("firing_rate_min", opts.firing_rate_min).toDouble();
+        opts.firing_rate_max = CLP.named_parameters.value("firing_rate_max", opts.firing_rate_max).toDouble();
+        opts.noise_level = CLP.named_parameters.value("noise_level", opts.noise_level).toDouble();
+        opts.seed = CLP.named_parameters.value("seed", opts.seed).toULongLong();
+        opts.pipeline_path = CLP.named_parameters.value("pipeline").toString();
+        opts.run_pipeline = !CLP.named_parameters.contains("skip_pipeline");
+        QString output_fname = CLP.named_parameters.value("output", opts.outpath + "/benchmark_results.json").toString();
+        QString baseline_fname = CLP.named_parameters.value("baseline").toString();
+        double tolerance = CLP.named_parameters.value("tolerance", 0.2).toDouble();
+
+        QJsonObject results;
+        QString error_message;
+        bool ok = run_benchmark(opts, results, error_message);
+        print_benchmark_results(results);
+        if (!TextFile::write(output_fname, QJsonDocument(results).toJson())) {
+            qCritical() << "Unable to write results to: " + output_fname;
+            return -1;
+        }
+        printf("Wrote %s\n", output_fname.toLatin1().data());
+        if (!ok) {
+            qCritical() << error_message;
+            return -1;
+        }
+        if (!baseline_fname.isEmpty()) {
+            QJsonParseError parse_error;
+            QJsonObject baseline = QJsonDocument::fromJson(TextFile::read(baseline_fname).toUtf8(), &parse_error).object();
+            if (parse_error.error != QJsonParseError::NoError) {
+                qCritical() << "Unable to parse baseline: " + baseline_fname;
+                return -1;
+            }
+            QStringList regressions = compare_benchmark_to_baseline(results, baseline, tolerance);
+            foreach (QString str, regressions) {
+                printf("REGRESSION: %s\n", str.toLatin1().data());
+            }
+            if (!regressions.isEmpty())
+                return -1;
+            printf("No regressions relative to %s\n", baseline_fname.toLatin1().data());
+        }
+    }
     /*
     else if (arg1 == "create-prv") {
 
@@ -640,7 +728,9 @@ bool run_script(const QStringList& script_fnames, const QVariantMap& params, con
     //Controller2.setServerUrls(opts.server_urls);
     //Controller2.setServerBasePath(opts.server_base_path);
     Controller2.setForceRun(opts.force_run);
+    Controller2.setPriority(opts.priority);
     Controller2.setWorkingPath(opts.working_path);
+    Controller2.setPipelineRun(opts.pipeline_run);
     QJSValue MP2 = engine.newQObject(&Controller2);
     engine.globalObject().setProperty("_MP2", MP2);
 
@@ -681,11 +771,13 @@ void print_usage()
     printf("mountainprocess daemon-restart\n");
     printf("mountainprocess daemon-state\n");
     printf("mountainprocess daemon-state-summary\n");
-    printf("mountainprocess queue-script --_script_output=[optional_output_fname] [script1].js [script2.js] ... [file1].par [file2].par ...  [--_force_run]\n");
-    printf("mountainprocess queue-process [processor_name] --_process_output=[optional_output_fname] --[param1]=[val1] --[param2]=[val2] ... [--_force_run]\n");
+    printf("mountainprocess queue-script --_script_output=[optional_output_fname] [script1].js [script2.js] ... [file1].par [file2].par ...  [--_force_run] [--_priority=0]\n");
+    printf("mountainprocess queue-process [processor_name] --_process_output=[optional_output_fname] --[param1]=[val1] --[param2]=[val2] ... [--_force_run] [--_priority=0] [--_request_num_threads=1] [--_request_memory_gb=0]\n");
     printf("mountainprocess list-processors\n");
     printf("mountainprocess spec [processor_name]\n");
     printf("mountainprocess cleanup-cache\n");
+    printf("mountainprocess profile-summary [profile files or directories] [--pipeline_run=[id]] [--since=[yyyy-MM-ddThh:mm:ss]] [--output=[fname].json]\n");
+    printf("mountainprocess benchmark --outpath=[path] [--M=4] [--duration=60] [--K=10] [--samplerate=30000] [--seed=1] [--pipeline=[fname].pipeline] [--skip_pipeline] [--output=[fname].json] [--baseline=[fname].json] [--tolerance=0.2]\n");
 }
 
 void remove_system_parameters(QVariantMap& params)
@@ -732,6 +824,10 @@ bool queue_pript(PriptType prtype, const CLParams& CLP)
         PP.prtype = ProcessType;
         remove_system_parameters(PP.parameters);
         PP.processor_name = CLP.unnamed_parameters.value(1); //arg2
+        if (CLP.named_parameters.contains("_request_num_threads"))
+            PP.num_threads_requested = CLP.named_parameters["_request_num_threads"].toDouble();
+        if (CLP.named_parameters.contains("_request_memory_gb"))
+            PP.memory_gb_requested = CLP.named_parameters["_request_memory_gb"].toDouble();
     }
 
     PP.id = MLUtil::makeRandomId(20);
@@ -767,6 +863,8 @@ bool queue_pript(PriptType prtype, const CLParams& CLP)
 
     PP.force_run = CLP.named_parameters.contains("_force_run");
     PP.working_path = QDir::currentPath();
+    PP.priority = CLP.named_parameters.value("_priority", 0).toInt();
+    PP.user = qgetenv("USER");
 
     qDebug() << ":::::::::::::::::::::::::::::::::::::::::"
              << "queue_pript" << PP.force_run;
@@ -835,37 +933,6 @@ void mountainprocessMessageOutput(QtMsgType type, const QMessageLogContext& cont
     }
 }
 
-QJsonArray monitor_stats_to_json_array(const QList<MonitorStats>& stats)
-{
-    QJsonArray ret;
-    for (int i = 0; i < stats.count(); i++) {
-        MonitorStats X = stats[i];
-        QJsonObject obj;
-        obj["timestamp"] = X.timestamp.toMSecsSinceEpoch();
-        obj["mem_bytes"] = (long long)X.mem_bytes;
-        obj["cpu_pct"] = X.cpu_pct;
-        ret << obj;
-    }
-    return ret;
-}
-long compute_peak_mem_bytes(const QList<MonitorStats>& stats)
-{
-    long ret = 0;
-    for (int i = 0; i < stats.count(); i++) {
-        ret = qMax(ret, stats[i].mem_bytes);
-    }
-    return ret;
-}
-
-double compute_peak_cpu_pct(const QList<MonitorStats>& stats)
-{
-    double ret = 0;
-    for (int i = 0; i < stats.count(); i++) {
-        ret = qMax(ret, stats[i].cpu_pct);
-    }
-    return ret;
-}
-
 struct ProcessorCount {
     int queued = 0;
     int running = 0;
@@ -0,0 +1,359 @@
+/******************************************************
+** See the accompanying README and LICENSE files
+*******************************************************/
+
+#include "mpbenchmark.h"
+#include "processmonitor.h"
+#include "mda.h"
+#include "mlcommon.h"
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QJsonArray>
+#include <QProcess>
+#include <QThread>
+#include <QTime>
+#include <math.h>
+#include <sys/resource.h>
+
+#define BENCHMARK_SAMPLE_INTERVAL_MSEC 50
+
+namespace {
+
+struct BenchmarkStage {
+    QString name;
+    QString command; //run-process or run-script
+    QString target; //the processor or the script
+    QVariantMap parameters;
+};
+
+double children_cpu_time_sec()
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_CHILDREN, &usage) != 0)
+        return 0;
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6;
+}
+
+//runs "mountainprocess [command] [target] --[key]=[val] ..." and samples its whole process tree until it exits
+QJsonObject run_stage(const BenchmarkStage& S, const QString& log_path)
+{
+    QStringList args;
+    args << S.command << S.target;
+    QStringList keys = S.parameters.keys();
+    foreach (QString key, keys) {
+        args << QString("--%1=%2").arg(key).arg(S.parameters[key].toString());
+    }
+    args << "--_force_run"; //nothing from the result cache
+    if (S.command == "run-script")
+        args << "--_nodaemon";
+
+    printf("Running %s (%s %s)...\n", S.name.toLatin1().data(), S.command.toLatin1().data(), S.target.toLatin1().data());
+    QJsonObject ret;
+    ret["name"] = S.name;
+    ret["command"] = S.command;
+    ret["target"] = S.target;
+    ret["log"] = log_path;
+
+    QProcess P;
+    P.setProcessChannelMode(QProcess::MergedChannels);
+    P.setStandardOutputFile(log_path);
+    double cpu_time_before = children_cpu_time_sec();
+    QTime timer;
+    timer.start();
+    P.start(QCoreApplication::applicationFilePath(), args);
+    if (!P.waitForStarted()) {
+        ret["success"] = false;
+        ret["error"] = "Unable to start process";
+        return ret;
+    }
+    ProcessTreeMonitor monitor;
+    monitor.setPid(P.processId());
+    MonitorStats stats;
+    monitor.sample(stats);
+    while (P.state() != QProcess::NotRunning) {
+        P.waitForFinished(BENCHMARK_SAMPLE_INTERVAL_MSEC);
+        monitor.sample(stats);
+    }
+    double wall_time_sec = timer.elapsed() * 1.0 / 1000;
+    //the exact cpu time of the reaped tree -- the samples miss whatever happened after the last one
+    double cpu_time_sec = qMax(children_cpu_time_sec() - cpu_time_before, monitor.peakStats().cpu_time_sec);
+    MonitorStats peak = monitor.peakStats();
+
+    bool success = ((P.exitStatus() == QProcess::NormalExit) && (P.exitCode() == 0));
+    ret["success"] = success;
+    if (!success)
+        ret["error"] = QString("Exit code %1 (see log)").arg(P.exitCode());
+    ret["wall_time_sec"] = wall_time_sec;
+    ret["cpu_time_sec"] = cpu_time_sec;
+    ret["peak_mem_bytes"] = (double)peak.mem_bytes;
+    ret["read_bytes"] = (double)peak.read_bytes;
+    ret["write_bytes"] = (double)peak.write_bytes;
+    ret["major_faults"] = (double)peak.major_faults;
+    printf("    %s: %.2f s wall, %.2f s cpu, %ld MB peak, %ld MB read, %ld MB written\n", success ? "ok" : "FAILED",
+        wall_time_sec, cpu_time_sec, peak.mem_bytes / 1000000, (long)(peak.read_bytes / 1000000), (long)(peak.write_bytes / 1000000));
+    return ret;
+}
+
+double uniform_random(double a, double b)
+{
+    return a + (b - a) * (qrand() * 1.0 / RAND_MAX);
+}
+
+//K waveforms (MxTxK) with a peak channel each, decaying across the other channels, and the info array of synthesize1
+void generate_waveforms(Mda& waveforms, Mda& info, const MPBenchmarkOpts& opts)
+{
+    int M = opts.M, K = opts.K, T = opts.clip_size;
+    qsrand(opts.seed);
+    waveforms.allocate(M, T, K);
+    info.allocate(6, K);
+    int Tmid = (T + 1) / 2 - 1;
+    for (int k = 0; k < K; k++) {
+        int peak_channel = k % M;
+        double amplitude = uniform_random(5, 15);
+        double width = uniform_random(1.5, 3);
+        for (int m = 0; m < M; m++) {
+            double channel_factor = exp(-fabs(m - peak_channel) * uniform_random(0.5, 1.5));
+            for (int t = 0; t < T; t++) {
+                double tt = t - Tmid;
+                double val = -exp(-tt * tt / (2 * width * width)) + 0.3 * exp(-(tt - 3 * width) * (tt - 3 * width) / (8 * width * width));
+                waveforms.setValue(amplitude * channel_factor * val, m, t, k);
+            }
+        }
+        info.setValue(uniform_random(opts.firing_rate_min, opts.firing_rate_max), 0, k); //firing rate (Hz)
+        info.setValue(2, 1, k); //refractory period (ms)
+        //no amplitude or time scaling
+    }
+}
+
+QJsonObject opts_to_json_object(const MPBenchmarkOpts& opts)
+{
+    QJsonObject obj;
+    obj["M"] = opts.M;
+    obj["duration_sec"] = opts.duration_sec;
+    obj["K"] = opts.K;
+    obj["samplerate"] = opts.samplerate;
+    obj["firing_rate_min"] = opts.firing_rate_min;
+    obj["firing_rate_max"] = opts.firing_rate_max;
+    obj["noise_level"] = opts.noise_level;
+    obj["seed"] = (double)opts.seed;
+    obj["clip_size"] = opts.clip_size;
+    obj["pipeline"] = opts.pipeline_path;
+    return obj;
+}
+}
+
+bool run_benchmark(const MPBenchmarkOpts& opts_in, QJsonObject& results, QString& error_message)
+{
+    MPBenchmarkOpts opts = opts_in;
+    if (opts.pipeline_path.isEmpty())
+        opts.pipeline_path = MLUtil::mountainlabBasePath() + "/mountainsort/pipelines/mountainsort_001.pipeline";
+    QString path = QDir(opts.outpath).absolutePath();
+    if (!QDir().mkpath(path + "/logs")) {
+        error_message = "Unable to create output path: " + path;
+        return false;
+    }
+
+    Mda waveforms, info;
+    generate_waveforms(waveforms, info, opts);
+    if ((!waveforms.write64(path + "/waveforms.mda")) || (!info.write64(path + "/info.mda"))) {
+        error_message = "Unable to write waveforms";
+        return false;
+    }
+
+    //the same processors and parameters as mountainsort_001.pipeline (with whiten:true and no adjacency matrix), except
+    //that ms_metrics gets no add_noise_level, which the processor does not accept
+    QList<BenchmarkStage> stages;
+    {
+        BenchmarkStage S;
+        S.command = "run-process";
+
+        S.name = S.target = "synthesize1";
+        S.parameters.clear();
+        S.parameters["waveforms"] = path + "/waveforms.mda";
+        S.parameters["info"] = path + "/info.mda";
+        S.parameters["timeseries_out"] = path + "/raw.mda";
+        S.parameters["firings_true"] = path + "/firings_true.mda";
+        S.parameters["N"] = (double)(long)(opts.duration_sec * opts.samplerate);
+        S.parameters["samplerate"] = opts.samplerate;
+        S.parameters["waveforms_oversamp"] = 1;
+        S.parameters["noise_level"] = opts.noise_level;
+        S.parameters["seed"] = (double)opts.seed;
+        stages << S;
+
+        S.name = S.target = "bandpass_filter";
+        S.parameters.clear();
+        S.parameters["timeseries"] = path + "/raw.mda";
+        S.parameters["timeseries_out"] = path + "/filt.mda";
+        S.parameters["samplerate"] = opts.samplerate;
+        S.parameters["freq_min"] = opts.freq_min;
+        S.parameters["freq_max"] = opts.freq_max;
+        stages << S;
+
+        S.name = S.target = "whiten";
+        S.parameters.clear();
+        S.parameters["timeseries"] = path + "/filt.mda";
+        S.parameters["timeseries_out"] = path + "/pre.mda";
+        stages << S;
+
+        S.name = S.target = "detect";
+        S.parameters.clear();
+        S.parameters["timeseries"] = path + "/pre.mda";
+        S.parameters["detect_out"] = path + "/detect.mda";
+        S.parameters["detect_threshold"] = opts.detect_threshold;
+        S.parameters["detect_interval"] = opts.detect_interval;
+        S.parameters["clip_size"] = opts.clip_size;
+        S.parameters["sign"] = 0;
+        S.parameters["individual_channels"] = 1;
+        stages << S;
+
+        S.name = S.target = "branch_cluster_v2";
+        S.parameters.clear();
+        S.parameters["timeseries"] = path + "/pre.mda";
+        S.parameters["detect"] = path + "/detect.mda";
+        S.parameters["adjacency_matrix"] = "";
+        S.parameters["firings_out"] = path + "/firings1.mda";
+        S.parameters["clip_size"] = opts.clip_size;
+        S.parameters["min_shell_size"] = 150;
+        S.parameters["shell_increment"] = 0;
+        S.parameters["num_features"] = 10;
+        S.parameters["num_features2"] = 10;
+        S.parameters["detect_interval"] = opts.detect_interval;
+        S.parameters["consolidation_factor"] = 0.9;
+        S.parameters["isocut_threshold"] = 1.5;
+        stages << S;
+
+        S.name = S.target = "merge_across_channels_v2";
+        S.parameters.clear();
+        S.parameters["timeseries"] = path + "/pre.mda";
+        S.parameters["firings"] = path + "/firings1.mda";
+        S.parameters["firings_out"] = path + "/firings2.mda";
+        S.parameters["clip_size"] = opts.clip_size;
+        stages << S;
+
+        S.name = S.target = "fit_stage";
+        S.parameters.clear();
+        S.parameters["timeseries"] = path + "/pre.mda";
+        S.parameters["firings"] = path + "/firings2.mda";
+        S.parameters["firings_out"] = path + "/firings3.mda";
+        S.parameters["clip_size"] = opts.clip_size;
+        S.parameters["min_shell_size"] = 150;
+        S.parameters["shell_increment"] = 0;
+        stages << S;
+
+        S.name = S.target = "ms_metrics";
+        S.parameters.clear();
+        S.parameters["timeseries"] = path + "/pre.mda";
+        S.parameters["firings"] = path + "/firings3.mda";
+        S.parameters["cluster_metrics"] = path + "/cluster_metrics.csv";
+        S.parameters["cluster_pair_metrics"] = path + "/cluster_pair_metrics.csv";
+        S.parameters["clip_size"] = opts.clip_size;
+        stages << S;
+    }
+
+    results = QJsonObject();
+    results["config"] = opts_to_json_object(opts);
+    results["timestamp"] = QDateTime::currentDateTime().toString(Qt::ISODate);
+    results["num_cores"] = QThread::idealThreadCount();
+    QJsonArray stage_results;
+    bool ok = true;
+    for (int i = 0; i < stages.count(); i++) {
+        QJsonObject R = run_stage(stages[i], QString("%1/logs/%2.log").arg(path).arg(stages[i].name));
+        stage_results << R;
+        if (!R["success"].toBool()) {
+            error_message = "Stage failed: " + stages[i].name;
+            ok = false;
+            break;
+        }
+    }
+    results["stages"] = stage_results;
+    if ((ok) && (opts.run_pipeline)) {
+        BenchmarkStage S;
+        S.name = "pipeline";
+        S.command = "run-script";
+        S.target = opts.pipeline_path;
+        QDir().mkpath(path + "/pipeline");
+        S.parameters["raw"] = path + "/raw.mda";
+        S.parameters["outpath"] = path + "/pipeline";
+        S.parameters["samplerate"] = opts.samplerate;
+        S.parameters["freq_min"] = opts.freq_min;
+        S.parameters["freq_max"] = opts.freq_max;
+        S.parameters["detect_threshold"] = opts.detect_threshold;
+        S.parameters["detect_interval"] = opts.detect_interval;
+        S.parameters["clip_size"] = opts.clip_size;
+        QJsonObject R = run_stage(S, path + "/logs/pipeline.log");
+        results["pipeline"] = R;
+        if (!R["success"].toBool()) {
+            error_message = "Pipeline failed";
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+QStringList compare_benchmark_to_baseline(const QJsonObject& results, const QJsonObject& baseline, double tolerance)
+{
+    QMap<QString, QJsonObject> current_by_name, baseline_by_name;
+    QJsonArray stages = results["stages"].toArray();
+    for (int i = 0; i < stages.count(); i++)
+        current_by_name[stages[i].toObject()["name"].toString()] = stages[i].toObject();
+    if (results.contains("pipeline"))
+        current_by_name["pipeline"] = results["pipeline"].toObject();
+    QJsonArray baseline_stages = baseline["stages"].toArray();
+    for (int i = 0; i < baseline_stages.count(); i++)
+        baseline_by_name[baseline_stages[i].toObject()["name"].toString()] = baseline_stages[i].toObject();
+    if (baseline.contains("pipeline"))
+        baseline_by_name["pipeline"] = baseline["pipeline"].toObject();
+
+    if (results["config"].toObject() != baseline["config"].toObject())
+        qWarning() << "The benchmark configuration differs from that of the baseline";
+
+    //differences below these are noise
+    QMap<QString, double> min_values;
+    min_values["wall_time_sec"] = 0.5;
+    min_values["cpu_time_sec"] = 0.5;
+    min_values["peak_mem_bytes"] = 20e6;
+
+    QStringList ret;
+    QStringList names = current_by_name.keys();
+    foreach (QString name, names) {
+        if (!baseline_by_name.contains(name))
+            continue;
+        QJsonObject C = current_by_name[name];
+        QJsonObject B = baseline_by_name[name];
+        if ((!C["success"].toBool()) || (!B["success"].toBool()))
+            continue;
+        QStringList fields = min_values.keys();
+        foreach (QString field, fields) {
+            double val = C[field].toDouble();
+            double val0 = B[field].toDouble();
+            if ((val > val0 * (1 + tolerance)) && (val - val0 > min_values[field])) {
+                //a stage can finish before the monitor takes a sample, leaving a zero in the baseline
+                if (val0 > 0)
+                    ret << QString("%1: %2 is %3 (baseline %4, +%5%)").arg(name).arg(field).arg(val).arg(val0).arg((int)((val / val0 - 1) * 100));
+                else
+                    ret << QString("%1: %2 is %3 (baseline %4)").arg(name).arg(field).arg(val).arg(val0);
+            }
+        }
+    }
+    return ret;
+}
+
+void print_benchmark_results(const QJsonObject& results)
+{
+    QJsonArray stages = results["stages"].toArray();
+    if (results.contains("pipeline"))
+        stages << results["pipeline"];
+    printf("\n%-28s %10s %10s %10s %10s %10s\n", "stage", "wall (s)", "cpu (s)", "peak (MB)", "read (MB)", "write (MB)");
+    for (int i = 0; i < stages.count(); i++) {
+        QJsonObject S = stages[i].toObject();
+        printf("%-28s %10.2f %10.2f %10ld %10ld %10ld%s\n", S["name"].toString().toLatin1().data(),
+            S["wall_time_sec"].toDouble(), S["cpu_time_sec"].toDouble(),
+            (long)(S["peak_mem_bytes"].toDouble() / 1e6), (long)(S["read_bytes"].toDouble() / 1e6), (long)(S["write_bytes"].toDouble() / 1e6),
+            S["success"].toBool() ? "" : " FAILED");
+    }
+    printf("\n");
+}
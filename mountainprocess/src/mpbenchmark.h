@@ -0,0 +1,49 @@
+/******************************************************
+** See the accompanying README and LICENSE files
+*******************************************************/
+
+#ifndef MPBENCHMARK_H
+#define MPBENCHMARK_H
+
+#include <QString>
+#include <QStringList>
+#include <QJsonObject>
+
+struct MPBenchmarkOpts {
+    QString outpath; //where the dataset and all the intermediate files go
+    //the synthetic dataset (see synthesize1)
+    int M = 4; //channels
+    double duration_sec = 60;
+    int K = 10; //units
+    double samplerate = 30000;
+    double firing_rate_min = 1, firing_rate_max = 5; //Hz
+    double noise_level = 1;
+    quint64 seed = 1; //the same seed gives the same dataset
+    //the sorting parameters (the defaults of mountainsort_001.pipeline)
+    double freq_min = 300, freq_max = 8000;
+    double detect_threshold = 3.5;
+    int detect_interval = 10;
+    int clip_size = 50;
+    QString pipeline_path; //empty for mountainsort/pipelines/mountainsort_001.pipeline
+    bool run_pipeline = true; //also run the whole pipeline in one go
+};
+
+/*
+ * An end-to-end benchmark of the sorting pipeline.
+ *
+ * A synthetic dataset of the requested size is generated with synthesize1, then each processor of
+ * mountainsort_001.pipeline is run on it (one "mountainprocess run-process" at a time, with --_force_run so that
+ * nothing comes from the result cache), and finally the whole pipeline (run-script --_nodaemon). Each of these runs
+ * is sampled with ProcessTreeMonitor: the results record the wall time, cpu time, peak resident memory and the bytes
+ * read and written of each stage, as json.
+ *
+ * Results can be compared to those of an earlier run (the baseline): a stage regresses when its wall time,
+ * cpu time or peak memory exceeds the baseline by more than the tolerance (a fraction).
+ */
+
+bool run_benchmark(const MPBenchmarkOpts& opts, QJsonObject& results, QString& error_message);
+//returns a description of each regression, empty if there are none
+QStringList compare_benchmark_to_baseline(const QJsonObject& results, const QJsonObject& baseline, double tolerance);
+void print_benchmark_results(const QJsonObject& results);
+
+#endif // MPBENCHMARK_H
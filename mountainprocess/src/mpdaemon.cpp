@@ -23,7 +23,14 @@
 #include "mlcommon.h"
 #include <QSharedMemory>
 #include <signal.h>
+#include <math.h>
+#include <algorithm>
 #include "localserver.h"
+#include "mpresourcehistory.h"
+#include "processmonitor.h"
+
+//the accumulated usage of each user decays with this half life, for fair sharing
+#define USER_USAGE_HALF_LIFE_SEC 600
 
 static bool stopDaemon = false;
 
@@ -81,6 +88,12 @@ public:
     QString m_log_path;
     QSharedMemory* shm = nullptr;
     LocalServer::Server* m_server = nullptr;
+    MPResourceHistory m_resource_history;
+    QMap<QString, double> m_user_usage; //decayed thread-seconds per user
+    QDateTime m_last_user_usage_update;
+    QMap<QString, ProcessTreeMonitor> m_monitors; //by pript id
+    QMap<QString, double> m_input_size_bytes; //by pript id, once all of the inputs exist
+    QTime m_monitor_timer;
 
     void process_command(QJsonObject obj);
     void writeLogRecord(QString record_type, QString key1 = "", QVariant val1 = QVariant(), QString key2 = "", QVariant val2 = QVariant(), QString key3 = "", QVariant val3 = QVariant());
@@ -116,6 +129,7 @@ public:
     }
 
     void stop_orphan_processes_and_scripts();
+    void monitor_running_processes();
 
     /////////////////////////////////
     int num_running_pripts(PriptType prtype);
@@ -125,6 +139,15 @@ public:
     ProcessResources compute_process_resources_available();
     ProcessResources compute_process_resources_needed(MPDaemonPript P);
 
+    /////////////////////////////////
+    double compute_input_size_bytes(const MPDaemonPript& P);
+    ProcessResourceEstimate estimate_process_resources(const MPDaemonPript& P);
+    double estimate_remaining_sec(const MPDaemonPript& P);
+    void record_process_resources(const MPDaemonPript& P);
+    void update_user_usage();
+    QStringList pending_process_keys_in_schedule_order();
+    void compute_reservation(ProcessResources pr_needed, ProcessResources pr_available, double& shadow_sec, ProcessResources& pr_extra);
+
     bool acquireServer();
     bool releaseServer();
     bool acquireSocket();
@@ -169,6 +192,9 @@ MPDaemon::MPDaemon()
 
     d->m_total_resources_available.num_threads = 12;
     d->m_total_resources_available.memory_gb = 8;
+
+    d->m_resource_history.setPath(MPDaemon::daemonPath() + "/resource_history.json");
+    d->m_resource_history.load();
 }
 
 void kill_process_and_children(QProcess* P)
@@ -223,6 +249,7 @@ bool MPDaemon::run()
     signal(SIGTERM, sighandler);
 
     d->m_is_running = true;
+    d->m_monitor_timer.start();
 
     d->writeLogRecord("start-daemon");
 
@@ -261,6 +288,10 @@ void MPDaemon::iterate()
     d->stop_orphan_processes_and_scripts();
     d->handle_scripts();
     d->handle_processes();
+    if (d->m_monitor_timer.elapsed() >= 1000) {
+        d->monitor_running_processes();
+        d->m_monitor_timer.restart();
+    }
 }
 
 void MPDaemon::clearProcessing()
@@ -416,6 +447,9 @@ void MPDaemon::slot_pript_qprocess_finished()
         S->success = true;
     }
     d->finish_and_finalize(*S);
+    if ((S->prtype == ProcessType) && (S->success)) {
+        d->record_process_resources(*S);
+    }
 
     QJsonObject obj0;
     obj0["pript_id"] = pript_id;
@@ -643,6 +677,9 @@ bool MPDaemonPrivate::launch_pript(QString pript_id)
         QString par_fname = CacheManager::globalInstance()->makeLocalFile(S->id + ".par", CacheManager::ShortTerm);
         TextFile::write(par_fname, parameters_json);
         args << par_fname;
+        if (S->priority) {
+            args << QString("--_priority=%1").arg(S->priority);
+        }
     }
     else if (S->prtype == ProcessType) {
         debug_log(__FUNCTION__, __FILE__, __LINE__);
@@ -654,8 +691,9 @@ bool MPDaemonPrivate::launch_pript(QString pript_id)
         foreach (QString pkey, pkeys) {
             args << QString("--%1=%2").arg(pkey).arg(S->parameters[pkey].toString());
         }
-        S->runtime_opts.num_threads_allotted = S->num_threads_requested;
-        S->runtime_opts.memory_gb_allotted = S->memory_gb_requested;
+        ProcessResources pr_needed = compute_process_resources_needed(*S);
+        S->runtime_opts.num_threads_allotted = pr_needed.num_threads;
+        S->runtime_opts.memory_gb_allotted = pr_needed.memory_gb;
     }
     if (S->force_run) {
         args << "--_force_run";
@@ -750,9 +788,164 @@ ProcessResources MPDaemonPrivate::compute_process_resources_needed(MPDaemonPript
     ret.num_threads = P.num_threads_requested;
     ret.memory_gb = P.memory_gb_requested;
     ret.num_processes = 1;
+    ProcessResourceEstimate est = estimate_process_resources(P);
+    if (est.valid) {
+        //what this processor actually used on inputs of this size takes precedence over the (often over-conservative) request
+        ret.num_threads = est.num_threads;
+        ret.memory_gb = est.memory_gb;
+        //but the estimate is scaled up with the input size, and should not exceed what we have in total
+        if (m_total_resources_available.num_threads)
+            ret.num_threads = qMin(ret.num_threads, m_total_resources_available.num_threads);
+        if (m_total_resources_available.memory_gb)
+            ret.memory_gb = qMin(ret.memory_gb, m_total_resources_available.memory_gb);
+    }
+    return ret;
+}
+
+double MPDaemonPrivate::compute_input_size_bytes(const MPDaemonPript& P)
+{
+    //this is called for every pending and running process each time we schedule, so it is cached
+    //(but not until all of the inputs exist, since they may still be the outputs of other processes)
+    if (m_input_size_bytes.contains(P.id))
+        return m_input_size_bytes[P.id];
+    double ret = 0;
+    bool all_exist = true;
+    QStringList paths = get_input_paths(P);
+    foreach (QString path, paths) {
+        if ((QDir::isRelativePath(path)) && (!P.working_path.isEmpty()))
+            path = P.working_path + "/" + path;
+        if (!QFile::exists(path))
+            all_exist = false;
+        if (path.endsWith(".prv")) {
+            QJsonObject obj = QJsonDocument::fromJson(TextFile::read(path).toUtf8()).object();
+            ret += obj["original_size"].toDouble();
+        }
+        else {
+            ret += QFileInfo(path).size();
+        }
+    }
+    if (all_exist)
+        m_input_size_bytes[P.id] = ret;
     return ret;
 }
 
+ProcessResourceEstimate MPDaemonPrivate::estimate_process_resources(const MPDaemonPript& P)
+{
+    if (P.prtype != ProcessType)
+        return ProcessResourceEstimate();
+    return m_resource_history.estimate(P.processor_name, compute_input_size_bytes(P));
+}
+
+double MPDaemonPrivate::estimate_remaining_sec(const MPDaemonPript& P)
+{
+    //returns -1 if unknown
+    double duration_sec = estimate_process_resources(P).duration_sec;
+    if (duration_sec <= 0)
+        return -1;
+    double elapsed_sec = P.timestamp_started.msecsTo(QDateTime::currentDateTime()) / 1000.0;
+    return qMax(0.0, duration_sec - elapsed_sec);
+}
+
+void MPDaemonPrivate::record_process_resources(const MPDaemonPript& P)
+{
+    ProcessResourceRecord rec;
+    rec.peak_mem_bytes = P.runtime_results["peak_mem_bytes"].toDouble();
+    if (rec.peak_mem_bytes <= 0)
+        return; //for example, the process had already been completed so nothing was run
+    rec.peak_cpu_pct = P.runtime_results["peak_cpu_pct"].toDouble();
+    rec.input_size_bytes = compute_input_size_bytes(P);
+    rec.duration_sec = P.timestamp_started.msecsTo(P.timestamp_finished) / 1000.0;
+    m_resource_history.addRecord(P.processor_name, rec);
+    if (!m_resource_history.save()) {
+        writeLogRecord("error", "message", "Unable to save resource history.");
+    }
+}
+
+void MPDaemonPrivate::update_user_usage()
+{
+    QDateTime now = QDateTime::currentDateTime();
+    if (!m_last_user_usage_update.isValid()) {
+        m_last_user_usage_update = now;
+        return;
+    }
+    double dt = m_last_user_usage_update.msecsTo(now) / 1000.0;
+    m_last_user_usage_update = now;
+    double decay = exp(-dt * log(2.0) / USER_USAGE_HALF_LIFE_SEC);
+    QStringList users = m_user_usage.keys();
+    foreach (QString user, users) {
+        m_user_usage[user] *= decay;
+    }
+    QStringList keys = m_pripts.keys();
+    foreach (QString key, keys) {
+        if ((m_pripts[key].prtype == ProcessType) && (m_pripts[key].is_running)) {
+            m_user_usage[m_pripts[key].user] += qMax(1.0, m_pripts[key].runtime_opts.num_threads_allotted) * dt;
+        }
+    }
+}
+
+QStringList MPDaemonPrivate::pending_process_keys_in_schedule_order()
+{
+    //highest priority first, then the user with the least recent usage (fair share), then first come first served
+    QStringList ret;
+    QStringList keys = m_pripts.keys();
+    foreach (QString key, keys) {
+        if (m_pripts[key].prtype == ProcessType) {
+            if ((!m_pripts[key].is_running) && (!m_pripts[key].is_finished)) {
+                ret << key;
+            }
+        }
+    }
+    std::stable_sort(ret.begin(), ret.end(), [this](const QString& k1, const QString& k2) {
+        const MPDaemonPript& P1 = m_pripts[k1];
+        const MPDaemonPript& P2 = m_pripts[k2];
+        if (P1.priority != P2.priority)
+            return P1.priority > P2.priority;
+        double usage1 = m_user_usage.value(P1.user);
+        double usage2 = m_user_usage.value(P2.user);
+        if (usage1 != usage2)
+            return usage1 < usage2;
+        return P1.timestamp_queued < P2.timestamp_queued;
+    });
+    return ret;
+}
+
+void MPDaemonPrivate::compute_reservation(ProcessResources pr_needed, ProcessResources pr_available, double& shadow_sec, ProcessResources& pr_extra)
+{
+    /*
+     * Determine when (shadow_sec from now) enough of the running processes are expected to have
+     * finished for pr_needed to fit, and what will be left over (pr_extra) once it starts.
+     * If we cannot tell from the history, assume it starts once everything running now has finished.
+     */
+    QList<QPair<double, QString> > ends;
+    QStringList keys = m_pripts.keys();
+    foreach (QString key, keys) {
+        if ((m_pripts[key].prtype == ProcessType) && (m_pripts[key].is_running)) {
+            double remaining_sec = estimate_remaining_sec(m_pripts[key]);
+            if (remaining_sec >= 0)
+                ends << qMakePair(remaining_sec, key);
+        }
+    }
+    qSort(ends);
+    ProcessResources pr = pr_available;
+    for (int i = 0; i < ends.count(); i++) {
+        ProcessRuntimeOpts rtopts = m_pripts[ends[i].second].runtime_opts;
+        pr.num_threads += rtopts.num_threads_allotted;
+        pr.memory_gb += rtopts.memory_gb_allotted;
+        pr.num_processes += 1;
+        if (is_at_most(pr_needed, pr, m_total_resources_available)) {
+            shadow_sec = ends[i].first;
+            pr_extra.num_threads = pr.num_threads - pr_needed.num_threads;
+            pr_extra.memory_gb = pr.memory_gb - pr_needed.memory_gb;
+            pr_extra.num_processes = pr.num_processes - pr_needed.num_processes;
+            return;
+        }
+    }
+    shadow_sec = 0;
+    pr_extra.num_threads = m_total_resources_available.num_threads - pr_needed.num_threads;
+    pr_extra.memory_gb = m_total_resources_available.memory_gb - pr_needed.memory_gb;
+    pr_extra.num_processes = m_total_resources_available.num_processes - pr_needed.num_processes;
+}
+
 bool MPDaemonPrivate::acquireServer()
 {
     if (!shm)
@@ -847,26 +1040,60 @@ bool MPDaemonPrivate::releaseSocket()
 
 bool MPDaemonPrivate::handle_processes()
 {
+    /*
+     * Pending processes are considered in schedule order (see pending_process_keys_in_schedule_order).
+     * The first one that does not fit gets a reservation, so that it is not starved by a stream of
+     * smaller processes. Those behind it are only backfilled if they are expected to finish before
+     * the reservation begins, or if they fit in what will be left over once it has started.
+     */
+    update_user_usage();
+    QStringList ids = m_input_size_bytes.keys();
+    foreach (QString id, ids) {
+        if (!m_pripts.contains(id))
+            m_input_size_bytes.remove(id);
+    }
     ProcessResources pr_available = compute_process_resources_available();
-    QStringList keys = m_pripts.keys();
+    bool have_reservation = false;
+    double shadow_sec = 0;
+    ProcessResources pr_extra;
+    QStringList keys = pending_process_keys_in_schedule_order();
     foreach (QString key, keys) {
-        if (m_pripts[key].prtype == ProcessType) {
-            if ((!m_pripts[key].is_running) && (!m_pripts[key].is_finished)) {
-                ProcessResources pr_needed = compute_process_resources_needed(m_pripts[key]);
-                if (is_at_most(pr_needed, pr_available, m_total_resources_available)) {
-                    if (process_parameters_are_okay(key)) {
-                        if (okay_to_run_process(key)) { //check whether there are io file conflicts at the moment
-                            if (launch_pript(key)) {
-                                pr_available.num_threads -= m_pripts[key].runtime_opts.num_threads_allotted;
-                                pr_available.memory_gb -= m_pripts[key].runtime_opts.memory_gb_allotted;
-                                pr_available.num_processes -= 1;
-                            }
-                        }
-                    }
-                    else {
-                        writeLogRecord("unqueue-process", "pript_id", key, "reason", "processor not found or parameters are incorrect.");
-                        m_pripts.remove(key);
-                    }
+        if (!process_parameters_are_okay(key)) {
+            writeLogRecord("unqueue-process", "pript_id", key, "reason", "processor not found or parameters are incorrect.");
+            m_pripts.remove(key);
+            continue;
+        }
+        ProcessResources pr_needed = compute_process_resources_needed(m_pripts[key]);
+        if (!is_at_most(pr_needed, m_total_resources_available, m_total_resources_available)) {
+            //it can never fit, so it should not hold up the processes behind it with a reservation
+            continue;
+        }
+        if (!is_at_most(pr_needed, pr_available, m_total_resources_available)) {
+            if (!have_reservation) {
+                compute_reservation(pr_needed, pr_available, shadow_sec, pr_extra);
+                have_reservation = true;
+            }
+            continue;
+        }
+        bool uses_reserved_resources = false;
+        if (have_reservation) {
+            double duration_sec = estimate_process_resources(m_pripts[key]).duration_sec;
+            if ((duration_sec <= 0) || (duration_sec > shadow_sec)) {
+                if (!is_at_most(pr_needed, pr_extra, m_total_resources_available))
+                    continue;
+                uses_reserved_resources = true;
+            }
+        }
+        if (okay_to_run_process(key)) { //check whether there are io file conflicts at the moment
+            if (launch_pript(key)) {
+                ProcessRuntimeOpts rtopts = m_pripts[key].runtime_opts;
+                pr_available.num_threads -= rtopts.num_threads_allotted;
+                pr_available.memory_gb -= rtopts.memory_gb_allotted;
+                pr_available.num_processes -= 1;
+                if (uses_reserved_resources) {
+                    pr_extra.num_threads -= rtopts.num_threads_allotted;
+                    pr_extra.memory_gb -= rtopts.memory_gb_allotted;
+                    pr_extra.num_processes -= 1;
                 }
             }
         }
@@ -1101,6 +1328,7 @@ void MPDaemonPrivate::write_pript_file(const MPDaemonPript& P)
 
 void MPDaemonPrivate::finish_and_finalize(MPDaemonPript& P)
 {
+    m_monitors.remove(P.id);
     P.is_finished = true;
     P.is_running = false;
     P.timestamp_finished = QDateTime::currentDateTime();
@@ -1110,6 +1338,31 @@ void MPDaemonPrivate::finish_and_finalize(MPDaemonPript& P)
     write_pript_file(P);
 }
 
+void MPDaemonPrivate::monitor_running_processes()
+{
+    QMap<qint64, QList<qint64> > process_children;
+    bool have_process_children = false;
+    QStringList keys = m_pripts.keys();
+    foreach (QString key, keys) {
+        MPDaemonPript* P = &m_pripts[key];
+        if ((P->prtype != ProcessType) || (!P->is_running) || (!P->qprocess))
+            continue;
+        if (!have_process_children) {
+            process_children = ProcessTreeMonitor::readProcessChildren(); //one scan of /proc shared by all processes
+            have_process_children = true;
+        }
+        ProcessTreeMonitor* M = &m_monitors[key];
+        if (M->pid() != P->qprocess->processId())
+            M->setPid(P->qprocess->processId());
+        MonitorStats MS;
+        if (M->sample(MS, process_children)) {
+            QJsonObject usage = monitor_stats_to_json_object(MS);
+            usage["peak"] = monitor_stats_to_json_object(M->peakStats());
+            P->resource_usage = usage;
+        }
+    }
+}
+
 void MPDaemonPrivate::stop_orphan_processes_and_scripts()
 {
     QStringList keys = m_pripts.keys();
@@ -1274,6 +1527,8 @@ QJsonObject pript_struct_to_obj(MPDaemonPript S, RecordType rt)
     ret["timestamp_queued"] = S.timestamp_queued.toString("yyyy-MM-dd|hh:mm:ss.zzz");
     ret["timestamp_started"] = S.timestamp_started.toString("yyyy-MM-dd|hh:mm:ss.zzz");
     ret["timestamp_finished"] = S.timestamp_finished.toString("yyyy-MM-dd|hh:mm:ss.zzz");
+    ret["priority"] = S.priority;
+    ret["user"] = S.user;
     if (S.prtype == ScriptType) {
         ret["prtype"] = "script";
         if (rt != AbbreviatedRecord) {
@@ -1287,6 +1542,11 @@ QJsonObject pript_struct_to_obj(MPDaemonPript S, RecordType rt)
     else {
         ret["prtype"] = "process";
         ret["processor_name"] = S.processor_name;
+        ret["num_threads_requested"] = S.num_threads_requested;
+        ret["memory_gb_requested"] = S.memory_gb_requested;
+    }
+    if (!S.resource_usage.isEmpty()) {
+        ret["resource_usage"] = S.resource_usage;
     }
     if (rt == RuntimeRecord) {
         ret["runtime_opts"] = runtime_opts_struct_to_obj(S.runtime_opts);
@@ -1312,6 +1572,8 @@ MPDaemonPript pript_obj_to_struct(QJsonObject obj)
     ret.timestamp_queued = QDateTime::fromString(obj.value("timestamp_queued").toString(), "yyyy-MM-dd|hh:mm:ss.zzz");
     ret.timestamp_started = QDateTime::fromString(obj.value("timestamp_started").toString(), "yyyy-MM-dd|hh:mm:ss.zzz");
     ret.timestamp_finished = QDateTime::fromString(obj.value("timestamp_finished").toString(), "yyyy-MM-dd|hh:mm:ss.zzz");
+    ret.priority = obj.value("priority").toInt();
+    ret.user = obj.value("user").toString();
     if (obj.value("prtype").toString() == "script") {
         ret.prtype = ScriptType;
         ret.script_paths = json_array_to_stringlist(obj.value("script_paths").toArray());
@@ -1320,6 +1582,8 @@ MPDaemonPript pript_obj_to_struct(QJsonObject obj)
     else {
         ret.prtype = ProcessType;
         ret.processor_name = obj.value("processor_name").toString();
+        ret.num_threads_requested = obj.value("num_threads_requested").toDouble(1);
+        ret.memory_gb_requested = obj.value("memory_gb_requested").toDouble(0);
     }
     return ret;
 }
@@ -79,6 +79,7 @@ struct MPDaemonPript {
     bool success = false;
     QString error;
     QJsonObject runtime_results;
+    QJsonObject resource_usage; //sampled by the daemon while running
     qint64 parent_pid = 0;
     bool force_run;
     QString working_path;
@@ -87,6 +88,8 @@ struct MPDaemonPript {
     QDateTime timestamp_finished;
     QProcess* qprocess = 0;
     QFile* stdout_file = 0;
+    int priority = 0; //higher priority pripts are launched first
+    QString user; //for fair sharing of resources between users
 
     //For a script:
     QStringList script_paths;
@@ -0,0 +1,240 @@
+/******************************************************
+** See the accompanying README and LICENSE files
+*******************************************************/
+
+#include "mpprofiles.h"
+#include "mlcommon.h"
+#include "taskprogress.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QMap>
+#include <algorithm>
+
+namespace {
+
+struct SectionSummary {
+    double time_sec = 0;
+    double count = 0;
+    double max_sec = 0;
+    double bytes = 0;
+};
+
+struct ProcessorSummary {
+    long num_runs = 0;
+    double wall_time_sec = 0;
+    double cpu_time_sec = 0;
+    double peak_mem_bytes = 0;
+    double read_bytes = 0;
+    double write_bytes = 0;
+    QMap<QString, SectionSummary> sections;
+    QMap<QString, TaskManager::TaskProgressLatencyHistogram> latencies; //merged over the runs
+};
+
+bool load_profile(const QString& fname, QJsonObject& profile)
+{
+    QJsonParseError error;
+    profile = QJsonDocument::fromJson(TextFile::read(fname).toUtf8(), &error).object();
+    if (error.error != QJsonParseError::NoError) {
+        qWarning() << "Unable to parse profile: " + fname;
+        return false;
+    }
+    return true;
+}
+
+QJsonArray latencies_to_json_array(const QMap<QString, TaskManager::TaskProgressLatencyHistogram>& latencies)
+{
+    QJsonArray ret;
+    foreach (QString name, latencies.keys()) {
+        TaskManager::TaskProgressLatencyHistogram H = latencies.value(name);
+        QJsonObject obj;
+        obj["name"] = name;
+        obj["count"] = (double)H.count;
+        obj["total_msec"] = H.total_msec;
+        obj["max_msec"] = H.max_msec;
+        obj["mean_msec"] = H.meanMsec();
+        obj["p50_msec"] = H.percentileMsec(0.5);
+        obj["p99_msec"] = H.percentileMsec(0.99);
+        ret << obj;
+    }
+    return ret;
+}
+
+QJsonArray sections_to_json_array(const QMap<QString, SectionSummary>& sections)
+{
+    QStringList names = sections.keys();
+    std::stable_sort(names.begin(), names.end(), [&sections](const QString& a, const QString& b) {
+        return sections.value(a).time_sec > sections.value(b).time_sec;
+    });
+    QJsonArray ret;
+    foreach (QString name, names) {
+        SectionSummary S = sections.value(name);
+        QJsonObject obj;
+        obj["name"] = name;
+        obj["time_sec"] = S.time_sec;
+        obj["count"] = S.count;
+        obj["max_sec"] = S.max_sec;
+        if (S.bytes) {
+            obj["bytes"] = S.bytes;
+            if (S.time_sec)
+                obj["mb_per_sec"] = S.bytes * 1e-6 / S.time_sec;
+        }
+        ret << obj;
+    }
+    return ret;
+}
+}
+
+QString write_process_profile(const QString& profiles_path, const QJsonObject& profile)
+{
+    if (!QDir().mkpath(profiles_path)) {
+        qWarning() << "Unable to create profiles path: " + profiles_path;
+        return "";
+    }
+    QString fname = QString("%1/%2_%3_%4.json").arg(profiles_path).arg(QDateTime::currentDateTime().toString("yyyyMMdd-hhmmss")).arg(profile["processor_name"].toString()).arg(MLUtil::makeRandomId(6));
+    if (!TextFile::write(fname, QJsonDocument(profile).toJson())) {
+        qWarning() << "Unable to write profile: " + fname;
+        return "";
+    }
+    return fname;
+}
+
+void remove_old_process_profiles(const QString& profiles_path, double max_age_days)
+{
+    if (max_age_days <= 0)
+        return;
+    QDateTime cutoff = QDateTime::currentDateTime().addSecs((qint64)(-max_age_days * 24 * 60 * 60));
+    QStringList list = QDir(profiles_path).entryList(QStringList("*.json"), QDir::Files, QDir::Name);
+    foreach (QString fname, list) {
+        QString path0 = profiles_path + "/" + fname;
+        if (QFileInfo(path0).lastModified() < cutoff)
+            QFile::remove(path0);
+    }
+}
+
+QList<QJsonObject> load_process_profiles(const QStringList& paths, const QString& pipeline_run, const QDateTime& since)
+{
+    QStringList fnames;
+    foreach (QString path, paths) {
+        if (QFileInfo(path).isDir()) {
+            QStringList list = QDir(path).entryList(QStringList("*.json"), QDir::Files, QDir::Name);
+            foreach (QString str, list)
+                fnames << path + "/" + str;
+        }
+        else {
+            fnames << path;
+        }
+    }
+    QList<QJsonObject> ret;
+    foreach (QString fname, fnames) {
+        QJsonObject profile;
+        if (!load_profile(fname, profile))
+            continue;
+        if ((!pipeline_run.isEmpty()) && (profile["pipeline_run"].toString() != pipeline_run))
+            continue;
+        if ((since.isValid()) && (QDateTime::fromString(profile["timestamp"].toString(), Qt::ISODate) < since))
+            continue;
+        ret << profile;
+    }
+    return ret;
+}
+
+QJsonObject summarize_process_profiles(const QList<QJsonObject>& profiles)
+{
+    QMap<QString, ProcessorSummary> processors;
+    double total_wall_time_sec = 0;
+    for (int i = 0; i < profiles.count(); i++) {
+        QJsonObject P = profiles[i];
+        ProcessorSummary& S = processors[P["processor_name"].toString()];
+        QJsonObject usage = P["resource_usage"].toObject();
+        S.num_runs++;
+        S.wall_time_sec += P["wall_time_sec"].toDouble();
+        S.cpu_time_sec += usage["cpu_time_sec"].toDouble();
+        S.peak_mem_bytes = qMax(S.peak_mem_bytes, usage["mem_bytes"].toDouble());
+        S.read_bytes += usage["read_bytes"].toDouble();
+        S.write_bytes += usage["write_bytes"].toDouble();
+        total_wall_time_sec += P["wall_time_sec"].toDouble();
+        QJsonArray sections = P["sections"].toArray();
+        for (int j = 0; j < sections.count(); j++) {
+            QJsonObject X = sections[j].toObject();
+            SectionSummary& SS = S.sections[X["name"].toString()];
+            SS.time_sec += X["time_sec"].toDouble();
+            SS.count += X["count"].toDouble();
+            SS.max_sec = qMax(SS.max_sec, X["max_sec"].toDouble());
+            SS.bytes += X["bytes"].toDouble();
+        }
+        QJsonArray latencies = P["latencies"].toArray();
+        for (int j = 0; j < latencies.count(); j++) {
+            QJsonObject X = latencies[j].toObject();
+            TaskManager::TaskProgressLatencyHistogram& H = S.latencies[X["name"].toString()];
+            H.count += (long)X["count"].toDouble();
+            H.total_msec += X["total_msec"].toDouble();
+            H.max_msec = qMax(H.max_msec, X["max_msec"].toDouble());
+            QJsonArray bucket_counts = X["bucket_counts"].toArray();
+            for (int b = 0; (b < bucket_counts.count()) && (b < H.bucket_counts.count()); b++)
+                H.bucket_counts[b] += (long)bucket_counts[b].toDouble();
+        }
+    }
+
+    QStringList names = processors.keys();
+    std::stable_sort(names.begin(), names.end(), [&processors](const QString& a, const QString& b) {
+        return processors.value(a).wall_time_sec > processors.value(b).wall_time_sec;
+    });
+    QJsonArray processors_array;
+    foreach (QString name, names) {
+        ProcessorSummary S = processors.value(name);
+        QJsonObject obj;
+        obj["processor_name"] = name;
+        obj["num_runs"] = (double)S.num_runs;
+        obj["wall_time_sec"] = S.wall_time_sec;
+        obj["cpu_time_sec"] = S.cpu_time_sec;
+        obj["peak_mem_bytes"] = S.peak_mem_bytes;
+        obj["read_bytes"] = S.read_bytes;
+        obj["write_bytes"] = S.write_bytes;
+        obj["sections"] = sections_to_json_array(S.sections);
+        obj["latencies"] = latencies_to_json_array(S.latencies);
+        processors_array << obj;
+    }
+    QJsonObject ret;
+    ret["num_profiles"] = profiles.count();
+    ret["wall_time_sec"] = total_wall_time_sec; //summed over processes, some of which may have run concurrently
+    ret["processors"] = processors_array;
+    return ret;
+}
+
+void print_profile_summary(const QJsonObject& summary)
+{
+    double total = summary["wall_time_sec"].toDouble();
+    printf("%d profiles, %g sec total\n\n", summary["num_profiles"].toInt(), total);
+    QJsonArray processors = summary["processors"].toArray();
+    for (int i = 0; i < processors.count(); i++) {
+        QJsonObject P = processors[i].toObject();
+        double wall = P["wall_time_sec"].toDouble();
+        printf("%s: %g sec wall (%d%%), %g sec cpu, %ld MB peak, %ld MB read, %ld MB written, %d runs\n",
+            P["processor_name"].toString().toLatin1().data(),
+            wall, total ? (int)(wall * 100 / total) : 0, P["cpu_time_sec"].toDouble(),
+            (long)(P["peak_mem_bytes"].toDouble() / 1e6), (long)(P["read_bytes"].toDouble() / 1e6), (long)(P["write_bytes"].toDouble() / 1e6),
+            P["num_runs"].toInt());
+        QJsonArray sections = P["sections"].toArray();
+        for (int j = 0; j < sections.count(); j++) {
+            QJsonObject S = sections[j].toObject();
+            //section times are summed over threads
+            printf("    %-30s %10.3f sec %10ld calls %10.3f sec max", S["name"].toString().toLatin1().data(),
+                S["time_sec"].toDouble(), (long)S["count"].toDouble(), S["max_sec"].toDouble());
+            if (S.contains("mb_per_sec"))
+                printf(" %10.1f MB/s", S["mb_per_sec"].toDouble());
+            printf("\n");
+        }
+        QJsonArray latencies = P["latencies"].toArray();
+        for (int j = 0; j < latencies.count(); j++) {
+            QJsonObject L = latencies[j].toObject();
+            printf("    %-30s %10ld calls %10.3f ms mean %10.3f ms p50 %10.3f ms p99 %10.3f ms max\n", L["name"].toString().toLatin1().data(),
+                (long)L["count"].toDouble(), L["mean_msec"].toDouble(), L["p50_msec"].toDouble(), L["p99_msec"].toDouble(), L["max_msec"].toDouble());
+        }
+    }
+    printf("\n");
+}
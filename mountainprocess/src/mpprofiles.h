@@ -0,0 +1,31 @@
+/******************************************************
+** See the accompanying README and LICENSE files
+*******************************************************/
+
+#ifndef MPPROFILES_H
+#define MPPROFILES_H
+
+#include <QDateTime>
+#include <QJsonObject>
+#include <QList>
+#include <QStringList>
+
+/*
+ * The profiles written by the processors (see MSProfile in mountainsort) as collected by run-process.
+ *
+ * Each profile is kept in the runtime results of its process and also as a file of its own in the profiles
+ * directory of the mountainprocess log, tagged with the pipeline run (if any) that the process belonged to.
+ * The files are removed after profile_max_age_days (mountainprocess config) so that the directory stays bounded.
+ * A summary merges these per processor, so that one can see where the time of a pipeline run went.
+ */
+
+//writes the profile to a new file in profiles_path, returns the file name (empty on failure)
+QString write_process_profile(const QString& profiles_path, const QJsonObject& profile);
+//removes the profiles in profiles_path last written more than max_age_days ago (none if max_age_days<=0)
+void remove_old_process_profiles(const QString& profiles_path, double max_age_days);
+//the profiles in the given files or directories, optionally restricted to a pipeline run and/or a start time
+QList<QJsonObject> load_process_profiles(const QStringList& paths, const QString& pipeline_run, const QDateTime& since);
+QJsonObject summarize_process_profiles(const QList<QJsonObject>& profiles);
+void print_profile_summary(const QJsonObject& summary);
+
+#endif // MPPROFILES_H
@@ -0,0 +1,121 @@
+/******************************************************
+** See the accompanying README and LICENSE files
+*******************************************************/
+
+#include "mpresourcehistory.h"
+#include "mlcommon.h"
+
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QFile>
+
+//only the most recent records for each processor are kept
+#define MAX_RECORDS_PER_PROCESSOR 20
+//we pad the learned estimates because peak memory is sampled (once per second)
+#define ESTIMATE_SAFETY_FACTOR 1.25
+
+void MPResourceHistory::setPath(const QString& path)
+{
+    m_path = path;
+}
+
+bool MPResourceHistory::load()
+{
+    m_records.clear();
+    if (m_path.isEmpty())
+        return false;
+    if (!QFile::exists(m_path))
+        return true;
+    QJsonParseError error;
+    QJsonObject obj = QJsonDocument::fromJson(TextFile::read(m_path).toUtf8(), &error).object();
+    if (error.error != QJsonParseError::NoError) {
+        qWarning() << "Error parsing resource history file: " + m_path;
+        return false;
+    }
+    QStringList processor_names = obj.keys();
+    foreach (QString processor_name, processor_names) {
+        QJsonArray list = obj[processor_name].toArray();
+        for (int i = 0; i < list.count(); i++) {
+            QJsonObject rr = list[i].toObject();
+            ProcessResourceRecord rec;
+            rec.input_size_bytes = rr["input_size_bytes"].toDouble();
+            rec.peak_mem_bytes = rr["peak_mem_bytes"].toDouble();
+            rec.peak_cpu_pct = rr["peak_cpu_pct"].toDouble();
+            rec.duration_sec = rr["duration_sec"].toDouble();
+            m_records[processor_name] << rec;
+        }
+    }
+    return true;
+}
+
+bool MPResourceHistory::save() const
+{
+    if (m_path.isEmpty())
+        return false;
+    QJsonObject obj;
+    QStringList processor_names = m_records.keys();
+    foreach (QString processor_name, processor_names) {
+        QJsonArray list;
+        foreach (ProcessResourceRecord rec, m_records[processor_name]) {
+            QJsonObject rr;
+            rr["input_size_bytes"] = rec.input_size_bytes;
+            rr["peak_mem_bytes"] = rec.peak_mem_bytes;
+            rr["peak_cpu_pct"] = rec.peak_cpu_pct;
+            rr["duration_sec"] = rec.duration_sec;
+            list << rr;
+        }
+        obj[processor_name] = list;
+    }
+    if (!TextFile::write(m_path + ".tmp", QJsonDocument(obj).toJson()))
+        return false;
+    QFile::remove(m_path);
+    return QFile::rename(m_path + ".tmp", m_path);
+}
+
+void MPResourceHistory::addRecord(const QString& processor_name, const ProcessResourceRecord& rec)
+{
+    QList<ProcessResourceRecord>* list = &m_records[processor_name];
+    list->append(rec);
+    while (list->count() > MAX_RECORDS_PER_PROCESSOR)
+        list->removeFirst();
+}
+
+ProcessResourceEstimate MPResourceHistory::estimate(const QString& processor_name, double input_size_bytes) const
+{
+    ProcessResourceEstimate ret;
+    QList<ProcessResourceRecord> list = m_records.value(processor_name);
+    if (list.isEmpty())
+        return ret;
+
+    /*
+     * We assume that memory and time are nondecreasing in the input size.
+     * So the run with the smallest input that is at least as large as ours gives an upper bound.
+     * If ours is larger than anything we have seen, scale up the largest run linearly.
+     */
+    int best_above = -1;
+    int largest = 0;
+    for (int i = 0; i < list.count(); i++) {
+        if (list[i].input_size_bytes >= input_size_bytes) {
+            if ((best_above < 0) || (list[i].input_size_bytes < list[best_above].input_size_bytes))
+                best_above = i;
+        }
+        if (list[i].input_size_bytes > list[largest].input_size_bytes)
+            largest = i;
+    }
+    ProcessResourceRecord rec;
+    double factor = 1;
+    if (best_above >= 0) {
+        rec = list[best_above];
+    }
+    else {
+        rec = list[largest];
+        if (rec.input_size_bytes > 0)
+            factor = input_size_bytes / rec.input_size_bytes;
+    }
+
+    ret.valid = true;
+    ret.memory_gb = rec.peak_mem_bytes * factor * ESTIMATE_SAFETY_FACTOR / 1e9;
+    ret.num_threads = qMax(1.0, rec.peak_cpu_pct / 100);
+    ret.duration_sec = rec.duration_sec * factor * ESTIMATE_SAFETY_FACTOR;
+    return ret;
+}
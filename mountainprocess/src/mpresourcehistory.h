@@ -0,0 +1,47 @@
+/******************************************************
+** See the accompanying README and LICENSE files
+*******************************************************/
+
+#ifndef MPRESOURCEHISTORY_H
+#define MPRESOURCEHISTORY_H
+
+#include <QString>
+#include <QMap>
+#include <QList>
+#include <QJsonObject>
+
+struct ProcessResourceRecord {
+    double input_size_bytes = 0;
+    double peak_mem_bytes = 0;
+    double peak_cpu_pct = 0;
+    double duration_sec = 0;
+};
+
+struct ProcessResourceEstimate {
+    bool valid = false;
+    double memory_gb = 0;
+    double num_threads = 0;
+    double duration_sec = 0; //0 means unknown
+};
+
+/*
+ * Keeps track of the resources actually used by past runs of each processor
+ * (peak RSS, peak CPU and wall time as reported in the runtime results), so that
+ * the daemon can estimate what a queued process will need based on the total
+ * size of its inputs. Records are persisted to a json file in the daemon path.
+ */
+class MPResourceHistory {
+public:
+    void setPath(const QString& path);
+    bool load();
+    bool save() const;
+
+    void addRecord(const QString& processor_name, const ProcessResourceRecord& rec);
+    ProcessResourceEstimate estimate(const QString& processor_name, double input_size_bytes) const;
+
+private:
+    QString m_path;
+    QMap<QString, QList<ProcessResourceRecord> > m_records;
+};
+
+#endif // MPRESOURCEHISTORY_H
@@ -6,6 +6,7 @@
 
 #include "processmanager.h"
 #include <QDir>
+#include <QFile>
 #include <QDebug>
 #include <QJsonDocument>
 #include <QJsonObject>
@@ -16,15 +17,37 @@
 #include <QCryptographicHash>
 #include "mpdaemon.h"
 #include "mlcommon.h"
+#include "resultcache.h"
+#include "cachemanager.h"
 
 #include <QCoreApplication>
 #include <QThread>
+#include <QThreadPool>
 #include <QTimer>
 #include "mpdaemon.h"
 
+//once a time series has this many samples we halve its resolution
+#define MAX_NUM_MONITOR_SAMPLES 2000
+
 struct PMProcess {
     MLProcessInfo info;
     QProcess* qprocess;
+    QString profile_path;
+    ProcessTreeMonitor monitor;
+    long num_monitor_samples = 0;
+    long monitor_stride = 1;
+};
+
+class ResultCacheStoreRunnable : public QRunnable {
+public:
+    ResultCache cache;
+    MLProcessor processor;
+    QVariantMap parameters;
+
+    void run()
+    {
+        cache.store(processor, parameters);
+    }
 };
 
 class ProcessManagerPrivate {
@@ -33,6 +56,8 @@ public:
 
     QMap<QString, MLProcessor> m_processors;
     QMap<QString, PMProcess> m_processes;
+    ResultCache m_result_cache;
+    QThreadPool m_result_cache_pool; //results are stored in the background, one at a time
     //QStringList m_server_urls;
     //QString m_server_base_path;
 
@@ -44,6 +69,8 @@ public:
     QJsonObject compute_unique_process_object(MLProcessor P, const QVariantMap& parameters);
     bool all_input_and_output_files_exist(MLProcessor P, const QVariantMap& parameters);
     QJsonObject create_file_object(const QString& fname);
+    QString completed_process_record_path(MLProcessor P, const QVariantMap& parameters);
+    void write_completed_process_record(MLProcessor P, const QVariantMap& parameters);
 
     static MLProcessor create_processor_from_json_object(QJsonObject obj);
     static MLParameter create_parameter_from_json_object(QJsonObject obj);
@@ -54,11 +81,17 @@ ProcessManager::ProcessManager()
     d = new ProcessManagerPrivate;
     d->q = this;
 
+    if (!MLUtil::configValue("mountainprocess", "result_cache_path").toString().isEmpty()) {
+        d->m_result_cache.setPath(MLUtil::configResolvedPath("mountainprocess", "result_cache_path"));
+    }
+    d->m_result_cache_pool.setMaxThreadCount(1);
+
     QTimer::singleShot(1000, this, SLOT(slot_monitor()));
 }
 
 ProcessManager::~ProcessManager()
 {
+    d->m_result_cache_pool.waitForDone(); //so that results being stored are not lost on exit
     d->clear_all_processes();
     delete d;
 }
@@ -168,6 +201,7 @@ QString ProcessManager::startProcess(const QString& processor_name, const QVaria
         return "";
     }
     MLProcessor P = d->m_processors[processor_name];
+    ResultCache::unshareOutputs(P, parameters);
     QString exe_command = P.exe_command;
     exe_command.replace(QRegExp("\\$\\(basepath\\)"), P.basepath);
     {
@@ -207,6 +241,13 @@ QString ProcessManager::startProcess(const QString& processor_name, const QVaria
     PP.info.exit_status = QProcess::NormalExit;
     PP.qprocess = new QProcess;
     PP.qprocess->setProcessChannelMode(QProcess::MergedChannels);
+    //processors that support profiling write their profile here (see MSProfile)
+    PP.profile_path = CacheManager::globalInstance()->makeLocalFile("process_profile." + id + ".json", CacheManager::ShortTerm);
+    {
+        QProcessEnvironment env = QProcessEnvironment::systemEnvironment();
+        env.insert("ML_PROFILE_OUTPUT", PP.profile_path);
+        PP.qprocess->setProcessEnvironment(env);
+    }
     //connect(PP.qprocess,SIGNAL(readyRead()),this,SLOT(slot_qprocess_output()));
     QObject::connect(PP.qprocess, SIGNAL(finished(int, QProcess::ExitStatus)), this, SLOT(slot_process_finished()));
     printf("STARTING: %s.\n", PP.info.exe_command.toLatin1().data());
@@ -217,6 +258,7 @@ QString ProcessManager::startProcess(const QString& processor_name, const QVaria
         delete PP.qprocess;
         return "";
     }
+    PP.monitor.setPid(PP.qprocess->processId());
     d->m_processes[id] = PP;
     return id;
 }
@@ -279,16 +321,19 @@ bool ProcessManager::processAlreadyCompleted(const QString& processor_name, cons
 
     MLProcessor P = d->m_processors[processor_name];
 
-    if (!d->all_input_and_output_files_exist(P, parameters))
-        return false;
-
-    QJsonObject obj = d->compute_unique_process_object(P, parameters);
-
-    QString code = d->compute_unique_object_code(obj);
+    if (d->all_input_and_output_files_exist(P, parameters)) {
+        if (QFile::exists(d->completed_process_record_path(P, parameters)))
+            return true;
+    }
 
-    QString path = MPDaemon::daemonPath() + "/completed_processes/" + code + ".json";
+    //the same inputs (by content) may have been processed elsewhere, possibly by another user
+    if (d->m_result_cache.materialize(P, parameters)) {
+        printf("Using cached result: %s\n", processor_name.toLatin1().data());
+        d->write_completed_process_record(P, parameters);
+        return true;
+    }
 
-    return QFile::exists(path);
+    return false;
 }
 
 QStringList ProcessManager::allProcessIds() const
@@ -366,14 +411,14 @@ void ProcessManager::slot_process_finished()
         }
         else {
             MLProcessor processor = d->m_processors[processor_name];
-            QJsonObject obj = d->compute_unique_process_object(processor, parameters);
-            QString code = d->compute_unique_object_code(obj);
-            QString fname = MPDaemon::daemonPath() + "/completed_processes/" + code + ".json";
-            QString json = QJsonDocument(obj).toJson();
-            if (QFile::exists(fname))
-                QFile::remove(fname); //shouldn't be needed
-            if (TextFile::write(fname + ".tmp", json)) {
-                QFile::rename(fname + ".tmp", fname);
+            d->write_completed_process_record(processor, parameters);
+            if (d->m_result_cache.isEnabled()) {
+                //checksumming and copying the outputs would block the event loop
+                ResultCacheStoreRunnable* R = new ResultCacheStoreRunnable;
+                R->cache = d->m_result_cache;
+                R->processor = processor;
+                R->parameters = parameters;
+                d->m_result_cache_pool.start(R);
             }
         }
     }
@@ -391,29 +436,28 @@ void ProcessManager::slot_qprocess_output()
     }
 }
 
-QString execute_and_read_stdout(QString cmd)
-{
-    QProcess P;
-    P.start(cmd);
-    P.waitForStarted();
-    P.waitForFinished();
-    return P.readAllStandardOutput();
-}
-
 void ProcessManager::slot_monitor()
 {
+    //each process reads only its own subtree of /proc -- the full scan is left to the daemon, which monitors them all
     QStringList ids = d->m_processes.keys();
     foreach (QString id, ids) {
         PMProcess* PP = &d->m_processes[id];
         if (PP->qprocess) {
-            QString cmd = QString("ps -p %1 -o rss,%cpu --noheader").arg(PP->qprocess->pid());
-            QString str = execute_and_read_stdout(cmd);
-            QStringList list = str.split(" ", QString::SkipEmptyParts);
             MonitorStats MS;
-            MS.timestamp = QDateTime::currentDateTime();
-            MS.mem_bytes = list.value(0).toLong() * 1000;
-            MS.cpu_pct = list.value(1).toDouble();
-            PP->info.monitor_stats << MS;
+            if (!PP->monitor.sample(MS))
+                continue;
+            PP->info.peak_stats = PP->monitor.peakStats();
+            if (PP->num_monitor_samples % PP->monitor_stride == 0) {
+                PP->info.monitor_stats << MS;
+                if (PP->info.monitor_stats.count() >= MAX_NUM_MONITOR_SAMPLES) {
+                    QList<MonitorStats> thinned;
+                    for (int i = 0; i < PP->info.monitor_stats.count(); i += 2)
+                        thinned << PP->info.monitor_stats[i];
+                    PP->info.monitor_stats = thinned;
+                    PP->monitor_stride *= 2;
+                }
+            }
+            PP->num_monitor_samples++;
         }
     }
 
@@ -438,6 +482,13 @@ void ProcessManagerPrivate::update_process_info(QString id)
         PP->info.finished = true;
         PP->info.exit_code = qprocess->exitCode();
         PP->info.exit_status = qprocess->exitStatus();
+        if ((!PP->profile_path.isEmpty()) && (QFile::exists(PP->profile_path))) {
+            QJsonParseError error;
+            PP->info.profile = QJsonDocument::fromJson(TextFile::read(PP->profile_path).toUtf8(), &error).object();
+            if (error.error != QJsonParseError::NoError)
+                qWarning() << "Unable to parse profile: " + PP->profile_path;
+            QFile::remove(PP->profile_path);
+        }
     }
     PP->info.standard_output += qprocess->readAll();
 }
@@ -597,6 +648,26 @@ QString ProcessManagerPrivate::compute_unique_object_code(QJsonObject obj)
     return QString(hash.result().toHex());
 }
 
+QString ProcessManagerPrivate::completed_process_record_path(MLProcessor P, const QVariantMap& parameters)
+{
+    QJsonObject obj = compute_unique_process_object(P, parameters);
+    QString code = compute_unique_object_code(obj);
+    return MPDaemon::daemonPath() + "/completed_processes/" + code + ".json";
+}
+
+void ProcessManagerPrivate::write_completed_process_record(MLProcessor P, const QVariantMap& parameters)
+{
+    QJsonObject obj = compute_unique_process_object(P, parameters);
+    QString code = compute_unique_object_code(obj);
+    QString fname = MPDaemon::daemonPath() + "/completed_processes/" + code + ".json";
+    QString json = QJsonDocument(obj).toJson();
+    if (QFile::exists(fname))
+        QFile::remove(fname); //shouldn't be needed
+    if (TextFile::write(fname + ".tmp", json)) {
+        QFile::rename(fname + ".tmp", fname);
+    }
+}
+
 QJsonObject ProcessManagerPrivate::create_file_object(const QString& fname_in)
 {
     QString fname = resolve_file_name_p(fname_in);
@@ -12,6 +12,7 @@
 #include <QProcess>
 #include <QDateTime>
 #include <QJsonObject>
+#include "processmonitor.h"
 
 struct MLParameter {
     QString name;
@@ -34,12 +35,6 @@ struct MLProcessor {
     QString basepath;
 };
 
-struct MonitorStats {
-    QDateTime timestamp;
-    long mem_bytes = 0;
-    double cpu_pct = 0;
-};
-
 struct MLProcessInfo {
     QString processor_name;
     QVariantMap parameters;
@@ -47,9 +42,11 @@ struct MLProcessInfo {
     bool finished;
     int exit_code;
     QList<MonitorStats> monitor_stats;
+    MonitorStats peak_stats;
     QProcess::ExitStatus exit_status;
     QByteArray standard_output;
     QByteArray standard_error;
+    QJsonObject profile; //written by the processor, if it supports profiling (see ML_PROFILE_OUTPUT)
 };
 
 class ProcessManagerPrivate;
@@ -0,0 +1,218 @@
+/******************************************************
+** See the accompanying README and LICENSE files
+*******************************************************/
+
+#include "processmonitor.h"
+
+#include <QDir>
+#include <QFile>
+#include <QStringList>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+QByteArray read_proc_file(const QString& path)
+{
+    //files in /proc report a size of zero, so we just read until the end
+    QByteArray ret;
+    int fd = ::open(path.toLatin1().data(), O_RDONLY);
+    if (fd < 0)
+        return ret;
+    char buf[4096];
+    while (true) {
+        ssize_t num = ::read(fd, buf, sizeof(buf));
+        if (num <= 0)
+            break;
+        ret.append(buf, num);
+    }
+    ::close(fd);
+    return ret;
+}
+
+//the fields following the command name in /proc/[pid]/stat, so that field n (as numbered in proc(5)) is at index n-3
+QList<QByteArray> read_stat_fields(qint64 pid)
+{
+    QByteArray txt = read_proc_file(QString("/proc/%1/stat").arg(pid));
+    int ind = txt.lastIndexOf(')'); //the command name may contain spaces or parentheses
+    if (ind < 0)
+        return QList<QByteArray>();
+    return txt.mid(ind + 1).simplified().split(' ');
+}
+
+//returns the value of a "key: value" line, as in /proc/[pid]/status and /proc/[pid]/io
+qint64 read_keyed_value(const QByteArray& txt, const QByteArray& key)
+{
+    int ind = txt.indexOf("\n" + key + ":");
+    if (ind < 0) {
+        if (!txt.startsWith(key + ":"))
+            return 0;
+        ind = -1;
+    }
+    int ind1 = ind + 1 + key.count() + 1;
+    int ind2 = txt.indexOf('\n', ind1);
+    if (ind2 < 0)
+        ind2 = txt.count();
+    QList<QByteArray> list = txt.mid(ind1, ind2 - ind1).simplified().split(' ');
+    return list.value(0).toLongLong();
+}
+
+void collect_descendants(qint64 pid, const QMap<qint64, QList<qint64> >& process_children, QList<qint64>& pids)
+{
+    pids << pid;
+    QList<qint64> children = process_children.value(pid);
+    foreach (qint64 child, children) {
+        if (!pids.contains(child))
+            collect_descendants(child, process_children, pids);
+    }
+}
+}
+
+void ProcessTreeMonitor::setPid(qint64 pid)
+{
+    m_pid = pid;
+    m_counters.clear();
+    m_last_stats = MonitorStats();
+    m_peak_stats = MonitorStats();
+}
+
+qint64 ProcessTreeMonitor::pid() const
+{
+    return m_pid;
+}
+
+bool ProcessTreeMonitor::sample(MonitorStats& stats)
+{
+    QMap<qint64, QList<qint64> > process_children;
+    if (!readSubtreeChildren(m_pid, process_children))
+        process_children = readProcessChildren();
+    return sample(stats, process_children);
+}
+
+bool ProcessTreeMonitor::sample(MonitorStats& stats, const QMap<qint64, QList<qint64> >& process_children)
+{
+    static const double ticks_per_sec = sysconf(_SC_CLK_TCK);
+
+    if ((!m_pid) || (!QFile::exists(QString("/proc/%1").arg(m_pid))))
+        return false;
+
+    QList<qint64> pids;
+    collect_descendants(m_pid, process_children, pids);
+
+    stats = MonitorStats();
+    stats.timestamp = QDateTime::currentDateTime();
+    foreach (qint64 pid, pids) {
+        QList<QByteArray> fields = read_stat_fields(pid);
+        if (fields.count() < 22)
+            continue; //the process has exited in the meantime
+        PidCounters C;
+        C.minor_faults = fields[10 - 3].toLongLong();
+        C.major_faults = fields[12 - 3].toLongLong();
+        C.cpu_time_sec = (fields[14 - 3].toLongLong() + fields[15 - 3].toLongLong()) / ticks_per_sec;
+        QByteArray io = read_proc_file(QString("/proc/%1/io").arg(pid));
+        C.read_bytes = read_keyed_value(io, "read_bytes");
+        C.write_bytes = read_keyed_value(io, "write_bytes");
+        qint64 start_time = fields[22 - 3].toLongLong(); //in clock ticks after boot
+        m_counters[qMakePair(pid, start_time)] = C;
+
+        QByteArray status = read_proc_file(QString("/proc/%1/status").arg(pid));
+        stats.mem_bytes += read_keyed_value(status, "VmRSS") * 1024;
+        stats.num_processes++;
+    }
+    foreach (PidCounters C, m_counters) {
+        stats.cpu_time_sec += C.cpu_time_sec;
+        stats.read_bytes += C.read_bytes;
+        stats.write_bytes += C.write_bytes;
+        stats.minor_faults += C.minor_faults;
+        stats.major_faults += C.major_faults;
+    }
+    if (m_last_stats.timestamp.isValid()) {
+        double elapsed_sec = m_last_stats.timestamp.msecsTo(stats.timestamp) / 1000.0;
+        if (elapsed_sec > 0)
+            stats.cpu_pct = (stats.cpu_time_sec - m_last_stats.cpu_time_sec) / elapsed_sec * 100;
+    }
+    m_last_stats = stats;
+
+    MonitorStats peak = stats;
+    peak.mem_bytes = qMax(m_peak_stats.mem_bytes, stats.mem_bytes);
+    peak.cpu_pct = qMax(m_peak_stats.cpu_pct, stats.cpu_pct);
+    peak.num_processes = qMax(m_peak_stats.num_processes, stats.num_processes);
+    m_peak_stats = peak;
+
+    return true;
+}
+
+MonitorStats ProcessTreeMonitor::peakStats() const
+{
+    return m_peak_stats;
+}
+
+QMap<qint64, QList<qint64> > ProcessTreeMonitor::readProcessChildren()
+{
+    QMap<qint64, QList<qint64> > ret;
+    QStringList list = QDir("/proc").entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+    foreach (QString str, list) {
+        bool ok;
+        qint64 pid = str.toLongLong(&ok);
+        if (!ok)
+            continue;
+        QList<QByteArray> fields = read_stat_fields(pid);
+        if (fields.count() < 2)
+            continue;
+        ret[fields[4 - 3].toLongLong()] << pid;
+    }
+    return ret;
+}
+
+bool ProcessTreeMonitor::readSubtreeChildren(qint64 pid, QMap<qint64, QList<qint64> >& process_children)
+{
+    process_children.clear();
+    if (!QFile::exists(QString("/proc/%1/task/%1/children").arg(pid)))
+        return false;
+    QList<qint64> queue;
+    queue << pid;
+    while (!queue.isEmpty()) {
+        qint64 pid0 = queue.takeFirst();
+        if (process_children.contains(pid0))
+            continue;
+        QList<qint64>& children = process_children[pid0];
+        //the children of every thread of the process, not only those of the main thread
+        QStringList tids = QDir(QString("/proc/%1/task").arg(pid0)).entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+        foreach (QString tid, tids) {
+            QList<QByteArray> list = read_proc_file(QString("/proc/%1/task/%2/children").arg(pid0).arg(tid)).simplified().split(' ');
+            foreach (QByteArray str, list) {
+                bool ok;
+                qint64 child = str.toLongLong(&ok);
+                if ((ok) && (!children.contains(child))) {
+                    children << child;
+                    queue << child;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+QJsonObject monitor_stats_to_json_object(const MonitorStats& X)
+{
+    QJsonObject obj;
+    obj["timestamp"] = X.timestamp.toMSecsSinceEpoch();
+    obj["mem_bytes"] = (long long)X.mem_bytes;
+    obj["cpu_pct"] = X.cpu_pct;
+    obj["cpu_time_sec"] = X.cpu_time_sec;
+    obj["read_bytes"] = X.read_bytes;
+    obj["write_bytes"] = X.write_bytes;
+    obj["minor_faults"] = X.minor_faults;
+    obj["major_faults"] = X.major_faults;
+    obj["num_processes"] = X.num_processes;
+    return obj;
+}
+
+QJsonArray monitor_stats_to_json_array(const QList<MonitorStats>& stats)
+{
+    QJsonArray ret;
+    for (int i = 0; i < stats.count(); i++) {
+        ret << monitor_stats_to_json_object(stats[i]);
+    }
+    return ret;
+}
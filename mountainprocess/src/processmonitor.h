@@ -0,0 +1,70 @@
+/******************************************************
+** See the accompanying README and LICENSE files
+*******************************************************/
+
+#ifndef PROCESSMONITOR_H
+#define PROCESSMONITOR_H
+
+#include <QDateTime>
+#include <QMap>
+#include <QList>
+#include <QPair>
+#include <QJsonObject>
+#include <QJsonArray>
+
+struct MonitorStats {
+    QDateTime timestamp;
+    long mem_bytes = 0; //resident set size
+    double cpu_pct = 0; //since the previous sample
+    //the following are cumulative
+    double cpu_time_sec = 0;
+    qint64 read_bytes = 0;
+    qint64 write_bytes = 0;
+    qint64 minor_faults = 0;
+    qint64 major_faults = 0;
+    int num_processes = 0;
+};
+
+/*
+ * Samples the resource usage of a process together with all of its descendants
+ * by reading /proc/[pid]/stat, /proc/[pid]/status and /proc/[pid]/io directly
+ * (no child processes are spawned). The cumulative counters of descendants that
+ * have exited are retained from their last sample, even if their pid is reused.
+ */
+class ProcessTreeMonitor {
+public:
+    void setPid(qint64 pid);
+    qint64 pid() const;
+
+    //returns false if the process no longer exists
+    //this one reads only the subtree of the process (see readSubtreeChildren)
+    bool sample(MonitorStats& stats);
+    bool sample(MonitorStats& stats, const QMap<qint64, QList<qint64> >& process_children);
+    //the largest memory and cpu usage seen so far, together with the latest cumulative counters
+    MonitorStats peakStats() const;
+
+    //maps each pid to its child pids, for all processes on the system
+    static QMap<qint64, QList<qint64> > readProcessChildren();
+    //the same for the tree of a single process only, from /proc/[pid]/task/[tid]/children (which needs a kernel with
+    //CONFIG_PROC_CHILDREN) -- returns false if that is not available
+    static bool readSubtreeChildren(qint64 pid, QMap<qint64, QList<qint64> >& process_children);
+
+private:
+    struct PidCounters {
+        double cpu_time_sec = 0;
+        qint64 read_bytes = 0;
+        qint64 write_bytes = 0;
+        qint64 minor_faults = 0;
+        qint64 major_faults = 0;
+    };
+    qint64 m_pid = 0;
+    //last known counters of every process seen in the tree, by (pid, start time) since pids get reused
+    QMap<QPair<qint64, qint64>, PidCounters> m_counters;
+    MonitorStats m_last_stats;
+    MonitorStats m_peak_stats;
+};
+
+QJsonObject monitor_stats_to_json_object(const MonitorStats& X);
+QJsonArray monitor_stats_to_json_array(const QList<MonitorStats>& stats);
+
+#endif // PROCESSMONITOR_H
@@ -0,0 +1,297 @@
+/******************************************************
+** See the accompanying README and LICENSE files
+*******************************************************/
+
+#include "resultcache.h"
+#include "mlcommon.h"
+
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#ifdef Q_OS_LINUX
+#include <linux/fs.h> //for FICLONE
+#endif
+
+namespace {
+
+bool reflink_file(const QString& src, const QString& dst)
+{
+#ifdef FICLONE
+    int fd_src = ::open(src.toUtf8().data(), O_RDONLY);
+    if (fd_src < 0)
+        return false;
+    int fd_dst = ::open(dst.toUtf8().data(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd_dst < 0) {
+        ::close(fd_src);
+        return false;
+    }
+    bool ok = (ioctl(fd_dst, FICLONE, fd_src) == 0);
+    ::close(fd_src);
+    ::close(fd_dst);
+    if (!ok)
+        QFile::remove(dst);
+    return ok;
+#else
+    Q_UNUSED(src)
+    Q_UNUSED(dst)
+    return false;
+#endif
+}
+
+bool hardlink_file(const QString& src, const QString& dst)
+{
+    return (::link(src.toUtf8().data(), dst.toUtf8().data()) == 0);
+}
+
+//by reflink, hard link or copy -- in that order of preference
+bool materialize_file(const QString& src, const QString& dst)
+{
+    if (reflink_file(src, dst))
+        return true;
+    if (hardlink_file(src, dst))
+        return true; //the object is read-only, and unshareOutputs() removes the link before the output is rewritten
+    if (!QFile::copy(src, dst))
+        return false;
+    QFile::setPermissions(dst, QFile::ReadOwner | QFile::WriteOwner | QFile::ReadGroup | QFile::ReadOther);
+    return true;
+}
+
+QString input_checksum(const QString& path)
+{
+    if (path.endsWith(".prv")) {
+        //a .prv file already records the checksum of the content it refers to
+        QJsonObject obj = QJsonDocument::fromJson(TextFile::read(path).toUtf8()).object();
+        return obj["original_checksum"].toString();
+    }
+    if (!QFile::exists(path))
+        return "";
+    return MLUtil::computeSha1SumOfFile(path);
+}
+
+//a parameter may be given a list of files (or values) rather than a single one
+bool is_list(const QVariant& val)
+{
+    return ((val.type() == QVariant::List) || (val.type() == QVariant::StringList));
+}
+}
+
+void ResultCache::setPath(const QString& path)
+{
+    m_path = path;
+    if (!m_path.isEmpty()) {
+        MLUtil::mkdirIfNeeded(m_path);
+        MLUtil::mkdirIfNeeded(m_path + "/objects");
+        MLUtil::mkdirIfNeeded(m_path + "/results");
+    }
+}
+
+bool ResultCache::isEnabled() const
+{
+    return !m_path.isEmpty();
+}
+
+QString ResultCache::computeKey(const MLProcessor& P, const QVariantMap& parameters) const
+{
+    QJsonObject obj;
+    obj["mountainprocess_version"] = "0.1";
+    obj["processor_name"] = P.name;
+    obj["processor_version"] = P.version;
+    {
+        QJsonObject inputs;
+        QStringList pnames = P.inputs.keys();
+        foreach (QString pname, pnames) {
+            QVariant val = parameters.value(pname);
+            if (is_list(val)) {
+                QJsonArray checksums;
+                QStringList paths = val.toStringList();
+                foreach (QString path, paths) {
+                    QString checksum = input_checksum(path);
+                    if (checksum.isEmpty())
+                        return "";
+                    checksums << checksum;
+                }
+                inputs[pname] = checksums;
+                continue;
+            }
+            QString path = val.toString();
+            if (path.isEmpty()) {
+                inputs[pname] = ""; //an optional input that was not provided
+                continue;
+            }
+            QString checksum = input_checksum(path);
+            if (checksum.isEmpty())
+                return "";
+            inputs[pname] = checksum;
+        }
+        obj["inputs"] = inputs;
+    }
+    {
+        QJsonArray outputs;
+        QStringList pnames = P.outputs.keys();
+        foreach (QString pname, pnames) {
+            //the store holds a single file per output
+            if (is_list(parameters.value(pname)))
+                return "";
+            if (!parameters.value(pname).toString().isEmpty())
+                outputs << pname;
+        }
+        obj["outputs"] = outputs;
+    }
+    {
+        QJsonObject parameters0;
+        QStringList pnames = P.parameters.keys();
+        foreach (QString pname, pnames) {
+            QVariant val = parameters.value(pname);
+            if (is_list(val))
+                parameters0[pname] = QJsonArray::fromStringList(val.toStringList());
+            else
+                parameters0[pname] = val.toString();
+        }
+        obj["parameters"] = parameters0;
+    }
+    //the keys of a QJsonObject are sorted, so this is canonical
+    QByteArray json = QJsonDocument(obj).toJson(QJsonDocument::Compact);
+    return QString(QCryptographicHash::hash(json, QCryptographicHash::Sha1).toHex());
+}
+
+bool ResultCache::materialize(const MLProcessor& P, const QVariantMap& parameters) const
+{
+    if (!isEnabled())
+        return false;
+    QString key = computeKey(P, parameters);
+    if (key.isEmpty())
+        return false;
+    QString record_path = m_path + "/results/" + key + ".json";
+    if (!QFile::exists(record_path))
+        return false;
+    QJsonObject record = QJsonDocument::fromJson(TextFile::read(record_path).toUtf8()).object();
+    QJsonObject outputs = record["outputs"].toObject();
+
+    //first make sure every object is still there, so that we don't leave partial results behind
+    QStringList pnames = P.outputs.keys();
+    foreach (QString pname, pnames) {
+        QString fname = parameters.value(pname).toString();
+        if (fname.isEmpty())
+            continue;
+        QJsonObject output = outputs[pname].toObject();
+        QString opath = object_path(output["sha1"].toString());
+        if ((!QFile::exists(opath)) || (QFileInfo(opath).size() != output["size"].toVariant().toLongLong()))
+            return false;
+    }
+
+    QStringList created;
+    foreach (QString pname, pnames) {
+        QString fname = parameters.value(pname).toString();
+        if (fname.isEmpty())
+            continue;
+        QString opath = object_path(outputs[pname].toObject()["sha1"].toString());
+        if (QFile::exists(fname))
+            QFile::remove(fname);
+        if (!materialize_file(opath, fname)) {
+            qWarning() << "Unable to materialize cached result: " + fname;
+            foreach (QString fname0, created) {
+                QFile::remove(fname0);
+            }
+            return false;
+        }
+        created << fname;
+    }
+    return true;
+}
+
+bool ResultCache::store(const MLProcessor& P, const QVariantMap& parameters) const
+{
+    if (!isEnabled())
+        return false;
+    QString key = computeKey(P, parameters);
+    if (key.isEmpty())
+        return false;
+    QJsonObject outputs;
+    QStringList pnames = P.outputs.keys();
+    foreach (QString pname, pnames) {
+        QString fname = parameters.value(pname).toString();
+        if (fname.isEmpty())
+            continue;
+        if (!QFile::exists(fname))
+            return false;
+        QFileInfo info0(fname);
+        QString sha1 = MLUtil::computeSha1SumOfFile(fname);
+        if (!add_object(fname, sha1, info0)) {
+            qWarning() << "Unable to add result to cache: " + fname;
+            return false;
+        }
+        QJsonObject output;
+        output["sha1"] = sha1;
+        output["size"] = QFileInfo(fname).size();
+        outputs[pname] = output;
+    }
+    QJsonObject record;
+    record["processor_name"] = P.name;
+    record["processor_version"] = P.version;
+    record["outputs"] = outputs;
+    QString record_path = m_path + "/results/" + key + ".json";
+    QString tmp_path = record_path + ".tmp." + MLUtil::makeRandomId();
+    if (!TextFile::write(tmp_path, QJsonDocument(record).toJson()))
+        return false;
+    //several users may complete the same process at the same time -- the last rename wins, which is fine
+    if (::rename(tmp_path.toUtf8().data(), record_path.toUtf8().data()) != 0) {
+        QFile::remove(tmp_path);
+        return false;
+    }
+    return true;
+}
+
+void ResultCache::unshareOutputs(const MLProcessor& P, const QVariantMap& parameters)
+{
+    QStringList pnames = P.outputs.keys();
+    foreach (QString pname, pnames) {
+        QString fname = parameters.value(pname).toString();
+        if (fname.isEmpty())
+            continue;
+        struct stat SS;
+        if (stat(fname.toUtf8().data(), &SS) == 0) {
+            if (SS.st_nlink > 1)
+                QFile::remove(fname);
+        }
+    }
+}
+
+QString ResultCache::object_path(const QString& sha1) const
+{
+    return QString("%1/objects/%2/%3").arg(m_path).arg(sha1.mid(0, 2)).arg(sha1);
+}
+
+bool ResultCache::add_object(const QString& fname, const QString& sha1, const QFileInfo& info0) const
+{
+    if (sha1.isEmpty())
+        return false;
+    QString opath = object_path(sha1);
+    if (QFile::exists(opath))
+        return true; //deduplicated
+    MLUtil::mkdirIfNeeded(QFileInfo(opath).path());
+    //we never hard link the output into the store, because a processor may later overwrite the output in place
+    QString tmp_path = opath + ".tmp." + MLUtil::makeRandomId();
+    if (!reflink_file(fname, tmp_path)) {
+        if (!QFile::copy(fname, tmp_path))
+            return false;
+    }
+    //the checksum was computed in the background, so make sure the output was not rewritten in the meantime
+    QFileInfo info1(fname);
+    if ((info1.size() != info0.size()) || (info1.lastModified() != info0.lastModified())) {
+        QFile::remove(tmp_path);
+        return false;
+    }
+    QFile::setPermissions(tmp_path, QFile::ReadOwner | QFile::ReadGroup | QFile::ReadOther);
+    if (::rename(tmp_path.toUtf8().data(), opath.toUtf8().data()) != 0) {
+        QFile::remove(tmp_path);
+        return QFile::exists(opath);
+    }
+    return true;
+}
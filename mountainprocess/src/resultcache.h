@@ -0,0 +1,48 @@
+/******************************************************
+** See the accompanying README and LICENSE files
+*******************************************************/
+
+#ifndef RESULTCACHE_H
+#define RESULTCACHE_H
+
+#include "processmanager.h"
+#include <QFileInfo>
+
+/*
+ * An optional content-addressed cache of process results, shared between users.
+ *
+ * A result is keyed on the checksums of the input file contents (not their paths or
+ * modification times) together with the processor name, version and parameters.
+ * The output files are kept once per distinct content in a deduplicated object store,
+ * and on a cache hit they are materialized at the requested output paths by reflink
+ * (where the file system supports it), hard link, or as a last resort a copy.
+ *
+ * Layout of the cache directory:
+ *   objects/[first two chars]/[sha1] -- read-only output file contents
+ *   results/[key].json -- maps output names to the sha1 of their content
+ *
+ * Enable by setting mountainprocess.result_cache_path in the configuration.
+ */
+class ResultCache {
+public:
+    void setPath(const QString& path);
+    bool isEnabled() const;
+
+    //returns an empty string if any of the inputs could not be checksummed, or if an output is a list of files
+    QString computeKey(const MLProcessor& P, const QVariantMap& parameters) const;
+    //on a hit, creates the output files and returns true
+    bool materialize(const MLProcessor& P, const QVariantMap& parameters) const;
+    //checksums and copies the outputs, which takes a while for large files -- thread safe
+    bool store(const MLProcessor& P, const QVariantMap& parameters) const;
+
+    //remove output files that are hard links into the store, so that a processor writing them in place cannot corrupt it
+    static void unshareOutputs(const MLProcessor& P, const QVariantMap& parameters);
+
+private:
+    QString m_path;
+
+    QString object_path(const QString& sha1) const;
+    bool add_object(const QString& fname, const QString& sha1, const QFileInfo& info0) const;
+};
+
+#endif // RESULTCACHE_H
@@ -77,7 +77,9 @@ public:
     //QStringList m_server_urls;
     //QString m_server_base_path;
     bool m_force_run = false;
+    int m_priority = 0;
     QString m_working_path;
+    QString m_pipeline_run;
     QJsonObject m_results;
 
     QList<PipelineNode2> m_pipeline_nodes;
@@ -127,11 +129,21 @@ void ScriptController2::setForceRun(bool force_run)
     d->m_force_run = force_run;
 }
 
+void ScriptController2::setPriority(int priority)
+{
+    d->m_priority = priority;
+}
+
 void ScriptController2::setWorkingPath(QString working_path)
 {
     d->m_working_path = working_path;
 }
 
+void ScriptController2::setPipelineRun(QString pipeline_run)
+{
+    d->m_pipeline_run = pipeline_run;
+}
+
 QJsonObject ScriptController2::getResults()
 {
     return d->m_results;
@@ -313,6 +325,12 @@ QProcess* ScriptController2Private::queue_process(QString processor_name, const
     if (force_run) {
         args << "--_force_run";
     }
+    if (m_priority) {
+        args << QString("--_priority=%1").arg(m_priority); //processes inherit the priority of the script
+    }
+    if (!m_pipeline_run.isEmpty()) {
+        args << QString("--_pipeline_run=%1").arg(m_pipeline_run); //so that the profiles of the processes can be found together
+    }
     QProcess* P1 = new QProcess;
     P1->setReadChannelMode(QProcess::MergedChannels);
     P1->start(exe, args);
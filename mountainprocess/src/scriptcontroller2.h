@@ -20,7 +20,9 @@ public:
     void setServerUrls(const QStringList& urls);
     void setServerBasePath(const QString& path);
     void setForceRun(bool force_run);
+    void setPriority(int priority);
     void setWorkingPath(QString working_path);
+    void setPipelineRun(QString pipeline_run);
     QJsonObject getResults();
 
     Q_INVOKABLE QString addProcess(QString processor_name, QString inputs_json, QString parameters_json, QString outputs_json); //returns json
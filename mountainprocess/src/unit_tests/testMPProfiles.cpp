@@ -0,0 +1,94 @@
+#include "testMPProfiles.h"
+#include "mpprofiles.h"
+#include <QJsonArray>
+
+static QJsonObject make_profile(const QString& processor_name, double wall_time_sec, double mem_bytes, const QString& section_name, double section_time_sec)
+{
+    QJsonObject usage;
+    usage["cpu_time_sec"] = 2 * wall_time_sec;
+    usage["mem_bytes"] = mem_bytes;
+    usage["read_bytes"] = 1000;
+    usage["write_bytes"] = 10;
+    QJsonObject section;
+    section["name"] = section_name;
+    section["time_sec"] = section_time_sec;
+    section["count"] = 2;
+    section["max_sec"] = section_time_sec / 2;
+    section["bytes"] = 1e6;
+    QJsonObject P;
+    P["processor_name"] = processor_name;
+    P["wall_time_sec"] = wall_time_sec;
+    P["resource_usage"] = usage;
+    P["sections"] = QJsonArray() << section;
+    return P;
+}
+
+static QJsonObject make_latency(const QString& name, long count, double total_msec, double max_msec, int bucket)
+{
+    QJsonArray bucket_counts;
+    for (int b = 0; b < 32; b++)
+        bucket_counts << (double)((b == bucket) ? count : 0);
+    QJsonObject L;
+    L["name"] = name;
+    L["count"] = (double)count;
+    L["total_msec"] = total_msec;
+    L["max_msec"] = max_msec;
+    L["bucket_counts"] = bucket_counts;
+    return L;
+}
+
+void TestMPProfiles::testSummarize()
+{
+    QList<QJsonObject> profiles;
+    profiles << make_profile("ms3.bandpass_filter", 3, 100, "read", 1);
+    profiles << make_profile("ms3.whiten", 5, 300, "read", 2);
+    profiles << make_profile("ms3.whiten", 4, 200, "read", 3);
+    QJsonObject summary = summarize_process_profiles(profiles);
+    QCOMPARE(summary["num_profiles"].toInt(), 3);
+    QCOMPARE(summary["wall_time_sec"].toDouble(), 12.0);
+
+    //by decreasing wall time
+    QJsonArray processors = summary["processors"].toArray();
+    QCOMPARE(processors.count(), 2);
+    QJsonObject P = processors[0].toObject();
+    QCOMPARE(P["processor_name"].toString(), QString("ms3.whiten"));
+    QCOMPARE(P["num_runs"].toInt(), 2);
+    QCOMPARE(P["wall_time_sec"].toDouble(), 9.0);
+    QCOMPARE(P["cpu_time_sec"].toDouble(), 18.0);
+    QCOMPARE(P["peak_mem_bytes"].toDouble(), 300.0);
+    QCOMPARE(P["read_bytes"].toDouble(), 2000.0);
+    QCOMPARE(P["write_bytes"].toDouble(), 20.0);
+    QCOMPARE(processors[1].toObject()["processor_name"].toString(), QString("ms3.bandpass_filter"));
+
+    QJsonArray sections = P["sections"].toArray();
+    QCOMPARE(sections.count(), 1);
+    QJsonObject S = sections[0].toObject();
+    QCOMPARE(S["name"].toString(), QString("read"));
+    QCOMPARE(S["time_sec"].toDouble(), 5.0);
+    QCOMPARE(S["count"].toDouble(), 4.0);
+    QCOMPARE(S["max_sec"].toDouble(), 1.5);
+    QCOMPARE(S["bytes"].toDouble(), 2e6);
+    QCOMPARE(S["mb_per_sec"].toDouble(), 2e6 * 1e-6 / 5);
+}
+
+void TestMPProfiles::testSummarizeLatencies()
+{
+    //three reads in the bucket below 1.024 ms and one in the bucket below 1048.576 ms, in two runs
+    QList<QJsonObject> profiles;
+    QJsonObject P1 = make_profile("ms3.whiten", 1, 0, "read", 1);
+    P1["latencies"] = QJsonArray() << make_latency("DiskReadMda32::readChunk", 3, 3, 1, 10);
+    QJsonObject P2 = make_profile("ms3.whiten", 1, 0, "read", 1);
+    P2["latencies"] = QJsonArray() << make_latency("DiskReadMda32::readChunk", 1, 1000, 1000, 20);
+    profiles << P1 << P2;
+    QJsonObject summary = summarize_process_profiles(profiles);
+    QJsonArray latencies = summary["processors"].toArray()[0].toObject()["latencies"].toArray();
+    QCOMPARE(latencies.count(), 1);
+    QJsonObject L = latencies[0].toObject();
+    QCOMPARE(L["name"].toString(), QString("DiskReadMda32::readChunk"));
+    QCOMPARE(L["count"].toDouble(), 4.0);
+    QCOMPARE(L["total_msec"].toDouble(), 1003.0);
+    QCOMPARE(L["max_msec"].toDouble(), 1000.0);
+    QCOMPARE(L["mean_msec"].toDouble(), 1003.0 / 4);
+    QCOMPARE(L["p50_msec"].toDouble(), 1.024);
+    QCOMPARE(L["p99_msec"].toDouble(), 1000.0); //the bucket bound, capped by the max
+}
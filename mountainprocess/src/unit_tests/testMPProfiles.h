@@ -0,0 +1,13 @@
+#ifndef TESTMPPROFILES_H
+#define TESTMPPROFILES_H
+
+#include <QtTest/QTest>
+
+class TestMPProfiles : public QObject {
+    Q_OBJECT
+private slots:
+    void testSummarize();
+    void testSummarizeLatencies();
+};
+
+#endif // TESTMPPROFILES_H
@@ -1,5 +1,6 @@
 #include "testMda.h"
 #include "testMdaIO.h"
+#include "testMPProfiles.h"
 
 template <typename TestClass>
 int runTest(int argc, char** argv)
@@ -15,5 +16,6 @@ int main(int argc, char** argv)
 {
     runTest<TestMda>(argc, argv);
     runTest<TestMdaIO>(argc, argv);
+    runTest<TestMPProfiles>(argc, argv);
     return 0;
 }
@@ -0,0 +1,255 @@
+/******************************************************
+** See the accompanying README and LICENSE files
+*******************************************************/
+
+/*
+ * mountainsort_benchmark: microbenchmarks of the array I/O and of a few kernels, on generated files
+ *
+ * mountainsort_benchmark [--M=32] [--N=1000000] [--clip_size=50] [--num_clips=10000] [--K=20]
+ *     [--warmup=1] [--repetitions=5] [--filter=readChunk] [--tmp=/path/for/files] [--output=results.json]
+ *
+ * The files are written to a fresh directory under tmp and removed at the end. Reads are from the page cache
+ * after the warm-up, so the read numbers measure the library (conversion, copying, seeking) rather than the disk.
+ */
+
+#include "microbenchmark.h"
+#include "compute_templates_0.h"
+#include "diskreadmda32.h"
+#include "diskwritemda.h"
+#include "extract_clips.h"
+#include "mda.h"
+#include "mda32.h"
+#include "mdaio.h"
+#include "mlcommon.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <string.h>
+
+namespace {
+
+long bytes_per_entry(int data_type)
+{
+    if (data_type == MDAIO_TYPE_INT16)
+        return 2;
+    if (data_type == MDAIO_TYPE_FLOAT64)
+        return 8;
+    return 4;
+}
+
+QString data_type_name(int data_type)
+{
+    if (data_type == MDAIO_TYPE_INT16)
+        return "int16";
+    if (data_type == MDAIO_TYPE_FLOAT64)
+        return "float64";
+    return "float32";
+}
+
+void make_header(MDAIO_HEADER& H, int data_type, long M, long N)
+{
+    memset(&H, 0, sizeof(H));
+    H.data_type = data_type;
+    H.num_bytes_per_entry = bytes_per_entry(data_type);
+    H.num_dims = 2;
+    H.dims[0] = M;
+    H.dims[1] = N;
+}
+
+bool write_with_mdaio(const QString& path, int data_type, float* data, long M, long N)
+{
+    FILE* f = fopen(path.toLatin1().data(), "wb");
+    if (!f)
+        return false;
+    MDAIO_HEADER H;
+    make_header(H, data_type, M, N);
+    mda_write_header(&H, f);
+    long num = mda_write_float32(data, &H, M * N, f);
+    fclose(f);
+    return (num == M * N);
+}
+
+template <typename T>
+bool read_with_mdaio(const QString& path, T* data, long n, long (*read_func)(T*, MDAIO_HEADER*, long, FILE*))
+{
+    FILE* f = fopen(path.toLatin1().data(), "rb");
+    if (!f)
+        return false;
+    MDAIO_HEADER H;
+    mda_read_header(&H, f);
+    long num = read_func(data, &H, n, f);
+    fclose(f);
+    return (num == n);
+}
+
+//noise-like values within the range of int16, so that every conversion is exercised on realistic data
+Mda32 generate_timeseries(long M, long N)
+{
+    Mda32 X(M, N);
+    float* ptr = X.dataPtr();
+    quint32 state = 1;
+    for (long i = 0; i < M * N; i++) {
+        state = state * 1664525 + 1013904223;
+        ptr[i] = ((long)(state >> 16) % 2000) - 1000;
+    }
+    return X;
+}
+}
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    CLParams CLP(argc, argv);
+
+    long M = CLP.named_parameters.value("M", 32).toLongLong();
+    long N = CLP.named_parameters.value("N", 1e6).toLongLong();
+    int T = CLP.named_parameters.value("clip_size", 50).toInt();
+    long num_clips = CLP.named_parameters.value("num_clips", 10000).toLongLong();
+    int K = CLP.named_parameters.value("K", 20).toInt();
+    QString tmp_base = CLP.named_parameters.value("tmp", MLUtil::tempPath()).toString();
+    QString output_fname = CLP.named_parameters.value("output").toString();
+    long chunk_size = qMin(N, 10000L);
+
+    MicroBenchmarkRunner runner;
+    runner.setWarmupCount(CLP.named_parameters.value("warmup", 1).toInt());
+    runner.setRepetitions(CLP.named_parameters.value("repetitions", 5).toInt());
+    runner.setFilter(CLP.named_parameters.value("filter").toString());
+
+    QString path = tmp_base + "/mountainsort_benchmark_" + MLUtil::makeRandomId(6);
+    if (!QDir().mkpath(path)) {
+        qWarning() << "Unable to create directory: " + path;
+        return -1;
+    }
+    printf("Generating %ldx%ld timeseries in %s...\n", M, N, path.toLatin1().data());
+    Mda32 X = generate_timeseries(M, N);
+    QString raw_path = path + "/raw.mda";
+    X.write32(raw_path);
+    QList<int> data_types;
+    data_types << MDAIO_TYPE_INT16 << MDAIO_TYPE_FLOAT32 << MDAIO_TYPE_FLOAT64;
+    foreach (int data_type, data_types) {
+        write_with_mdaio(path + "/raw_" + data_type_name(data_type) + ".mda", data_type, X.dataPtr(), M, N);
+    }
+    DiskReadMda32 X_disk(raw_path);
+    double total_bytes = M * N * 4.0;
+
+    //the same pseudo-random clip times and labels in every run
+    QVector<double> times(num_clips);
+    QVector<int> labels(num_clips);
+    {
+        quint32 state = 2;
+        for (long i = 0; i < num_clips; i++) {
+            state = state * 1664525 + 1013904223;
+            times[i] = T + (state >> 8) % qMax(1L, N - 2 * T);
+            labels[i] = 1 + i % K;
+        }
+    }
+
+    printf("\n");
+    runner.printHeader();
+
+    //DiskReadMda32::readChunk
+    runner.run("DiskReadMda32::readChunk sequential", (N + chunk_size - 1) / chunk_size, total_bytes, [&]() {
+        Mda32 chunk;
+        for (long t = 0; t < N; t += chunk_size)
+            X_disk.readChunk(chunk, 0, t, M, qMin(chunk_size, N - t));
+    });
+    runner.run("DiskReadMda32::readChunk strided (one channel)", (N + chunk_size - 1) / chunk_size, N * 4.0, [&]() {
+        Mda32 chunk;
+        for (long t = 0; t < N; t += chunk_size)
+            X_disk.readChunk(chunk, M / 2, t, 1, qMin(chunk_size, N - t));
+    });
+    runner.run("DiskReadMda32::readChunk random clips", num_clips, num_clips * M * T * 4.0, [&]() {
+        Mda32 clip;
+        for (long i = 0; i < num_clips; i++)
+            X_disk.readChunk(clip, 0, (long)times[i] - T / 2, M, T);
+    });
+    {
+        DiskReadMda32 X_int16(path + "/raw_int16.mda");
+        runner.run("DiskReadMda32::readChunk sequential (int16 file)", (N + chunk_size - 1) / chunk_size, total_bytes, [&]() {
+            Mda32 chunk;
+            for (long t = 0; t < N; t += chunk_size)
+                X_int16.readChunk(chunk, 0, t, M, qMin(chunk_size, N - t));
+        });
+    }
+
+    //DiskWriteMda::writeChunk
+    {
+        Mda32 chunk(M, chunk_size);
+        X.getChunk(chunk, 0, 0, M, chunk_size);
+        for (int asynchronous = 0; asynchronous <= 1; asynchronous++) {
+            QString name = asynchronous ? "DiskWriteMda::writeChunk (asynchronous)" : "DiskWriteMda::writeChunk";
+            runner.run(name, N / chunk_size, (N / chunk_size) * chunk_size * M * 4.0, [&]() {
+                DiskWriteMda Y;
+                Y.setAsynchronous(asynchronous);
+                Y.open(MDAIO_TYPE_FLOAT32, path + "/out.mda", M, N);
+                for (long t = 0; t + chunk_size <= N; t += chunk_size)
+                    Y.writeChunk(chunk, 0, t);
+                Y.close();
+            });
+        }
+    }
+
+    //mda_read_* and mda_write_* conversions
+    {
+        QVector<float> buf32(M * N);
+        QVector<double> buf64(M * N);
+        foreach (int data_type, data_types) {
+            QString fname = path + "/raw_" + data_type_name(data_type) + ".mda";
+            double file_bytes = M * N * bytes_per_entry(data_type);
+            runner.run(QString("mda_read_float32 (%1 file)").arg(data_type_name(data_type)), M * N, file_bytes, [&]() {
+                read_with_mdaio<float>(fname, buf32.data(), M * N, mda_read_float32);
+            });
+            runner.run(QString("mda_read_float64 (%1 file)").arg(data_type_name(data_type)), M * N, file_bytes, [&]() {
+                read_with_mdaio<double>(fname, buf64.data(), M * N, mda_read_float64);
+            });
+            runner.run(QString("mda_write_float32 (%1 file)").arg(data_type_name(data_type)), M * N, file_bytes, [&]() {
+                write_with_mdaio(path + "/out.mda", data_type, X.dataPtr(), M, N);
+            });
+        }
+    }
+
+    //Mda32::getChunk and Mda32::setChunk
+    {
+        Mda32 Y(M, N);
+        runner.run("Mda32::getChunk", (N + chunk_size - 1) / chunk_size, total_bytes, [&]() {
+            Mda32 chunk;
+            for (long t = 0; t < N; t += chunk_size)
+                X.getChunk(chunk, 0, t, M, qMin(chunk_size, N - t));
+        });
+        Mda32 chunk;
+        X.getChunk(chunk, 0, 0, M, chunk_size);
+        runner.run("Mda32::setChunk", N / chunk_size, (N / chunk_size) * chunk_size * M * 4.0, [&]() {
+            for (long t = 0; t + chunk_size <= N; t += chunk_size)
+                Y.setChunk(chunk, 0, t);
+        });
+    }
+
+    //kernels
+    runner.run("extract_clips", num_clips, num_clips * M * T * 4.0, [&]() {
+        extract_clips(X_disk, times, T);
+    });
+    runner.run("compute_templates_0", num_clips, num_clips * M * T * 4.0, [&]() {
+        compute_templates_0(X_disk, times, labels, T);
+    });
+
+    QDir(path).removeRecursively();
+
+    if (!output_fname.isEmpty()) {
+        QJsonObject obj;
+        obj["M"] = (double)M;
+        obj["N"] = (double)N;
+        obj["clip_size"] = T;
+        obj["num_clips"] = (double)num_clips;
+        obj["K"] = K;
+        obj["results"] = runner.results();
+        if (!TextFile::write(output_fname, QJsonDocument(obj).toJson())) {
+            qWarning() << "Unable to write results to: " + output_fname;
+            return -1;
+        }
+    }
+    return 0;
+}
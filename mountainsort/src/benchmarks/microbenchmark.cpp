@@ -0,0 +1,89 @@
+/******************************************************
+** See the accompanying README and LICENSE files
+*******************************************************/
+
+#include "microbenchmark.h"
+#include <QElapsedTimer>
+#include <QJsonObject>
+#include <QVector>
+#include <algorithm>
+
+class MicroBenchmarkRunnerPrivate {
+public:
+    MicroBenchmarkRunner* q;
+
+    int m_warmup_count = 1;
+    int m_repetitions = 5;
+    QString m_filter;
+    QJsonArray m_results;
+};
+
+MicroBenchmarkRunner::MicroBenchmarkRunner()
+{
+    d = new MicroBenchmarkRunnerPrivate;
+    d->q = this;
+}
+
+MicroBenchmarkRunner::~MicroBenchmarkRunner()
+{
+    delete d;
+}
+
+void MicroBenchmarkRunner::setWarmupCount(int num)
+{
+    d->m_warmup_count = qMax(0, num);
+}
+
+void MicroBenchmarkRunner::setRepetitions(int num)
+{
+    d->m_repetitions = qMax(1, num);
+}
+
+void MicroBenchmarkRunner::setFilter(const QString& filter)
+{
+    d->m_filter = filter;
+}
+
+void MicroBenchmarkRunner::run(const QString& name, long num_ops, double num_bytes, const std::function<void()>& func)
+{
+    if ((!d->m_filter.isEmpty()) && (!name.contains(d->m_filter)))
+        return;
+    for (int i = 0; i < d->m_warmup_count; i++)
+        func();
+    QVector<double> times_sec(d->m_repetitions);
+    for (int i = 0; i < d->m_repetitions; i++) {
+        QElapsedTimer timer;
+        timer.start();
+        func();
+        times_sec[i] = timer.nsecsElapsed() * 1e-9;
+    }
+    QVector<double> sorted = times_sec;
+    std::sort(sorted.begin(), sorted.end());
+    double median_sec = sorted[sorted.count() / 2];
+    double min_sec = sorted[0];
+
+    QJsonObject obj;
+    obj["name"] = name;
+    obj["num_ops"] = (double)num_ops;
+    obj["num_bytes"] = num_bytes;
+    obj["repetitions"] = d->m_repetitions;
+    obj["median_sec"] = median_sec;
+    obj["min_sec"] = min_sec;
+    obj["ns_per_op"] = num_ops ? median_sec * 1e9 / num_ops : 0;
+    obj["mb_per_sec"] = median_sec ? num_bytes * 1e-6 / median_sec : 0;
+    obj["max_mb_per_sec"] = min_sec ? num_bytes * 1e-6 / min_sec : 0;
+    d->m_results << obj;
+
+    printf("%-50s %12.1f %12.1f %12.1f %12.4f\n", name.toLatin1().data(), obj["ns_per_op"].toDouble(),
+        obj["mb_per_sec"].toDouble(), obj["max_mb_per_sec"].toDouble(), median_sec);
+}
+
+void MicroBenchmarkRunner::printHeader() const
+{
+    printf("%-50s %12s %12s %12s %12s\n", "benchmark", "ns/op", "MB/s", "max MB/s", "median (s)");
+}
+
+QJsonArray MicroBenchmarkRunner::results() const
+{
+    return d->m_results;
+}
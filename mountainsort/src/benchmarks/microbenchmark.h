@@ -0,0 +1,42 @@
+/******************************************************
+** See the accompanying README and LICENSE files
+*******************************************************/
+
+#ifndef MICROBENCHMARK_H
+#define MICROBENCHMARK_H
+
+#include <QJsonArray>
+#include <QString>
+#include <functional>
+
+/*
+ * A small harness for timing the array I/O and kernels in isolation.
+ *
+ * Each benchmark is a function that performs a fixed number of operations on a fixed number of bytes. It is run a
+ * few times untimed (the warm-up, which also brings the files into the page cache), then timed over a number of
+ * repetitions. The median repetition gives ns/op and MB/s, with the fastest one alongside.
+ */
+
+class MicroBenchmarkRunnerPrivate;
+class MicroBenchmarkRunner {
+public:
+    friend class MicroBenchmarkRunnerPrivate;
+    MicroBenchmarkRunner();
+    virtual ~MicroBenchmarkRunner();
+
+    void setWarmupCount(int num);
+    void setRepetitions(int num);
+    //only the benchmarks whose names contain this string are run
+    void setFilter(const QString& filter);
+
+    //func performs num_ops operations on num_bytes bytes in all (num_bytes may be 0)
+    void run(const QString& name, long num_ops, double num_bytes, const std::function<void()>& func);
+
+    void printHeader() const;
+    QJsonArray results() const;
+
+private:
+    MicroBenchmarkRunnerPrivate* d;
+};
+
+#endif // MICROBENCHMARK_H
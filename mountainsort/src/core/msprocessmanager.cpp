@@ -1,6 +1,7 @@
 #include "msprocessmanager.h"
 #include "mountainsort_version.h"
 #include "msprocessor.h"
+#include "msprofile.h"
 #include <QList>
 #include <QTime>
 #include <QCoreApplication>
@@ -19,6 +20,7 @@
 #include "copy_processor.h"
 #include "mda2txt_processor.h"
 #include "mask_out_artifacts_processor.h"
+#include "compute_artifact_mask_processor.h"
 #include "fit_stage_processor.h"
 #include "compute_templates_processor.h"
 #include "mlcommon.h"
@@ -98,6 +100,7 @@ void MSProcessManager::loadDefaultProcessors()
     loadProcessor(new copy_Processor);
     loadProcessor(new mda2txt_Processor);
     loadProcessor(new mask_out_artifacts_Processor);
+    loadProcessor(new compute_artifact_mask_Processor);
     loadProcessor(new fit_stage_Processor);
     loadProcessor(new compute_templates_Processor);
     loadProcessor(new mv_compute_templates_Processor);
@@ -222,6 +225,11 @@ bool MSProcessManager::runProcess(const QString& processor_name, const QVariantM
         qWarning() << "Unable to find processor [202]" << processor_name;
         return false;
     }
+    QString profile_path = qgetenv("ML_PROFILE_OUTPUT"); //set by mountainprocess
+    if (!profile_path.isEmpty()) {
+        MSProfile::clear();
+        MSProfile::setEnabled(true);
+    }
     bool ret = processor->run(parameters);
     if (ret) {
         printf("Elapsed time for processor %s: %g sec\n", processor_name.toLatin1().data(), timer.elapsed() * 1.0 / 1000);
@@ -229,6 +237,13 @@ bool MSProcessManager::runProcess(const QString& processor_name, const QVariantM
     else {
         qWarning() << "Error in processor->run" << processor_name;
     }
+    if (!profile_path.isEmpty()) {
+        MSProfile::setEnabled(false);
+        QJsonObject profile = MSProfile::toJsonObject(processor_name, processor->version(), timer.elapsed() * 1.0 / 1000, ret);
+        if (!TextFile::write(profile_path, QJsonDocument(profile).toJson())) {
+            qWarning() << "Unable to write profile: " + profile_path;
+        }
+    }
 
     return ret;
 }
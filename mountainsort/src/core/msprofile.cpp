@@ -0,0 +1,204 @@
+/******************************************************
+** See the accompanying README and LICENSE files
+*******************************************************/
+
+#include "msprofile.h"
+#include "omp.h"
+#include "taskprogress.h"
+#include <QAtomicInt>
+#include <QHash>
+#include <QList>
+#include <QMap>
+#include <QMutex>
+#include <QSet>
+#include <algorithm>
+
+namespace {
+
+struct ProfileEntry {
+    qint64 nsec = 0;
+    qint64 count = 0;
+    qint64 max_nsec = 0;
+    qint64 num_bytes = 0;
+};
+
+struct ProfileThreadTable {
+    QMutex mutex; //only contended while the tables are being merged
+    QHash<const char*, ProfileEntry> entries;
+};
+
+QAtomicInt s_enabled(0);
+QMutex s_tables_mutex;
+//the tables outlive their threads, so that nothing is lost when a thread exits before the profile is read
+QList<ProfileThreadTable*> s_tables;
+thread_local ProfileThreadTable* t_table = 0;
+
+ProfileThreadTable* thread_table()
+{
+    if (!t_table) {
+        t_table = new ProfileThreadTable;
+        QMutexLocker locker(&s_tables_mutex);
+        s_tables << t_table;
+    }
+    return t_table;
+}
+
+void add_to_profile(const char* section, qint64 nsec, qint64 count, qint64 num_bytes)
+{
+    ProfileThreadTable* table = thread_table();
+    QMutexLocker locker(&table->mutex);
+    ProfileEntry& E = table->entries[section];
+    E.nsec += nsec;
+    E.count += count;
+    E.max_nsec = qMax(E.max_nsec, nsec);
+    E.num_bytes += num_bytes;
+}
+}
+
+void MSProfile::setEnabled(bool val)
+{
+    s_enabled.store(val ? 1 : 0);
+}
+
+bool MSProfile::isEnabled()
+{
+    return (s_enabled.load() != 0);
+}
+
+void MSProfile::clear()
+{
+    QMutexLocker locker(&s_tables_mutex);
+    foreach (ProfileThreadTable* table, s_tables) {
+        QMutexLocker locker2(&table->mutex);
+        table->entries.clear();
+    }
+}
+
+void MSProfile::addTime(const char* section, qint64 nsec, qint64 num_bytes)
+{
+    if (!isEnabled())
+        return;
+    add_to_profile(section, nsec, 1, num_bytes);
+}
+
+void MSProfile::addBytes(const char* section, qint64 num_bytes)
+{
+    if (!isEnabled())
+        return;
+    add_to_profile(section, 0, 0, num_bytes);
+}
+
+QJsonArray MSProfile::sections()
+{
+    //merge by name rather than by pointer, in case the same literal appears at more than one address
+    QMap<QString, ProfileEntry> merged;
+    QMap<QString, int> num_threads;
+    {
+        QMutexLocker locker(&s_tables_mutex);
+        foreach (ProfileThreadTable* table, s_tables) {
+            QMutexLocker locker2(&table->mutex);
+            QSet<QString> names_in_table;
+            QHash<const char*, ProfileEntry>::const_iterator it;
+            for (it = table->entries.constBegin(); it != table->entries.constEnd(); ++it) {
+                QString name = QString::fromLatin1(it.key());
+                ProfileEntry& E = merged[name];
+                E.nsec += it.value().nsec;
+                E.count += it.value().count;
+                E.max_nsec = qMax(E.max_nsec, it.value().max_nsec);
+                E.num_bytes += it.value().num_bytes;
+                names_in_table.insert(name);
+            }
+            foreach (QString name, names_in_table)
+                num_threads[name]++;
+        }
+    }
+
+    QList<QString> names = merged.keys();
+    std::stable_sort(names.begin(), names.end(), [&merged](const QString& a, const QString& b) {
+        return merged[a].nsec > merged[b].nsec;
+    });
+    QJsonArray ret;
+    foreach (QString name, names) {
+        const ProfileEntry& E = merged[name];
+        QJsonObject obj;
+        obj["name"] = name;
+        obj["time_sec"] = E.nsec * 1e-9; //summed over threads
+        obj["count"] = (double)E.count;
+        obj["max_sec"] = E.max_nsec * 1e-9;
+        obj["num_threads"] = num_threads[name];
+        if (E.num_bytes) {
+            obj["bytes"] = (double)E.num_bytes;
+            if (E.nsec)
+                obj["mb_per_sec"] = E.num_bytes * 1e-6 / (E.nsec * 1e-9);
+        }
+        ret << obj;
+    }
+    return ret;
+}
+
+QJsonArray MSProfile::latencies()
+{
+    TaskManager::TaskProgressMonitor* monitor = TaskManager::TaskProgressMonitor::globalInstance();
+    QStringList names = monitor->latencyNames();
+    names.sort();
+    QJsonArray ret;
+    foreach (QString name, names) {
+        TaskManager::TaskProgressLatencyHistogram H = monitor->getLatencyHistogram(name);
+        if (!H.count)
+            continue;
+        QJsonObject obj;
+        obj["name"] = name;
+        obj["count"] = (double)H.count;
+        obj["total_msec"] = H.total_msec;
+        obj["max_msec"] = H.max_msec;
+        obj["mean_msec"] = H.meanMsec();
+        obj["p50_msec"] = H.percentileMsec(0.5);
+        obj["p99_msec"] = H.percentileMsec(0.99);
+        QJsonArray bucket_counts; //so that the histograms of several processes can be merged
+        for (int b = 0; b < H.bucket_counts.count(); b++)
+            bucket_counts << (double)H.bucket_counts[b];
+        obj["bucket_counts"] = bucket_counts;
+        ret << obj;
+    }
+    return ret;
+}
+
+QJsonObject MSProfile::toJsonObject(const QString& processor_name, const QString& processor_version, double wall_time_sec, bool success)
+{
+    QJsonObject obj;
+    obj["processor_name"] = processor_name;
+    obj["processor_version"] = processor_version;
+    obj["success"] = success;
+    obj["wall_time_sec"] = wall_time_sec;
+    obj["num_threads"] = omp_get_max_threads();
+    obj["sections"] = sections();
+    obj["latencies"] = latencies();
+    return obj;
+}
+
+MSProfileTimer::MSProfileTimer(const char* section)
+    : m_section(section)
+{
+    if (!MSProfile::isEnabled())
+        return;
+    m_running = true;
+    m_timer.start();
+}
+
+MSProfileTimer::~MSProfileTimer()
+{
+    stop();
+}
+
+void MSProfileTimer::addBytes(qint64 num_bytes)
+{
+    m_num_bytes += num_bytes;
+}
+
+void MSProfileTimer::stop()
+{
+    if (!m_running)
+        return;
+    m_running = false;
+    MSProfile::addTime(m_section, m_timer.nsecsElapsed(), m_num_bytes);
+}
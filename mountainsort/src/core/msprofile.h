@@ -0,0 +1,60 @@
+/******************************************************
+** See the accompanying README and LICENSE files
+*******************************************************/
+
+#ifndef MSPROFILE_H
+#define MSPROFILE_H
+
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QJsonObject>
+
+/*
+ * Instrumentation for the processors: named sections, each with its total time, number of calls, longest call and
+ * bytes handled.
+ *
+ * Every thread adds to a table of its own, and the tables are merged only when the profile is read, so timers in
+ * parallel loops do not contend with one another. While profiling is disabled (the default) a timer does nothing but
+ * check a flag.
+ *
+ * Section names are keyed by pointer and must be string literals.
+ *
+ * The profile also includes the latency histograms that the library records in the sharded counters of the
+ * TaskProgressMonitor (DiskReadMda32::readChunk, DiskWriteMda::writeChunk, ...), which are always on.
+ *
+ * MSProcessManager enables profiling when the environment variable ML_PROFILE_OUTPUT is set, and writes the profile
+ * there (see toJsonObject) once the processor has run. mountainprocess sets it for every process it starts.
+ */
+
+class MSProfile {
+public:
+    static void setEnabled(bool val);
+    static bool isEnabled();
+    static void clear();
+
+    static void addTime(const char* section, qint64 nsec, qint64 num_bytes = 0);
+    static void addBytes(const char* section, qint64 num_bytes);
+
+    //the sections merged over all threads, by decreasing total time
+    static QJsonArray sections();
+    //the latency histograms of the TaskProgressMonitor, by name
+    static QJsonArray latencies();
+    static QJsonObject toJsonObject(const QString& processor_name, const QString& processor_version, double wall_time_sec, bool success);
+};
+
+class MSProfileTimer {
+public:
+    MSProfileTimer(const char* section);
+    ~MSProfileTimer();
+    void addBytes(qint64 num_bytes);
+    //records the section now rather than at the end of the scope
+    void stop();
+
+private:
+    const char* m_section;
+    QElapsedTimer m_timer;
+    qint64 m_num_bytes = 0;
+    bool m_running = false;
+};
+
+#endif // MSPROFILE_H
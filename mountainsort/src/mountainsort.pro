@@ -7,6 +7,7 @@ CONFIG += c++11
 
 include(../../mlcommon/mlcommon.pri)
 include(../../mlcommon/mda.pri)
+include(../../mlcommon/taskprogress.pri)
 
 DESTDIR = ../bin
 OBJECTS_DIR = ../build
@@ -24,6 +25,7 @@ HEADERS += \
     core/msprocessmanager.h \
     core/mountainsort_version.h \
     core/msprocessor.h \
+    core/msprofile.h \
     processors/example_processor.h \
     processors/bandpass_filter_processor.h \
     processors/bandpass_filter0.h \
@@ -49,6 +51,7 @@ HEADERS += \
     processors/mda2txt_processor.h \
     processors/mask_out_artifacts_processor.h \
     processors/mask_out_artifacts.h \
+    processors/compute_artifact_mask_processor.h \
     processors/fit_stage_processor.h \
     processors/remove_noise_clusters_processor.h \
     processors/fit_stage.h \
@@ -115,6 +118,7 @@ SOURCES += \
     core/msprocessmanager.cpp \
     core/mountainsort_version.cpp \
     core/msprocessor.cpp \
+    core/msprofile.cpp \
     processors/example_processor.cpp \
     processors/bandpass_filter_processor.cpp \
     processors/bandpass_filter0.cpp \
@@ -136,6 +140,7 @@ SOURCES += \
     processors/mda2txt_processor.cpp \
     processors/mask_out_artifacts_processor.cpp \
     processors/mask_out_artifacts.cpp \
+    processors/compute_artifact_mask_processor.cpp \
     processors/fit_stage_processor.cpp \
     processors/remove_noise_clusters_processor.cpp \
     processors/fit_stage.cpp \
@@ -221,13 +226,17 @@ HEADERS += utils/get_sort_indices.h \
     utils/msmisc.h \
     utils/get_pca_features.h \
     utils/compute_templates_0.h \
-    utils/eigenvalue_decomposition.h
+    utils/eigenvalue_decomposition.h \
+    utils/cluster_metrics_engine.h \
+    utils/clip_store.h
 
 SOURCES += utils/get_sort_indices.cpp \
     utils/matrix_mda.cpp \
     utils/get_pca_features.cpp \
     utils/compute_templates_0.cpp \
-    utils/msmisc.cpp
+    utils/msmisc.cpp \
+    utils/cluster_metrics_engine.cpp \
+    utils/clip_store.cpp
 
 HEADERS += utils/svm.h
 SOURCES += utils/svm.cpp
@@ -273,10 +282,21 @@ test {
     SOURCES += unit_tests/testMda.cpp	\
 	unit_tests/testMain.cpp	\
         unit_tests/testMdaIO.cpp \
-        unit_tests/testBandpassFilter.cpp
+        unit_tests/testBandpassFilter.cpp \
+        unit_tests/testSynthesize1.cpp \
+        unit_tests/testTaskProgress.cpp
     HEADERS += unit_tests/testMda.h \
         unit_tests/testMdaIO.h  \
-        unit_tests/testBandpassFilter.h
+        unit_tests/testBandpassFilter.h \
+        unit_tests/testSynthesize1.h \
+        unit_tests/testTaskProgress.h
+} else:benchmark {
+    #qmake CONFIG+=benchmark
+    TARGET = mountainsort_benchmark
+    INCLUDEPATH += benchmarks
+    SOURCES += benchmarks/benchmarkMain.cpp \
+        benchmarks/microbenchmark.cpp
+    HEADERS += benchmarks/microbenchmark.h
 } else {
     SOURCES += mountainsortmain.cpp
 }
@@ -9,5 +9,6 @@
 //#define PROCESSING_CHUNK_SIZE 2 //for debugging with small arrays
 #define PROCESSING_CHUNK_SIZE 1e6
 #define PROCESSING_CHUNK_OVERLAP_SIZE 1e4
+#define MERGE_STAGE_CLIP_MEMORY_SIZE 2e9 //bytes of clips that merge_stage keeps in memory, rather than extracting them again
 
 #endif // MSPREFS_H
@@ -2,12 +2,14 @@
 #include "diskreadmda.h"
 
 #include <diskwritemda.h>
+#include "mdaarena.h"
 #include "omp.h"
 #include "fftw3.h"
+#include <QDebug>
 #include <QTime>
 #include <math.h>
 #include "msprefs.h"
-#include <QTime>
+#include "msprofile.h"
 
 #ifdef USE_SSE2
 #include <diskreadmda32.h>
@@ -25,13 +27,18 @@ bool bandpass_filter0(const QString& input_path, const QString& output_path, dou
 {
     QTime timer_total;
     timer_total.start();
-    QMap<QString, long> elapsed_times;
 
     DiskReadMda32 X(input_path);
     const long M = X.N1();
     const long N = X.N2();
 
-    DiskWriteMda Y(MDAIO_TYPE_FLOAT32, output_path, M, N);
+    //write-behind, so that the threads do not wait on the disk
+    DiskWriteMda Y;
+    Y.setAsynchronous(true);
+    if (!Y.open(MDAIO_TYPE_FLOAT32, output_path, M, N)) {
+        qWarning() << "Unable to open output file: " + output_path;
+        return false;
+    }
 
     int num_threads = omp_get_max_threads();
     long memory_size = 0.1 * 1e9;
@@ -45,60 +52,56 @@ bool bandpass_filter0(const QString& input_path, const QString& output_path, dou
         timer_status.start();
         long num_timepoints_handled = 0;
         long bytes_allocated = 0;
-#pragma omp parallel for
-        for (long timepoint = 0; timepoint < N; timepoint += chunk_size) {
-            QMap<QString, long> elapsed_times_local;
-            Mda32 chunk;
+#pragma omp parallel
+        {
+            MdaArenaScope arena_scope; //the chunks and the FFT buffers are recycled from one iteration to the next
+#pragma omp for
+            for (long timepoint = 0; timepoint < N; timepoint += chunk_size) {
+                Mda32 chunk;
 #pragma omp critical(lock1)
-            {
-                QTime timer;
-                timer.start();
-                X.readChunk(chunk, 0, timepoint - overlap_size, M, chunk_size + 2 * overlap_size);
-                bytes_allocated += chunk.totalSize() * 4; //for debugging, if needed
-                elapsed_times["readChunk"] += timer.elapsed();
-            }
-            {
-                QTime timer;
-                timer.start();
-                chunk = do_bandpass_filter0(chunk, samplerate, freq_min, freq_max, freq_wid);
-                elapsed_times_local["do_bandpass_filter0"] += timer.elapsed();
-            }
-            Mda32 chunk2;
-            {
-                QTime timer;
-                timer.start();
-                chunk.getChunk(chunk2, 0, overlap_size, M, chunk_size);
-                elapsed_times_local["getChunk"] += timer.elapsed();
-            }
-#pragma omp critical(lock1)
-            {
-                elapsed_times["do_bandpass_filter0"] += elapsed_times_local["do_bandpass_filter0"];
-                elapsed_times["getChunk"] += elapsed_times_local["getChunk"];
-
                 {
-                    QTime timer;
-                    timer.start();
+                    MSProfileTimer timer("readChunk");
+                    X.readChunk(chunk, 0, timepoint - overlap_size, M, chunk_size + 2 * overlap_size);
+                    timer.addBytes(chunk.totalSize() * 4);
+                    bytes_allocated += chunk.totalSize() * 4; //for debugging, if needed
+                }
+                {
+                    MSProfileTimer timer("do_bandpass_filter0");
+                    chunk = do_bandpass_filter0(chunk, samplerate, freq_min, freq_max, freq_wid);
+                }
+                Mda32 chunk2;
+                {
+                    MSProfileTimer timer("getChunk");
+                    chunk.getChunk(chunk2, 0, overlap_size, M, chunk_size);
+                }
+                {
+                    //thread safe in asynchronous mode (this only waits if the queue is full)
+                    MSProfileTimer timer("writeChunk");
                     Y.writeChunk(chunk2, 0, timepoint);
-                    elapsed_times["writeChunk"] += timer.elapsed();
+                    timer.addBytes(chunk2.totalSize() * 4);
                 }
-                num_timepoints_handled += qMin(chunk_size, N - timepoint);
-                if ((timer_status.elapsed() > 1000) || (num_timepoints_handled == N) || (timepoint == 0)) {
-                    printf("%ld/%ld (%d%%) - Elapsed(s): RC:%g, BPF:%g, GC:%g, WC:%g, Total:%g, %d threads\n",
-                        num_timepoints_handled, N,
-                        (int)(num_timepoints_handled * 1.0 / N * 100),
-                        elapsed_times["readChunk"] * 1.0 / 1000,
-                        elapsed_times["do_bandpass_filter0"] * 1.0 / 1000,
-                        elapsed_times["getChunk"] * 1.0 / 1000,
-                        elapsed_times["writeChunk"] * 1.0 / 1000,
-                        timer_total.elapsed() * 1.0 / 1000,
-                        omp_get_num_threads());
-                    timer_status.restart();
+#pragma omp critical(lock1)
+                {
+                    num_timepoints_handled += qMin(chunk_size, N - timepoint);
+                    if ((timer_status.elapsed() > 1000) || (num_timepoints_handled == N) || (timepoint == 0)) {
+                        printf("%ld/%ld (%d%%) - Elapsed(s): %g, %d threads\n",
+                            num_timepoints_handled, N,
+                            (int)(num_timepoints_handled * 1.0 / N * 100),
+                            timer_total.elapsed() * 1.0 / 1000,
+                            omp_get_num_threads());
+                        timer_status.restart();
+                    }
+                    bytes_allocated -= chunk.totalSize() * 4;
                 }
-                bytes_allocated -= chunk.totalSize() * 4;
             }
         }
     }
 
+    if (!Y.close()) {
+        qWarning() << "Problem writing output file: " + output_path;
+        return false;
+    }
+
     return true;
 }
 
@@ -128,8 +131,8 @@ Mda32 do_bandpass_filter0(Mda32& X, double samplerate, double freq_min, double f
     float* Xptr = X.dataPtr();
     float* Yptr = Y.dataPtr();
 
-    double* kernel0 = (double*)allocate(sizeof(double) * N);
-    float* Xhat = (float*)allocate(sizeof(float) * MN * 2);
+    double* kernel0 = (double*)mda_arena_allocate(sizeof(double) * N);
+    float* Xhat = (float*)mda_arena_allocate(sizeof(float) * MN * 2);
     define_kernel(N, kernel0, samplerate, freq_min, freq_max, freq_wid);
 
     do_fft_1d_r2c(M, N, Xhat, Xptr);
@@ -138,8 +141,8 @@ Mda32 do_bandpass_filter0(Mda32& X, double samplerate, double freq_min, double f
 
     multiply_by_factor(MN, Yptr, 1.0 / N);
 
-    free(kernel0);
-    free(Xhat);
+    mda_arena_free(kernel0);
+    mda_arena_free(Xhat);
 
     return Y;
 }
@@ -155,8 +158,8 @@ bool do_fft_1d_r2c(int M, int N, float* out, float* in)
 
     int MN = M * N;
 
-    fftw_complex* in2 = (fftw_complex*)fftw_malloc(sizeof(fftw_complex) * MN);
-    fftw_complex* out2 = (fftw_complex*)fftw_malloc(sizeof(fftw_complex) * MN);
+    fftw_complex* in2 = (fftw_complex*)mda_arena_allocate(sizeof(fftw_complex) * MN); //aligned, as fftw_malloc
+    fftw_complex* out2 = (fftw_complex*)mda_arena_allocate(sizeof(fftw_complex) * MN); //aligned, as fftw_malloc
     for (int ii = 0; ii < MN; ii++) {
         //in2[ii][0]=in[ii*2];
         //in2[ii][1]=in[ii*2+1];
@@ -218,8 +221,8 @@ bool do_fft_1d_r2c(int M, int N, float* out, float* in)
         out[ii * 2] = out2[ii][0];
         out[ii * 2 + 1] = out2[ii][1];
     }
-    fftw_free(in2);
-    fftw_free(out2);
+    mda_arena_free(in2);
+    mda_arena_free(out2);
 
 /*
 	if (num_threads>1) {
@@ -244,8 +247,8 @@ bool do_ifft_1d_c2r(int M, int N, float* out, float* in)
 
     int MN = M * N;
 
-    fftw_complex* in2 = (fftw_complex*)fftw_malloc(sizeof(fftw_complex) * MN);
-    fftw_complex* out2 = (fftw_complex*)fftw_malloc(sizeof(fftw_complex) * MN);
+    fftw_complex* in2 = (fftw_complex*)mda_arena_allocate(sizeof(fftw_complex) * MN); //aligned, as fftw_malloc
+    fftw_complex* out2 = (fftw_complex*)mda_arena_allocate(sizeof(fftw_complex) * MN); //aligned, as fftw_malloc
     for (int ii = 0; ii < MN; ii++) {
         in2[ii][0] = in[ii * 2];
         in2[ii][1] = in[ii * 2 + 1];
@@ -271,8 +274,8 @@ bool do_ifft_1d_c2r(int M, int N, float* out, float* in)
     for (int ii = 0; ii < MN; ii++) {
         out[ii] = out2[ii][0];
     }
-    fftw_free(in2);
-    fftw_free(out2);
+    mda_arena_free(in2);
+    mda_arena_free(out2);
 
 /*
 	if (num_threads>1) {
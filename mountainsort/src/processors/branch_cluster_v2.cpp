@@ -376,8 +376,8 @@ QVector<double> compute_dists_from_template(Mda& clips, Mda& template0)
     long M = clips.N1();
     long T = clips.N2();
     long L = clips.N3();
-    double* ptr1 = clips.dataPtr();
-    double* ptr2 = template0.dataPtr();
+    const double* ptr1 = clips.constDataPtr();
+    const double* ptr2 = template0.constDataPtr();
     QVector<double> ret;
     long aaa = 0;
     for (long i = 0; i < L; i++) {
@@ -14,11 +14,15 @@
 #include "msmisc.h"
 #include "compute_templates_0.h"
 #include "jsvm.h"
+#include "cluster_metrics_engine.h"
+#include "clip_store.h"
 
 namespace ClusterScores {
-QVector<double> compute_cluster_scores(const DiskReadMda32& timeseries, const Mda32& clips, cluster_scores_opts opts);
-double compute_distance(long N, float* ptr1, float* ptr2);
-bool is_zero(const Mda& X);
+QVector<double> compute_cluster_scores(const DiskReadMda32& timeseries, const Mda32& clips, cluster_scores_opts opts, const QList<long>& noise_inds);
+QVector<double> compute_cluster_pair_scores(DiskReadMda32 timeseries, const Mda32& clips1, const Mda32& clips2, cluster_scores_opts opts, const QList<long>& noise_inds1, const QList<long>& noise_inds2, QVector<double>* out_proj_data1, QVector<double>* out_proj_data2);
+QList<long> random_noise_inds(long L, int T, long N);
+double compute_distance(long N, const float* ptr1, const float* ptr2);
+bool is_zero(const Mda32View& X);
 
 bool cluster_scores(QString timeseries, QString firings, QString cluster_scores_path, QString cluster_pair_scores_path, cluster_scores_opts opts)
 {
@@ -38,55 +42,69 @@ bool cluster_scores(QString timeseries, QString firings, QString cluster_scores_
         }
     }
 
-    Mda cluster_scores(3, opts.cluster_numbers.count());
+    //indexes the events by label, and keeps the clips of each cluster for the pairs it is part of
+    ClusterMetricsEngine engine(X, times, labels, opts.clip_size);
+    ClipStore clip_store; //the clips come from here when the store can be opened or made
+    if (clip_store.open(timeseries, firings, opts.clip_size))
+        engine.setClipStore(&clip_store);
+    int T = opts.clip_size;
+
+    QList<int> k1s, k2s;
+    if (!opts.cluster_scores_only) {
+        find_pairs_to_compare(k1s, k2s, X, F, opts);
+    }
+
+    //the random noise clips are chosen here, in the same order as when everything was serial (the clusters, then the pairs),
+    //so that the scores do not depend on the threads
+    QVector<QList<long> > noise_inds(opts.cluster_numbers.count());
     for (int i = 0; i < opts.cluster_numbers.count(); i++) {
-        int k = opts.cluster_numbers[i];
-        printf("k=%d\n", k);
-        QVector<double> times_k;
-        for (long j = 0; j < labels.count(); j++) {
-            if (labels[j] == k)
-                times_k << times[j];
+        long L = engine.eventCount(opts.cluster_numbers[i]);
+        if (L)
+            noise_inds[i] = random_noise_inds(L, T, X.N2());
+    }
+    QVector<QList<long> > pair_noise_inds1(k1s.count()), pair_noise_inds2(k1s.count());
+    for (int ii = 0; ii < k1s.count(); ii++) {
+        long L1 = engine.eventCount(k1s[ii]);
+        long L2 = engine.eventCount(k2s[ii]);
+        if ((L1) && (L2)) {
+            pair_noise_inds1[ii] = random_noise_inds(L1, T, X.N2());
+            pair_noise_inds2[ii] = random_noise_inds(L2, T, X.N2());
         }
-        Mda32 clips_k = extract_clips(X, times_k, opts.clip_size);
+    }
 
-        QVector<double> scores_k = compute_cluster_scores(X, clips_k, opts);
-        cluster_scores.setValue(k, 0, i);
-        for (int a = 0; a < scores_k.count(); a++) {
-            cluster_scores.setValue(scores_k[a], a + 1, i);
-        }
+    Mda cluster_scores(3, opts.cluster_numbers.count());
+    {
+        double* cluster_scores_ptr = cluster_scores.dataPtr();
+        engine.run(opts.cluster_numbers.count(), [&](long i, const DiskReadMda32& X_local) {
+            int k = opts.cluster_numbers.at(i);
+            Mda32 clips_k = engine.clips(k, X_local);
+
+            QVector<double> scores_k = compute_cluster_scores(X_local, clips_k, opts, noise_inds.at(i));
+            cluster_scores_ptr[3 * i] = k;
+            for (int a = 0; a < scores_k.count(); a++) {
+                cluster_scores_ptr[3 * i + a + 1] = scores_k[a];
+            }
+        });
     }
 
     Mda cluster_pair_scores;
     if (!opts.cluster_scores_only) {
-        QList<int> k1s, k2s;
-        find_pairs_to_compare(k1s, k2s, X, F, opts);
         cluster_pair_scores.allocate(3, k1s.count());
-        for (int ii = 0; ii < k1s.count(); ii++) {
-            int k1 = k1s[ii];
-            int k2 = k2s[ii];
-            printf("k1/k2 = %d/%d\n", k1, k2);
-
-            QVector<double> times_k1;
-            for (long j = 0; j < labels.count(); j++) {
-                if (labels[j] == k1)
-                    times_k1 << times[j];
-            }
-            Mda32 clips_k1 = extract_clips(X, times_k1, opts.clip_size);
+        double* cluster_pair_scores_ptr = cluster_pair_scores.dataPtr();
+        engine.run(k1s.count(), [&](long ii, const DiskReadMda32& X_local) {
+            int k1 = k1s.at(ii);
+            int k2 = k2s.at(ii);
 
-            QVector<double> times_k2;
-            for (long j = 0; j < labels.count(); j++) {
-                if (labels[j] == k2)
-                    times_k2 << times[j];
-            }
-            Mda32 clips_k2 = extract_clips(X, times_k2, opts.clip_size);
+            Mda32 clips_k1 = engine.clips(k1, X_local);
+            Mda32 clips_k2 = engine.clips(k2, X_local);
 
-            QVector<double> scores_k1_k2 = compute_cluster_pair_scores(X, clips_k1, clips_k2, opts);
-            cluster_pair_scores.setValue(k1, 0, ii);
-            cluster_pair_scores.setValue(k2, 1, ii);
+            QVector<double> scores_k1_k2 = compute_cluster_pair_scores(X_local, clips_k1, clips_k2, opts, pair_noise_inds1.at(ii), pair_noise_inds2.at(ii), 0, 0);
+            cluster_pair_scores_ptr[3 * ii] = k1;
+            cluster_pair_scores_ptr[3 * ii + 1] = k2;
             for (int a = 0; a < scores_k1_k2.count(); a++) {
-                cluster_pair_scores.setValue(scores_k1_k2[a], a + 2, ii);
+                cluster_pair_scores_ptr[3 * ii + a + 2] = scores_k1_k2[a];
             }
-        }
+        });
     }
 
     if (!cluster_scores.write64(cluster_scores_path))
@@ -98,17 +116,23 @@ bool cluster_scores(QString timeseries, QString firings, QString cluster_scores_
     return true;
 }
 
-Mda32 add_self_noise_to_clips(const DiskReadMda32& timeseries, const Mda32& clips, double noise_factor)
+//the starting timepoints of L random noise clips, sorted so that we don't random access the timeseries too much
+QList<long> random_noise_inds(long L, int T, long N)
+{
+    QList<long> rand_inds;
+    for (long i = 0; i < L; i++) {
+        rand_inds << T + (qrand() % N - T * 2);
+    }
+    qSort(rand_inds);
+    return rand_inds;
+}
+
+Mda32 add_self_noise_to_clips(const DiskReadMda32& timeseries, const Mda32& clips, double noise_factor, const QList<long>& rand_inds)
 {
     Mda32 ret = clips;
     int M = clips.N1();
     int T = clips.N2();
-    QList<long> rand_inds;
-    for (long i = 0; i < clips.N3(); i++) {
-        rand_inds << T + (qrand() % timeseries.N2() - T * 2);
-    }
-    qSort(rand_inds); //good to do this so we don't random access the timeseries too much
-    //could this add a bad bias?? don't really know.
+    //could sorting the random indices add a bad bias?? don't really know.
     //one way around this is to randomize the order these are applied to the clips
     for (long i = 0; i < clips.N3(); i++) {
         long ind0 = rand_inds[i];
@@ -135,7 +159,7 @@ Mda32 add_noise_to(const Mda32& X, double noise_level)
     return ret;
 }
 
-QVector<double> compute_cluster_scores(const DiskReadMda32& timeseries, const Mda32& clips, cluster_scores_opts opts)
+QVector<double> compute_cluster_scores(const DiskReadMda32& timeseries, const Mda32& clips, cluster_scores_opts opts, const QList<long>& noise_inds)
 {
     if (clips.N3() == 0)
         return QVector<double>();
@@ -156,7 +180,7 @@ QVector<double> compute_cluster_scores(const DiskReadMda32& timeseries, const Md
         }
     }
     //Mda32 clips_noise = add_noise_to(clips, opts.add_noise_level);
-    Mda32 clips_noise = add_self_noise_to_clips(timeseries, clips, opts.add_noise_level);
+    Mda32 clips_noise = add_self_noise_to_clips(timeseries, clips, opts.add_noise_level, noise_inds);
     long num_err = 0;
     for (long i = 0; i < clips_noise.N3(); i++) {
         double val = sign * clips_noise.value(ind_m_of_peak, ind_t_of_peak, i);
@@ -165,11 +189,10 @@ QVector<double> compute_cluster_scores(const DiskReadMda32& timeseries, const Md
     }
     QVector<double> ret;
     ret << num_err * 1.0 / clips.N3();
-    printf("%ld/%ld (%g%%)\n", num_err, clips.N3(), num_err * 1.0 / clips.N3() * 100);
     return ret;
 }
 
-double compute_distance(long N, float* ptr1, float* ptr2)
+double compute_distance(long N, const float* ptr1, const float* ptr2)
 {
     double sumsqr = 0;
     for (long i = 0; i < N; i++) {
@@ -179,9 +202,13 @@ double compute_distance(long N, float* ptr1, float* ptr2)
     return sqrt(sumsqr);
 }
 
-bool is_zero(const Mda32& X)
+bool is_zero(const Mda32View& X)
 {
-    return ((X.minimum() == 0) && (X.maximum() == 0));
+    for (long i = 0; i < X.totalSize(); i++) {
+        if (X.constDataPtr()[i] != 0)
+            return false;
+    }
+    return true;
 }
 
 void find_pairs_to_compare(QList<int>& k1s, QList<int>& k2s, const DiskReadMda32& timeseries, const DiskReadMda& firings, cluster_scores_opts opts)
@@ -200,20 +227,24 @@ void find_pairs_to_compare(QList<int>& k1s, QList<int>& k2s, const DiskReadMda32
     int T = templates.N2();
     int K = templates.N3();
 
+    Mda32View templates_view = templates.view();
+    QVector<int> template_is_zero(K + 1, 0);
+    for (int k = 1; k <= K; k++) {
+        template_is_zero[k] = is_zero(templates_view.slice(k - 1));
+    }
+
     for (int k1 = 1; k1 <= K; k1++) {
         if ((opts.cluster_numbers.isEmpty()) || (opts.cluster_numbers.contains(k1))) {
             QVector<double> dists;
 
-            Mda32 template1;
-            templates.getChunk(template1, 0, 0, k1 - 1, M, T, 1);
+            Mda32View template1 = templates_view.slice(k1 - 1);
 
             QList<int> k2s_considered;
             for (int k2 = k1 + 1; k2 <= K; k2++) {
                 if ((opts.cluster_numbers.isEmpty()) || (opts.cluster_numbers.contains(k2))) {
-                    Mda32 template2;
-                    templates.getChunk(template1, 0, 0, k2 - 1, M, T, 1);
-                    double dist = compute_distance(M * T, template1.dataPtr(), template2.dataPtr());
-                    if ((is_zero(template1)) || (is_zero(template2))) {
+                    Mda32View template2 = templates_view.slice(k2 - 1);
+                    double dist = compute_distance(M * T, template1.constDataPtr(), template2.constDataPtr());
+                    if ((template_is_zero[k1]) || (template_is_zero[k2])) {
                         dists << 0;
                     }
                     else {
@@ -222,6 +253,8 @@ void find_pairs_to_compare(QList<int>& k1s, QList<int>& k2s, const DiskReadMda32
                     k2s_considered << k2;
                 }
             }
+            if (dists.isEmpty())
+                continue;
 
             QVector<double> dists_sorted = dists;
             qSort(dists_sorted);
@@ -239,6 +272,19 @@ void find_pairs_to_compare(QList<int>& k1s, QList<int>& k2s, const DiskReadMda32
     }
 }
 QVector<double> compute_cluster_pair_scores(DiskReadMda32 timeseries, const Mda32& clips1, const Mda32& clips2, cluster_scores_opts opts, QVector<double>* out_proj_data1, QVector<double>* out_proj_data2)
+{
+    long L1 = clips1.N3();
+    long L2 = clips2.N3();
+    if (!L1)
+        return QVector<double>();
+    if (!L2)
+        return QVector<double>();
+    QList<long> noise_inds1 = random_noise_inds(L1, clips1.N2(), timeseries.N2());
+    QList<long> noise_inds2 = random_noise_inds(L2, clips2.N2(), timeseries.N2());
+    return compute_cluster_pair_scores(timeseries, clips1, clips2, opts, noise_inds1, noise_inds2, out_proj_data1, out_proj_data2);
+}
+
+QVector<double> compute_cluster_pair_scores(DiskReadMda32 timeseries, const Mda32& clips1, const Mda32& clips2, cluster_scores_opts opts, const QList<long>& noise_inds1, const QList<long>& noise_inds2, QVector<double>* out_proj_data1, QVector<double>* out_proj_data2)
 {
     long L1 = clips1.N3();
     long L2 = clips2.N3();
@@ -250,8 +296,8 @@ QVector<double> compute_cluster_pair_scores(DiskReadMda32 timeseries, const Mda3
     int T = clips1.N2();
 
     qDebug() << "^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^" << opts.add_noise_level;
-    Mda32 clips1_noise = add_self_noise_to_clips(timeseries, clips1, opts.add_noise_level);
-    Mda32 clips2_noise = add_self_noise_to_clips(timeseries, clips2, opts.add_noise_level);
+    Mda32 clips1_noise = add_self_noise_to_clips(timeseries, clips1, opts.add_noise_level, noise_inds1);
+    Mda32 clips2_noise = add_self_noise_to_clips(timeseries, clips2, opts.add_noise_level, noise_inds2);
 
     Mda32 X(M * T, L1 + L2);
     QVector<int> labels;
@@ -324,7 +370,6 @@ QVector<double> compute_cluster_pair_scores(DiskReadMda32 timeseries, const Mda3
         }
     }
 
-    printf("%ld/%ld (%g%%)    cutoff=%g\n", num_err, L1 + L2, num_err * 1.0 / (L1 + L2) * 100, cutoff_00);
     QVector<double> ret;
     ret << num_err * 1.0 / (L1 + L2);
     return ret;
@@ -0,0 +1,45 @@
+/******************************************************
+** See the accompanying README and LICENSE files
+*******************************************************/
+
+#include "compute_artifact_mask_processor.h"
+#include "mask_out_artifacts.h"
+
+class compute_artifact_mask_ProcessorPrivate {
+public:
+    compute_artifact_mask_Processor* q;
+};
+
+compute_artifact_mask_Processor::compute_artifact_mask_Processor()
+{
+    d = new compute_artifact_mask_ProcessorPrivate;
+    d->q = this;
+
+    this->setName("compute_artifact_mask");
+    this->setVersion("0.1");
+    this->setDescription("The ranges that mask_out_artifacts would zero, as a 3xL array (channel, first timepoint, last timepoint)");
+    this->setInputFileParameters("timeseries");
+    this->setOutputFileParameters("mask_out");
+    this->setRequiredParameters("threshold", "interval_size");
+}
+
+compute_artifact_mask_Processor::~compute_artifact_mask_Processor()
+{
+    delete d;
+}
+
+bool compute_artifact_mask_Processor::check(const QMap<QString, QVariant>& params)
+{
+    if (!this->checkParameters(params))
+        return false;
+    return true;
+}
+
+bool compute_artifact_mask_Processor::run(const QMap<QString, QVariant>& params)
+{
+    QString timeseries_path = params["timeseries"].toString();
+    QString mask_out_path = params["mask_out"].toString();
+    double threshold = params["threshold"].toDouble();
+    int interval_size = params["interval_size"].toInt();
+    return compute_artifact_mask(timeseries_path, mask_out_path, threshold, interval_size);
+}
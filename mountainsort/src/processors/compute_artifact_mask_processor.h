@@ -0,0 +1,24 @@
+/******************************************************
+** See the accompanying README and LICENSE files
+*******************************************************/
+
+#ifndef COMPUTE_ARTIFACT_MASK_PROCESSOR_H
+#define COMPUTE_ARTIFACT_MASK_PROCESSOR_H
+
+#include "msprocessor.h"
+
+class compute_artifact_mask_ProcessorPrivate;
+class compute_artifact_mask_Processor : public MSProcessor {
+public:
+    friend class compute_artifact_mask_ProcessorPrivate;
+    compute_artifact_mask_Processor();
+    virtual ~compute_artifact_mask_Processor();
+
+    bool check(const QMap<QString, QVariant>& params);
+    bool run(const QMap<QString, QVariant>& params);
+
+private:
+    compute_artifact_mask_ProcessorPrivate* d;
+};
+
+#endif // COMPUTE_ARTIFACT_MASK_PROCESSOR_H
@@ -14,6 +14,7 @@
 #include <math.h>
 #include "get_pca_features.h"
 #include "msmisc.h"
+#include "mdaarena.h"
 
 bool compute_detectability_scores(QString timeseries_path, QString firings_path, QString firings_out_path, const compute_detectability_scores_opts& opts)
 {
@@ -46,38 +47,60 @@ bool compute_detectability_scores(QString timeseries_path, QString firings_path,
 
     int K = MLCompute::max<int>(labels);
 
-    QList<Subcluster> subclusters;
+    //the events of each cluster, found once rather than by a scan of all the events for every cluster
+    QVector<QVector<long> > inds_by_label(K + 1);
+    for (long i = 0; i < L; i++) {
+        if ((labels[i] >= 1) && (labels[i] <= K))
+            inds_by_label[labels[i]] << i;
+    }
 
-#pragma omp parallel for
-    for (int k = 1; k <= K; k++) { //iterate through all clusters
-        int count1 = 0;
-        int count2 = 0;
-
-        QVector<long> inds_k;
-#pragma omp critical
-        inds_k = find_label_inds(labels, k); //find the indices corresonding to this cluster
-
-        if (inds_k.count() > 0) { //if the cluster is non-empty
-            Mda clips_k;
-            Mda noise_shape;
-            int channel;
-#pragma omp critical
-            {
+    //the noise shape only depends on the detection channel, so it is estimated once per channel (and all from the same random clips)
+    printf("Estimating noise shapes\n");
+    int M = timeseries.N1();
+    QVector<Mda> noise_shapes(M);
+    {
+        QVector<int> channel_used(M, 0);
+        for (int k = 1; k <= K; k++) {
+            if (!inds_by_label[k].isEmpty()) {
+                int ch = channels[inds_by_label[k][0]];
+                if ((ch >= 0) && (ch < M))
+                    channel_used[ch] = 1;
+            }
+        }
+        Mda rand_clips = extract_random_clips(timeseries, T);
+        Mda* noise_shapes_ptr = noise_shapes.data();
+#pragma omp parallel for schedule(dynamic)
+        for (int m = 0; m < M; m++) {
+            if (channel_used.at(m))
+                noise_shapes_ptr[m] = estimate_noise_shape(rand_clips, m);
+        }
+    }
+
+    Define_Shells_Opts opts2;
+    opts2.min_shell_size = opts.min_shell_size;
+    opts2.shell_increment = opts.shell_increment;
+    QVector<QList<Subcluster> > subclusters_by_label(K + 1);
+    QList<Subcluster>* subclusters_by_label_ptr = subclusters_by_label.data();
+#pragma omp parallel
+    {
+        DiskReadMda timeseries_local; //each thread reads with its own file handle
+#pragma omp critical(compute_detectability_scores)
+        timeseries_local = timeseries;
+        MdaArenaScope arena_scope; //the clips and workspaces of this thread are recycled from one cluster to the next
+#pragma omp for schedule(dynamic)
+        for (int k = 1; k <= K; k++) { //iterate through all clusters
+            const QVector<long>& inds_k = inds_by_label.at(k); //the indices corresonding to this cluster
+            if (inds_k.count() > 0) { //if the cluster is non-empty
+#pragma omp critical(compute_detectability_scores_print)
                 printf("k=%d/%d\n", k, K);
                 QVector<double> times_k;
                 for (long i = 0; i < inds_k.count(); i++) {
-                    times_k << times[inds_k[i]];
+                    times_k << times.at(inds_k[i]);
                 }
-                channel = channels[inds_k[0]]; //the channel should be the same for all events in the cluster
-                clips_k = extract_clips(timeseries, times_k, T);
-                noise_shape = estimate_noise_shape(timeseries, T, channel); //estimate the noise shape corresponding to detection on this particular channel
-            }
-            Define_Shells_Opts opts2;
-            opts2.min_shell_size = opts.min_shell_size;
-            opts2.shell_increment = opts.shell_increment;
-            QList<Subcluster> subclusters0 = compute_subcluster_detectability_scores(noise_shape, clips_k, channel, opts2); //actually compute the scores
-#pragma omp critical
-            {
+                int channel = channels.at(inds_k[0]); //the channel should be the same for all events in the cluster
+                Mda clips_k = extract_clips(timeseries_local, times_k, T);
+                Mda noise_shape = ((channel >= 0) && (channel < M)) ? noise_shapes.at(channel) : Mda(M, T); //the noise shape corresponding to detection on this particular channel
+                QList<Subcluster> subclusters0 = compute_subcluster_detectability_scores(noise_shape, clips_k, channel, opts2); //actually compute the scores
                 for (int ii = 0; ii < subclusters0.count(); ii++) {
                     Subcluster SC = subclusters0[ii];
                     QList<long> new_inds; //we want the inds to correspond to the original inds
@@ -86,14 +109,15 @@ bool compute_detectability_scores(QString timeseries_path, QString firings_path,
                     }
                     SC.inds = new_inds;
                     SC.label = k;
-                    subclusters << SC;
-                    count1 += SC.inds.count();
-                    if (SC.inds.count() > 0)
-                        count2++;
+                    subclusters_by_label_ptr[k] << SC;
                 }
             }
         }
     }
+    //in the order of the labels, whatever the order the threads finished in
+    QList<Subcluster> subclusters;
+    for (int k = 1; k <= K; k++)
+        subclusters.append(subclusters_by_label[k]);
 
     int num_subclusters = subclusters.count();
 
@@ -253,59 +277,54 @@ QVector<double> randsample_with_replacement(long N, long K)
     return ret;
 }
 
+Mda extract_random_clips(DiskReadMda& X, int T, long num_rand_times)
+{
+    int N = X.N2();
+    QVector<double> rand_times = randsample_with_replacement(N - 2 * T, num_rand_times);
+    for (int i = 0; i < rand_times.count(); i++)
+        rand_times[i] += T;
+    return extract_clips(X, rand_times, T);
+}
+
 Mda estimate_noise_shape(DiskReadMda& X, int T, int ch)
+{
+    return estimate_noise_shape(extract_random_clips(X, T), ch);
+}
+
+Mda estimate_noise_shape(const Mda& rand_clips, int ch)
 {
     // Computes the expected shape of the template in a noise cluster
     // which may be considered as a row in the noise covariance matrix
-    // X is the MxN array of raw or pre-processed data
-    // T is the clip size
+    // rand_clips are MxTxL clips at random times of the raw or pre-processed data
     // ch is the channel where detection takes place
-    QTime timer;
-    timer.start();
-    int M = X.N1();
-    int N = X.N2();
+    int M = rand_clips.N1();
+    int T = rand_clips.N2();
+    long num_rand_clips = rand_clips.N3();
     int Tmid = (int)((T + 1) / 2) - 1;
-    int num_rand_times = 10000;
-    QVector<double> rand_times = randsample_with_replacement(N - 2 * T, num_rand_times);
-    for (int i = 0; i < rand_times.count(); i++)
-        rand_times[i] += T;
-    Mda rand_clips = extract_clips(X, rand_times, T);
     QVector<double> peaks;
-    for (int i = 0; i < rand_times.count(); i++) {
+    for (long i = 0; i < num_rand_clips; i++) {
         peaks << rand_clips.get(ch, Tmid, i);
     }
     Mda noise_shape;
     noise_shape.allocate(M, T);
     double* noise_shape_ptr = noise_shape.dataPtr();
-    double* rand_clips_ptr = rand_clips.dataPtr();
-    int bbb = 0;
-    for (int i = 0; i < rand_times.count(); i++) {
+    const double* rand_clips_ptr = rand_clips.constDataPtr();
+    for (long i = 0; i < num_rand_clips; i++) {
         if (fabs(peaks[i]) <= 2) { //focus on noise clips (where amplitude is low)
-            int aaa = 0;
-            for (int t = 0; t < T; t++) {
-                for (int m = 0; m < M; m++) {
-                    noise_shape_ptr[aaa] += peaks[i] * rand_clips_ptr[bbb];
-                    aaa++;
-                    bbb++;
-                }
+            const double* clip_ptr = &rand_clips_ptr[M * T * i];
+            for (int aaa = 0; aaa < M * T; aaa++) {
+                noise_shape_ptr[aaa] += peaks[i] * clip_ptr[aaa];
             }
         }
-        else
-            bbb += M * T; //important and tricky!!!
     }
     double noise_shape_norm = 0;
-    for (int t = 0; t < T; t++) {
-        for (int m = 0; m < M; m++) {
-            double val = noise_shape.get(m, t);
-            noise_shape_norm += val * val;
-        }
+    for (int aaa = 0; aaa < M * T; aaa++) {
+        noise_shape_norm += noise_shape_ptr[aaa] * noise_shape_ptr[aaa];
     }
     noise_shape_norm = sqrt(noise_shape_norm);
     if (noise_shape_norm) {
-        for (int t = 0; t < T; t++) {
-            for (int m = 0; m < M; m++) {
-                noise_shape.set(noise_shape.get(m, t) / noise_shape_norm, m, t);
-            }
+        for (int aaa = 0; aaa < M * T; aaa++) {
+            noise_shape_ptr[aaa] /= noise_shape_norm;
         }
     }
     return noise_shape;
@@ -317,11 +336,7 @@ Mda compute_features(Mda& clips, int num_features)
     int T = clips.N2();
     int L = clips.N3();
 
-    Mda clips_reshaped(M * T, L);
-    long NNN = M * T * L;
-    for (long iii = 0; iii < NNN; iii++) {
-        clips_reshaped.set(clips.get(iii), iii);
-    }
+    MdaView clips_reshaped = clips.view().reshaped(M * T, L); //no copy
 
     Mda FF, CC, sigma;
     pca(CC, FF, sigma, clips_reshaped, num_features, false);
@@ -334,60 +349,57 @@ Mda compute_features(Mda& clips, int num_features)
     //return ret;
 }
 
-void compute_geometric_median(int M, int N, double* output, double* input, int num_iterations)
+void compute_geometric_median(int M, int N, double* output, double* input, int num_iterations, double tolerance)
 {
-    double* weights = (double*)malloc(sizeof(double) * N);
-    double* dists = (double*)malloc(sizeof(double) * N);
+    //Weiszfeld iterations -- the workspace comes from the arena of the calling thread (see MdaArenaScope)
+    double* weights = (double*)mda_arena_allocate(sizeof(double) * N);
+    double* dists = (double*)mda_arena_allocate(sizeof(double) * N);
+    double* previous_output = (double*)mda_arena_allocate(sizeof(double) * M);
     for (int j = 0; j < N; j++)
         weights[j] = 1;
     for (int it = 1; it <= num_iterations; it++) {
-        float sumweights = 0;
+        double sumweights = 0;
         for (int j = 0; j < N; j++)
             sumweights += weights[j];
         if (sumweights)
             for (int j = 0; j < N; j++)
                 weights[j] /= sumweights;
-        for (int i = 0; i < M; i++)
+        for (int i = 0; i < M; i++) {
+            previous_output[i] = output[i];
             output[i] = 0;
-        {
-            //compute output
-            int kkk = 0;
-            for (int j = 0; j < N; j++) {
-                int i = 0;
-                for (int m = 0; m < M; m++) {
-                    output[i] += weights[j] * input[kkk];
-                    i++;
-                    kkk++;
-                }
-            }
         }
-        {
-            //compute dists
-            int kkk = 0;
-            for (int j = 0; j < N; j++) {
-                int i = 0;
-                double sumsqr = 0;
-                for (int m = 0; m < M; m++) {
-                    double diff = output[i] - input[kkk];
-                    i++;
-                    kkk++;
-                    sumsqr += diff * diff;
-                }
-                dists[j] = sqrt(sumsqr);
+        //compute output -- contiguous inner loops, so that the compiler can vectorize them
+        for (int j = 0; j < N; j++) {
+            const double* col = &input[M * (long)j];
+            double w = weights[j];
+            for (int m = 0; m < M; m++)
+                output[m] += w * col[m];
+        }
+        //compute dists and weights
+        for (int j = 0; j < N; j++) {
+            const double* col = &input[M * (long)j];
+            double sumsqr = 0;
+            for (int m = 0; m < M; m++) {
+                double diff = output[m] - col[m];
+                sumsqr += diff * diff;
             }
+            dists[j] = sqrt(sumsqr);
+            weights[j] = dists[j] ? 1 / dists[j] : 0;
         }
-        {
-            //compute weights
-            for (int j = 0; j < N; j++) {
-                if (dists[j])
-                    weights[j] = 1 / dists[j];
-                else
-                    weights[j] = 0;
+        //stop early once the estimate has settled
+        if ((it > 1) && (tolerance > 0)) {
+            double change_sumsqr = 0, sumsqr = 0;
+            for (int m = 0; m < M; m++) {
+                change_sumsqr += (output[m] - previous_output[m]) * (output[m] - previous_output[m]);
+                sumsqr += output[m] * output[m];
             }
+            if (change_sumsqr <= tolerance * tolerance * sumsqr)
+                break;
         }
     }
-    free(dists);
-    free(weights);
+    mda_arena_free(previous_output);
+    mda_arena_free(dists);
+    mda_arena_free(weights);
 }
 
 Mda compute_geometric_median_template(Mda& clips)
@@ -460,24 +472,37 @@ QList<Subcluster> compute_subcluster_detectability_scores(Mda& noise_shape, Mda&
     QList<Shell> shells = define_shells(peaks, opts);
 
     QList<Subcluster> subclusters;
+    const double* clips_ptr = clips.constDataPtr();
+    const double* noise_shape_ptr = noise_shape.constDataPtr();
+    Mda subtemplate(M, T);
+    double* subtemplate_ptr = subtemplate.dataPtr();
     for (int s = 0; s < shells.count(); s++) {
-        QList<long> inds_s = shells[s].inds;
-        Mda clips_s = get_subclips(clips, inds_s);
-        //Mda subtemplate=compute_geometric_median_template(clips_s);
-        Mda subtemplate = compute_mean_clip(clips_s);
-        double ip = compute_template_ip(noise_shape, subtemplate);
-        Mda subtemplate_resid;
-        subtemplate_resid.allocate(M, T);
-        for (int t = 0; t < T; t++) {
-            for (int m = 0; m < M; m++) {
-                subtemplate_resid.set(subtemplate.get(m, t) - ip * noise_shape.get(m, t), m, t);
-            }
+        const QList<long>& inds_s = shells[s].inds;
+        //the mean clip of the shell, without making a copy of its clips
+        //(we used to use compute_geometric_median_template here)
+        for (int aaa = 0; aaa < M * T; aaa++)
+            subtemplate_ptr[aaa] = 0;
+        for (long i = 0; i < inds_s.count(); i++) {
+            const double* clip_ptr = &clips_ptr[M * T * inds_s[i]];
+            for (int aaa = 0; aaa < M * T; aaa++)
+                subtemplate_ptr[aaa] += clip_ptr[aaa];
+        }
+        if (!inds_s.isEmpty()) {
+            for (int aaa = 0; aaa < M * T; aaa++)
+                subtemplate_ptr[aaa] /= inds_s.count();
+        }
+        double ip = 0;
+        for (int aaa = 0; aaa < M * T; aaa++)
+            ip += noise_shape_ptr[aaa] * subtemplate_ptr[aaa];
+        double subtemplate_resid_sumsqr = 0;
+        for (int aaa = 0; aaa < M * T; aaa++) {
+            double val = subtemplate_ptr[aaa] - ip * noise_shape_ptr[aaa];
+            subtemplate_resid_sumsqr += val * val;
         }
-        double subtemplate_resid_norm = compute_template_norm(subtemplate_resid);
         Subcluster SC;
         SC.inds = inds_s;
-        SC.detectability_score = subtemplate_resid_norm; // here's the score!
-        SC.peak = subtemplate.get(channel, Tmid);
+        SC.detectability_score = sqrt(subtemplate_resid_sumsqr); // here's the score!
+        SC.peak = subtemplate.value(channel, Tmid);
         subclusters << SC;
     }
     return subclusters;
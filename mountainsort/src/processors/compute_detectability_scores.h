@@ -39,9 +39,12 @@ QVector<long> find_label_inds(const QVector<int>& labels, int k);
 Mda get_subclips(Mda& clips, const QList<long>& inds);
 QList<Shell> define_shells(const QVector<double>& peaks, const Define_Shells_Opts& opts);
 QVector<double> randsample_with_replacement(long N, long K);
+Mda extract_random_clips(DiskReadMda& X, int T, long num_rand_times = 10000);
 Mda estimate_noise_shape(DiskReadMda& X, int T, int ch);
+Mda estimate_noise_shape(const Mda& rand_clips, int ch);
 Mda compute_features(Mda& clips, int num_features);
-void compute_geometric_median(int M, int N, double* output, double* input, int num_iterations = 10);
+//stops before num_iterations when the estimate moves by less than tolerance (relative to its norm) in an iteration
+void compute_geometric_median(int M, int N, double* output, double* input, int num_iterations = 10, double tolerance = 1e-6);
 Mda compute_geometric_median_template(Mda& clips);
 double compute_template_ip(Mda& T1, Mda& T2);
 double compute_template_norm(Mda& T);
@@ -1,11 +1,11 @@
 #include "confusion_matrix.h"
-#include "diskreadmda.h"
+#include "firingsstore.h"
 #include <QSet>
 #include <QMap>
 #include "get_sort_indices.h"
 #include "hungarian.h"
 
-QVector<int> indexlist(const QVector<int>& T2, int t1, int offset, int& ptr2);
+QVector<int> indexlist(const QVector<qint64>& T2, qint64 t1, int offset, int& ptr2);
 Mda confusion_matrix_2(QString firings1_path, QString firings2_path, int max_matching_offset, QMap<int, int>& map12, QVector<long>& event_correspondence);
 Mda compute_optimal_assignments(const Mda& confusion_matrix);
 
@@ -53,9 +53,9 @@ bool confusion_matrix(QString firings1_path, QString firings2_path, QString outp
     return true;
 }
 
-void sort_times_labels_inds(QVector<double>& times, QVector<int>& labels, QVector<long>& INDS)
+void sort_times_labels_inds(QVector<qint64>& times, QVector<int>& labels, QVector<long>& INDS)
 {
-    QVector<double> times2;
+    QVector<qint64> times2;
     QVector<int> labels2;
     QVector<long> INDS2;
     QList<long> inds = get_sort_indices(times);
@@ -73,36 +73,22 @@ Mda confusion_matrix_2(QString firings1_path, QString firings2_path, int max_mat
 {
     event_correspondence.clear(); //this will be output
 
-    DiskReadMda C1;
-    C1.setPath(firings1_path);
-    DiskReadMda C2;
-    C2.setPath(firings2_path);
+    FiringsStore C1(firings1_path);
+    FiringsStore C2(firings2_path);
 
-    QVector<double> T1d, T2d;
-    QVector<int> L1, L2;
-    QVector<long> IND1, IND2;
+    //the times are 64-bit, since an int overflows after around 20 hours at 30 kHz
+    QVector<qint64> T1 = C1.times().toVector();
+    QVector<qint64> T2 = C2.times().toVector();
+    QVector<int> L1 = C1.labels().toVector();
+    QVector<int> L2 = C2.labels().toVector();
+    QVector<long> IND1(C1.eventCount()), IND2(C2.eventCount());
+    for (long ii = 0; ii < IND1.count(); ii++)
+        IND1[ii] = ii;
+    for (long ii = 0; ii < IND2.count(); ii++)
+        IND2[ii] = ii;
 
-    for (int ii = 0; ii < C1.N2(); ii++) {
-        T1d << C1.value(1, ii);
-        L1 << C1.value(2, ii);
-        IND1 << ii;
-    }
-    for (int ii = 0; ii < C2.N2(); ii++) {
-        T2d << C2.value(1, ii);
-        L2 << C2.value(2, ii);
-        IND2 << ii;
-    }
-
-    sort_times_labels_inds(T1d, L1, IND1);
-    sort_times_labels_inds(T2d, L2, IND2);
-
-    QVector<int> T1, T2;
-    for (long i = 0; i < T1d.count(); i++) {
-        T1 << (int)T1d[i];
-    }
-    for (long i = 0; i < T2d.count(); i++) {
-        T2 << (int)T2d[i];
-    }
+    sort_times_labels_inds(T1, L1, IND1);
+    sort_times_labels_inds(T2, L2, IND2);
 
     int K1 = 1;
     for (int ii = 0; ii < L1.count(); ii++) {
@@ -163,7 +149,8 @@ Mda confusion_matrix_2(QString firings1_path, QString firings2_path, int max_mat
                 }
             }
             //now remove the events that were marked above
-            QVector<int> new_T1, new_L1;
+            QVector<qint64> new_T1;
+            QVector<int> new_L1;
             QVector<long> new_IND1;
             for (int i = 0; i < T1.count(); i++) {
                 if (!inds1_to_remove.contains(i)) {
@@ -176,7 +163,8 @@ Mda confusion_matrix_2(QString firings1_path, QString firings2_path, int max_mat
             L1 = new_L1;
             IND1 = new_IND1;
 
-            QVector<int> new_T2, new_L2;
+            QVector<qint64> new_T2;
+            QVector<int> new_L2;
             QVector<long> new_IND2;
             for (int i = 0; i < T2.count(); i++) {
                 if (!inds2_to_remove.contains(i)) {
@@ -208,7 +196,7 @@ Mda confusion_matrix_2(QString firings1_path, QString firings2_path, int max_mat
     }
 
     event_correspondence.clear();
-    for (long i = 0; i < C1.N2(); i++) {
+    for (long i = 0; i < C1.eventCount(); i++) {
         if (event_mapping.contains(i)) {
             event_correspondence << event_mapping[i];
         }
@@ -220,7 +208,7 @@ Mda confusion_matrix_2(QString firings1_path, QString firings2_path, int max_mat
     return output;
 }
 
-QVector<int> indexlist(const QVector<int>& T2, int t1, int offset, int& ptr2)
+QVector<int> indexlist(const QVector<qint64>& T2, qint64 t1, int offset, int& ptr2)
 {
     // find T1 such that abs(T1-t1)<off, where t1 is a scalar. Update ptr2 which gives the rough
     // center value of this index.
@@ -233,7 +221,7 @@ QVector<int> indexlist(const QVector<int>& T2, int t1, int offset, int& ptr2)
         j++; // go up until T2's too late
     QVector<int> ret;
     for (int ii = i; ii <= j; ii++) {
-        int t2val = T2.value(ii);
+        qint64 t2val = T2.value(ii);
         if ((ii >= 0) && (ii < N) && (t1 - offset <= t2val) && (t2val <= t1 + offset))
             ret << ii;
     }
@@ -3,6 +3,7 @@
 #include <QTime>
 #include <math.h>
 #include "diskreadmda.h"
+#include "mdaarena.h"
 #include "msprefs.h"
 #include "mlcommon.h"
 
@@ -27,66 +28,70 @@ bool detect(const QString& timeseries_path, const QString& detect_path, const De
         QTime timer;
         timer.start();
         long num_timepoints_handled = 0;
-#pragma omp parallel for
-        for (long timepoint = 0; timepoint < N; timepoint += chunk_size) {
-            Mda chunk;
+#pragma omp parallel
+        {
+            MdaArenaScope arena_scope;
+#pragma omp for
+            for (long timepoint = 0; timepoint < N; timepoint += chunk_size) {
+                Mda chunk;
 #pragma omp critical(lock1)
-            {
-                X.readChunk(chunk, 0, timepoint - overlap_size, M, chunk_size + 2 * overlap_size);
-            }
-
-            QVector<double> times1;
-            QVector<int> channels1;
-            int m_begin = 0, m_end = M - 1;
-            if (!opts.individual_channels)
-                m_end = 0;
-            for (int m = m_begin; m <= m_end; m++) {
-                QVector<double> vals;
-                if (opts.individual_channels) {
-                    for (int j = 0; j < chunk.N2(); j++) {
-                        double tmp = chunk.value(m, j);
-                        if (opts.sign < 0)
-                            tmp = -tmp;
-                        if ((opts.sign == 0) && (tmp < 0))
-                            tmp = -tmp;
-                        vals << tmp;
-                    }
+                {
+                    X.readChunk(chunk, 0, timepoint - overlap_size, M, chunk_size + 2 * overlap_size);
                 }
-                else {
-                    for (int j = 0; j < chunk.N2(); j++) {
-                        double maxval = 0;
-                        for (int a = 0; a < M; a++) {
-                            double tmp = chunk.value(a, j);
+
+                QVector<double> times1;
+                QVector<int> channels1;
+                int m_begin = 0, m_end = M - 1;
+                if (!opts.individual_channels)
+                    m_end = 0;
+                for (int m = m_begin; m <= m_end; m++) {
+                    QVector<double> vals;
+                    if (opts.individual_channels) {
+                        for (int j = 0; j < chunk.N2(); j++) {
+                            double tmp = chunk.value(m, j);
                             if (opts.sign < 0)
                                 tmp = -tmp;
                             if ((opts.sign == 0) && (tmp < 0))
                                 tmp = -tmp;
-                            if (tmp > maxval)
-                                maxval = tmp;
+                            vals << tmp;
                         }
-                        vals << maxval;
                     }
-                }
-                QVector<double> times0 = do_detect(vals, opts.detect_interval, opts.detect_threshold);
+                    else {
+                        for (int j = 0; j < chunk.N2(); j++) {
+                            double maxval = 0;
+                            for (int a = 0; a < M; a++) {
+                                double tmp = chunk.value(a, j);
+                                if (opts.sign < 0)
+                                    tmp = -tmp;
+                                if ((opts.sign == 0) && (tmp < 0))
+                                    tmp = -tmp;
+                                if (tmp > maxval)
+                                    maxval = tmp;
+                            }
+                            vals << maxval;
+                        }
+                    }
+                    QVector<double> times0 = do_detect(vals, opts.detect_interval, opts.detect_threshold);
 
-                for (int i = 0; i < times0.count(); i++) {
-                    double time0 = times0[i] + timepoint - overlap_size;
-                    if ((time0 >= timepoint) && (time0 < timepoint + chunk_size)) {
-                        if ((time0 >= Tmid) && (time0 + Tmid < N)) {
-                            times1 << time0 + 1; //convert to 1-based indexing
-                            channels1 << m + 1;
+                    for (int i = 0; i < times0.count(); i++) {
+                        double time0 = times0[i] + timepoint - overlap_size;
+                        if ((time0 >= timepoint) && (time0 < timepoint + chunk_size)) {
+                            if ((time0 >= Tmid) && (time0 + Tmid < N)) {
+                                times1 << time0 + 1; //convert to 1-based indexing
+                                channels1 << m + 1;
+                            }
                         }
                     }
                 }
-            }
 #pragma omp critical(lock2)
-            {
-                times.append(times1);
-                channels.append(channels1);
-                num_timepoints_handled += qMin(chunk_size, N - timepoint);
-                if ((timer.elapsed() > 5000) || (num_timepoints_handled == N)) {
-                    printf("%ld/%ld (%d%%)\n", num_timepoints_handled, N, (int)(num_timepoints_handled * 1.0 / N * 100));
-                    timer.restart();
+                {
+                    times.append(times1);
+                    channels.append(channels1);
+                    num_timepoints_handled += qMin(chunk_size, N - timepoint);
+                    if ((timer.elapsed() > 5000) || (num_timepoints_handled == N)) {
+                        printf("%ld/%ld (%d%%)\n", num_timepoints_handled, N, (int)(num_timepoints_handled * 1.0 / N * 100));
+                        timer.restart();
+                    }
                 }
             }
         }
@@ -5,6 +5,8 @@
 #include "get_principal_components.h"
 #endif
 #include "get_principal_components.h"
+#include "clip_store.h"
+#include <algorithm>
 
 Mda extract_clips(const DiskReadMda& X, const QVector<double>& times, int clip_size)
 {
@@ -106,6 +108,23 @@ Mda32 extract_clips(const DiskReadMda32& X, const QVector<double>& times, const
 
 bool extract_clips(const QString& timeseries_path, const QString& firings_path, const QString& clips_path, int clip_size)
 {
+    ClipStore store;
+    if (store.open(timeseries_path, firings_path, clip_size)) {
+        Mda32 clips(store.M(), store.clipSize(), store.eventCount());
+        long MT = store.M() * store.clipSize();
+        float* clips_ptr = clips.dataPtr();
+        bool complete = true;
+        for (long j = 0; (complete) && (j < store.eventCount()); j++) {
+            Mda32View clip = store.clip(j);
+            if (clip.isEmpty()) //an event with a negative label is not in the store
+                complete = false;
+            else
+                std::copy(clip.constDataPtr(), clip.constDataPtr() + MT, &clips_ptr[MT * j]);
+        }
+        if (complete)
+            return clips.write32(clips_path);
+    }
+
     DiskReadMda X(timeseries_path);
     DiskReadMda F(firings_path);
     QVector<double> times;
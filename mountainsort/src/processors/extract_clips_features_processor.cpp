@@ -59,11 +59,7 @@ bool extract_clips_features_Processor::run(const QMap<QString, QVariant>& params
     long M = clips.N1();
     long T = clips.N2();
     long L = clips.N3();
-    Mda clips_reshaped(M * T, L);
-    long NNN = M * T * L;
-    for (long iii = 0; iii < NNN; iii++) {
-        clips_reshaped.set(clips.get(iii), iii);
-    }
+    MdaView clips_reshaped = clips.view().reshaped(M * T, L); //no copy
     Mda CC, FF, sigma;
     pca(CC, FF, sigma, clips_reshaped, num_features, subtract_mean);
     return FF.write32(features_path);
@@ -9,23 +9,24 @@
 #include "mlcommon.h"
 #include "mlcommon.h"
 #include "diskreadmda.h"
+#include "mdaarena.h"
 #include <QTime>
 #include <math.h>
 #include "compute_templates_0.h"
 #include "compute_detectability_scores.h"
 #include "get_sort_indices.h"
 #include "msprefs.h"
+#include "msprofile.h"
 #include "omp.h"
 
-QList<long> fit_stage_kernel(Mda& X, Mda& templates, QVector<double>& times, QVector<int>& labels, const fit_stage_opts& opts);
-QList<long> fit_stage_kernel_old(Mda& X, Mda& templates, QVector<double>& times, QVector<int>& labels, const fit_stage_opts& opts);
+QList<long> fit_stage_kernel(Mda& X, const Mda& templates, QVector<double>& times, QVector<int>& labels, const fit_stage_opts& opts);
+QList<long> fit_stage_kernel_old(Mda& X, const Mda& templates, QVector<double>& times, QVector<int>& labels, const fit_stage_opts& opts);
 
 bool fit_stage_new(const QString& timeseries_path, const QString& firings_path, const QString& firings_out_path, const fit_stage_opts& opts)
 {
     //Just for timing things
     QTime timer_total;
     timer_total.start();
-    QMap<QString, long> elapsed_times;
 
     //The timeseries data and the dimensions
     DiskReadMda X(timeseries_path);
@@ -47,7 +48,11 @@ bool fit_stage_new(const QString& timeseries_path, const QString& firings_path,
     Mda firings_split = split_into_shells(firings, define_shells_opts);
 
     //These are the templates corresponding to the sub-clusters (after shell splitting)
-    Mda templates = compute_templates_0(X, firings_split, T); //MxTxK (wrong: MxNxK)
+    Mda templates;
+    {
+        MSProfileTimer timer("compute_templates_0");
+        templates = compute_templates_0(X, firings_split, T); //MxTxK (wrong: MxNxK)
+    }
 
     //L is the number of events. Accumulate vectors of times and labels for convenience
     long L = firings.N2();
@@ -73,72 +78,66 @@ bool fit_stage_new(const QString& timeseries_path, const QString& firings_path,
         QTime timer_status;
         timer_status.start();
         long num_timepoints_handled = 0;
-#pragma omp parallel for
-        for (long timepoint = 0; timepoint < N; timepoint += chunk_size) {
-            QMap<QString, long> elapsed_times_local;
-            Mda chunk; //this will be the chunk we are working on
-            Mda local_templates; //just a local copy of the templates
-            QVector<double> local_times; //the times that fall in this time range
-            QVector<int> local_labels; //the corresponding labels
-            QList<long> local_inds; //the corresponding event indices
-            fit_stage_opts local_opts;
+#pragma omp parallel
+        {
+            MdaArenaScope arena_scope;
+#pragma omp for
+            for (long timepoint = 0; timepoint < N; timepoint += chunk_size) {
+                Mda chunk; //this will be the chunk we are working on
+                Mda local_templates; //just a local copy of the templates (shared, the kernel only reads it)
+                QVector<double> local_times; //the times that fall in this time range
+                QVector<int> local_labels; //the corresponding labels
+                QList<long> local_inds; //the corresponding event indices
+                fit_stage_opts local_opts;
 #pragma omp critical(lock1)
-            {
-                //build the variables above
-                QTime timer;
-                timer.start();
-                local_templates = templates;
-                local_opts = opts;
-                X.readChunk(chunk, 0, timepoint - overlap_size, M, chunk_size + 2 * overlap_size);
-                elapsed_times["readChunk"] += timer.elapsed();
-                timer.start();
-                for (long jj = 0; jj < L; jj++) {
-                    if ((timepoint - overlap_size <= times[jj]) && (times[jj] < timepoint - overlap_size + chunk_size + 2 * overlap_size)) {
-                        local_times << times[jj] - (timepoint - overlap_size);
-                        local_labels << labels[jj];
-                        local_inds << jj;
+                {
+                    //build the variables above
+                    local_templates = templates;
+                    local_opts = opts;
+                    {
+                        MSProfileTimer timer("readChunk");
+                        X.readChunk(chunk, 0, timepoint - overlap_size, M, chunk_size + 2 * overlap_size);
+                        timer.addBytes(chunk.totalSize() * 8);
+                    }
+                    MSProfileTimer timer("set_local_data");
+                    for (long jj = 0; jj < L; jj++) {
+                        if ((timepoint - overlap_size <= times[jj]) && (times[jj] < timepoint - overlap_size + chunk_size + 2 * overlap_size)) {
+                            local_times << times[jj] - (timepoint - overlap_size);
+                            local_labels << labels[jj];
+                            local_inds << jj;
+                        }
                     }
                 }
-                elapsed_times["set_local_data"] += timer.elapsed();
-            }
-            //Our real task is to decide which of these events to keep. Those will be stored in local_inds_to_use
-            //"Local" means this chunk in this thread
-            QList<long> local_inds_to_use;
-            {
-                QTime timer;
-                timer.start();
-                //This is the main kernel operation!!
-                local_inds_to_use = fit_stage_kernel(chunk, local_templates, local_times, local_labels, local_opts);
-                elapsed_times_local["fit_stage_kernel"] += timer.elapsed();
-            }
+                //Our real task is to decide which of these events to keep. Those will be stored in local_inds_to_use
+                //"Local" means this chunk in this thread
+                QList<long> local_inds_to_use;
+                {
+                    MSProfileTimer timer("fit_stage_kernel");
+                    //This is the main kernel operation!!
+                    local_inds_to_use = fit_stage_kernel(chunk, local_templates, local_times, local_labels, local_opts);
+                }
 #pragma omp critical(lock1)
-            {
-                elapsed_times["fit_stage_kernel"] += elapsed_times_local["fit_stage_kernel"];
                 {
-                    QTime timer;
-                    timer.start();
-                    for (long ii = 0; ii < local_inds_to_use.count(); ii++) {
-                        long ind0 = local_inds[local_inds_to_use[ii]];
-                        double t0 = times[ind0];
-                        if ((timepoint <= t0) && (t0 < timepoint + chunk_size)) {
-                            inds_to_use << ind0;
+                    {
+                        MSProfileTimer timer("get_local_data");
+                        for (long ii = 0; ii < local_inds_to_use.count(); ii++) {
+                            long ind0 = local_inds[local_inds_to_use[ii]];
+                            double t0 = times[ind0];
+                            if ((timepoint <= t0) && (t0 < timepoint + chunk_size)) {
+                                inds_to_use << ind0;
+                            }
                         }
                     }
-                    elapsed_times_local["get_local_data"] += timer.elapsed();
-                }
 
-                num_timepoints_handled += qMin(chunk_size, N - timepoint);
-                if ((timer_status.elapsed() > 1000) || (num_timepoints_handled == N) || (timepoint == 0)) {
-                    printf("%ld/%ld (%d%%) - Elapsed(s): RC:%g, SLD:%g, KERNEL:%g, GLD:%g, Total:%g, %d threads\n",
-                        num_timepoints_handled, N,
-                        (int)(num_timepoints_handled * 1.0 / N * 100),
-                        elapsed_times["readChunk"] * 1.0 / 1000,
-                        elapsed_times["set_local_data"] * 1.0 / 1000,
-                        elapsed_times["fit_stage_kernel"] * 1.0 / 1000,
-                        elapsed_times["get_local_data"] * 1.0 / 1000,
-                        timer_total.elapsed() * 1.0 / 1000,
-                        omp_get_num_threads());
-                    timer_status.restart();
+                    num_timepoints_handled += qMin(chunk_size, N - timepoint);
+                    if ((timer_status.elapsed() > 1000) || (num_timepoints_handled == N) || (timepoint == 0)) {
+                        printf("%ld/%ld (%d%%) - Elapsed(s): %g, %d threads\n",
+                            num_timepoints_handled, N,
+                            (int)(num_timepoints_handled * 1.0 / N * 100),
+                            timer_total.elapsed() * 1.0 / 1000,
+                            omp_get_num_threads());
+                        timer_status.restart();
+                    }
                 }
             }
         }
@@ -163,7 +162,7 @@ bool fit_stage_new(const QString& timeseries_path, const QString& firings_path,
 
 typedef QList<int> IntList;
 
-QList<int> get_channel_mask(Mda template0, int num)
+QList<int> get_channel_mask(const MdaView& template0, int num)
 {
     int M = template0.N1();
     int T = template0.N2();
@@ -194,18 +193,21 @@ bool is_dirty(const Mda& dirty, long t0, const QList<int>& chmask)
     return false;
 }
 
-double compute_score(long N, double* X, double* template0)
+double compute_score(long N, const double* X, const double* template0)
 {
-    Mda resid(1, N);
-    double* resid_ptr = resid.dataPtr();
-    for (long i = 0; i < N; i++)
-        resid_ptr[i] = X[i] - template0[i];
-    double norm1 = MLCompute::norm(N, X);
-    double norm2 = MLCompute::norm(N, resid_ptr);
-    return norm1 * norm1 - norm2 * norm2;
+    //no residual array: this is called for every event
+    double before_sumsqr = 0;
+    double after_sumsqr = 0;
+    for (long i = 0; i < N; i++) {
+        double val = X[i];
+        before_sumsqr += val * val;
+        val -= template0[i];
+        after_sumsqr += val * val;
+    }
+    return before_sumsqr - after_sumsqr;
 }
 
-double compute_score(int M, int T, double* X, double* template0, const QList<int>& chmask)
+double compute_score(int M, int T, const double* X, const double* template0, const QList<int>& chmask)
 {
     double before_sumsqr = 0;
     double after_sumsqr = 0;
@@ -222,7 +224,7 @@ double compute_score(int M, int T, double* X, double* template0, const QList<int
     return before_sumsqr - after_sumsqr;
 }
 
-void subtract_scaled_template(long N, double* X, double* template0)
+void subtract_scaled_template(long N, double* X, const double* template0)
 {
     double S12 = 0, S22 = 0;
     for (long i = 0; i < N; i++) {
@@ -237,7 +239,7 @@ void subtract_scaled_template(long N, double* X, double* template0)
     }
 }
 
-void subtract_scaled_template(int M, int T, double* X, double* template0, const QList<int>& chmask)
+void subtract_scaled_template(int M, int T, double* X, const double* template0, const QList<int>& chmask)
 {
     double S12 = 0, S22 = 0;
     for (int t = 0; t < T; t++) {
@@ -260,7 +262,7 @@ void subtract_scaled_template(int M, int T, double* X, double* template0, const
     }
 }
 
-QList<long> fit_stage_kernel(Mda& X, Mda& templates, QVector<double>& times, QVector<int>& labels, const fit_stage_opts& opts)
+QList<long> fit_stage_kernel(Mda& X, const Mda& templates, QVector<double>& times, QVector<int>& labels, const fit_stage_opts& opts)
 {
     int M = X.N1(); //the number of dimensions
     int T = opts.clip_size; //the clip size
@@ -268,11 +270,13 @@ QList<long> fit_stage_kernel(Mda& X, Mda& templates, QVector<double>& times, QVe
     long L = times.count(); //number of events we are looking at
     int K = MLCompute::max<int>(labels); //the maximum label number
 
+    MdaView templates_view = templates.view();
+
     //compute the L2-norms of the templates ahead of time
     QVector<double> template_norms;
     template_norms << 0;
     for (int k = 1; k <= K; k++) {
-        template_norms << MLCompute::norm(M * T, templates.dataPtr(0, 0, k - 1));
+        template_norms << MLCompute::norm(M * T, templates_view.slice(k - 1).constDataPtr());
     }
 
     //keep passing through the data until nothing changes anymore
@@ -291,9 +295,7 @@ QList<long> fit_stage_kernel(Mda& X, Mda& templates, QVector<double>& times, QVe
 
     QList<IntList> channel_mask;
     for (int i = 0; i < K; i++) {
-        Mda template0;
-        templates.getChunk(template0, 0, 0, i, M, T, 1);
-        channel_mask << get_channel_mask(template0, 8); //use only the 8 channels with highest maxval
+        channel_mask << get_channel_mask(templates_view.slice(i), 8); //use only the 8 channels with highest maxval
     }
 
     while (something_changed) {
@@ -321,7 +323,7 @@ QList<long> fit_stage_kernel(Mda& X, Mda& templates, QVector<double>& times, QVe
                         //we do need to recompute it.
                         if ((tt >= 0) && (tt + T <= X.N2())) { //make sure we are in range
                             //The score will be how much something like the L2-norm is decreased
-                            score0 = compute_score(M, T, X.dataPtr(0, tt), templates.dataPtr(0, 0, k0 - 1), chmask);
+                            score0 = compute_score(M, T, X.constDataPtr() + M * tt, templates.constDataPtr() + M * T * (k0 - 1), chmask);
                         }
                         /*
                         if (score0 < template_norms[k0] * template_norms[k0] * 0.1)
@@ -362,7 +364,7 @@ QList<long> fit_stage_kernel(Mda& X, Mda& templates, QVector<double>& times, QVe
                 something_changed = true;
                 num_added++;
                 long tt = (long)(times_to_try[i] - Tmid + 0.5);
-                subtract_scaled_template(M, T, X.dataPtr(0, tt), templates.dataPtr(0, 0, labels_to_try[i] - 1), chmask);
+                subtract_scaled_template(M, T, X.dataPtr(0, tt), templates.constDataPtr() + M * T * (labels_to_try[i] - 1), chmask);
                 for (int aa = tt - T / 2 - 1; aa <= tt + T + T / 2 + 1; aa++) {
                     if ((aa >= 0) && (aa < X.N2())) {
                         for (int k = 0; k < chmask.count(); k++) {
@@ -386,7 +388,7 @@ QList<long> fit_stage_kernel(Mda& X, Mda& templates, QVector<double>& times, QVe
     return inds_to_use;
 }
 
-QList<long> fit_stage_kernel_old(Mda& X, Mda& templates, QVector<double>& times, QVector<int>& labels, const fit_stage_opts& opts)
+QList<long> fit_stage_kernel_old(Mda& X, const Mda& templates, QVector<double>& times, QVector<int>& labels, const fit_stage_opts& opts)
 {
     int M = X.N1(); //the number of dimensions
     int T = opts.clip_size; //the clip size
@@ -398,7 +400,7 @@ QList<long> fit_stage_kernel_old(Mda& X, Mda& templates, QVector<double>& times,
     QVector<double> template_norms;
     template_norms << 0;
     for (int k = 1; k <= K; k++) {
-        template_norms << MLCompute::norm(M * T, templates.dataPtr(0, 0, k - 1));
+        template_norms << MLCompute::norm(M * T, templates.constDataPtr() + M * T * (k - 1));
     }
 
     //keep passing through the data until nothing changes anymore
@@ -425,7 +427,7 @@ QList<long> fit_stage_kernel_old(Mda& X, Mda& templates, QVector<double>& times,
                     double score0 = 0;
                     if ((tt >= 0) && (tt + T <= X.N2())) { //make sure we are in range
                         //The score will be how much something like the L2-norm is decreased
-                        score0 = compute_score(M * T, X.dataPtr(0, tt), templates.dataPtr(0, 0, k0 - 1));
+                        score0 = compute_score(M * T, X.dataPtr(0, tt), templates.constDataPtr() + M * T * (k0 - 1));
                     }
                     /*
                     if (score0 < template_norms[k0] * template_norms[k0] * 0.1)
@@ -459,7 +461,7 @@ QList<long> fit_stage_kernel_old(Mda& X, Mda& templates, QVector<double>& times,
                 something_changed = true;
                 num_added++;
                 long tt = (long)(times_to_try[i] - Tmid + 0.5);
-                subtract_scaled_template(M * T, X.dataPtr(0, tt), templates.dataPtr(0, 0, labels_to_try[i] - 1));
+                subtract_scaled_template(M * T, X.dataPtr(0, tt), templates.constDataPtr() + M * T * (labels_to_try[i] - 1));
                 all_to_use[inds_to_try[i]] = 1;
             }
         }
@@ -1,91 +1,212 @@
 #include "mask_out_artifacts.h"
-#include "diskreadmda.h"
 #include "diskwritemda.h"
+#include <QDebug>
 #include <QTime>
 #include <math.h>
 #include "mlcommon.h"
-#include "mda.h"
-#include "mlcommon.h"
+#include "omp.h"
 
-bool mask_out_artifacts(const QString& timeseries_path, const QString& timeseries_out_path, double threshold, int interval_size)
+//around 40 MB of float32 timeseries per chunk, a whole number of intervals
+static long chunk_size_in_intervals(long M, int interval_size)
 {
-    if ((!threshold) || (!interval_size)) {
-        printf("Problem with input parameters. Either threshold or interval_size is zero.\n");
-        return false;
-    }
-
-    QTime status_timer;
-    status_timer.start();
+    return qMax(1L, (long)(1e7 / (M * interval_size)));
+}
 
-    DiskReadMda X(timeseries_path);
+//M x (N/interval_size), read in large chunks on all threads
+static Mda compute_interval_norms(const DiskReadMda32& X, int interval_size)
+{
     long M = X.N1();
     long N = X.N2();
+    long num_intervals = N / interval_size;
+    Mda norms(M, num_intervals);
+    double* norms_ptr = norms.dataPtr();
 
-    //compute norms of chunks
-    Mda norms(M, N / interval_size);
-    for (long i = 0; i < N / interval_size; i++) {
-        long timepoint = i * interval_size;
-        if (status_timer.elapsed() > 5000) {
-            printf("mask_out_artifacts compute_norms: %ld/%ld (%d%%)\n", timepoint, N, (int)(timepoint * 100.0 / N));
-            status_timer.restart();
-        }
-        Mda chunk;
-        X.readChunk(chunk, 0, timepoint, M, interval_size);
-        for (int m = 0; m < M; m++) {
-            double sumsqr = 0;
-            for (int aa = 0; aa < interval_size; aa++) {
-                sumsqr += chunk.value(m, aa) * chunk.value(m, aa);
+    long intervals_per_chunk = chunk_size_in_intervals(M, interval_size);
+    long num_chunks = (num_intervals + intervals_per_chunk - 1) / intervals_per_chunk;
+    QTime status_timer;
+    status_timer.start();
+    long num_intervals_handled = 0;
+#pragma omp parallel
+    {
+        DiskReadMda32 X_local; //each thread reads with its own file handle
+#pragma omp critical(mask_out_artifacts_norms)
+        X_local = X;
+        QVector<double> sumsqrs(M);
+#pragma omp for schedule(dynamic)
+        for (long c = 0; c < num_chunks; c++) {
+            long i0 = c * intervals_per_chunk;
+            long n = qMin(intervals_per_chunk, num_intervals - i0);
+            Mda32 chunk;
+            X_local.readChunk(chunk, 0, i0 * interval_size, M, n * interval_size);
+            const float* ptr = chunk.constDataPtr();
+            for (long j = 0; j < n; j++) {
+                sumsqrs.fill(0);
+                double* sumsqrs_ptr = sumsqrs.data();
+                for (long t = 0; t < interval_size; t++) {
+                    const float* col = &ptr[M * (j * interval_size + t)];
+                    for (long m = 0; m < M; m++)
+                        sumsqrs_ptr[m] += col[m] * col[m];
+                }
+                for (long m = 0; m < M; m++)
+                    norms_ptr[m + M * (i0 + j)] = sqrt(sumsqrs_ptr[m]);
+            }
+#pragma omp critical(mask_out_artifacts_norms)
+            {
+                num_intervals_handled += n;
+                if (status_timer.elapsed() > 5000) {
+                    printf("mask_out_artifacts compute_norms: %ld/%ld (%d%%)\n", num_intervals_handled, num_intervals, (int)(num_intervals_handled * 100.0 / num_intervals));
+                    status_timer.restart();
+                }
             }
-            norms.set(sqrt(sumsqr), m, i);
         }
     }
+    return norms;
+}
+
+Mda compute_artifact_mask(const DiskReadMda32& X, double threshold, int interval_size)
+{
+    long M = X.N1();
+    Mda norms = compute_interval_norms(X, interval_size);
+    long num_intervals = norms.N2();
 
-    //determine which chunks, on which channels, to use
-    Mda use_it(M, N / interval_size);
-    for (long i = 0; i < use_it.totalSize(); i++)
-        use_it.set(1, i);
-    for (int m = 0; m < M; m++) {
-        QVector<double> vals;
-        for (long i = 0; i < norms.N2(); i++) {
-            vals << norms.get(m, i);
+    //determine which intervals, on which channels, to use
+    QVector<char> use_it(M * num_intervals, 1);
+    for (long m = 0; m < M; m++) {
+        QVector<double> vals(num_intervals);
+        for (long i = 0; i < num_intervals; i++) {
+            vals[i] = norms.get(m, i);
         }
         double sigma0 = MLCompute::stdev(vals);
         double mean0 = MLCompute::mean(vals);
-        for (int i = 0; i < norms.N2(); i++) {
-            if (norms.value(m, i) > mean0 + sigma0 * threshold) {
-                use_it.setValue(0, m, i - 1); //don't use the neighbor chunks either
-                use_it.setValue(0, m, i);
-                use_it.setValue(0, m, i + 1); //don't use the neighbor chunks either
+        for (long i = 0; i < num_intervals; i++) {
+            if (vals[i] > mean0 + sigma0 * threshold) {
+                //don't use the neighbor intervals either
+                for (long i2 = qMax(0L, i - 1); i2 <= qMin(num_intervals - 1, i + 1); i2++)
+                    use_it[m + M * i2] = 0;
             }
         }
     }
 
-    //write the data
-    long num_timepoints_used = 0;
-    long num_timepoints_not_used = 0;
-    DiskWriteMda Y;
-    Y.open(MDAIO_TYPE_FLOAT32, timeseries_out_path, M, N);
-    for (long i = 0; i < N / interval_size; i++) {
-        long timepoint = i * interval_size;
-        if (status_timer.elapsed() > 5000) {
-            printf("mask_out_artifacts write data: %ld/%ld (%d%%)\n", timepoint, N, (int)(timepoint * 100.0 / N));
-            status_timer.restart();
-        }
-        Mda chunk;
-        X.readChunk(chunk, 0, timepoint, M, interval_size);
-        for (int m = 0; m < M; m++) {
-            if (use_it.value(m, i)) {
-                num_timepoints_used += interval_size;
-                Y.writeChunk(chunk, 0, timepoint);
+    //consecutive masked intervals of a channel become a single range
+    QList<long> channels, t1s, t2s;
+    for (long m = 0; m < M; m++) {
+        long i = 0;
+        while (i < num_intervals) {
+            if (use_it[m + M * i]) {
+                i++;
+                continue;
             }
-            else {
-                num_timepoints_not_used += interval_size;
+            long i1 = i;
+            while ((i < num_intervals) && (!use_it[m + M * i]))
+                i++;
+            channels << m + 1;
+            t1s << i1 * interval_size;
+            t2s << i * interval_size - 1;
+        }
+    }
+    Mda mask(3, channels.count());
+    for (long j = 0; j < channels.count(); j++) {
+        mask.setValue(channels[j], 0, j);
+        mask.setValue(t1s[j], 1, j);
+        mask.setValue(t2s[j], 2, j);
+    }
+    return mask;
+}
+
+void apply_artifact_mask(Mda32& chunk, long timepoint, const Mda& mask)
+{
+    long M = chunk.N1();
+    long N = chunk.N2();
+    float* ptr = chunk.dataPtr();
+    for (long j = 0; j < mask.N2(); j++) {
+        long m = (long)mask.value(0, j) - 1;
+        long t1 = qMax((long)mask.value(1, j), timepoint) - timepoint;
+        long t2 = qMin((long)mask.value(2, j), timepoint + N - 1) - timepoint;
+        if ((m < 0) || (m >= M))
+            continue;
+        for (long t = t1; t <= t2; t++)
+            ptr[m + M * t] = 0;
+    }
+}
+
+static long num_masked_timepoints(const Mda& mask)
+{
+    long ret = 0;
+    for (long j = 0; j < mask.N2(); j++)
+        ret += (long)mask.value(2, j) - (long)mask.value(1, j) + 1;
+    return ret;
+}
+
+bool compute_artifact_mask(const QString& timeseries_path, const QString& mask_out_path, double threshold, int interval_size)
+{
+    if ((!threshold) || (interval_size <= 0)) {
+        printf("Problem with input parameters. Either threshold or interval_size is zero.\n");
+        return false;
+    }
+    DiskReadMda32 X(timeseries_path);
+    Mda mask = compute_artifact_mask(X, threshold, interval_size);
+    long num_timepoints = X.N1() * (X.N2() / interval_size) * interval_size;
+    if (num_timepoints)
+        printf("Using %.2f%% of all timepoints\n", (num_timepoints - num_masked_timepoints(mask)) * 100.0 / num_timepoints);
+    return mask.write64(mask_out_path);
+}
+
+bool mask_out_artifacts(const QString& timeseries_path, const QString& timeseries_out_path, double threshold, int interval_size)
+{
+    if ((!threshold) || (interval_size <= 0)) {
+        printf("Problem with input parameters. Either threshold or interval_size is zero.\n");
+        return false;
+    }
+
+    DiskReadMda32 X(timeseries_path);
+    long M = X.N1();
+    long N = X.N2();
+    Mda mask = compute_artifact_mask(X, threshold, interval_size);
+
+    //write the data in large chunks, zeroing the masked ranges in memory (the timepoints after the last whole
+    //interval are copied as they are)
+    DiskWriteMda Y;
+    Y.setAsynchronous(true);
+    if (!Y.open(MDAIO_TYPE_FLOAT32, timeseries_out_path, M, N)) {
+        qWarning() << "Unable to open output file: " + timeseries_out_path;
+        return false;
+    }
+    long chunk_size = chunk_size_in_intervals(M, interval_size) * interval_size;
+    long num_chunks = (N + chunk_size - 1) / chunk_size;
+    QTime status_timer;
+    status_timer.start();
+    long num_timepoints_handled = 0;
+#pragma omp parallel
+    {
+        DiskReadMda32 X_local; //each thread reads with its own file handle
+#pragma omp critical(mask_out_artifacts_write)
+        X_local = X;
+#pragma omp for schedule(dynamic)
+        for (long c = 0; c < num_chunks; c++) {
+            long timepoint = c * chunk_size;
+            Mda32 chunk;
+            X_local.readChunk(chunk, 0, timepoint, M, qMin(chunk_size, N - timepoint));
+            apply_artifact_mask(chunk, timepoint, mask);
+            //thread safe in asynchronous mode
+            Y.writeChunk(chunk, 0, timepoint);
+#pragma omp critical(mask_out_artifacts_write)
+            {
+                num_timepoints_handled += chunk.N2();
+                if (status_timer.elapsed() > 5000) {
+                    printf("mask_out_artifacts write data: %ld/%ld (%d%%)\n", num_timepoints_handled, N, (int)(num_timepoints_handled * 100.0 / N));
+                    status_timer.restart();
+                }
             }
         }
     }
-    Y.close();
+    if (!Y.close()) {
+        qWarning() << "Problem writing output file: " + timeseries_out_path;
+        return false;
+    }
 
-    printf("Using %.2f%% of all timepoints\n", num_timepoints_used * 100.0 / (num_timepoints_used + num_timepoints_not_used));
+    long num_timepoints = M * (N / interval_size) * interval_size;
+    if (num_timepoints)
+        printf("Using %.2f%% of all timepoints\n", (num_timepoints - num_masked_timepoints(mask)) * 100.0 / num_timepoints);
 
     return true;
 }
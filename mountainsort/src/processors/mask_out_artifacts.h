@@ -7,7 +7,25 @@
 #define MASK_OUT_ARTIFACTS_H
 
 #include <QString>
+#include "diskreadmda32.h"
+#include "mda.h"
+#include "mda32.h"
+
+/*
+ * An interval of a channel is an artifact when its norm exceeds the mean of that channel by threshold standard
+ * deviations -- it is masked out together with its two neighbors.
+ *
+ * The mask is a compact 3xL array of masked ranges, one per column: channel (1-based), first timepoint, last
+ * timepoint (inclusive), by channel and then by time. compute_artifact_mask writes only this array, and processors
+ * downstream can zero the ranges as they read with apply_artifact_mask, rather than reading a masked copy of the
+ * whole timeseries.
+ */
 
 bool mask_out_artifacts(const QString& timeseries_path, const QString& timeseries_out_path, double threshold, int interval_size);
+bool compute_artifact_mask(const QString& timeseries_path, const QString& mask_out_path, double threshold, int interval_size);
+
+Mda compute_artifact_mask(const DiskReadMda32& X, double threshold, int interval_size);
+//zeros the masked ranges that fall in chunk, which starts at the given timepoint
+void apply_artifact_mask(Mda32& chunk, long timepoint, const Mda& mask);
 
 #endif // MASK_OUT_ARTIFACTS_H
@@ -12,7 +12,7 @@ mask_out_artifacts_Processor::mask_out_artifacts_Processor()
     d->q = this;
 
     this->setName("mask_out_artifacts");
-    this->setVersion("0.1");
+    this->setVersion("0.2");
     this->setInputFileParameters("timeseries");
     this->setOutputFileParameters("timeseries_out");
     this->setRequiredParameters("threshold", "interval_size");
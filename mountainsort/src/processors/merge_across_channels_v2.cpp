@@ -6,6 +6,7 @@
 
 #include "merge_across_channels_v2.h"
 #include "diskreadmda.h"
+#include "mdaview.h"
 #include "mlcommon.h"
 #include "mlcommon.h"
 #include "compute_templates_0.h"
@@ -18,6 +19,7 @@ bool peaks_are_within_range_to_consider(double p1, double p2, merge_across_chann
 bool peaks_are_within_range_to_consider(double p11, double p12, double p21, double p22, merge_across_channels_v2_opts opts);
 bool cluster_is_already_being_used(const QVector<double>& times_in, const QVector<double>& other_times_in, merge_across_channels_v2_opts opts);
 QList<long> reverse_order(const QList<long>& inds);
+QVector<QVector<long> > get_inds_by_label(const QVector<int>& labels, int K);
 
 bool merge_across_channels_v2(const QString& timeseries_path, const QString& firings_path, const QString& firings_out_path, const merge_across_channels_v2_opts& opts)
 {
@@ -44,53 +46,70 @@ bool merge_across_channels_v2(const QString& timeseries_path, const QString& fir
     }
     int K = MLCompute::max<int>(labels);
 
+    //the events of each cluster, found once rather than by a scan of all the events for every cluster and pair
+    QVector<QVector<long> > inds_by_label = get_inds_by_label(labels, K);
+    QVector<int> peakchans_by_label(K + 1, 0);
+    for (int k = 1; k <= K; k++) {
+        if (!inds_by_label[k].isEmpty())
+            peakchans_by_label[k] = peakchans[inds_by_label[k][0]]; //the peak channel should be the same for all events with this label, so we just need to look at the first one
+    }
+
     //compute the average waveforms (aka templates)
     Mda templates = compute_templates_0(X, times, labels, opts.clip_size);
+    MdaView templates_view = templates.view();
 
     Mda channel_peaks(M, K);
+    double* channel_peaks_ptr = channel_peaks.dataPtr();
+#pragma omp parallel for
     for (int k = 0; k < K; k++) {
         for (int m = 0; m < M; m++) {
             double peak_value = 0;
             for (int t = 0; t < T; t++) {
-                double val = templates.value(m, t, k);
+                double val = templates_view.get(m, t, k);
                 if (qAbs(val) > qAbs(peak_value)) {
                     peak_value = val;
                 }
             }
-            channel_peaks.setValue(peak_value, m, k);
+            channel_peaks_ptr[m + M * k] = peak_value;
         }
     }
 
-    //find the candidate pairs for merging
+    //find the candidate pairs for merging -- the whole matrix, read from the channel peaks in parallel over the rows
     Mda candidate_pairs(K, K);
+    double* candidate_pairs_ptr = candidate_pairs.dataPtr();
+#pragma omp parallel for schedule(dynamic)
     for (int k1 = 0; k1 < K; k1++) {
-        QVector<long> inds1 = find_label_inds(labels, k1 + 1);
-        if (!inds1.isEmpty()) {
-
-            for (int k2 = 0; k2 < K; k2++) {
-                QVector<long> inds2 = find_label_inds(labels, k2 + 1);
-                if (!inds2.isEmpty()) {
-                    int peakchan1 = peakchans[inds1[0]]; //the peak channel should be the same for all events with this labels, so we just need to look at the first one
-                    int peakchan2 = peakchans[inds2[0]];
-                    if (peakchan1 != peakchan2) { //only attempt to merge if the peak channels are different -- that's why it's called "merge_across_channels"
-                        double val11 = channel_peaks.value(peakchan1 - 1, k1);
-                        double val12 = channel_peaks.value(peakchan2 - 1, k1);
-                        double val21 = channel_peaks.value(peakchan1 - 1, k2);
-                        double val22 = channel_peaks.value(peakchan2 - 1, k2);
-                        if (peaks_are_within_range_to_consider(val11, val12, val21, val22, opts)) {
-                            printf("Within range to consider: m=(%d,%d) k=(%d,%d) %g,%g,%g,%g\n", peakchan1, peakchan2, k1, k2, val11, val12, val21, val22);
-                            candidate_pairs.setValue(1, k1, k2);
-                        }
-                    }
+        int peakchan1 = peakchans_by_label[k1 + 1];
+        if (!peakchan1)
+            continue;
+        for (int k2 = 0; k2 < K; k2++) {
+            int peakchan2 = peakchans_by_label[k2 + 1];
+            if ((peakchan2) && (peakchan1 != peakchan2)) { //only attempt to merge if the peak channels are different -- that's why it's called "merge_across_channels"
+                double val11 = channel_peaks.value(peakchan1 - 1, k1);
+                double val12 = channel_peaks.value(peakchan2 - 1, k1);
+                double val21 = channel_peaks.value(peakchan1 - 1, k2);
+                double val22 = channel_peaks.value(peakchan2 - 1, k2);
+                if (peaks_are_within_range_to_consider(val11, val12, val21, val22, opts)) {
+                    candidate_pairs_ptr[k1 + K * k2] = 1;
                 }
             }
         }
     }
+    for (int k1 = 0; k1 < K; k1++) {
+        for (int k2 = 0; k2 < K; k2++) {
+            if (candidate_pairs.get(k1, k2)) {
+                int peakchan1 = peakchans_by_label[k1 + 1];
+                int peakchan2 = peakchans_by_label[k2 + 1];
+                printf("Within range to consider: m=(%d,%d) k=(%d,%d) %g,%g,%g,%g\n", peakchan1, peakchan2, k1, k2,
+                    channel_peaks.value(peakchan1 - 1, k1), channel_peaks.value(peakchan2 - 1, k1), channel_peaks.value(peakchan1 - 1, k2), channel_peaks.value(peakchan2 - 1, k2));
+            }
+        }
+    }
 
     //sort by largest peak so we can go through in order
     QVector<double> abs_peaks_on_own_channels;
     for (int k = 0; k < K; k++) {
-        abs_peaks_on_own_channels << channel_peaks.value(peakchans[k] - 1, k);
+        abs_peaks_on_own_channels << channel_peaks.value(peakchans_by_label[k + 1] - 1, k);
     }
     QList<long> inds1 = get_sort_indices(abs_peaks_on_own_channels);
     inds1 = reverse_order(inds1);
@@ -101,17 +120,17 @@ bool merge_across_channels_v2(const QString& timeseries_path, const QString& fir
         clusters_to_use << false;
     for (int ii = 0; ii < inds1.count(); ii++) {
         int ik = inds1[ii];
-        QVector<long> inds_k = find_label_inds(labels, ik + 1);
+        const QVector<long>& inds_k = inds_by_label[ik + 1];
         QVector<double> times_k;
         for (long a = 0; a < inds_k.count(); a++) {
             times_k << times[inds_k[a]];
         }
         QVector<double> other_times;
         for (int ik2 = 0; ik2 < K; ik2++) {
-            if (candidate_pairs.value(ik, ik2)) {
+            if (candidate_pairs.get(ik, ik2)) {
                 printf("Merge candidate pair: %d,%d\n", ik + 1, ik2 + 1);
                 if (clusters_to_use[ik2]) { //we are already using the other one
-                    QVector<long> inds_k2 = find_label_inds(labels, ik2 + 1);
+                    const QVector<long>& inds_k2 = inds_by_label[ik2 + 1];
                     for (long a = 0; a < inds_k2.count(); a++) {
                         other_times << times[inds_k2[a]];
                     }
@@ -131,7 +150,7 @@ bool merge_across_channels_v2(const QString& timeseries_path, const QString& fir
     QVector<long> inds_to_use;
     for (long ii = 0; ii < L; ii++) {
         int ik = labels[ii] - 1;
-        if (clusters_to_use[ik]) {
+        if ((ik >= 0) && (clusters_to_use[ik])) {
             inds_to_use << ii;
         }
     }
@@ -228,3 +247,15 @@ QList<long> reverse_order(const QList<long>& inds)
     }
     return ret;
 }
+
+QVector<QVector<long> > get_inds_by_label(const QVector<int>& labels, int K)
+{
+    //ret[k] are the indices of the events with label k (1<=k<=K), in increasing order
+    QVector<QVector<long> > ret(K + 1);
+    for (long i = 0; i < labels.count(); i++) {
+        int k = labels[i];
+        if ((k >= 1) && (k <= K))
+            ret[k] << i;
+    }
+    return ret;
+}
@@ -15,13 +15,21 @@
 #include "extract_clips.h"
 #include "msmisc.h"
 #include "isocut.h"
+#include "msprefs.h"
 
-bool check_if_merge_candidate(double& best_dt0, Mda& template1, Mda& template2, double peakchan1, double peakchan2, const merge_stage_opts& opts);
+struct merge_candidate_2 {
+    int k1, k2;
+    double best_dt0;
+};
+
+QVector<QVector<long>> get_inds_by_label_2(const QVector<int>& labels, int K);
+QList<merge_candidate_2> find_merge_candidates_2(const Mda& templates, const QVector<QVector<long>>& inds_by_label, const QVector<int>& peakchans_by_label, const merge_stage_opts& opts);
 void make_reflexive_and_transitive_2(Mda& S, Mda& best_dt);
 Mda remove_redundant_events_2(Mda& firings, int maxdt);
 QVector<int> remove_unused_labels_2(const QVector<int>& labels);
 bool test_for_merge(const QVector<double>& X1, const QVector<double>& X2);
 bool test_for_merge(const Mda& clips1, const Mda& clips2);
+bool test_for_merge(const Mda& clips1, const Mda& W1, const Mda& clips2, const Mda& W2);
 
 bool merge_stage(const QString& timeseries_path, const QString& firings_path, const QString& firings_out_path, const merge_stage_opts& opts)
 {
@@ -29,8 +37,6 @@ bool merge_stage(const QString& timeseries_path, const QString& firings_path, co
     Mda firings;
     firings.read(firings_path);
 
-    int M = X.N1();
-    int T = opts.clip_size;
     long L = firings.N2();
 
     //setup arrays for peakchans, times, labels
@@ -44,41 +50,112 @@ bool merge_stage(const QString& timeseries_path, const QString& firings_path, co
     }
     int K = MLCompute::max<int>(labels);
 
+    //the events of each cluster, found once rather than for every pair
+    QVector<QVector<long>> inds_by_label = get_inds_by_label_2(labels, K);
+    QVector<int> peakchans_by_label(K + 1, 0);
+    for (int k = 1; k <= K; k++) {
+        if (!inds_by_label[k].isEmpty())
+            peakchans_by_label[k] = peakchans[inds_by_label[k][0]];
+    }
+
     Mda templates = compute_templates_0(X, times, labels, opts.clip_size);
 
     //assemble the merge_matrix (binary) and best_dt
     printf("Assembling the merge matrix...\n");
     Mda merge_matrix(K, K);
     Mda best_dt(K, K);
-    for (int k1 = 1; k1 <= K; k1++) {
-        for (int k2 = k1 + 1; k2 <= K; k2++) {
-            QList<long> inds1 = find_inds(labels, k1);
-            QList<long> inds2 = find_inds(labels, k2);
-            if ((!inds1.isEmpty()) && (!inds2.isEmpty())) {
-                Mda template1, template2;
-                templates.getChunk(template1, 0, 0, k1 - 1, M, T, 1);
-                templates.getChunk(template2, 0, 0, k2 - 1, M, T, 1);
-                int peakchan1 = peakchans[inds1[0]];
-                int peakchan2 = peakchans[inds2[0]];
-                double best_dt0;
-                if (check_if_merge_candidate(best_dt0, template1, template2, peakchan1, peakchan2, opts)) {
-                    printf("Candidate: (%d,%d) dt=%g\n", k1, k2, best_dt0);
-                    QVector<double> times1, times2;
-                    for (long a = 0; a < inds1.count(); a++)
-                        times1 << times[inds1[a]];
-                    for (long a = 0; a < inds2.count(); a++)
-                        times2 << times[inds2[a]] - best_dt0; //do the time correction (very important)
-                    Mda clips1 = extract_clips(X, times1, opts.clip_size);
-                    Mda clips2 = extract_clips(X, times2, opts.clip_size);
-                    if (test_for_merge(clips1, clips2)) {
-                        merge_matrix.setValue(1, k1 - 1, k2 - 1);
-                        best_dt.setValue(best_dt0, k1 - 1, k2 - 1);
+    QList<merge_candidate_2> candidates = find_merge_candidates_2(templates, inds_by_label, peakchans_by_label, opts);
+    for (int i = 0; i < candidates.count(); i++) {
+        printf("Candidate: (%d,%d) dt=%g\n", candidates[i].k1, candidates[i].k2, candidates[i].best_dt0);
+    }
+
+    //the clusters involved in a candidate pair
+    QList<int> involved_labels;
+    {
+        QVector<int> involved(K + 1, 0);
+        for (int i = 0; i < candidates.count(); i++) {
+            involved[candidates[i].k1] = 1;
+            involved[candidates[i].k2] = 1;
+        }
+        for (int k = 1; k <= K; k++) {
+            if (involved[k])
+                involved_labels << k;
+        }
+    }
+
+    //extract the clips of each of these clusters once (rather than once per pair), keeping them as long as they fit in memory
+    //note that best_dt0 is always zero (see check_if_merge_candidate_2), so the time correction does not change the clips
+    QVector<Mda> clips_by_label(K + 1);
+    QVector<int> clips_kept(K + 1, 0);
+    QVector<Mda> mean_clips_by_label(K + 1);
+    {
+        Mda* mean_clips_ptr = mean_clips_by_label.data();
+        long clip_memory_used = 0;
+#pragma omp parallel
+        {
+            DiskReadMda X_local; //each thread reads with its own file handle
+#pragma omp critical(lock1)
+            X_local = X;
+#pragma omp for schedule(dynamic)
+            for (int ii = 0; ii < involved_labels.count(); ii++) {
+                int k = involved_labels[ii];
+                QVector<double> times_k;
+                for (long a = 0; a < inds_by_label[k].count(); a++)
+                    times_k << times[inds_by_label[k][a]];
+                Mda clips_k = extract_clips(X_local, times_k, opts.clip_size);
+                mean_clips_ptr[k] = compute_mean_clip(clips_k);
+                long num_bytes = clips_k.totalSize() * sizeof(double);
+#pragma omp critical(lock2)
+                {
+                    if (clip_memory_used + num_bytes <= MERGE_STAGE_CLIP_MEMORY_SIZE) {
+                        clips_by_label[k] = clips_k;
+                        clips_kept[k] = 1;
+                        clip_memory_used += num_bytes;
                     }
                 }
             }
         }
     }
 
+    //test the candidate pairs in parallel
+    QVector<int> do_merge(candidates.count(), 0);
+    int* do_merge_ptr = do_merge.data();
+#pragma omp parallel
+    {
+        DiskReadMda X_local;
+#pragma omp critical(lock1)
+        X_local = X;
+#pragma omp for schedule(dynamic)
+        for (int i = 0; i < candidates.count(); i++) {
+            int k1 = candidates[i].k1;
+            int k2 = candidates[i].k2;
+            Mda clips1 = clips_by_label.at(k1);
+            Mda clips2 = clips_by_label.at(k2);
+            //clips that did not fit in memory are extracted again
+            if (!clips_kept[k1]) {
+                QVector<double> times1;
+                for (long a = 0; a < inds_by_label[k1].count(); a++)
+                    times1 << times[inds_by_label[k1][a]];
+                clips1 = extract_clips(X_local, times1, opts.clip_size);
+            }
+            if (!clips_kept[k2]) {
+                QVector<double> times2;
+                for (long a = 0; a < inds_by_label[k2].count(); a++)
+                    times2 << times[inds_by_label[k2][a]] - candidates[i].best_dt0; //do the time correction (very important)
+                clips2 = extract_clips(X_local, times2, opts.clip_size);
+            }
+            if (test_for_merge(clips1, mean_clips_by_label.at(k1), clips2, mean_clips_by_label.at(k2)))
+                do_merge_ptr[i] = 1;
+        }
+    }
+    for (int i = 0; i < candidates.count(); i++) {
+        if (do_merge[i]) {
+            merge_matrix.setValue(1, candidates[i].k1 - 1, candidates[i].k2 - 1);
+            best_dt.setValue(candidates[i].best_dt0, candidates[i].k1 - 1, candidates[i].k2 - 1);
+        }
+    }
+    clips_by_label.clear();
+
     //make the matrix reflexive and transitive
     make_reflexive_and_transitive_2(merge_matrix, best_dt);
 
@@ -152,56 +229,55 @@ void make_reflexive_and_transitive_2(Mda& S, Mda& best_dt)
     }
 }
 
-double max_absolute_value_on_channel_2(Mda& template1, int channel)
+QVector<QVector<long>> get_inds_by_label_2(const QVector<int>& labels, int K)
 {
-    QVector<double> vals;
-    for (int i = 0; i < template1.N2(); i++) {
-        vals << qAbs(template1.value(channel - 1, i));
+    //ret[k] are the indices of the events with label k (1<=k<=K), in increasing order
+    QVector<QVector<long>> ret(K + 1);
+    for (long i = 0; i < labels.count(); i++) {
+        int k = labels[i];
+        if ((k >= 1) && (k <= K))
+            ret[k] << i;
     }
-    return MLCompute::max(vals);
-}
-
-double compute_noncentered_correlation_2(long N, double* X1, double* X2)
-{
-    double S12 = 0, S11 = 0, S22 = 0;
-    for (long i = 0; i < N; i++) {
-        S12 += X1[i] * X2[i];
-        S11 += X1[i] * X1[i];
-        S22 += X2[i] * X2[i];
-    }
-    if ((!S11) || (!S22))
-        return 0;
-    return S12 / (sqrt(S11) * sqrt(S22));
+    return ret;
 }
 
-Mda time_shift_template_2(Mda& template0, int dt)
+double max_absolute_value_on_channel_2(const MdaView& template1, int channel)
 {
-    int M = template0.N1();
-    int T = template0.N2();
-    Mda ret(M, T);
-    for (int t = 0; t < T; t++) {
-        for (int m = 0; m < M; m++) {
-            ret.setValue(template0.value(m, t - dt), m, t);
-        }
+    double ret = 0;
+    for (int i = 0; i < template1.N2(); i++) {
+        ret = qMax(ret, qAbs(template1.value(channel - 1, i)));
     }
     return ret;
 }
 
-double compute_sliding_noncentered_correlation_2(Mda& template1, Mda& template2)
+//the same as the correlation of time-shifted copies of template1 with template2 (maximized over the shifts),
+//but without the copies: for a shift of dt the overlapping columns of the two templates are contiguous,
+//and the energy of the overlapping part of template1 comes from its cumulative column energies
+double compute_sliding_noncentered_correlation_2(const MdaView& template1, const MdaView& template2, const double* cumulative_energy1, double energy2)
 {
     int M = template1.N1();
     int T = template1.N2();
+    const double* ptr1 = template1.constDataPtr();
+    const double* ptr2 = template2.constDataPtr();
     double best = 0;
+    if (!energy2)
+        return best;
     for (int dt = -T / 2; dt <= T / 2; dt++) {
-        Mda template1b = time_shift_template_2(template1, dt);
-        double val = compute_noncentered_correlation_2(M * T, template1b.dataPtr(), template2.dataPtr());
+        long len = T - qAbs(dt);
+        long t1 = qMax(0, -dt); //first column of template1 that overlaps
+        long t2 = qMax(0, dt); //and the corresponding column of template2
+        double S11 = cumulative_energy1[t1 + len] - cumulative_energy1[t1];
+        if (!S11)
+            continue;
+        double S12 = MLCompute::dotProduct(M * len, &ptr1[M * t1], &ptr2[M * t2]);
+        double val = S12 / (sqrt(S11) * sqrt(energy2));
         if (val > best)
             best = val;
     }
     return best;
 }
 
-bool check_if_merge_candidate(double& best_dt0, Mda& template1, Mda& template2, double peakchan1, double peakchan2, const merge_stage_opts& opts)
+bool check_if_merge_candidate_2(double& best_dt0, const MdaView& template1, const MdaView& template2, const double* cumulative_energy1, double energy2, double peakchan1, double peakchan2, const merge_stage_opts& opts)
 {
     //values to return if no merge
     best_dt0 = 0;
@@ -214,8 +290,7 @@ bool check_if_merge_candidate(double& best_dt0, Mda& template1, Mda& template2,
     }
 
     //min_template_corr_coef criterion
-    //double r12 = compute_noncentered_correlation_2(M * T, template1.dataPtr(), template2.dataPtr());
-    double r12 = compute_sliding_noncentered_correlation_2(template1, template2);
+    double r12 = compute_sliding_noncentered_correlation_2(template1, template2, cumulative_energy1, energy2);
     if (r12 < opts.min_template_corr_coef) {
         return false;
     }
@@ -223,6 +298,59 @@ bool check_if_merge_candidate(double& best_dt0, Mda& template1, Mda& template2,
     return true;
 }
 
+QList<merge_candidate_2> find_merge_candidates_2(const Mda& templates, const QVector<QVector<long>>& inds_by_label, const QVector<int>& peakchans_by_label, const merge_stage_opts& opts)
+{
+    int M = templates.N1();
+    int T = templates.N2();
+    int K = templates.N3();
+    MdaView templates_view = templates.view();
+
+    //cumulative column energies of each template, so that the energy of any range of columns is a difference
+    Mda cumulative_energies(T + 1, K);
+    for (int k = 0; k < K; k++) {
+        double* ptr = cumulative_energies.dataPtr(0, k);
+        ptr[0] = 0;
+        for (int t = 0; t < T; t++) {
+            double sumsqr = 0;
+            for (int m = 0; m < M; m++) {
+                double val = templates_view.get(m, t, k);
+                sumsqr += val * val;
+            }
+            ptr[t + 1] = ptr[t] + sumsqr;
+        }
+    }
+    const double* cumulative_energies_ptr = cumulative_energies.constDataPtr();
+
+    //all the pairs in one parallel pass, each row k1 by one thread
+    QVector<QList<merge_candidate_2>> candidates_by_row(K + 1);
+    QList<merge_candidate_2>* candidates_by_row_ptr = candidates_by_row.data();
+#pragma omp parallel for schedule(dynamic)
+    for (int k1 = 1; k1 <= K; k1++) {
+        if (inds_by_label[k1].isEmpty())
+            continue;
+        MdaView template1 = templates_view.slice(k1 - 1);
+        const double* cumulative_energy1 = &cumulative_energies_ptr[(T + 1) * (k1 - 1)];
+        for (int k2 = k1 + 1; k2 <= K; k2++) {
+            if (inds_by_label[k2].isEmpty())
+                continue;
+            double energy2 = cumulative_energies_ptr[(T + 1) * (k2 - 1) + T];
+            double best_dt0;
+            if (check_if_merge_candidate_2(best_dt0, template1, templates_view.slice(k2 - 1), cumulative_energy1, energy2, peakchans_by_label[k1], peakchans_by_label[k2], opts)) {
+                merge_candidate_2 C;
+                C.k1 = k1;
+                C.k2 = k2;
+                C.best_dt0 = best_dt0;
+                candidates_by_row_ptr[k1] << C;
+            }
+        }
+    }
+
+    QList<merge_candidate_2> ret;
+    for (int k1 = 1; k1 <= K; k1++)
+        ret.append(candidates_by_row[k1]);
+    return ret;
+}
+
 Mda remove_redundant_events_2(Mda& firings, int maxdt)
 {
     QVector<double> times;
@@ -234,12 +362,13 @@ Mda remove_redundant_events_2(Mda& firings, int maxdt)
         labels << (int)firings.value(2, i);
     }
     int K = MLCompute::max<int>(labels);
+    QVector<QVector<long>> inds_by_label = get_inds_by_label_2(labels, K);
 
     QVector<int> to_use;
     for (long i = 0; i < L; i++)
         to_use << 1;
     for (int k = 1; k <= K; k++) {
-        QList<long> inds_k = find_inds(labels, k);
+        const QVector<long>& inds_k = inds_by_label[k];
         QVector<double> times_k;
         for (long i = 0; i < inds_k.count(); i++)
             times_k << times[inds_k[i]];
@@ -359,14 +488,17 @@ bool test_for_merge(const QVector<double>& X1, const QVector<double>& X2)
 }
 
 bool test_for_merge(const Mda& clips1, const Mda& clips2)
+{
+    return test_for_merge(clips1, compute_mean_clip(clips1), clips2, compute_mean_clip(clips2));
+}
+
+bool test_for_merge(const Mda& clips1, const Mda& W1, const Mda& clips2, const Mda& W2)
 {
     int M = clips1.N1();
     int T = clips1.N2();
     long L1 = clips1.N3();
     long L2 = clips2.N3();
 
-    Mda W1 = compute_mean_clip(clips1);
-    Mda W2 = compute_mean_clip(clips2);
     Mda Wdiff(M, T);
     for (long ii = 0; ii < M * T; ii++) {
         Wdiff.setValue(W2.value(ii) - W1.value(ii), ii);
@@ -18,6 +18,8 @@
 #include "jsvm.h"
 #include "noise_nearest.h"
 #include "get_sort_indices.h"
+#include "cluster_metrics_engine.h"
+#include "clip_store.h"
 
 namespace MSMetrics {
 
@@ -25,9 +27,11 @@ struct Metric {
     QList<double> values;
 };
 
-double compute_noise_overlap(const DiskReadMda32& X, const QVector<double>& times, ms_metrics_opts opts);
-double compute_overlap(const DiskReadMda32& X, const QVector<double>& times1, const QVector<double>& times2, ms_metrics_opts opts);
-QSet<QString> get_pairs_to_compare(const DiskReadMda32& X, const DiskReadMda& F, int num_comparisons_per_cluster, ms_metrics_opts opts);
+double compute_noise_overlap(const Mda32& clips, const Mda32& noise_clips, ms_metrics_opts opts);
+double compute_overlap(const Mda32& clips1, const Mda32& clips2, ms_metrics_opts opts);
+QSet<QString> get_pairs_to_compare(const Mda32& templates, int num_comparisons_per_cluster, ms_metrics_opts opts);
+long random_time(long N, int clip_size);
+Mda32 concatenate_clips(const Mda32& clips1, const Mda32& clips2);
 
 bool ms_metrics(QString timeseries, QString firings, QString cluster_metrics_path, QString cluster_pair_metrics_path, ms_metrics_opts opts)
 {
@@ -64,6 +68,23 @@ bool ms_metrics(QString timeseries, QString firings, QString cluster_metrics_pat
         }
     }
 
+    //indexes the events by label, and keeps the sampled clips of each cluster for the pair metrics
+    ClusterMetricsEngine engine(X, times, labels, opts.clip_size);
+    ClipStore clip_store; //the clips come from here when the store can be opened or made
+    if (clip_store.open(timeseries, firings, opts.clip_size))
+        engine.setClipStore(&clip_store);
+    int num_clusters = opts.cluster_numbers.count();
+    int M = X.N1();
+    int T = opts.clip_size;
+
+    //the random times of the noise clips are drawn here, in the order of the clusters, so that they do not depend on the threads
+    QVector<QVector<double> > noise_times(num_clusters);
+    for (int i = 0; i < num_clusters; i++) {
+        long num_to_use = qMin((long)opts.max_num_to_use, engine.eventCount(opts.cluster_numbers[i]));
+        for (long j = 0; j < num_to_use; j++)
+            noise_times[i] << random_time(X.N2(), opts.clip_size);
+    }
+
     /*
     noise_nearest_opts nn_opts;
     nn_opts.cluster_numbers = opts.cluster_numbers;
@@ -73,37 +94,54 @@ bool ms_metrics(QString timeseries, QString firings, QString cluster_metrics_pat
     */
 
     printf("Cluster metrics...\n");
-    QMap<QString, Metric> cluster_metrics;
-    QTime timer;
-    timer.start();
-    for (int i = 0; i < opts.cluster_numbers.count(); i++) {
-        if (timer.elapsed() > 5000) {
-            qDebug() << QString("Cluster %1 of %2").arg(i + 1).arg(opts.cluster_numbers.count());
-            timer.restart();
-        }
-        int k = opts.cluster_numbers[i];
-        QVector<double> times_k;
-        for (long i = 0; i < times.count(); i++) {
-            if (labels[i] == k) {
-                times_k << times[i];
+    QVector<double> peak_amps(num_clusters);
+    QVector<double> peak_noises(num_clusters);
+    QVector<double> noise_overlaps(num_clusters);
+    Mda32 templates(M, T, num_clusters); //for choosing the pairs to compare
+    {
+        double* peak_amps_ptr = peak_amps.data();
+        double* peak_noises_ptr = peak_noises.data();
+        double* noise_overlaps_ptr = noise_overlaps.data();
+        float* templates_ptr = templates.dataPtr();
+        const QVector<double>* noise_times_ptr = noise_times.constData();
+        long num_handled = 0;
+        QTime timer;
+        timer.start();
+        engine.run(num_clusters, [&](long i, const DiskReadMda32& X_local) {
+            int k = opts.cluster_numbers.at(i);
+            Mda32 template_k, stdev_k;
+            engine.computeTemplateAndStdev(template_k, stdev_k, k, X_local);
+            std::copy(template_k.constDataPtr(), template_k.constDataPtr() + M * T, &templates_ptr[M * T * i]);
+            {
+                double min0 = template_k.minimum();
+                double max0 = template_k.maximum();
+                peak_amps_ptr[i] = qMax(qAbs(min0), qAbs(max0));
             }
-        }
-        Mda32 clips_k = extract_clips(X, times_k, opts.clip_size);
-        Mda32 template_k = compute_mean_clip(clips_k);
-        Mda32 stdev_k = compute_stdev_clip(clips_k);
-        {
-            double min0 = template_k.minimum();
-            double max0 = template_k.maximum();
-            cluster_metrics["peak_amp"].values << qMax(qAbs(min0), qAbs(max0));
-        }
-        {
-            double min0 = stdev_k.minimum();
-            double max0 = stdev_k.maximum();
-            cluster_metrics["peak_noise"].values << qMax(qAbs(min0), qAbs(max0));
-        }
-        {
-            cluster_metrics["noise_overlap"].values << compute_noise_overlap(X, times_k, opts);
-        }
+            {
+                double min0 = stdev_k.minimum();
+                double max0 = stdev_k.maximum();
+                peak_noises_ptr[i] = qMax(qAbs(min0), qAbs(max0));
+            }
+            {
+                Mda32 clips_k = engine.sampledClips(k, opts.max_num_to_use, X_local);
+                Mda32 noise_clips = extract_clips(X_local, noise_times_ptr[i], opts.clip_size);
+                noise_overlaps_ptr[i] = compute_noise_overlap(clips_k, noise_clips, opts);
+            }
+#pragma omp critical(ms_metrics_progress)
+            {
+                num_handled++;
+                if (timer.elapsed() > 5000) {
+                    qDebug() << QString("Cluster %1 of %2").arg(num_handled).arg(num_clusters);
+                    timer.restart();
+                }
+            }
+        });
+    }
+    QMap<QString, Metric> cluster_metrics;
+    for (int i = 0; i < num_clusters; i++) {
+        cluster_metrics["peak_amp"].values << peak_amps[i];
+        cluster_metrics["peak_noise"].values << peak_noises[i];
+        cluster_metrics["noise_overlap"].values << noise_overlaps[i];
         /*
         {
             double numer = isolation_matrix.value(i, opts.cluster_numbers.count());
@@ -139,47 +177,53 @@ bool ms_metrics(QString timeseries, QString firings, QString cluster_metrics_pat
     }
 
     printf("get pairs to compare...\n");
-    QSet<QString> pairs_to_compare = get_pairs_to_compare(X, F, 5, opts);
+    QSet<QString> pairs_to_compare = get_pairs_to_compare(templates, 5, opts);
 
     //////////////////////////////////////////////////////////////
     printf("Cluster pair metrics...\n");
-    QMap<QString, Metric> cluster_pair_metrics;
-    QTime timer1;
-    timer1.start();
-    for (int i1 = 0; i1 < opts.cluster_numbers.count(); i1++) {
-        if (timer1.elapsed() > 5000) {
-            qDebug() << QString("Cluster pair metrics %1 of %2").arg(i1 + 1).arg(opts.cluster_numbers.count());
-            timer1.restart();
+    QList<int> pair_i1s, pair_i2s;
+    for (int i1 = 0; i1 < num_clusters; i1++) {
+        for (int i2 = 0; i2 < num_clusters; i2++) {
+            if (pairs_to_compare.contains(QString("%1-%2").arg(opts.cluster_numbers[i1]).arg(opts.cluster_numbers[i2]))) {
+                pair_i1s << i1;
+                pair_i2s << i2;
+            }
         }
-        for (int i2 = 0; i2 < opts.cluster_numbers.count(); i2++) {
-            int k1 = opts.cluster_numbers[i1];
-            int k2 = opts.cluster_numbers[i2];
-
-            if (pairs_to_compare.contains(QString("%1-%2").arg(k1).arg(k2))) {
-                QVector<double> times_k1;
-                for (long i = 0; i < times.count(); i++) {
-                    if (labels[i] == k1) {
-                        times_k1 << times[i];
-                    }
-                }
-                QVector<double> times_k2;
-                for (long i = 0; i < times.count(); i++) {
-                    if (labels[i] == k2) {
-                        times_k2 << times[i];
-                    }
-                }
-                double val = compute_overlap(X, times_k1, times_k2, opts);
+    }
+    QVector<double> overlaps(num_clusters * num_clusters, 0);
+    {
+        double* overlaps_ptr = overlaps.data();
+        long num_handled = 0;
+        QTime timer1;
+        timer1.start();
+        engine.run(pair_i1s.count(), [&](long ii, const DiskReadMda32& X_local) {
+            int i1 = pair_i1s.at(ii);
+            int i2 = pair_i2s.at(ii);
+            int k1 = opts.cluster_numbers.at(i1);
+            int k2 = opts.cluster_numbers.at(i2);
+            long num_to_use = qMin((long)opts.max_num_to_use, qMin(engine.eventCount(k1), engine.eventCount(k2)));
+            if (num_to_use >= opts.min_num_to_use) {
+                //the same sampled clips as for the noise overlap
+                Mda32 clips1 = engine.sampledClips(k1, num_to_use, X_local);
+                Mda32 clips2 = engine.sampledClips(k2, num_to_use, X_local);
+                double val = compute_overlap(clips1, clips2, opts);
                 if (val >= 0.01) { //to save some space in the file
-                    cluster_pair_metrics["overlap"].values << val;
-                }
-                else {
-                    cluster_pair_metrics["overlap"].values << 0;
+                    overlaps_ptr[i1 * num_clusters + i2] = val;
                 }
             }
-            else {
-                cluster_pair_metrics["overlap"].values << 0;
+#pragma omp critical(ms_metrics_progress)
+            {
+                num_handled++;
+                if (timer1.elapsed() > 5000) {
+                    qDebug() << QString("Cluster pair metrics %1 of %2").arg(num_handled).arg(pair_i1s.count());
+                    timer1.restart();
+                }
             }
-        }
+        });
+    }
+    QMap<QString, Metric> cluster_pair_metrics;
+    for (int ii = 0; ii < overlaps.count(); ii++) {
+        cluster_pair_metrics["overlap"].values << overlaps[ii];
     }
 
     QStringList cluster_pair_metric_names = cluster_pair_metrics.keys();
@@ -217,44 +261,32 @@ long random_time(long N, int clip_size)
     return clip_size + (qrand() % (N - clip_size * 2));
 }
 
-QVector<double> sample(const QVector<double>& times, long num)
+Mda32 concatenate_clips(const Mda32& clips1, const Mda32& clips2)
 {
-    QVector<double> random_values(times.count());
-    for (long i = 0; i < times.count(); i++) {
-        random_values[i] = sin(i * 12 + i * i);
-    }
-    QList<long> inds = get_sort_indices(random_values);
-    QVector<double> ret;
-    for (long i = 0; (i < num) && (i < inds.count()); i++) {
-        ret << times[inds[i]];
-    }
+    int M = clips1.N1();
+    int T = clips1.N2();
+    long L1 = clips1.N3();
+    long L2 = clips2.N3();
+    Mda32 ret(M, T, L1 + L2);
+    std::copy(clips1.constDataPtr(), clips1.constDataPtr() + M * T * L1, ret.dataPtr());
+    std::copy(clips2.constDataPtr(), clips2.constDataPtr() + M * T * L2, ret.dataPtr() + M * T * L1);
     return ret;
 }
 
-double compute_noise_overlap(const DiskReadMda32& X, const QVector<double>& times, ms_metrics_opts opts)
+double compute_noise_overlap(const Mda32& clips, const Mda32& noise_clips, ms_metrics_opts opts)
 {
-    int num_to_use = qMin(opts.max_num_to_use, times.count());
-    QVector<double> times_subset = sample(times, num_to_use);
-
-    QVector<double> all_times = times_subset;
     QVector<int> all_labels; //0 and 1
-
-    for (long i = 0; i < times_subset.count(); i++) {
+    for (long i = 0; i < clips.N3(); i++) {
         all_labels << 1;
     }
     //equal amount of random clips
-    for (long i = 0; i < times_subset.count(); i++) {
-        all_times << random_time(X.N2(), opts.clip_size);
+    for (long i = 0; i < noise_clips.N3(); i++) {
         all_labels << 0;
     }
 
-    Mda32 all_clips = extract_clips(X, all_times, opts.clip_size);
+    Mda32 all_clips = concatenate_clips(clips, noise_clips);
 
-    Mda32 all_clips_reshaped(all_clips.N1() * all_clips.N2(), all_clips.N3());
-    long NNN = all_clips.totalSize();
-    for (long iii = 0; iii < NNN; iii++) {
-        all_clips_reshaped.set(all_clips.get(iii), iii);
-    }
+    Mda32View all_clips_reshaped = all_clips.view().reshaped(all_clips.N1() * all_clips.N2(), all_clips.N3()); //no copy
 
     bool subtract_mean = false;
     Mda32 FF;
@@ -284,33 +316,21 @@ double compute_noise_overlap(const DiskReadMda32& X, const QVector<double>& time
     return 1 - (num_correct * 1.0 / num_total);
 }
 
-double compute_overlap(const DiskReadMda32& X, const QVector<double>& times1, const QVector<double>& times2, ms_metrics_opts opts)
+//clips1 and clips2 are the samples of the two clusters (the same number of each)
+double compute_overlap(const Mda32& clips1, const Mda32& clips2, ms_metrics_opts opts)
 {
-    int num_to_use = qMin(qMin(opts.max_num_to_use, times1.count()), times2.count());
-    if (num_to_use < opts.min_num_to_use)
-        return 0;
-    QVector<double> times1_subset = sample(times1, num_to_use);
-    QVector<double> times2_subset = sample(times2, num_to_use);
-
-    QVector<double> all_times;
     QVector<int> all_labels; //1 and 2
 
-    for (long i = 0; i < times1_subset.count(); i++) {
-        all_times << times1_subset[i];
+    for (long i = 0; i < clips1.N3(); i++) {
         all_labels << 1;
     }
-    for (long i = 0; i < times2_subset.count(); i++) {
-        all_times << times2_subset[i];
+    for (long i = 0; i < clips2.N3(); i++) {
         all_labels << 2;
     }
 
-    Mda32 all_clips = extract_clips(X, all_times, opts.clip_size);
+    Mda32 all_clips = concatenate_clips(clips1, clips2);
 
-    Mda32 all_clips_reshaped(all_clips.N1() * all_clips.N2(), all_clips.N3());
-    long NNN = all_clips.totalSize();
-    for (long iii = 0; iii < NNN; iii++) {
-        all_clips_reshaped.set(all_clips.get(iii), iii);
-    }
+    Mda32View all_clips_reshaped = all_clips.view().reshaped(all_clips.N1() * all_clips.N2(), all_clips.N3()); //no copy
 
     bool subtract_mean = false;
     Mda32 FF;
@@ -321,7 +341,7 @@ double compute_overlap(const DiskReadMda32& X, const QVector<double>& times1, co
     tree.create(FF);
     double num_correct = 0;
     double num_total = 0;
-    for (long i = 0; i < all_times.count(); i++) {
+    for (long i = 0; i < all_labels.count(); i++) {
         QVector<float> p;
         for (int j = 0; j < FF.N1(); j++) {
             p << FF.value(j, i);
@@ -340,65 +360,45 @@ double compute_overlap(const DiskReadMda32& X, const QVector<double>& times1, co
     return 1 - (num_correct * 1.0 / num_total);
 }
 
-QVector<long> find_label_inds(const QVector<int>& labels, int k)
-{
-    QVector<long> ret;
-    for (int i = 0; i < labels.count(); i++) {
-        if (labels[i] == k)
-            ret << i;
-    }
-    return ret;
-}
-
-double distsqr_between_templates(const Mda32& X, const Mda32& Y)
+double distsqr_between_templates(const Mda32View& X, const Mda32View& Y)
 {
+    const float* Xptr = X.constDataPtr();
+    const float* Yptr = Y.constDataPtr();
     double ret = 0;
     for (long i = 0; i < X.totalSize(); i++) {
-        double tmp = X.get(i) - Y.get(i);
+        double tmp = Xptr[i] - Yptr[i];
         ret += tmp * tmp;
     }
     return ret;
 }
 
-QSet<QString> get_pairs_to_compare(const DiskReadMda32& X, const DiskReadMda& F, int num_comparisons_per_cluster, ms_metrics_opts opts)
+//templates is MxTxn, in the order of opts.cluster_numbers
+QSet<QString> get_pairs_to_compare(const Mda32& templates, int num_comparisons_per_cluster, ms_metrics_opts opts)
 {
-    QSet<QString> ret;
-
-    QSet<int> cluster_numbers_set;
-    for (int i = 0; i < opts.cluster_numbers.count(); i++) {
-        cluster_numbers_set.insert(opts.cluster_numbers[i]);
-    }
-
-    QVector<double> times;
-    QVector<int> labels;
-    for (long i = 0; i < F.N2(); i++) {
-        int label0 = (int)F.value(2, i);
-        if (cluster_numbers_set.contains(label0)) {
-            //inds << i;
-            times << F.value(1, i);
-            labels << label0;
-        }
-    }
-
-    Mda32 templates0 = compute_templates_0(X, times, labels, opts.clip_size);
-
-    for (int i1 = 0; i1 < opts.cluster_numbers.count(); i1++) {
-        int k1 = opts.cluster_numbers[i1];
-        Mda32 template1;
-        templates0.getChunk(template1, 0, 0, k1 - 1, template1.N1(), template1.N2(), 1);
+    int num_clusters = opts.cluster_numbers.count();
+    Mda32View templates_view = templates.view();
+
+    QVector<QList<QString> > pairs(num_clusters);
+    QList<QString>* pairs_ptr = pairs.data();
+#pragma omp parallel for schedule(dynamic)
+    for (int i1 = 0; i1 < num_clusters; i1++) {
+        int k1 = opts.cluster_numbers.at(i1);
+        Mda32View template1 = templates_view.slice(i1);
         QVector<double> dists;
-        for (int i2 = 0; i2 < opts.cluster_numbers.count(); i2++) {
-            Mda32 template2;
-            int k2 = opts.cluster_numbers[i2];
-            templates0.getChunk(template2, 0, 0, k2 - 1, template2.N1(), template2.N2(), 1);
-            dists << distsqr_between_templates(template1, template2);
+        for (int i2 = 0; i2 < num_clusters; i2++) {
+            dists << distsqr_between_templates(template1, templates_view.slice(i2));
         }
         QList<long> inds = get_sort_indices(dists);
         for (int a = 0; (a < inds.count()) && (a < num_comparisons_per_cluster); a++) {
-            ret.insert(QString("%1-%2").arg(k1).arg(opts.cluster_numbers[inds[a]]));
+            pairs_ptr[i1] << QString("%1-%2").arg(k1).arg(opts.cluster_numbers.at(inds[a]));
         }
     }
 
+    QSet<QString> ret;
+    for (int i1 = 0; i1 < num_clusters; i1++) {
+        foreach (QString pair, pairs[i1])
+            ret.insert(pair);
+    }
     return ret;
 }
 }
@@ -8,6 +8,7 @@
 
 #include <diskreadmda.h>
 #include <diskreadmda32.h>
+#include <firingsstore.h>
 #include "mlcommon.h"
 #include "extract_clips.h"
 #include "synthesize1.h" //for randn
@@ -376,17 +377,13 @@ int get_majority_label(QList<int> labels)
 Mda compute_isolation_matrix(QString timeseries, QString firings, noise_nearest_opts opts)
 {
     DiskReadMda32 X(timeseries);
-    DiskReadMda F(firings);
+    FiringsStore F(firings);
     int num_features = 20;
     int K_nearest = 5;
     int exhaustive_search_num = 15;
 
     //define opts.cluster_numbers in case it is empty
-    QVector<int> labels0;
-    for (long i = 0; i < F.N2(); i++) {
-        labels0 << (int)F.value(2, i);
-    }
-    int K = MLCompute::max(labels0);
+    int K = F.K();
     if (opts.cluster_numbers.isEmpty()) {
         for (int k = 1; k <= K; k++) {
             opts.cluster_numbers << k;
@@ -402,12 +399,16 @@ Mda compute_isolation_matrix(QString timeseries, QString firings, noise_nearest_
     //QVector<long> inds;
     QVector<double> times;
     QVector<int> labels;
-    for (long i = 0; i < F.N2(); i++) {
-        int label0 = (int)F.value(2, i);
-        if (cluster_numbers_set.contains(label0)) {
-            //inds << i;
-            times << F.value(1, i);
-            labels << label0;
+    {
+        FiringsColumn<qint64> times0 = F.times();
+        FiringsColumn<qint32> labels0 = F.labels();
+        for (long i = 0; i < F.eventCount(); i++) {
+            int label0 = labels0[i];
+            if (cluster_numbers_set.contains(label0)) {
+                //inds << i;
+                times << times0[i];
+                labels << label0;
+            }
         }
     }
 
@@ -511,15 +512,11 @@ Mda compute_isolation_matrix(QString timeseries, QString firings, noise_nearest_
 Mda compute_isolation_matrix_old(QString timeseries, QString firings, noise_nearest_opts opts)
 {
     DiskReadMda32 X(timeseries);
-    DiskReadMda F(firings);
+    FiringsStore F(firings);
     int num_features = 0;
 
     //define opts.cluster_numbers in case it is empty
-    QVector<int> labels0;
-    for (long i = 0; i < F.N2(); i++) {
-        labels0 << (int)F.value(2, i);
-    }
-    int K = MLCompute::max(labels0);
+    int K = F.K();
     if (opts.cluster_numbers.isEmpty()) {
         for (int k = 1; k <= K; k++) {
             opts.cluster_numbers << k;
@@ -535,12 +532,16 @@ Mda compute_isolation_matrix_old(QString timeseries, QString firings, noise_near
     //QVector<long> inds;
     QVector<double> times;
     QVector<int> labels;
-    for (long i = 0; i < F.N2(); i++) {
-        int label0 = (int)F.value(2, i);
-        if (cluster_numbers_set.contains(label0)) {
-            //inds << i;
-            times << F.value(1, i);
-            labels << label0;
+    {
+        FiringsColumn<qint64> times0 = F.times();
+        FiringsColumn<qint32> labels0 = F.labels();
+        for (long i = 0; i < F.eventCount(); i++) {
+            int label0 = labels0[i];
+            if (cluster_numbers_set.contains(label0)) {
+                //inds << i;
+                times << times0[i];
+                labels << label0;
+            }
         }
     }
 
@@ -2,6 +2,7 @@
 #include "diskreadmda.h"
 #include "diskwritemda.h"
 #include "mda.h"
+#include "mdaarena.h"
 #include "msprefs.h"
 #include <math.h>
 #include <QDebug>
@@ -34,35 +35,39 @@ bool normalize_channels(const QString& input, const QString& output)
         QTime timer;
         timer.start();
         long num_timepoints_handled = 0;
-#pragma omp parallel for
-        for (long timepoint = 0; timepoint < N; timepoint += chunk_size) {
-            Mda chunk;
+#pragma omp parallel
+        {
+            MdaArenaScope arena_scope;
+#pragma omp for
+            for (long timepoint = 0; timepoint < N; timepoint += chunk_size) {
+                Mda chunk;
 #pragma omp critical(lock1)
-            {
-                X.readChunk(chunk, 0, timepoint, M, qMin(chunk_size, N - timepoint));
-            }
-            double* chunkptr = chunk.dataPtr();
+                {
+                    X.readChunk(chunk, 0, timepoint, M, qMin(chunk_size, N - timepoint));
+                }
+                double* chunkptr = chunk.dataPtr();
 
-            QVector<double> sumsqrs0(M);
-            for (int m = 0; m < M; m++)
-                sumsqrs0[m] = 0;
+                QVector<double> sumsqrs0(M);
+                for (int m = 0; m < M; m++)
+                    sumsqrs0[m] = 0;
 
-            long aa = 0;
-            for (long i = 0; i < chunk.N2(); i++) {
-                for (int m = 0; m < M; m++) {
-                    sumsqrs0[m] += chunkptr[aa] * chunkptr[aa];
-                    aa++;
+                long aa = 0;
+                for (long i = 0; i < chunk.N2(); i++) {
+                    for (int m = 0; m < M; m++) {
+                        sumsqrs0[m] += chunkptr[aa] * chunkptr[aa];
+                        aa++;
+                    }
                 }
-            }
 #pragma omp critical(lock2)
-            {
-                for (int m = 0; m < M; m++) {
-                    sumsqrs[m] += sumsqrs0[m];
-                }
-                num_timepoints_handled += qMin(chunk_size, N - timepoint);
-                if ((timer.elapsed() > 5000) || (num_timepoints_handled == N)) {
-                    printf("%ld/%ld (%d%%)\n", num_timepoints_handled, N, (int)(num_timepoints_handled * 1.0 / N * 100));
-                    timer.restart();
+                {
+                    for (int m = 0; m < M; m++) {
+                        sumsqrs[m] += sumsqrs0[m];
+                    }
+                    num_timepoints_handled += qMin(chunk_size, N - timepoint);
+                    if ((timer.elapsed() > 5000) || (num_timepoints_handled == N)) {
+                        printf("%ld/%ld (%d%%)\n", num_timepoints_handled, N, (int)(num_timepoints_handled * 1.0 / N * 100));
+                        timer.restart();
+                    }
                 }
             }
         }
@@ -84,29 +89,33 @@ bool normalize_channels(const QString& input, const QString& output)
         QTime timer;
         timer.start();
         long num_timepoints_handled = 0;
-#pragma omp parallel for
-        for (long timepoint = 0; timepoint < N; timepoint += chunk_size) {
-            Mda chunk_in;
+#pragma omp parallel
+        {
+            MdaArenaScope arena_scope;
+#pragma omp for
+            for (long timepoint = 0; timepoint < N; timepoint += chunk_size) {
+                Mda chunk_in;
 #pragma omp critical(lock1)
-            {
-                X.readChunk(chunk_in, 0, timepoint, M, qMin(chunk_size, N - timepoint));
-            }
-            double* chunk_in_ptr = chunk_in.dataPtr();
-            Mda chunk_out(M, chunk_in.N2());
-            double* chunk_out_ptr = chunk_out.dataPtr();
-            for (long i = 0; i < chunk_in.N2(); i++) {
-                long aa = M * i;
-                for (int m = 0; m < M; m++) {
-                    chunk_out_ptr[aa + m] = chunk_in_ptr[aa + m] / stdevs[m];
+                {
+                    X.readChunk(chunk_in, 0, timepoint, M, qMin(chunk_size, N - timepoint));
+                }
+                double* chunk_in_ptr = chunk_in.dataPtr();
+                Mda chunk_out(M, chunk_in.N2());
+                double* chunk_out_ptr = chunk_out.dataPtr();
+                for (long i = 0; i < chunk_in.N2(); i++) {
+                    long aa = M * i;
+                    for (int m = 0; m < M; m++) {
+                        chunk_out_ptr[aa + m] = chunk_in_ptr[aa + m] / stdevs[m];
+                    }
                 }
-            }
 #pragma omp critical(lock2)
-            {
-                Y.writeChunk(chunk_out, 0, timepoint);
-                num_timepoints_handled += qMin(chunk_size, N - timepoint);
-                if ((timer.elapsed() > 5000) || (num_timepoints_handled == N)) {
-                    printf("%ld/%ld (%d%%)\n", num_timepoints_handled, N, (int)(num_timepoints_handled * 1.0 / N * 100));
-                    timer.restart();
+                {
+                    Y.writeChunk(chunk_out, 0, timepoint);
+                    num_timepoints_handled += qMin(chunk_size, N - timepoint);
+                    if ((timer.elapsed() > 5000) || (num_timepoints_handled == N)) {
+                        printf("%ld/%ld (%d%%)\n", num_timepoints_handled, N, (int)(num_timepoints_handled * 1.0 / N * 100));
+                        timer.restart();
+                    }
                 }
             }
         }
@@ -1,5 +1,6 @@
 #include "remove_duplicate_clusters.h"
 #include "mda.h"
+#include "mdaview.h"
 #include <QList>
 #include <stdio.h>
 #include "get_sort_indices.h"
@@ -8,7 +9,8 @@
 #include "mlcommon.h"
 #include "mlcommon.h"
 
-bool probably_the_same(Mda& templates, int ch1, int k1, int ch2, int k2, const remove_duplicate_clusters_Opts& opts);
+bool probably_the_same(const MdaView& templates, const Mda& max_abs, const QVector<double>& sumsqrs, int ch1, int k1, int ch2, int k2, const remove_duplicate_clusters_Opts& opts);
+Mda compute_same_matrix(const Mda& templates, const QVector<int>& cluster_channels, const remove_duplicate_clusters_Opts& opts);
 
 typedef QList<long> IntList;
 bool remove_duplicate_clusters(const QString& timeseries_path, const QString& firings_path, const QString& firings_out_path, const remove_duplicate_clusters_Opts& opts)
@@ -47,14 +49,16 @@ bool remove_duplicate_clusters(const QString& timeseries_path, const QString& fi
     printf("Computing templates...\n");
     Mda templates = compute_templates_0(X, F, opts.clip_size);
     printf("Comparing templates...\n");
+    //all the pairs are compared at once (in parallel), and the decisions below are read from the matrix
+    Mda same = compute_same_matrix(templates, cluster_channels, opts);
     for (int k1 = 0; k1 < K; k1++) {
         for (int k2 = 0; k2 < K; k2++) {
             if ((clusters_to_use[k1]) && (clusters_to_use[k2])) {
                 int ch1 = cluster_channels[k1];
                 int ch2 = cluster_channels[k2];
                 if (ch1 != ch2) {
-                    if (probably_the_same(templates, ch1 - 1, k1, ch2 - 1, k2, opts)) {
-                        if (fabs(templates.value(ch1, Tmid, k1)) > fabs(templates.value(ch2, Tmid, k2))) {
+                    if (same.value(k1, k2)) {
+                        if (fabs(templates.value(ch1 - 1, Tmid, k1)) > fabs(templates.value(ch2 - 1, Tmid, k2))) {
                             clusters_to_use[k2] = 0;
                         }
                         else {
@@ -88,7 +92,7 @@ bool remove_duplicate_clusters(const QString& timeseries_path, const QString& fi
     long L_new = 0;
     for (int i = 0; i < L; i++) {
         int label0 = (int)F.value(2, i);
-        if ((label0 == 0) || (clusters_to_use[label0]))
+        if ((label0 == 0) || (clusters_to_use[label0 - 1]))
             L_new++;
     }
     Mda F2;
@@ -96,7 +100,7 @@ bool remove_duplicate_clusters(const QString& timeseries_path, const QString& fi
     int j = 0;
     for (int i = 0; i < L; i++) {
         int label0 = (int)F.value(2, i);
-        if ((label0 == 0) || (clusters_to_use[label0])) {
+        if ((label0 == 0) || (clusters_to_use[label0 - 1])) {
             for (int a = 0; a < F.N1(); a++) {
                 F2.setValue(F.value(a, i), a, j);
             }
@@ -111,34 +115,68 @@ bool remove_duplicate_clusters(const QString& timeseries_path, const QString& fi
     return true;
 }
 
-bool probably_the_same(Mda& templates, int ch1, int k1, int ch2, int k2, const remove_duplicate_clusters_Opts& opts)
+Mda compute_same_matrix(const Mda& templates, const QVector<int>& cluster_channels, const remove_duplicate_clusters_Opts& opts)
 {
-    Q_UNUSED(opts)
     int M = templates.N1();
     int T = templates.N2();
-    int best_shift = 0;
-    double best_ip = 0;
-    double max11 = 0, max12 = 0;
-    double max21 = 0, max22 = 0;
-    for (int t = 0; t < T; t++) {
-        double val11 = templates.value(ch1, t, k1), val12 = templates.value(ch1, t, k2);
-        double val21 = templates.value(ch2, t, k1), val22 = templates.value(ch2, t, k2);
-        if (fabs(val11) > max11)
-            max11 = fabs(val11);
-        if (fabs(val12) > max12)
-            max12 = fabs(val12);
-        if (fabs(val21) > max21)
-            max21 = fabs(val21);
-        if (fabs(val22) > max22)
-            max22 = fabs(val22);
+    int K = templates.N3();
+    MdaView templates_view = templates.view();
+
+    //the peak of each template on each channel, and the squared norm of each template, computed once rather than per pair
+    Mda max_abs(M, K);
+    QVector<double> sumsqrs(K);
+    for (int k = 0; k < K; k++) {
+        double sumsqr = 0;
+        for (int t = 0; t < T; t++) {
+            for (int m = 0; m < M; m++) {
+                double val = templates_view.get(m, t, k);
+                if (fabs(val) > max_abs.get(m, k))
+                    max_abs.set(fabs(val), m, k);
+                sumsqr += val * val;
+            }
+        }
+        sumsqrs[k] = sumsqr;
     }
+
+    //tiles of pairs, so that a thread works on a few templates at a time
+    Mda same(K, K);
+    double* same_ptr = same.dataPtr();
+    int tile_size = 32;
+    int num_tiles = (K + tile_size - 1) / tile_size;
+#pragma omp parallel for schedule(dynamic)
+    for (long ii = 0; ii < (long)num_tiles * num_tiles; ii++) {
+        int k1_start = (ii / num_tiles) * tile_size;
+        int k2_start = (ii % num_tiles) * tile_size;
+        for (int k1 = k1_start; (k1 < k1_start + tile_size) && (k1 < K); k1++) {
+            for (int k2 = k2_start; (k2 < k2_start + tile_size) && (k2 < K); k2++) {
+                int ch1 = cluster_channels[k1];
+                int ch2 = cluster_channels[k2];
+                if (ch1 != ch2) {
+                    if (probably_the_same(templates_view, max_abs, sumsqrs, ch1 - 1, k1, ch2 - 1, k2, opts))
+                        same_ptr[k1 + K * k2] = 1;
+                }
+            }
+        }
+    }
+    return same;
+}
+
+bool probably_the_same(const MdaView& templates, const Mda& max_abs, const QVector<double>& sumsqrs, int ch1, int k1, int ch2, int k2, const remove_duplicate_clusters_Opts& opts)
+{
+    Q_UNUSED(opts)
+    int M = templates.N1();
+    int T = templates.N2();
+    double max11 = max_abs.value(ch1, k1), max12 = max_abs.value(ch1, k2);
+    double max21 = max_abs.value(ch2, k1), max22 = max_abs.value(ch2, k2);
     if (max12 < max11 * 0.5)
         return false;
     if (max21 < max22 * 0.5)
         return false;
+    int best_shift = 0;
+    double best_ip = 0;
     for (int shift = -T / 2; shift <= T / 2; shift++) {
         double ip = 0;
-        for (int t = 0; t < T; t++) {
+        for (int t = qMax(0, shift); t < qMin(T, T + shift); t++) {
             ip += templates.value(ch1, t, k1) * templates.value(ch1, t - shift, k2);
             ip += templates.value(ch2, t, k1) * templates.value(ch2, t - shift, k2);
         }
@@ -147,20 +185,22 @@ bool probably_the_same(Mda& templates, int ch1, int k1, int ch2, int k2, const r
             best_shift = shift;
         }
     }
-    Mda resid(M, T);
-    double* resid_ptr = resid.dataPtr();
-    double* ptr1 = templates.dataPtr(0, 0, k1);
-    double* ptr2 = templates.dataPtr(0, 0, k2);
+    //the squared norm of template k1 minus template k2 shifted by best_shift
+    double resid_sumsqr = 0;
     for (int t = 0; t < T; t++) {
-        for (int m = 0; m < M; m++) {
-            resid.setValue(templates.value(m, t, k1) - templates.value(m, t - best_shift, k2), m, t);
+        const double* ptr1 = templates.constDataPtr(0, t, k1);
+        if ((t - best_shift >= 0) && (t - best_shift < T)) {
+            const double* ptr2 = templates.constDataPtr(0, t - best_shift, k2);
+            for (int m = 0; m < M; m++)
+                resid_sumsqr += (ptr1[m] - ptr2[m]) * (ptr1[m] - ptr2[m]);
+        }
+        else {
+            for (int m = 0; m < M; m++)
+                resid_sumsqr += ptr1[m] * ptr1[m];
         }
     }
-    double norm_resid = MLCompute::norm(M * T, resid_ptr);
-    double norm1 = MLCompute::norm(M * T, ptr1);
-    double norm2 = MLCompute::norm(M * T, ptr2);
-    if (norm_resid * norm_resid < norm1 * norm1 * 0.5) {
-        if (norm_resid * norm_resid < norm2 * norm2 * 0.5) {
+    if (resid_sumsqr < sumsqrs[k1] * 0.5) {
+        if (resid_sumsqr < sumsqrs[k2] * 0.5) {
             return true;
         }
     }
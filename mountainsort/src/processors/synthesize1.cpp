@@ -11,10 +11,15 @@
 #include "get_sort_indices.h"
 
 #include <mda32.h>
+#include "diskwritemda.h"
+#include "mdaarena.h"
+#include "omp.h"
+#include <algorithm>
+#include <math.h>
 
-double rand_uniform(double a, double b);
+double rand_uniform(std::mt19937_64& gen, double a, double b);
 long rand_int(long a, long b);
-double eval_waveform(Mda& W, int m, double t, int k, int waveforms_oversamp);
+static quint64 mix64(quint64 z);
 
 bool synthesize1(const QString& waveforms_in_path, const QString& info_in_path, const QString& timeseries_out_path, const QString& firings_true_path, const synthesize1_opts& opts)
 {
@@ -36,6 +41,15 @@ bool synthesize1(const QString& waveforms_in_path, const QString& info_in_path,
 
     int T = T0 / waveforms_oversamp;
 
+    //the seed determines the whole dataset: the spike times and scales come from a generator seeded by it, and
+    //the noise at (m,n) is the (m+M*n)-th number of its stream, so the output does not depend on the chunks or the threads
+    quint64 seed = opts.seed;
+    if (!seed) {
+        std::random_device rd;
+        seed = ((quint64)rd() << 32) ^ rd();
+    }
+    std::mt19937_64 gen(mix64(~seed));
+
     //define true times and labels
     QVector<double> times;
     QVector<int> labels;
@@ -50,7 +64,7 @@ bool synthesize1(const QString& waveforms_in_path, const QString& info_in_path,
         printf("k=%d, pop=%ld, refr=%g ms (%g timepoints)\n", k, pop, refractory_period, refractory_period / 1000 * samplerate);
         QVector<double> times_k;
         for (long a = 0; a < pop; a++) {
-            double t0 = rand_uniform(T + 1, N - T - 1);
+            double t0 = rand_uniform(gen, T + 1, N - T - 1);
             times_k << t0;
         }
         qSort(times_k);
@@ -61,10 +75,10 @@ bool synthesize1(const QString& waveforms_in_path, const QString& info_in_path,
                 last_t0 = t0;
                 double vscale0 = 1;
                 if ((vscale1) || (vscale2))
-                    vscale0 = rand_uniform(vscale1, vscale2);
+                    vscale0 = rand_uniform(gen, vscale1, vscale2);
                 double hscale0 = 1;
                 if ((hscale1) || (hscale2))
-                    hscale0 = rand_uniform(hscale1, hscale2);
+                    hscale0 = rand_uniform(gen, hscale1, hscale2);
                 times << times_k[i];
                 labels << k + 1;
                 hscales << hscale0;
@@ -73,57 +87,82 @@ bool synthesize1(const QString& waveforms_in_path, const QString& info_in_path,
         }
     }
 
-    Mda32 X(M, N);
-    // Random noise
-    generate_randn(X.totalSize(), X.dataPtr());
-    for (long n = 0; n < N; n++) {
-        for (long m = 0; m < M; m++) {
-            double val = X.get(m, n);
-            val = val * noise_level;
-            X.set(val, m, n);
-        }
-    }
-
     QList<long> inds = get_sort_indices(times);
     QVector<double> times2;
     QVector<int> labels2;
+    QVector<double> hscales2, vscales2;
     for (long i = 0; i < times.count(); i++) {
         times2 << times[inds[i]];
         labels2 << labels[inds[i]];
+        hscales2 << hscales[inds[i]];
+        vscales2 << vscales[inds[i]];
     }
 
     Mda firings(3, times2.count());
     for (long i = 0; i < times2.count(); i++) {
-        double t0 = times2[i];
-        double k0 = labels2[i];
-        double hscale0 = hscales[i];
-        double vscale0 = vscales[i];
-        firings.setValue(t0, 1, i);
-        firings.setValue(k0, 2, i);
-        for (int t = (long)t0 - T / 2; t < (long)t0 + T / 2; t++) {
-            for (int m = 0; m < M; m++) {
-                double val = vscale0 * eval_waveform(W, m, (t - t0) * hscale0, k0 - 1, waveforms_oversamp);
-                X.setValue(X.value(m, t) + val, m, t);
-            }
-        }
+        firings.setValue(times2[i], 1, i);
+        firings.setValue(labels2[i], 2, i);
     }
     firings.write64(firings_true_path);
 
-    return X.write32(timeseries_out_path);
-}
+    //the timeseries is generated chunk by chunk on all threads and streamed to disk, so it is never all in memory
+    DiskWriteMda Y;
+    Y.setAsynchronous(true);
+    if (!Y.open(MDAIO_TYPE_FLOAT32, timeseries_out_path, M, N)) {
+        qWarning() << "Unable to open output file: " + timeseries_out_path;
+        return false;
+    }
+    int num_threads = omp_get_max_threads();
+    long chunk_size = (long)(0.1 * 1e9 / (M * 4.0 * num_threads));
+    chunk_size = qMin(N, qMax(10000L, chunk_size));
+    const double* W_ptr = W.constDataPtr();
+    int center0 = (int)((T0 + 1) / 2) - 1;
+#pragma omp parallel
+    {
+        MdaArenaScope arena_scope;
+#pragma omp for schedule(dynamic)
+        for (long n0 = 0; n0 < N; n0 += chunk_size) {
+            long size0 = qMin(chunk_size, N - n0);
+            Mda32 chunk(M, size0);
+            float* chunk_ptr = chunk.dataPtr();
+            // Random noise
+            generate_randn(seed, M * n0, M * size0, chunk_ptr);
+            for (long j = 0; j < M * size0; j++) {
+                double val = chunk_ptr[j];
+                chunk_ptr[j] = val * noise_level;
+            }
+            // The spikes that overlap this chunk, in order of time
+            long i1 = std::lower_bound(times2.constBegin(), times2.constEnd(), (double)(n0 - T / 2 - 1)) - times2.constBegin();
+            for (long i = i1; (i < times2.count()) && ((long)times2.at(i) - T / 2 < n0 + size0); i++) {
+                double t0 = times2.at(i);
+                int k0 = labels2.at(i) - 1;
+                double hscale0 = hscales2.at(i);
+                double vscale0 = vscales2.at(i);
+                long t1 = qMax(n0, (long)t0 - T / 2);
+                long t2 = qMin(n0 + size0, (long)t0 + T / 2);
+                for (long t = t1; t < t2; t++) {
+                    //linear interpolation of the oversampled waveform, the same for all channels
+                    double ind = center0 + (t - t0) * hscale0 * waveforms_oversamp;
+                    int ind0 = (int)ind;
+                    int ind1 = (int)(ind + 1);
+                    double p = ind - ind0;
+                    if ((ind0 < 0) || (ind1 >= T0))
+                        continue;
+                    const double* W0 = &W_ptr[M * (ind0 + T0 * (long)k0)];
+                    const double* W1 = &W_ptr[M * (ind1 + T0 * (long)k0)];
+                    float* Xptr = &chunk_ptr[M * (t - n0)];
+                    for (int m = 0; m < M; m++) {
+                        double val = vscale0 * (p * W1[m] + (1 - p) * W0[m]);
+                        Xptr[m] = Xptr[m] + val;
+                    }
+                }
+            }
+            //thread safe in asynchronous mode (this only waits if the queue is full)
+            Y.writeChunk(chunk, 0, n0);
+        }
+    }
 
-double eval_waveform(Mda& W, int m, double t, int k, int waveforms_oversamp)
-{
-    int center0 = (int)((W.N2() + 1) / 2) - 1;
-    double ind = center0 + t * waveforms_oversamp;
-    int ind0 = (int)ind;
-    int ind1 = (int)(ind + 1);
-    double p = ind - ind0;
-    if ((ind0 < 0) || (ind1 >= W.N2()))
-        return 0;
-    double val0 = W.value(m, ind0, k);
-    double val1 = W.value(m, ind1, k);
-    return p * val1 + (1 - p) * val0;
+    return Y.close();
 }
 
 long rand_int(long a, long b)
@@ -133,9 +172,9 @@ long rand_int(long a, long b)
     return a + (qrand() % (b - a + 1));
 }
 
-double rand_uniform(double a, double b)
+double rand_uniform(std::mt19937_64& gen, double a, double b)
 {
-    double val = (qrand() + 0.5) / RAND_MAX;
+    double val = ((gen() >> 11) + 0.5) * (1.0 / 9007199254740992.0); //(0,1), the same on every platform
     return a + val * (b - a);
 }
 
@@ -148,3 +187,38 @@ void generate_randn(size_t N, float* X)
         X[n] = dist(e2);
     }
 }
+
+//a 64-bit mix (from splitmix64) -- consecutive inputs give independent-looking outputs
+static quint64 mix64(quint64 z)
+{
+    z += 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+void generate_randn(quint64 seed, long offset, long N, float* X)
+{
+    //entries 2p and 2p+1 of the stream are the Box-Muller pair made from two hashes of (seed,p)
+    quint64 key = mix64(seed);
+    for (long j = 0; j < N; j++) {
+        long c = offset + j;
+        quint64 p = (quint64)(c / 2);
+        quint64 h1 = mix64(key ^ mix64(2 * p));
+        quint64 h2 = mix64(key ^ mix64(2 * p + 1));
+        double u1 = ((h1 >> 11) + 1) * (1.0 / 9007199254740992.0); //(0,1]
+        double u2 = (h2 >> 11) * (1.0 / 9007199254740992.0); //[0,1)
+        double r = sqrt(-2 * log(u1));
+        if ((c % 2 == 0) && (j + 1 < N)) {
+            X[j] = r * cos(2 * M_PI * u2);
+            X[j + 1] = r * sin(2 * M_PI * u2);
+            j++;
+        }
+        else if (c % 2 == 0) {
+            X[j] = r * cos(2 * M_PI * u2);
+        }
+        else {
+            X[j] = r * sin(2 * M_PI * u2);
+        }
+    }
+}
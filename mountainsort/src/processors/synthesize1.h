@@ -8,12 +8,14 @@
 #define SYNTHESIZE1_H
 
 #include <QString>
+#include <QtGlobal>
 
 struct synthesize1_opts {
     double samplerate = 30000;
     long N = 1000;
     double noise_level = 1;
     int waveforms_oversamp = 1;
+    quint64 seed = 0; //of the spike times, scales and noise, 0 for a random seed
 };
 
 bool synthesize1(
@@ -24,5 +26,7 @@ bool synthesize1(
     const synthesize1_opts& opts);
 
 void generate_randn(size_t N, float* X);
+//counter-based: X[j] is the (offset+j)-th number of the stream of the seed, however the stream is split up
+void generate_randn(quint64 seed, long offset, long N, float* X);
 
 #endif // SYNTHESIZE1_H
@@ -22,12 +22,12 @@ synthesize1_Processor::synthesize1_Processor()
     d->q = this;
 
     this->setName("synthesize1");
-    this->setVersion("0.11");
+    this->setVersion("0.12");
     this->setInputFileParameters("waveforms", "info");
     this->setOutputFileParameters("timeseries_out", "firings_true");
     this->setRequiredParameters("N", "samplerate");
     this->setRequiredParameters("waveforms_oversamp");
-    this->setOptionalParameters("noise_level");
+    this->setOptionalParameters("noise_level", "seed");
 }
 
 synthesize1_Processor::~synthesize1_Processor()
@@ -54,6 +54,7 @@ bool synthesize1_Processor::run(const QMap<QString, QVariant>& params)
     opts.noise_level = params.value("noise_level", 1).toDouble();
     opts.waveforms_oversamp = params.value("waveforms_oversamp").toInt();
     opts.samplerate = params.value("samplerate", 30000).toDouble();
+    opts.seed = params.value("seed", 0).toULongLong();
 
     return synthesize1(waveforms_path, info_path, timeseries_out_path, firings_true_path, opts);
 }
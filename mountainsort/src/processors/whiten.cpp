@@ -2,6 +2,7 @@
 #include "diskreadmda.h"
 #include "diskwritemda.h"
 #include "mda.h"
+#include "mdaarena.h"
 #include "msprefs.h"
 #include <math.h>
 #include <QDebug>
@@ -31,39 +32,43 @@ bool whiten(const QString& input, const QString& output)
         QTime timer;
         timer.start();
         long num_timepoints_handled = 0;
-#pragma omp parallel for
-        for (long timepoint = 0; timepoint < N; timepoint += chunk_size) {
-            Mda chunk;
+#pragma omp parallel
+        {
+            MdaArenaScope arena_scope;
+#pragma omp for
+            for (long timepoint = 0; timepoint < N; timepoint += chunk_size) {
+                Mda chunk;
 #pragma omp critical(lock1)
-            {
-                X.readChunk(chunk, 0, timepoint, M, qMin(chunk_size, N - timepoint));
-            }
-            double* chunkptr = chunk.dataPtr();
-            Mda XXt0(M, M);
-            double* XXt0ptr = XXt0.dataPtr();
-            for (long i = 0; i < chunk.N2(); i++) {
-                long aa = M * i;
-                long bb = 0;
-                for (int m1 = 0; m1 < M; m1++) {
-                    for (int m2 = 0; m2 < M; m2++) {
-                        XXt0ptr[bb] += chunkptr[aa + m1] * chunkptr[aa + m2];
-                        bb++;
+                {
+                    X.readChunk(chunk, 0, timepoint, M, qMin(chunk_size, N - timepoint));
+                }
+                double* chunkptr = chunk.dataPtr();
+                Mda XXt0(M, M);
+                double* XXt0ptr = XXt0.dataPtr();
+                for (long i = 0; i < chunk.N2(); i++) {
+                    long aa = M * i;
+                    long bb = 0;
+                    for (int m1 = 0; m1 < M; m1++) {
+                        for (int m2 = 0; m2 < M; m2++) {
+                            XXt0ptr[bb] += chunkptr[aa + m1] * chunkptr[aa + m2];
+                            bb++;
+                        }
                     }
                 }
-            }
 #pragma omp critical(lock2)
-            {
-                long bb = 0;
-                for (int m1 = 0; m1 < M; m1++) {
-                    for (int m2 = 0; m2 < M; m2++) {
-                        XXtptr[bb] += XXt0ptr[bb];
-                        bb++;
+                {
+                    long bb = 0;
+                    for (int m1 = 0; m1 < M; m1++) {
+                        for (int m2 = 0; m2 < M; m2++) {
+                            XXtptr[bb] += XXt0ptr[bb];
+                            bb++;
+                        }
+                    }
+                    num_timepoints_handled += qMin(chunk_size, N - timepoint);
+                    if ((timer.elapsed() > 5000) || (num_timepoints_handled == N)) {
+                        printf("%ld/%ld (%d%%)\n", num_timepoints_handled, N, (int)(num_timepoints_handled * 1.0 / N * 100));
+                        timer.restart();
                     }
-                }
-                num_timepoints_handled += qMin(chunk_size, N - timepoint);
-                if ((timer.elapsed() > 5000) || (num_timepoints_handled == N)) {
-                    printf("%ld/%ld (%d%%)\n", num_timepoints_handled, N, (int)(num_timepoints_handled * 1.0 / N * 100));
-                    timer.restart();
                 }
             }
         }
@@ -80,43 +85,54 @@ bool whiten(const QString& input, const QString& output)
     double* WWptr = WW.dataPtr();
 
     DiskWriteMda Y;
-    Y.open(MDAIO_TYPE_FLOAT32, output, M, N);
+    Y.setAsynchronous(true); //write-behind, so that the threads do not wait on the disk
+    if (!Y.open(MDAIO_TYPE_FLOAT32, output, M, N)) {
+        qWarning() << "Unable to open output file: " + output;
+        return false;
+    }
     {
         QTime timer;
         timer.start();
         long num_timepoints_handled = 0;
-#pragma omp parallel for
-        for (long timepoint = 0; timepoint < N; timepoint += chunk_size) {
-            Mda chunk_in;
+#pragma omp parallel
+        {
+            MdaArenaScope arena_scope;
+#pragma omp for
+            for (long timepoint = 0; timepoint < N; timepoint += chunk_size) {
+                Mda chunk_in;
 #pragma omp critical(lock1)
-            {
-                X.readChunk(chunk_in, 0, timepoint, M, qMin(chunk_size, N - timepoint));
-            }
-            double* chunk_in_ptr = chunk_in.dataPtr();
-            Mda chunk_out(M, chunk_in.N2());
-            double* chunk_out_ptr = chunk_out.dataPtr();
-            for (long i = 0; i < chunk_in.N2(); i++) { // explicitly do mat-mat mult ... TODO replace w/ BLAS3
-                long aa = M * i;
-                long bb = 0;
-                for (int m1 = 0; m1 < M; m1++) {
-                    for (int m2 = 0; m2 < M; m2++) {
-                        chunk_out_ptr[aa + m1] += chunk_in_ptr[aa + m2] * WWptr[bb]; // actually this does dgemm w/ WW^T
-                        bb++; // but since symmetric, doesn't matter.
+                {
+                    X.readChunk(chunk_in, 0, timepoint, M, qMin(chunk_size, N - timepoint));
+                }
+                double* chunk_in_ptr = chunk_in.dataPtr();
+                Mda chunk_out(M, chunk_in.N2());
+                double* chunk_out_ptr = chunk_out.dataPtr();
+                for (long i = 0; i < chunk_in.N2(); i++) { // explicitly do mat-mat mult ... TODO replace w/ BLAS3
+                    long aa = M * i;
+                    long bb = 0;
+                    for (int m1 = 0; m1 < M; m1++) {
+                        for (int m2 = 0; m2 < M; m2++) {
+                            chunk_out_ptr[aa + m1] += chunk_in_ptr[aa + m2] * WWptr[bb]; // actually this does dgemm w/ WW^T
+                            bb++; // but since symmetric, doesn't matter.
+                        }
                     }
                 }
-            }
+                Y.writeChunk(chunk_out, 0, timepoint); //thread safe in asynchronous mode
 #pragma omp critical(lock2)
-            {
-                Y.writeChunk(chunk_out, 0, timepoint);
-                num_timepoints_handled += qMin(chunk_size, N - timepoint);
-                if ((timer.elapsed() > 5000) || (num_timepoints_handled == N)) {
-                    printf("%ld/%ld (%d%%)\n", num_timepoints_handled, N, (int)(num_timepoints_handled * 1.0 / N * 100));
-                    timer.restart();
+                {
+                    num_timepoints_handled += qMin(chunk_size, N - timepoint);
+                    if ((timer.elapsed() > 5000) || (num_timepoints_handled == N)) {
+                        printf("%ld/%ld (%d%%)\n", num_timepoints_handled, N, (int)(num_timepoints_handled * 1.0 / N * 100));
+                        timer.restart();
+                    }
                 }
             }
         }
     }
-    Y.close();
+    if (!Y.close()) {
+        qWarning() << "Problem writing output file: " + output;
+        return false;
+    }
 
     return true;
 }
@@ -1,6 +1,8 @@
 #include "testMda.h"
 #include "testMdaIO.h"
 #include "testBandpassFilter.h"
+#include "testSynthesize1.h"
+#include "testTaskProgress.h"
 
 template <typename TestClass>
 int runTest(int argc, char** argv)
@@ -18,5 +20,7 @@ int main(int argc, char** argv)
     runTest<TestMda>(argc, argv);
     runTest<TestMdaIO>(argc, argv);
     runTest<TestBandpassFilter>(argc, argv);
+    runTest<TestSynthesize1>(argc, argv);
+    runTest<TestTaskProgress>(argc, argv);
     return 0;
 }
@@ -2,9 +2,13 @@
 #include <QTemporaryFile>
 #include <QDebug>
 #include <cstring>
+#include <utility>
 #include "testMda.h"
 #include "mda.h"
+#include "mda32.h"
 #include "diskwritemda.h"
+#include "firingsstore.h"
+#include "mdaarena.h"
 
 static double max_difference(const Mda& X, const Mda& Y)
 {
@@ -152,12 +156,136 @@ void TestMda::testDiskWrite()
     QVERIFY(qFuzzyIsNull(max_difference(X1, Y1)));
 }
 
+void TestMda::testFiringsStore()
+{
+    //channel, time, label and one extra row, with a time beyond the range of an int
+    Mda F(4, 5);
+    double vals[5][4] = { { 1, 100, 2, 0.5 }, { 2, 3e10, 1, 1.5 }, { 1, 250, 2, 2.5 }, { 3, 7, 0, 3.5 }, { 1, 8, 2, 4.5 } };
+    for (int i = 0; i < 5; i++)
+        for (int r = 0; r < 4; r++)
+            F.setValue(vals[i][r], r, i);
+
+    QTemporaryFile tempFile;
+    QVERIFY(tempFile.open());
+    QVERIFY(FiringsStore::write(tempFile.fileName(), F));
+    QVERIFY(FiringsStore::isFiringsStore(tempFile.fileName()));
+
+    FiringsStore store;
+    QVERIFY(store.open(tempFile.fileName()));
+    QCOMPARE(store.eventCount(), 5L);
+    QCOMPARE(store.K(), 2);
+    QCOMPARE(store.extraRowCount(), 1);
+    QCOMPARE(store.times()[1], (qint64)30000000000LL);
+    QCOMPARE(store.channels()[3], 3);
+    QCOMPARE(store.extraRow(0)[4], 4.5);
+    FiringsColumn<qint64> inds = store.eventIndicesForLabel(2);
+    QCOMPARE(inds.count(), 3L);
+    QCOMPARE(inds[0], (qint64)0);
+    QCOMPARE(inds[1], (qint64)2);
+    QCOMPARE(inds[2], (qint64)4);
+    QCOMPARE(store.timesForLabel(1), QVector<qint64>() << 30000000000LL);
+    QVERIFY(store.eventIndicesForLabel(3).isEmpty());
+    QVERIFY(qFuzzyIsNull(max_difference(store.toMda(), F)));
+}
+
+void TestMda::testSharing()
+{
+    Mda32 X(3, 4);
+    X.setValue(5, 1, 2);
+    Mda32 Y = X;
+    QCOMPARE(Y.constDataPtr(), X.constDataPtr()); //shared until written
+    Y.setValue(7, 1, 2);
+    QVERIFY(Y.constDataPtr() != X.constDataPtr());
+    QCOMPARE(X.value(1, 2), 5.0f);
+    QCOMPARE(Y.value(1, 2), 7.0f);
+
+    const dtype32* ptr = Y.constDataPtr();
+    Mda32 Z(std::move(Y));
+    QCOMPARE(Z.constDataPtr(), ptr);
+    QCOMPARE(Y.totalSize(), 0L);
+    Y = std::move(Z);
+    QCOMPARE(Y.constDataPtr(), ptr);
+    QCOMPARE(Z.totalSize(), 0L);
+    Z.allocate(2, 2); //a moved-from array can be reused
+    QCOMPARE(Z.totalSize(), 4L);
+
+    Mda A(2, 2);
+    Mda B = A;
+    B.allocate(3, 3); //no copy of the shared data, and A is unaffected
+    QCOMPARE(A.N1(), 2L);
+    QCOMPARE(B.N1(), 3L);
+}
+
+void TestMda::testView()
+{
+    Mda32 X(2, 3, 4);
+    for (long i = 0; i < X.totalSize(); i++)
+        X.set(i, i);
+    Mda32View V = X.view();
+    QCOMPARE(V.constDataPtr(), X.constDataPtr());
+    QCOMPARE(V.get(1, 2, 3), X.get(1, 2, 3));
+
+    Mda32View clip = V.slice(2);
+    QCOMPARE(clip.N1(), 2L);
+    QCOMPARE(clip.N2(), 3L);
+    QCOMPARE(clip.N3(), 1L);
+    QCOMPARE(clip.get(1, 1), X.get(1, 1, 2));
+
+    Mda32View channel = V.row(1); //strided
+    QVERIFY(!channel.isContiguous());
+    QCOMPARE(channel.get(0, 2, 3), X.get(1, 2, 3));
+    QVERIFY(channel.reshaped(12, 1).isEmpty());
+
+    Mda32 Y;
+    channel.copyTo(Y);
+    QCOMPARE(Y.N1(), 1L);
+    QCOMPARE(Y.N2(), 3L);
+    QCOMPARE(Y.N3(), 4L);
+    QCOMPARE(Y.get(0, 1, 2), X.get(1, 1, 2));
+
+    Mda32View reshaped = V.reshaped(6, 4);
+    QCOMPARE(reshaped.get(5, 3), X.get(1, 2, 3));
+}
+
+void TestMda::testArena()
+{
+    QVERIFY(!MdaArenaScope::isActive());
+    MdaArenaScope::releaseCache();
+    {
+        MdaArenaScope arena_scope;
+        QVERIFY(MdaArenaScope::isActive());
+        const double* ptr1;
+        {
+            Mda X(10, 1000);
+            ptr1 = X.constDataPtr();
+            QCOMPARE((long)((quintptr)ptr1 % MDA_ARENA_ALIGNMENT), 0L);
+        }
+        QVERIFY(MdaArenaScope::cachedBytes() >= 10 * 1000 * (long)sizeof(double));
+        //a similar size gets the same block back, zeroed
+        Mda Y(10, 990);
+        QCOMPARE(Y.constDataPtr(), ptr1);
+        QCOMPARE(Y.value(9, 989), 0.0);
+    }
+    //the pool is released with the outermost scope
+    QVERIFY(!MdaArenaScope::isActive());
+    QCOMPARE(MdaArenaScope::cachedBytes(), 0L);
+}
+
 void TestMda::benchmarkAllocate()
 {
     Mda m;
     QBENCHMARK(m.allocate(512, 512));
 }
 
+void TestMda::benchmarkArenaAllocate()
+{
+    MdaArenaScope arena_scope;
+    QBENCHMARK
+    {
+        Mda m(512, 512);
+    }
+}
+
 void TestMda::benchmarkDiskWrite()
 {
     QTemporaryFile tempFile;
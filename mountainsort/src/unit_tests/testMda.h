@@ -9,7 +9,12 @@ private slots:
     void testSizes();
     void testValues();
     void testDiskWrite();
+    void testFiringsStore();
+    void testSharing();
+    void testView();
+    void testArena();
     void benchmarkAllocate();
+    void benchmarkArenaAllocate();
     void benchmarkDiskWrite();
     void benchmarkDiskRead();
     void benchmarkValues();
@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <cstring>
 #include <iostream>
+#include <math.h>
 #include <QTemporaryFile>
 #include <QDebug>
 
@@ -156,3 +157,86 @@ void TestMdaIO::testUInt32()
 {
     test_type<uint32_t>(MDAIO_TYPE_UINT32, mda_read_uint32, mda_write_uint32);
 }
+
+//lengths around the 8-wide vector body, so that both the body and the scalar remainder are exercised
+static const long int16_test_sizes[] = { 1, 7, 8, 9, 15, 16, 21 };
+static const int num_int16_test_sizes = sizeof(int16_test_sizes) / sizeof(int16_test_sizes[0]);
+
+void TestMdaIO::testInt16Limits()
+{
+    //int16 data at the limits survives a round trip through float32 and float64
+    const int16_t vals[] = { -32768, 32767, 0, -1, 1, -32767, 32766 };
+    for (int s = 0; s < num_int16_test_sizes; ++s) {
+        const long size = int16_test_sizes[s];
+        std::vector<int16_t> data(size);
+        for (long i = 0; i < size; ++i)
+            data[i] = vals[i % 7];
+        struct MDAIO_HEADER header;
+        std::memset(&header, 0, sizeof(header));
+        header.data_type = MDAIO_TYPE_INT16;
+
+        TempFile file;
+        QVERIFY(file.isOpen());
+        QCOMPARE(mda_write_int16(&data[0], &header, size, file), size);
+        file.rewind();
+        std::vector<float> as_float(size);
+        QCOMPARE(mda_read_float32(&as_float[0], &header, size, file), size);
+        file.rewind();
+        std::vector<double> as_double(size);
+        QCOMPARE(mda_read_float64(&as_double[0], &header, size, file), size);
+        for (long i = 0; i < size; ++i) {
+            QCOMPARE(as_float[i], (float)data[i]);
+            QCOMPARE(as_double[i], (double)data[i]);
+        }
+
+        TempFile file2;
+        QVERIFY(file2.isOpen());
+        QCOMPARE(mda_write_float32(&as_float[0], &header, size, file2), size);
+        file2.rewind();
+        std::vector<int16_t> result(size);
+        QCOMPARE(mda_read_int16(&result[0], &header, size, file2), size);
+        QVERIFY(result == data);
+
+        std::vector<int16_t> result2(size);
+        QCOMPARE(mda_convert_from_float64(&result2[0], &header, &as_double[0], size), size);
+        QVERIFY(result2 == data);
+    }
+}
+
+void TestMdaIO::testInt16Saturation()
+{
+    //out-of-range values saturate (rather than wrap) the same way from float and double, in the vector body and in
+    //the remainder, and the rest truncate toward zero
+    const double vals[] = { 1e10, -1e10, 3e9, -3e9, 40000, -40000, 32767.5, -32768.5, 32766.9, -32767.9, 2.5, -2.5, NAN };
+    const int16_t expected[] = { 32767, -32768, 32767, -32768, 32767, -32768, 32767, -32768, 32766, -32767, 2, -2, -32768 };
+    const long num_vals = sizeof(vals) / sizeof(vals[0]);
+    struct MDAIO_HEADER header;
+    std::memset(&header, 0, sizeof(header));
+    header.data_type = MDAIO_TYPE_INT16;
+    for (int s = 0; s < num_int16_test_sizes; ++s) {
+        const long size = int16_test_sizes[s];
+        for (long offset = 0; offset < num_vals; ++offset) {
+            std::vector<float> src32(size);
+            std::vector<double> src64(size);
+            for (long i = 0; i < size; ++i) {
+                src32[i] = vals[(offset + i) % num_vals];
+                src64[i] = vals[(offset + i) % num_vals];
+            }
+            std::vector<int16_t> dst32(size), dst64(size);
+            QCOMPARE(mda_convert_from_float32(&dst32[0], &header, &src32[0], size), size);
+            QCOMPARE(mda_convert_from_float64(&dst64[0], &header, &src64[0], size), size);
+            for (long i = 0; i < size; ++i) {
+                QCOMPARE(dst32[i], expected[(offset + i) % num_vals]);
+                QCOMPARE(dst64[i], expected[(offset + i) % num_vals]);
+            }
+
+            TempFile file;
+            QVERIFY(file.isOpen());
+            QCOMPARE(mda_write_float32(&src32[0], &header, size, file), size);
+            file.rewind();
+            std::vector<int16_t> result(size);
+            QCOMPARE(mda_read_int16(&result[0], &header, size, file), size);
+            QVERIFY(result == dst32);
+        }
+    }
+}
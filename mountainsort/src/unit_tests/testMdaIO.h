@@ -14,6 +14,8 @@ private slots:
     void testUInt16();
     void testFloat64();
     void testUInt32();
+    void testInt16Limits();
+    void testInt16Saturation();
 };
 
 #endif // TESTMDAIO_H
@@ -0,0 +1,52 @@
+#include "testSynthesize1.h"
+#include "synthesize1.h"
+#include <QVector>
+
+void TestSynthesize1::testRandnChunking()
+{
+    const quint64 seed = 12345;
+    const long offset = 7;
+    const long N = 1001;
+    QVector<float> whole(N);
+    generate_randn(seed, offset, N, whole.data());
+
+    //pieces of odd and even lengths, so that the pieces start and end on both halves of a Box-Muller pair
+    QList<long> sizes;
+    sizes << 1 << 2 << 3 << 64 << 333 << 1 << 4;
+    QVector<float> pieces(N);
+    long i = 0;
+    for (int j = 0; i < N; j++) {
+        long size = qMin(sizes[j % sizes.count()], N - i);
+        generate_randn(seed, offset + i, size, pieces.data() + i);
+        i += size;
+    }
+    for (long j = 0; j < N; j++)
+        QCOMPARE(pieces[j], whole[j]);
+
+    //a range that starts later in the stream is the corresponding part of the whole
+    QVector<float> part(100);
+    generate_randn(seed, offset + 500, part.count(), part.data());
+    for (long j = 0; j < part.count(); j++)
+        QCOMPARE(part[j], whole[500 + j]);
+}
+
+void TestSynthesize1::testRandnSeed()
+{
+    const long N = 100;
+    QVector<float> X1(N), X2(N);
+    generate_randn(1, 0, N, X1.data());
+    generate_randn(2, 0, N, X2.data());
+    QVERIFY(X1 != X2);
+
+    double sum = 0, sumsqr = 0;
+    QVector<float> X(100000);
+    generate_randn(3, 0, X.count(), X.data());
+    for (long j = 0; j < X.count(); j++) {
+        sum += X[j];
+        sumsqr += X[j] * X[j];
+    }
+    double mean = sum / X.count();
+    double var = sumsqr / X.count() - mean * mean;
+    QVERIFY(qAbs(mean) < 0.02);
+    QVERIFY(qAbs(var - 1) < 0.02);
+}
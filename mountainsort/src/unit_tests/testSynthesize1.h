@@ -0,0 +1,13 @@
+#ifndef TESTSYNTHESIZE1_H
+#define TESTSYNTHESIZE1_H
+
+#include <QtTest/QTest>
+
+class TestSynthesize1 : public QObject {
+    Q_OBJECT
+private slots:
+    void testRandnChunking();
+    void testRandnSeed();
+};
+
+#endif // TESTSYNTHESIZE1_H
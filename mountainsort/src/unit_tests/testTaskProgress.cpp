@@ -0,0 +1,108 @@
+#include "testTaskProgress.h"
+#include "taskprogress.h"
+#include "omp.h"
+#include <math.h>
+#include <thread>
+
+using namespace TaskManager;
+
+void TestTaskProgress::testLatencyBuckets()
+{
+    //bucket 0 is below 1 us, and bucket b>0 is [2^(b-1),2^b) us
+    QCOMPARE(TaskProgressLatencyHistogram::bucketForMsec(0), 0);
+    QCOMPARE(TaskProgressLatencyHistogram::bucketForMsec(0.0009), 0);
+    QCOMPARE(TaskProgressLatencyHistogram::bucketForMsec(-1), 0);
+    QCOMPARE(TaskProgressLatencyHistogram::bucketForMsec(NAN), 0);
+    QCOMPARE(TaskProgressLatencyHistogram::bucketForMsec(0.001), 1);
+    QCOMPARE(TaskProgressLatencyHistogram::bucketForMsec(0.0019), 1);
+    QCOMPARE(TaskProgressLatencyHistogram::bucketForMsec(0.002), 2);
+    QCOMPARE(TaskProgressLatencyHistogram::bucketForMsec(0.512), 10);
+    QCOMPARE(TaskProgressLatencyHistogram::bucketForMsec(1.0), 10);
+    QCOMPARE(TaskProgressLatencyHistogram::bucketForMsec(1.024), 11);
+    QCOMPARE(TaskProgressLatencyHistogram::bucketForMsec(1e12), (int)TaskProgressLatencyHistogram::NumBuckets - 1);
+    for (int b = 1; b + 1 < TaskProgressLatencyHistogram::NumBuckets; b++) {
+        double upper = TaskProgressLatencyHistogram::bucketUpperBoundMsec(b);
+        QCOMPARE(TaskProgressLatencyHistogram::bucketForMsec(upper * 0.999), b);
+        QCOMPARE(TaskProgressLatencyHistogram::bucketForMsec(upper), b + 1);
+    }
+}
+
+void TestTaskProgress::testLatencyPercentiles()
+{
+    TaskProgressLatencyHistogram H;
+    QCOMPARE(H.percentileMsec(0.5), 0.0);
+    QCOMPARE(H.meanMsec(), 0.0);
+
+    //three operations in [1,2) us and one in [512,1024) us
+    H.count = 4;
+    H.total_msec = 0.0045 + 0.9;
+    H.max_msec = 0.9;
+    H.bucket_counts[1] = 3;
+    H.bucket_counts[10] = 1;
+    QCOMPARE(H.percentileMsec(0), 0.002);
+    QCOMPARE(H.percentileMsec(0.5), 0.002);
+    QCOMPARE(H.percentileMsec(0.75), 0.002);
+    QCOMPARE(H.percentileMsec(0.99), 0.9); //the bucket bound (1.024), capped by the max
+    QCOMPARE(H.percentileMsec(1), 0.9);
+    QCOMPARE(H.meanMsec(), (0.0045 + 0.9) / 4);
+}
+
+void TestTaskProgress::testShardedCounters()
+{
+    //the monitor is global, so the names are unique to this test
+    TaskProgressMonitor* monitor = TaskProgressMonitor::globalInstance();
+    const QString quantity_name = "TestTaskProgress::testShardedCounters quantity";
+    const QString latency_name = "TestTaskProgress::testShardedCounters latency";
+    const long num = 100000;
+#pragma omp parallel for num_threads(8)
+    for (long i = 0; i < num; i++) {
+        monitor->incrementQuantity(quantity_name, 1);
+        monitor->recordLatency(latency_name, (i % 2) ? 2.0 : 0.5);
+    }
+    QCOMPARE(monitor->getQuantity(quantity_name), (double)num);
+
+    QVERIFY(monitor->latencyNames().contains(latency_name));
+    TaskProgressLatencyHistogram H = monitor->getLatencyHistogram(latency_name);
+    QCOMPARE(H.count, num);
+    QCOMPARE(H.total_msec, num / 2 * 2.0 + num / 2 * 0.5);
+    QCOMPARE(H.max_msec, 2.0);
+    long sum = 0;
+    for (int b = 0; b < H.bucket_counts.count(); b++)
+        sum += H.bucket_counts[b];
+    QCOMPARE(sum, num);
+    QCOMPARE(H.bucket_counts[TaskProgressLatencyHistogram::bucketForMsec(0.5)], num / 2); //bucket 9
+    QCOMPARE(H.bucket_counts[TaskProgressLatencyHistogram::bucketForMsec(2.0)], num / 2); //bucket 11
+    QCOMPARE(H.percentileMsec(0.5), 0.512);
+    QCOMPARE(H.percentileMsec(0.99), 2.0);
+
+    //more increments add to the same totals
+#pragma omp parallel for num_threads(4)
+    for (long i = 0; i < num; i++)
+        monitor->incrementQuantity(quantity_name, 0.5);
+    QCOMPARE(monitor->getQuantity(quantity_name), num * 1.5);
+}
+
+void TestTaskProgress::testExitedThreadCounters()
+{
+    //the totals of threads that have exited are kept
+    TaskProgressMonitor* monitor = TaskProgressMonitor::globalInstance();
+    const QString quantity_name = "TestTaskProgress::testExitedThreadCounters quantity";
+    const QString latency_name = "TestTaskProgress::testExitedThreadCounters latency";
+    QList<std::thread*> threads;
+    for (int j = 0; j < 4; j++) {
+        threads << new std::thread([monitor, quantity_name, latency_name]() {
+            for (int i = 0; i < 1000; i++) {
+                monitor->incrementQuantity(quantity_name, 2);
+                monitor->recordLatency(latency_name, 0.01);
+            }
+        });
+    }
+    foreach (std::thread* thread, threads) {
+        thread->join();
+        delete thread;
+    }
+    QCOMPARE(monitor->getQuantity(quantity_name), 8000.0);
+    TaskProgressLatencyHistogram H = monitor->getLatencyHistogram(latency_name);
+    QCOMPARE(H.count, 4000L);
+    QCOMPARE(H.bucket_counts[TaskProgressLatencyHistogram::bucketForMsec(0.01)], 4000L);
+}
@@ -0,0 +1,15 @@
+#ifndef TESTTASKPROGRESS_H
+#define TESTTASKPROGRESS_H
+
+#include <QtTest/QTest>
+
+class TestTaskProgress : public QObject {
+    Q_OBJECT
+private slots:
+    void testLatencyBuckets();
+    void testLatencyPercentiles();
+    void testShardedCounters();
+    void testExitedThreadCounters();
+};
+
+#endif // TESTTASKPROGRESS_H
@@ -0,0 +1,340 @@
+/******************************************************
+** See the accompanying README and LICENSE files
+*******************************************************/
+
+#include "clip_store.h"
+#include "extract_clips.h"
+#include "cachemanager.h"
+#include "mlcommon.h"
+#include "omp.h"
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <math.h>
+#include <string.h>
+
+#define CLIP_STORE_MAGIC "MLCLIPST"
+#define CLIP_STORE_VERSION 1
+#define CLIP_STORE_HEADER_SIZE 64
+#define CLIP_STORE_CLIPS_ALIGNMENT 64
+
+struct ClipStoreHeader {
+    char magic[8];
+    qint32 version;
+    qint32 M;
+    qint32 T;
+    qint32 K;
+    qint64 L; //the number of events in the firings
+    qint64 num_clips; //those with a label >=0
+};
+
+class ClipStorePrivate {
+public:
+    ClipStore* q;
+
+    QFile m_file;
+    uchar* m_map = 0;
+
+    int m_M = 0;
+    int m_T = 0;
+    int m_K = 0;
+    long m_L = 0;
+    long m_num_clips = 0;
+    const qint64* m_offsets = 0;
+    const qint64* m_event_indices = 0;
+    const qint64* m_positions = 0;
+    const float* m_clips = 0;
+
+    void clear();
+    static long clips_position(long K, long L, long num_clips);
+};
+
+ClipStore::ClipStore()
+{
+    d = new ClipStorePrivate;
+    d->q = this;
+}
+
+ClipStore::~ClipStore()
+{
+    close();
+    delete d;
+}
+
+bool ClipStore::open(const QString& timeseries_path, const QString& firings_path, int clip_size)
+{
+    close();
+    double max_gb = MLUtil::configValue("mountainsort", "clip_store_max_gb").toDouble();
+    if (max_gb <= 0)
+        return false; //not enabled
+    QString path = storePath(timeseries_path, firings_path, clip_size);
+    if (path.isEmpty())
+        return false;
+    if (QFile::exists(path)) {
+        if (openFile(path))
+            return true;
+        //truncated or from an older version
+        QFile::remove(path);
+    }
+    DiskReadMda32 X(timeseries_path);
+    DiskReadMda F(firings_path);
+    double size_gb = X.N1() * clip_size * F.N2() * 4.0 / 1e9;
+    if (size_gb > max_gb)
+        return false;
+    if (!create(path, X, F, clip_size))
+        return false;
+    return openFile(path);
+}
+
+bool ClipStore::openFile(const QString& path)
+{
+    close();
+    d->m_file.setFileName(path);
+    if (!d->m_file.open(QFile::ReadOnly)) {
+        qWarning() << "Unable to open clip store: " + path;
+        return false;
+    }
+    qint64 file_size = d->m_file.size();
+    if (file_size < CLIP_STORE_HEADER_SIZE) {
+        qWarning() << "Clip store is too small: " + path;
+        close();
+        return false;
+    }
+    d->m_map = d->m_file.map(0, file_size);
+    if (!d->m_map) {
+        qWarning() << "Unable to map clip store: " + path;
+        close();
+        return false;
+    }
+    ClipStoreHeader H;
+    memcpy(&H, d->m_map, sizeof(H));
+    if ((QByteArray(H.magic, 8) != QByteArray(CLIP_STORE_MAGIC)) || (H.version != CLIP_STORE_VERSION) || (H.M < 0) || (H.T < 0) || (H.K < 0) || (H.L < 0) || (H.num_clips < 0) || (H.num_clips > H.L)) {
+        qWarning() << "Unexpected header in clip store: " + path;
+        close();
+        return false;
+    }
+    long pos = ClipStorePrivate::clips_position(H.K, H.L, H.num_clips);
+    if (file_size < pos + 4L * H.M * H.T * H.num_clips) {
+        qWarning() << "Clip store is truncated: " + path;
+        close();
+        return false;
+    }
+    d->m_M = H.M;
+    d->m_T = H.T;
+    d->m_K = H.K;
+    d->m_L = H.L;
+    d->m_num_clips = H.num_clips;
+    d->m_offsets = (const qint64*)(d->m_map + CLIP_STORE_HEADER_SIZE);
+    d->m_event_indices = d->m_offsets + (H.K + 2);
+    d->m_positions = d->m_event_indices + H.num_clips;
+    d->m_clips = (const float*)(d->m_map + pos);
+    if (d->m_offsets[d->m_K + 1] != d->m_num_clips) {
+        qWarning() << "Clip store has an invalid label index: " + path;
+        close();
+        return false;
+    }
+    return true;
+}
+
+void ClipStore::close()
+{
+    d->clear();
+}
+
+bool ClipStore::isOpen() const
+{
+    return (d->m_map != 0);
+}
+
+QString ClipStore::storePath(const QString& timeseries_path, const QString& firings_path, int clip_size)
+{
+    if ((!QFile::exists(timeseries_path)) || (!QFile::exists(firings_path)))
+        return "";
+    QString checksum1 = MLUtil::computeSha1SumOfFile(timeseries_path);
+    QString checksum2 = MLUtil::computeSha1SumOfFile(firings_path);
+    if ((checksum1.isEmpty()) || (checksum2.isEmpty()))
+        return "";
+    QString code = QString("%1 %2 %3 %4").arg(checksum1).arg(checksum2).arg(clip_size).arg(CLIP_STORE_VERSION);
+    QString key = QString(QCryptographicHash::hash(code.toLatin1(), QCryptographicHash::Sha1).toHex());
+    return CacheManager::globalInstance()->makeLocalFile("clip_store_" + key + ".clips", CacheManager::LongTerm);
+}
+
+bool ClipStore::create(const QString& path, const DiskReadMda32& X, const DiskReadMda& firings, int clip_size)
+{
+    int M = X.N1();
+    int T = clip_size;
+    long L = firings.N2();
+    Mda F;
+    if ((L > 0) && (!firings.readChunk(F, 0, 0, firings.N1(), L)))
+        return false;
+
+    //a counting sort by label, so that the events of each label stay in the order of the firings
+    QVector<qint32> labels(L);
+    int K = 0;
+    for (long i = 0; i < L; i++) {
+        labels[i] = (qint32)F.value(2, i);
+        K = qMax(K, (int)labels[i]);
+    }
+    QVector<qint64> offsets(K + 2, 0);
+    for (long i = 0; i < L; i++) {
+        if (labels[i] >= 0)
+            offsets[labels[i] + 1]++;
+    }
+    for (int k = 0; k <= K; k++)
+        offsets[k + 1] += offsets[k];
+    long num_clips = offsets[K + 1];
+    QVector<qint64> event_indices(num_clips);
+    QVector<qint64> positions(L, -1);
+    QVector<double> times(num_clips);
+    {
+        QVector<qint64> next = offsets;
+        for (long i = 0; i < L; i++) {
+            if (labels[i] >= 0) {
+                long j = next[labels[i]]++;
+                event_indices[j] = i;
+                positions[i] = j;
+                times[j] = F.value(1, i);
+            }
+        }
+    }
+
+    QDir().mkpath(QFileInfo(path).path());
+    QString tmp_path = path + ".tmp." + MLUtil::makeRandomId(); //other processes may be creating the same store
+    QFile ff(tmp_path);
+    if (!ff.open(QFile::WriteOnly)) {
+        qWarning() << "Unable to open file for writing: " + tmp_path;
+        return false;
+    }
+    ClipStoreHeader H;
+    memset(&H, 0, sizeof(H));
+    memcpy(H.magic, CLIP_STORE_MAGIC, 8);
+    H.version = CLIP_STORE_VERSION;
+    H.M = M;
+    H.T = T;
+    H.K = K;
+    H.L = L;
+    H.num_clips = num_clips;
+    QByteArray header((const char*)&H, sizeof(H));
+    header.append(QByteArray(CLIP_STORE_HEADER_SIZE - sizeof(H), 0));
+    bool ok = true;
+    ok = ok && (ff.write(header) == CLIP_STORE_HEADER_SIZE);
+    ok = ok && (ff.write((const char*)offsets.constData(), 8 * (K + 2)) == 8 * (K + 2));
+    ok = ok && (ff.write((const char*)event_indices.constData(), 8 * num_clips) == 8 * num_clips);
+    ok = ok && (ff.write((const char*)positions.constData(), 8 * L) == 8 * L);
+    long padding = ClipStorePrivate::clips_position(K, L, num_clips) - ff.pos();
+    ok = ok && (ff.write(QByteArray(padding, 0)) == padding);
+
+    //the clips are extracted in blocks on all threads, and written in order, a batch of blocks at a time
+    long block_size = qMax(1L, (long)(1e7 / qMax(1, M * T))); //around 40 MB of clips per block
+    int num_threads = omp_get_max_threads();
+    for (long i0 = 0; (ok) && (i0 < num_clips); i0 += block_size * num_threads) {
+        long num_blocks = qMin((long)num_threads, (num_clips - i0 + block_size - 1) / block_size);
+        QVector<Mda32> blocks(num_blocks);
+        Mda32* blocks_ptr = blocks.data();
+#pragma omp parallel
+        {
+            DiskReadMda32 X_local; //each thread reads with its own file handle
+#pragma omp critical(clip_store_create)
+            X_local = X;
+#pragma omp for schedule(dynamic)
+            for (long b = 0; b < num_blocks; b++) {
+                blocks_ptr[b] = extract_clips(X_local, times.mid(i0 + b * block_size, block_size), T);
+            }
+        }
+        for (long b = 0; (ok) && (b < num_blocks); b++) {
+            long num_bytes = blocks[b].totalSize() * sizeof(dtype32);
+            ok = (ff.write((const char*)blocks[b].constDataPtr(), num_bytes) == num_bytes);
+        }
+    }
+    ff.close();
+    if (!ok) {
+        qWarning() << "Problem writing clip store: " + tmp_path;
+        QFile::remove(tmp_path);
+        return false;
+    }
+    if (QFile::exists(path))
+        QFile::remove(path);
+    if (!QFile::rename(tmp_path, path)) {
+        QFile::remove(tmp_path);
+        //another process may have just put an identical store in place
+        return QFile::exists(path);
+    }
+    return true;
+}
+
+int ClipStore::M() const
+{
+    return d->m_M;
+}
+
+int ClipStore::clipSize() const
+{
+    return d->m_T;
+}
+
+int ClipStore::K() const
+{
+    return d->m_K;
+}
+
+long ClipStore::eventCount() const
+{
+    return d->m_L;
+}
+
+long ClipStore::eventCount(int k) const
+{
+    if ((k < 0) || (k > d->m_K) || (!d->m_offsets))
+        return 0;
+    return d->m_offsets[k + 1] - d->m_offsets[k];
+}
+
+Mda32View ClipStore::clips(int k) const
+{
+    if ((k < 0) || (k > d->m_K) || (!d->m_offsets))
+        return Mda32View(0, d->m_M, d->m_T, 0);
+    long MT = (long)d->m_M * d->m_T;
+    return Mda32View(d->m_clips + MT * d->m_offsets[k], d->m_M, d->m_T, eventCount(k));
+}
+
+FiringsColumn<qint64> ClipStore::eventIndices(int k) const
+{
+    if ((k < 0) || (k > d->m_K) || (!d->m_offsets))
+        return FiringsColumn<qint64>();
+    return FiringsColumn<qint64>(d->m_event_indices + d->m_offsets[k], eventCount(k));
+}
+
+Mda32View ClipStore::clip(long i) const
+{
+    if ((i < 0) || (i >= d->m_L) || (d->m_positions[i] < 0))
+        return Mda32View(0, d->m_M, d->m_T, 0);
+    long MT = (long)d->m_M * d->m_T;
+    return Mda32View(d->m_clips + MT * d->m_positions[i], d->m_M, d->m_T);
+}
+
+void ClipStorePrivate::clear()
+{
+    if (m_map) {
+        m_file.unmap(m_map);
+        m_map = 0;
+    }
+    if (m_file.isOpen())
+        m_file.close();
+    m_M = 0;
+    m_T = 0;
+    m_K = 0;
+    m_L = 0;
+    m_num_clips = 0;
+    m_offsets = 0;
+    m_event_indices = 0;
+    m_positions = 0;
+    m_clips = 0;
+}
+
+long ClipStorePrivate::clips_position(long K, long L, long num_clips)
+{
+    long pos = CLIP_STORE_HEADER_SIZE + 8 * (K + 2) + 8 * num_clips + 8 * L;
+    return ((pos + CLIP_STORE_CLIPS_ALIGNMENT - 1) / CLIP_STORE_CLIPS_ALIGNMENT) * CLIP_STORE_CLIPS_ALIGNMENT;
+}
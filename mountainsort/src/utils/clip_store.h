@@ -0,0 +1,69 @@
+/******************************************************
+** See the accompanying README and LICENSE files
+*******************************************************/
+
+#ifndef CLIP_STORE_H
+#define CLIP_STORE_H
+
+#include <QString>
+#include "diskreadmda.h"
+#include "diskreadmda32.h"
+#include "firingsstore.h"
+#include "mda32.h"
+#include "mdaview.h"
+
+/*
+ * The clips of all the events of a firings file, extracted once and kept on disk for every processor that needs them.
+ *
+ * The store of (timeseries, firings, clip_size) lives in the long-term cache under a name made from the checksums
+ * of the two files (see MLUtil::computeSha1SumOfFile, which is itself cached) and the clip size, so a later
+ * processor of the pipeline -- or a later run -- finds it without looking at the timeseries at all.
+ *
+ * The file is memory-mapped. Its clips (float32, MxT each) are ordered by label and, within a label, in the order of
+ * the firings, with a table of offsets per label: the clips of a cluster are then a contiguous MxTxL_k view.
+ *
+ * The store is disabled unless mountainsort.clip_store_max_gb is set in the configuration, and no store larger than
+ * that is created.
+ *
+ * Layout: header | offsets (K+2 x int64) | event indices (L x int64) | positions (L x int64, -1 for events with a
+ * negative label) | clips (64-byte aligned, MxTxL float32)
+ */
+
+class ClipStorePrivate;
+class ClipStore {
+public:
+    friend class ClipStorePrivate;
+    ClipStore();
+    virtual ~ClipStore();
+
+    //opens the store of (timeseries, firings, clip_size), creating it first if needed -- returns false when the store
+    //is disabled or would be too large, the inputs cannot be checksummed (for example remote files) or the store cannot
+    //be written, and the caller extracts as before
+    bool open(const QString& timeseries_path, const QString& firings_path, int clip_size);
+    bool openFile(const QString& path);
+    void close();
+    bool isOpen() const;
+
+    static QString storePath(const QString& timeseries_path, const QString& firings_path, int clip_size);
+    static bool create(const QString& path, const DiskReadMda32& X, const DiskReadMda& firings, int clip_size);
+
+    int M() const;
+    int clipSize() const;
+    int K() const; //the maximum label
+    long eventCount() const; //of the firings
+    long eventCount(int k) const;
+
+    //the MxTxL_k clips of label k, in the order of the firings -- valid while the store is open
+    Mda32View clips(int k) const;
+    //the indices in the firings of the events of label k, matching clips(k)
+    FiringsColumn<qint64> eventIndices(int k) const;
+    //the MxT clip of event i of the firings, empty if it has a negative label
+    Mda32View clip(long i) const;
+
+private:
+    ClipStorePrivate* d;
+    ClipStore(const ClipStore&);
+    void operator=(const ClipStore&);
+};
+
+#endif // CLIP_STORE_H
@@ -0,0 +1,252 @@
+/******************************************************
+** See the accompanying README and LICENSE files
+*******************************************************/
+
+#include "cluster_metrics_engine.h"
+#include "clip_store.h"
+#include "extract_clips.h"
+#include "get_sort_indices.h"
+#include "mda.h"
+#include <QMutex>
+#include <QHash>
+#include <algorithm>
+#include <math.h>
+
+struct CachedClips {
+    Mda32 clips;
+    long num_bytes = 0;
+};
+
+class ClusterMetricsEnginePrivate {
+public:
+    ClusterMetricsEngine* q;
+
+    DiskReadMda32 m_X;
+    int m_clip_size;
+    QVector<QVector<double> > m_times_by_label; //index 0 is unused
+    long m_max_cached_bytes;
+    const ClipStore* m_clip_store = 0;
+
+    mutable QMutex m_cache_mutex;
+    mutable QHash<int, CachedClips> m_all_clips;
+    mutable QHash<int, CachedClips> m_sampled_clips;
+    mutable long m_cached_bytes;
+
+    //put X into the cache if it fits, replacing what was there
+    void cache_clips(QHash<int, CachedClips>& cache, int k, const Mda32& X) const;
+    //the clips of cluster k in the store, or an empty view if they are not there
+    Mda32View stored_clips(int k, int M) const;
+};
+
+ClusterMetricsEngine::ClusterMetricsEngine(const DiskReadMda32& X, const QVector<double>& times, const QVector<int>& labels, int clip_size)
+{
+    d = new ClusterMetricsEnginePrivate;
+    d->q = this;
+    d->m_X = X;
+    d->m_clip_size = clip_size;
+    d->m_max_cached_bytes = 1e9;
+    d->m_cached_bytes = 0;
+
+    //one pass over the events
+    int K = 0;
+    for (long i = 0; i < labels.count(); i++)
+        K = qMax(K, labels[i]);
+    d->m_times_by_label.resize(K + 1);
+    for (long i = 0; i < labels.count(); i++) {
+        if (labels[i] > 0)
+            d->m_times_by_label[labels[i]] << times[i];
+    }
+}
+
+ClusterMetricsEngine::~ClusterMetricsEngine()
+{
+    delete d;
+}
+
+void ClusterMetricsEngine::setMaxCachedBytes(long num_bytes)
+{
+    QMutexLocker locker(&d->m_cache_mutex);
+    d->m_max_cached_bytes = num_bytes;
+}
+
+void ClusterMetricsEngine::setClipStore(const ClipStore* store)
+{
+    d->m_clip_store = store;
+}
+
+int ClusterMetricsEngine::clipSize() const
+{
+    return d->m_clip_size;
+}
+
+int ClusterMetricsEngine::K() const
+{
+    return d->m_times_by_label.count() - 1;
+}
+
+long ClusterMetricsEngine::eventCount(int k) const
+{
+    if ((k < 1) || (k > K()))
+        return 0;
+    return d->m_times_by_label[k].count();
+}
+
+QVector<double> ClusterMetricsEngine::eventTimes(int k) const
+{
+    if ((k < 1) || (k > K()))
+        return QVector<double>();
+    return d->m_times_by_label[k];
+}
+
+Mda32 ClusterMetricsEngine::clips(int k, const DiskReadMda32& X) const
+{
+    Mda32View stored = d->stored_clips(k, X.N1());
+    if (!stored.isEmpty()) {
+        Mda32 ret;
+        stored.copyTo(ret);
+        return ret;
+    }
+    {
+        QMutexLocker locker(&d->m_cache_mutex);
+        if (d->m_all_clips.contains(k))
+            return d->m_all_clips[k].clips;
+    }
+    Mda32 ret = extract_clips(X, eventTimes(k), d->m_clip_size);
+    d->cache_clips(d->m_all_clips, k, ret);
+    return ret;
+}
+
+Mda32 ClusterMetricsEngine::sampledClips(int k, long num, const DiskReadMda32& X) const
+{
+    num = qMin(num, eventCount(k));
+    Mda32 ret;
+    bool found = false;
+    {
+        QMutexLocker locker(&d->m_cache_mutex);
+        if ((d->m_sampled_clips.contains(k)) && (d->m_sampled_clips[k].clips.N3() >= num)) {
+            ret = d->m_sampled_clips[k].clips;
+            found = true;
+        }
+    }
+    Mda32View stored = d->stored_clips(k, X.N1());
+    if ((!found) && (!stored.isEmpty())) {
+        QList<long> order = sampleOrder(stored.N3());
+        ret.allocate(stored.N1(), stored.N2(), num);
+        long MT = stored.N1() * stored.N2();
+        float* ret_ptr = ret.dataPtr();
+        for (long i = 0; i < num; i++)
+            std::copy(stored.constDataPtr(0, 0, order[i]), stored.constDataPtr(0, 0, order[i]) + MT, &ret_ptr[MT * i]);
+        return ret;
+    }
+    if (!found) {
+        QVector<double> times_k = eventTimes(k);
+        QList<long> order = sampleOrder(times_k.count());
+        QVector<double> times_subset(num);
+        for (long i = 0; i < num; i++)
+            times_subset[i] = times_k[order[i]];
+        ret = extract_clips(X, times_subset, d->m_clip_size);
+        d->cache_clips(d->m_sampled_clips, k, ret);
+    }
+    if (ret.N3() == num)
+        return ret;
+    //a prefix of a larger sample
+    Mda32 ret2;
+    ret.getChunk(ret2, 0, 0, 0, ret.N1(), ret.N2(), num);
+    return ret2;
+}
+
+void ClusterMetricsEngine::computeTemplateAndStdev(Mda32& template_out, Mda32& stdev_out, int k, const DiskReadMda32& X) const
+{
+    int M = X.N1();
+    int T = d->m_clip_size;
+    QVector<double> times_k = eventTimes(k);
+    long L = times_k.count();
+
+    Mda sums(M, T);
+    Mda sumsqrs(M, T);
+    double* sums_ptr = sums.dataPtr();
+    double* sumsqrs_ptr = sumsqrs.dataPtr();
+    long block_size = qMax(1L, (long)(1e7 / (M * T))); //around 40 MB of clips at a time
+    Mda32View stored = d->stored_clips(k, M);
+    for (long i0 = 0; i0 < L; i0 += block_size) {
+        Mda32 block;
+        const float* block_ptr;
+        long block_count;
+        if (!stored.isEmpty()) {
+            block_ptr = stored.constDataPtr(0, 0, i0);
+            block_count = qMin(block_size, L - i0);
+        }
+        else {
+            block = extract_clips(X, times_k.mid(i0, block_size), T);
+            block_ptr = block.constDataPtr();
+            block_count = block.N3();
+        }
+        for (long i = 0; i < block_count; i++) {
+            const float* Xptr = &block_ptr[M * T * i];
+            for (int j = 0; j < M * T; j++) {
+                sums_ptr[j] += Xptr[j];
+                sumsqrs_ptr[j] += Xptr[j] * Xptr[j];
+            }
+        }
+    }
+
+    template_out.allocate(M, T);
+    stdev_out.allocate(M, T);
+    if (!L)
+        return;
+    float* template_ptr = template_out.dataPtr();
+    float* stdev_ptr = stdev_out.dataPtr();
+    for (int j = 0; j < M * T; j++) {
+        template_ptr[j] = sums_ptr[j] / L;
+        stdev_ptr[j] = sqrt(sumsqrs_ptr[j] / L - (sums_ptr[j] * sums_ptr[j]) / ((double)L * L));
+    }
+}
+
+QList<long> ClusterMetricsEngine::sampleOrder(long n)
+{
+    QVector<double> random_values(n);
+    for (long i = 0; i < n; i++) {
+        random_values[i] = sin(i * 12 + i * i);
+    }
+    return get_sort_indices(random_values);
+}
+
+void ClusterMetricsEngine::run(long count, const std::function<void(long, const DiskReadMda32&)>& func) const
+{
+#pragma omp parallel
+    {
+        DiskReadMda32 X_local; //each thread reads with its own file handle
+#pragma omp critical(cluster_metrics_engine_run)
+        X_local = d->m_X;
+#pragma omp for schedule(dynamic)
+        for (long i = 0; i < count; i++) {
+            func(i, X_local);
+        }
+    }
+}
+
+void ClusterMetricsEnginePrivate::cache_clips(QHash<int, CachedClips>& cache, int k, const Mda32& X) const
+{
+    QMutexLocker locker(&m_cache_mutex);
+    long num_bytes = X.totalSize() * sizeof(dtype32);
+    long num_bytes_replaced = cache.contains(k) ? cache[k].num_bytes : 0;
+    if (m_cached_bytes - num_bytes_replaced + num_bytes > m_max_cached_bytes)
+        return;
+    m_cached_bytes += num_bytes - num_bytes_replaced;
+    CachedClips C;
+    C.clips = X;
+    C.num_bytes = num_bytes;
+    cache[k] = C;
+}
+
+Mda32View ClusterMetricsEnginePrivate::stored_clips(int k, int M) const
+{
+    if (!m_clip_store)
+        return Mda32View();
+    if ((m_clip_store->M() != M) || (m_clip_store->clipSize() != m_clip_size) || (k < 1) || (k >= m_times_by_label.count()))
+        return Mda32View();
+    //the events of the engine are those of the firings the store was made from, possibly restricted to some labels
+    if ((m_times_by_label[k].isEmpty()) || (m_clip_store->eventCount(k) != m_times_by_label[k].count()))
+        return Mda32View();
+    return m_clip_store->clips(k);
+}
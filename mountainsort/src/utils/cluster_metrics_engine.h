@@ -0,0 +1,65 @@
+/******************************************************
+** See the accompanying README and LICENSE files
+*******************************************************/
+
+#ifndef CLUSTER_METRICS_ENGINE_H
+#define CLUSTER_METRICS_ENGINE_H
+
+#include <QVector>
+#include <functional>
+#include "diskreadmda32.h"
+#include "mda32.h"
+
+class ClipStore;
+
+/*
+ * Shared machinery for the metrics that are computed cluster by cluster and pair by pair (ms_metrics, cluster_scores).
+ *
+ * The events are indexed by label once, rather than by a scan of all the events for every cluster and pair.
+ * The clips of a cluster (all of them, or a fixed pseudo-random sample of them) are extracted on first use and
+ * kept for the other metrics and pairs that need them, as long as they fit in the memory budget -- beyond it they
+ * are simply extracted again. run() processes clusters or pairs on all threads, each with its own file handle.
+ * With a clip store (see ClipStore) the clips are read from the store instead of the timeseries.
+ *
+ * Everything here may be called from several threads at once.
+ */
+
+class ClusterMetricsEnginePrivate;
+class ClusterMetricsEngine {
+public:
+    friend class ClusterMetricsEnginePrivate;
+    ClusterMetricsEngine(const DiskReadMda32& X, const QVector<double>& times, const QVector<int>& labels, int clip_size);
+    virtual ~ClusterMetricsEngine();
+
+    //the bytes of clips that are kept for reuse, default 1e9
+    void setMaxCachedBytes(long num_bytes);
+    //the store of the same timeseries, firings and clip size, which must stay open while the engine is used (or 0)
+    void setClipStore(const ClipStore* store);
+
+    int clipSize() const;
+    int K() const; //the maximum label
+    long eventCount(int k) const;
+    QVector<double> eventTimes(int k) const;
+
+    //all the clips of cluster k (MxTxL)
+    Mda32 clips(int k, const DiskReadMda32& X) const;
+    //the clips of the first num events in the sampling order of cluster k (see sampleOrder) -- these are always
+    //the same events, so a smaller sample is part of a larger one
+    Mda32 sampledClips(int k, long num, const DiskReadMda32& X) const;
+    //the mean and standard deviation clips (MxT) of cluster k, going through the events in blocks so that the clips
+    //of a large cluster are never all in memory at once
+    void computeTemplateAndStdev(Mda32& template_out, Mda32& stdev_out, int k, const DiskReadMda32& X) const;
+
+    //a fixed pseudo-random ordering of n events
+    static QList<long> sampleOrder(long n);
+
+    //calls func(i, X) for 0<=i<count in parallel (dynamic schedule), where X is the timeseries opened by the calling thread
+    void run(long count, const std::function<void(long, const DiskReadMda32&)>& func) const;
+
+private:
+    ClusterMetricsEnginePrivate* d;
+    ClusterMetricsEngine(const ClusterMetricsEngine&);
+    void operator=(const ClusterMetricsEngine&);
+};
+
+#endif // CLUSTER_METRICS_ENGINE_H
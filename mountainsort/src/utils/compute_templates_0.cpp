@@ -6,29 +6,28 @@
 
 #include "compute_templates_0.h"
 #include "mlcommon.h"
-#include "mlcommon.h"
 #include <math.h>
 
 Mda compute_templates_0(const DiskReadMda& X, Mda& firings, int clip_size)
 {
-    QVector<double> times;
-    QVector<int> labels;
     long L = firings.N2();
+    QVector<double> times(L);
+    QVector<int> labels(L);
     for (long i = 0; i < L; i++) {
-        times << firings.value(1, i);
-        labels << (int)firings.value(2, i);
+        times[i] = firings.value(1, i);
+        labels[i] = (int)firings.value(2, i);
     }
     return compute_templates_0(X, times, labels, clip_size);
 }
 
 Mda32 compute_templates_0(const DiskReadMda32& X, Mda& firings, int clip_size)
 {
-    QVector<double> times;
-    QVector<int> labels;
     long L = firings.N2();
+    QVector<double> times(L);
+    QVector<int> labels(L);
     for (long i = 0; i < L; i++) {
-        times << firings.value(1, i);
-        labels << (int)firings.value(2, i);
+        times[i] = firings.value(1, i);
+        labels[i] = (int)firings.value(2, i);
     }
     return compute_templates_0(X, times, labels, clip_size);
 }
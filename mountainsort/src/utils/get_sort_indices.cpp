@@ -23,3 +23,14 @@ QList<long> get_sort_indices(const QVector<double>& X)
         [&X](int i1, int i2) { return X[i1] < X[i2]; });
     return result;
 }
+
+QList<long> get_sort_indices(const QVector<qint64>& X)
+{
+    QList<long> result;
+    result.reserve(X.size());
+    for (long i = 0; i < X.size(); ++i)
+        result << i;
+    std::stable_sort(result.begin(), result.end(),
+        [&X](long i1, long i2) { return X[i1] < X[i2]; });
+    return result;
+}
@@ -10,5 +10,6 @@
 
 QList<long> get_sort_indices(const QList<long>& X);
 QList<long> get_sort_indices(const QVector<double>& X);
+QList<long> get_sort_indices(const QVector<qint64>& X);
 
 #endif // GET_SORT_INDICES_H
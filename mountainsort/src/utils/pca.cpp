@@ -16,6 +16,8 @@ Mda mult_AB(const Mda& A, const Mda& B);
 Mda32 mult_AB(const Mda32& A, const Mda32& B);
 Mda mult_AtransB(const Mda& A, const Mda& B);
 Mda32 mult_AtransB(const Mda32& A, const Mda32& B);
+Mda mult_AtransB(const Mda& A, const MdaView& B);
+Mda32 mult_AtransB(const Mda32& A, const Mda32View& B);
 Mda mult_ABtrans(const Mda& A, const Mda& B);
 void subtract_out_rank_1(Mda& X, Mda& C);
 void subtract_out_rank_1(Mda32& X, Mda32& C);
@@ -26,13 +28,19 @@ void pca_subtract_mean(Mda& X);
 void pca_subtract_mean(Mda32& X);
 
 void pca(Mda& C, Mda& F, Mda& sigma, const Mda& X, int num_features, bool subtract_mean)
+{
+    pca(C, F, sigma, X.view(), num_features, subtract_mean);
+}
+
+void pca(Mda& C, Mda& F, Mda& sigma, const MdaView& X, int num_features, bool subtract_mean)
 {
     long M = X.N1();
     //long N = X.N2();
     long K = num_features;
     long num_iterations_per_component = 10; //hard-coded for now
 
-    Mda Xw = X; //working data
+    Mda Xw; //working data
+    X.copyTo(Xw);
     if (subtract_mean) {
         pca_subtract_mean(Xw);
     }
@@ -56,13 +64,19 @@ void pca(Mda& C, Mda& F, Mda& sigma, const Mda& X, int num_features, bool subtra
 }
 
 void pca(Mda32& C, Mda32& F, Mda32& sigma, const Mda32& X, int num_features, bool subtract_mean)
+{
+    pca(C, F, sigma, X.view(), num_features, subtract_mean);
+}
+
+void pca(Mda32& C, Mda32& F, Mda32& sigma, const Mda32View& X, int num_features, bool subtract_mean)
 {
     long M = X.N1();
     //long N = X.N2();
     long K = num_features;
     long num_iterations_per_component = 10; //hard-coded for now
 
-    Mda32 Xw = X; //working data
+    Mda32 Xw; //working data
+    X.copyTo(Xw);
     if (subtract_mean) {
         pca_subtract_mean(Xw);
     }
@@ -225,7 +239,7 @@ Mda32 mult_AB(Mda32& A, Mda32& B) // gemm for two 2D MDAs.   inner part should b
     return C;
 }
 
-Mda mult_AtransB(const Mda& A, const Mda& B) // gemm for two 2D MDAs.   inner part should be BLAS3 call
+Mda mult_AtransB(const Mda& A, const MdaView& B) // gemm for two 2D MDAs.   inner part should be BLAS3 call
 {
     long M = A.N2();
     long L = A.N1();
@@ -236,12 +250,20 @@ Mda mult_AtransB(const Mda& A, const Mda& B) // gemm for two 2D MDAs.   inner pa
     }
     Mda C(M, N);
     const double* Aptr = A.constDataPtr();
-    const double* Bptr = B.constDataPtr();
     double* Cptr = C.dataPtr();
+    QVector<double> column; //only needed when the columns of B are not contiguous
+    if (B.stride(0) != 1)
+        column.resize(L);
     long iC = 0;
     for (long n = 0; n < N; n++) {
+        const double* Bptr = B.constDataPtr(0, n);
+        if (B.stride(0) != 1) {
+            for (long l = 0; l < L; l++)
+                column[l] = B.get(l, n);
+            Bptr = column.constData();
+        }
         for (long m = 0; m < M; m++) {
-            double val = MLCompute::dotProduct(L, &Aptr[L * m], &Bptr[L * n]);
+            double val = MLCompute::dotProduct(L, &Aptr[L * m], Bptr);
             Cptr[iC] = val;
             iC++;
         }
@@ -249,7 +271,12 @@ Mda mult_AtransB(const Mda& A, const Mda& B) // gemm for two 2D MDAs.   inner pa
     return C;
 }
 
-Mda32 mult_AtransB(const Mda32& A, const Mda32& B) // gemm for two 2D MDAs.   inner part should be BLAS3 call
+Mda mult_AtransB(const Mda& A, const Mda& B)
+{
+    return mult_AtransB(A, B.view());
+}
+
+Mda32 mult_AtransB(const Mda32& A, const Mda32View& B) // gemm for two 2D MDAs.   inner part should be BLAS3 call
 {
     long M = A.N2();
     long L = A.N1();
@@ -260,12 +287,20 @@ Mda32 mult_AtransB(const Mda32& A, const Mda32& B) // gemm for two 2D MDAs.   in
     }
     Mda32 C(M, N);
     const dtype32* Aptr = A.constDataPtr();
-    const dtype32* Bptr = B.constDataPtr();
     dtype32* Cptr = C.dataPtr();
+    QVector<dtype32> column; //only needed when the columns of B are not contiguous
+    if (B.stride(0) != 1)
+        column.resize(L);
     long iC = 0;
     for (long n = 0; n < N; n++) {
+        const dtype32* Bptr = B.constDataPtr(0, n);
+        if (B.stride(0) != 1) {
+            for (long l = 0; l < L; l++)
+                column[l] = B.get(l, n);
+            Bptr = column.constData();
+        }
         for (long m = 0; m < M; m++) {
-            double val = MLCompute::dotProduct(L, &Aptr[L * m], &Bptr[L * n]);
+            double val = MLCompute::dotProduct(L, &Aptr[L * m], Bptr);
             Cptr[iC] = val;
             iC++;
         }
@@ -273,6 +308,11 @@ Mda32 mult_AtransB(const Mda32& A, const Mda32& B) // gemm for two 2D MDAs.   in
     return C;
 }
 
+Mda32 mult_AtransB(const Mda32& A, const Mda32& B)
+{
+    return mult_AtransB(A, B.view());
+}
+
 Mda mult_ABtrans(const Mda& A, const Mda& B) // gemm for two 2D MDAs.   inner part should be BLAS3 call
 {
     long M = A.N1();
@@ -13,6 +13,9 @@
 // see info below
 void pca(Mda& components, Mda& features, Mda& sigma, const Mda& X, int num_features, bool subtract_mean);
 void pca(Mda32& components, Mda32& features, Mda32& sigma, const Mda32& X, int num_features, bool subtract_mean);
+// X may also be a view (only its first two dimensions are used), for example clips.view().reshaped(M * T, L)
+void pca(Mda& components, Mda& features, Mda& sigma, const MdaView& X, int num_features, bool subtract_mean);
+void pca(Mda32& components, Mda32& features, Mda32& sigma, const Mda32View& X, int num_features, bool subtract_mean);
 
 // same as pca, except input it X*X', and features are not computed (because how could they be?)
 void pca_from_XXt(Mda& components, Mda& sigma, const Mda& XXt, int num_features);
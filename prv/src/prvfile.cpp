@@ -7,6 +7,7 @@
 #include "cachemanager.h"
 #include "prvfile.h"
 #include "mlcommon.h"
+#include "checksumindex.h"
 
 #include <QJsonDocument>
 #include <QJsonObject>
@@ -34,9 +35,9 @@ public:
     static void println(QString str);
     static QByteArray read_binary_file(const QString& fname);
     static bool write_binary_file(const QString& fname, const QByteArray& data);
-    QString find_file(long size, const QString& checksum, const QString& checksum1000_optional, const PrvFileLocateOptions& opts);
-    QString find_remote_file(long size, const QString& checksum, const QString& checksum1000_optional, const PrvFileLocateOptions& opts);
-    QString find_local_file(long size, const QString& checksum, const QString& checksum1000_optional, const PrvFileLocateOptions& opts);
+    QString find_file(long size, const QString& checksum, const QString& checksum1000_optional, const QString& checksum_type, const PrvFileLocateOptions& opts);
+    QString find_remote_file(long size, const QString& checksum, const QString& checksum1000_optional, const QString& checksum_type, const PrvFileLocateOptions& opts);
+    QString find_local_file(long size, const QString& checksum, const QString& checksum1000_optional, const QString& checksum_type, const PrvFileLocateOptions& opts);
     void copy_from(const PrvFile& other);
 };
 
@@ -114,7 +115,9 @@ bool PrvFile::createFromFile(const QString& file_path, const PrvFileCreateOption
     obj["prv_version"] = PRV_VERSION;
     obj["original_path"] = file_path;
 
-    obj["original_checksum"] = MLUtil::computeSha1SumOfFile(file_path);
+    obj["original_checksum"] = MLUtil::computeChecksumOfFile(file_path, opts.checksum_type);
+    if (opts.checksum_type != "sha1")
+        obj["original_checksum_type"] = opts.checksum_type; //absent means sha1, as in older prv files
     obj["original_checksum_1000"] = MLUtil::computeSha1SumOfFileHead(file_path, 1000);
     obj["original_size"] = QFileInfo(file_path).size();
 
@@ -271,7 +274,7 @@ QString PrvFile::locate(const PrvFileLocateOptions& opts)
     QString checksum = obj["original_checksum"].toString();
     QString checksum1000 = obj["original_checksum_1000"].toString();
     long original_size = obj["original_size"].toVariant().toLongLong();
-    QString fname_or_url = d->find_file(original_size, checksum, checksum1000, opts);
+    QString fname_or_url = d->find_file(original_size, checksum, checksum1000, checksumType(), opts);
     return fname_or_url;
 }
 
@@ -290,6 +293,11 @@ QString PrvFile::checksum1000() const
     return d->m_object["original_checksum_1000"].toString();
 }
 
+QString PrvFile::checksumType() const
+{
+    return d->m_object["original_checksum_type"].toString("sha1");
+}
+
 long PrvFile::size() const
 {
     return d->m_object["original_size"].toVariant().toLongLong();
@@ -305,7 +313,7 @@ bool PrvFile::recoverFile(const QString& dst_file_path, const PrvFileRecoverOpti
     QString checksum = d->m_object["original_checksum"].toString();
     QString checksum1000 = d->m_object["original_checksum_1000"].toString();
     long original_size = d->m_object["original_size"].toVariant().toLongLong();
-    QString fname_or_url = d->find_file(original_size, checksum, checksum1000, opts.locate_opts);
+    QString fname_or_url = d->find_file(original_size, checksum, checksum1000, checksumType(), opts.locate_opts);
     if (fname_or_url.isEmpty()) {
         d->println("Unable to find file: size=" + QString::number(original_size) + " checksum=" + checksum + " checksum1000=" + checksum1000);
         return false;
@@ -413,7 +421,7 @@ bool PrvFilePrivate::write_binary_file(const QString& fname, const QByteArray& d
     return ret;
 }
 
-QString PrvFilePrivate::find_remote_file(long size, const QString& checksum, const QString& checksum1000_optional, const PrvFileLocateOptions& opts)
+QString PrvFilePrivate::find_remote_file(long size, const QString& checksum, const QString& checksum1000_optional, const QString& checksum_type, const PrvFileLocateOptions& opts)
 {
     QJsonArray remote_servers = opts.remote_servers;
     for (int i = 0; i < remote_servers.count(); i++) {
@@ -423,6 +431,8 @@ QString PrvFilePrivate::find_remote_file(long size, const QString& checksum, con
         QString url_path = server0["path"].toString();
         QString passcode = server0["passcode"].toString();
         QString url0 = host + ":" + QString::number(port) + url_path + QString("/?a=locate&checksum=%1&checksum1000=%2&size=%3&passcode=%4").arg(checksum).arg(checksum1000_optional).arg(size).arg(passcode);
+        if (checksum_type != "sha1")
+            url0 += "&checksum_type=" + checksum_type; //older servers ignore this, and simply won't find the file
         if (opts.verbose) {
             qDebug() << url0;
         }
@@ -439,12 +449,12 @@ QString PrvFilePrivate::find_remote_file(long size, const QString& checksum, con
     return "";
 }
 
-QString PrvFilePrivate::find_file(long size, const QString& checksum, const QString& checksum1000_optional, const PrvFileLocateOptions& opts)
+QString PrvFilePrivate::find_file(long size, const QString& checksum, const QString& checksum1000_optional, const QString& checksum_type, const PrvFileLocateOptions& opts)
 {
     if (opts.search_locally) {
         if (opts.verbose)
             printf("Searching locally...\n");
-        QString local_fname = find_local_file(size, checksum, checksum1000_optional, opts);
+        QString local_fname = find_local_file(size, checksum, checksum1000_optional, checksum_type, opts);
         if (!local_fname.isEmpty()) {
             if (opts.verbose) {
                 printf("Found file: %s\n", local_fname.toUtf8().data());
@@ -456,7 +466,7 @@ QString PrvFilePrivate::find_file(long size, const QString& checksum, const QStr
     if (opts.search_remotely) {
         if (opts.verbose)
             printf("Searching remotely...\n");
-        QString remote_url = find_remote_file(size, checksum, checksum1000_optional, opts);
+        QString remote_url = find_remote_file(size, checksum, checksum1000_optional, checksum_type, opts);
         if (!remote_url.isEmpty()) {
             if (opts.verbose) {
                 printf("Found remote file: %s\n", remote_url.toUtf8().data());
@@ -468,50 +478,11 @@ QString PrvFilePrivate::find_file(long size, const QString& checksum, const QStr
     return "";
 }
 
-QString find_file_2(QString directory, QString checksum, QString checksum1000_optional, long size, bool recursive)
-{
-    QStringList files = QDir(directory).entryList(QStringList("*"), QDir::Files);
-    foreach (QString file, files) {
-        QString path = directory + "/" + file;
-        if (QFileInfo(path).size() == size) {
-            if (!checksum1000_optional.isEmpty()) {
-                QString checksum0 = MLUtil::computeSha1SumOfFileHead(path, 1000);
-                if (checksum0 == checksum1000_optional) {
-                    QString checksum1 = MLUtil::computeSha1SumOfFile(path);
-                    if (checksum1 == checksum) {
-                        return path;
-                    }
-                }
-            }
-            else {
-                QString checksum1 = MLUtil::computeSha1SumOfFile(path);
-                if (checksum1 == checksum) {
-                    return path;
-                }
-            }
-        }
-    }
-    if (recursive) {
-        QStringList dirs = QDir(directory).entryList(QStringList("*"), QDir::Dirs | QDir::NoDotAndDotDot);
-        foreach (QString dir, dirs) {
-            QString path = find_file_2(directory + "/" + dir, checksum, checksum1000_optional, size, recursive);
-            if (!path.isEmpty())
-                return path;
-        }
-    }
-    return "";
-}
-
-QString PrvFilePrivate::find_local_file(long size, const QString& checksum, const QString& checksum1000_optional, const PrvFileLocateOptions& opts)
+QString PrvFilePrivate::find_local_file(long size, const QString& checksum, const QString& checksum1000_optional, const QString& checksum_type, const PrvFileLocateOptions& opts)
 {
-    QStringList local_search_paths = opts.local_search_paths;
-    for (int i = 0; i < local_search_paths.count(); i++) {
-        QString search_path = local_search_paths[i];
-        QString fname = find_file_2(search_path, checksum, checksum1000_optional, size, true);
-        if (!fname.isEmpty())
-            return fname;
-    }
-    return "";
+    //the index remembers the directory listings and checksums from previous searches, so only changed directories are rescanned
+    ChecksumIndex index;
+    return index.findFile(opts.local_search_paths, size, checksum, checksum1000_optional, true, checksum_type);
 }
 
 void PrvFilePrivate::copy_from(const PrvFile& other)
@@ -17,6 +17,7 @@
 
 struct PrvFileCreateOptions {
     bool create_temporary_files = false;
+    QString checksum_type = "sha1"; //or "sha1tree" for huge files (see sumit.h)
 };
 
 struct PrvFileLocateOptions {
@@ -55,6 +56,7 @@ public:
     QString prvFilePath() const;
     QString checksum() const;
     QString checksum1000() const;
+    QString checksumType() const;
     long size() const;
     QString originalPath() const;
 
@@ -426,6 +426,7 @@ public:
         parser.addOption(QCommandLineOption("ensure-remote", "if needed, upload the file to the server. Must specify --server"));
         parser.addOption(QCommandLineOption("server", "to be used with --ensure-remote", "[server name]"));
         parser.addOption(QCommandLineOption("raw-only", "to be used with --ensure-local or --ensure-remote"));
+        parser.addOption(QCommandLineOption("checksum-type", "sha1 (default) or sha1tree, which is much faster for huge files", "[type]"));
     }
     int execute(const QCommandLineParser& parser)
     {
@@ -455,6 +456,14 @@ public:
         if (parser.isSet("create-temporary-files")) {
             params.insert("create-temporary-files", true);
         }
+        if (parser.isSet("checksum-type")) {
+            QString checksum_type = parser.value("checksum-type");
+            if ((checksum_type != "sha1") && (checksum_type != "sha1tree")) {
+                println("Unknown checksum type: " + checksum_type);
+                return -1;
+            }
+            params.insert("checksum-type", checksum_type);
+        }
         if (is_file(src_path)) {
             int ret = create_file_prv(src_path, dst_path, params);
             if (ret != 0)
@@ -497,6 +506,7 @@ private:
         PrvFile PF;
         PrvFileCreateOptions opts;
         opts.create_temporary_files = params.contains("create-temporary-files");
+        opts.checksum_type = params.value("checksum-type", "sha1").toString();
         PF.createFromFile(src_path, opts);
         if (!PF.write(dst_path))
             return -1;
@@ -604,6 +614,7 @@ public:
         // --checksum=[] --checksum1000=[optional] --size=[]
         parser.addOption(QCommandLineOption("checksum", "checksum", "[]"));
         parser.addOption(QCommandLineOption("checksum1000", "checksum1000", "[optional]"));
+        parser.addOption(QCommandLineOption("checksum-type", "checksum type", "[sha1 (default) or sha1tree]"));
         parser.addOption(QCommandLineOption("size", "size", "[]"));
         parser.addOption(QCommandLineOption("server", "name of the server to search", "[server name]"));
         parser.addOption(QCommandLineOption("verbose", "verbose"));
@@ -633,6 +644,8 @@ public:
             obj["original_checksum"] = parser.value("checksum");
             obj["original_checksum_1000"] = parser.value("checksum1000");
             obj["original_size"] = parser.value("size").toLongLong();
+            if ((parser.isSet("checksum-type")) && (parser.value("checksum-type") != "sha1"))
+                obj["original_checksum_type"] = parser.value("checksum-type");
         }
         else {
             QString src_path = args.value(0);
@@ -649,7 +662,13 @@ public:
             }
             else {
                 if (m_cmd == "locate") {
-                    obj["original_checksum"] = MLUtil::computeSha1SumOfFile(src_path);
+                    QString checksum_type = parser.value("checksum-type");
+                    if ((!checksum_type.isEmpty()) && (checksum_type != "sha1")) {
+                        obj["original_checksum"] = MLUtil::computeChecksumOfFile(src_path, checksum_type);
+                        obj["original_checksum_type"] = checksum_type;
+                    }
+                    else
+                        obj["original_checksum"] = MLUtil::computeSha1SumOfFile(src_path);
                     obj["original_checksum_1000"] = MLUtil::computeSha1SumOfFileHead(src_path, 1000);
                     obj["original_size"] = QFileInfo(src_path).size();
                 }
@@ -905,7 +924,7 @@ public:
             // is on the local machine.
             QString path1 = prv_file.originalPath();
             if (QFile::exists(path1)) {
-                if (MLUtil::computeSha1SumOfFile(path1) == prv_file.checksum()) {
+                if (MLUtil::computeChecksumOfFile(path1, prv_file.checksumType()) == prv_file.checksum()) {
                     if (QFile::exists(dst_path))
                         QFile::remove(dst_path);
                     if (QFile::copy(path1, dst_path)) {